@@ -0,0 +1,189 @@
+/*
+ * admission control of jobs by cpu capacity of host.
+ *
+ * cost of a new job in cpus is the cpu-cost of job description if declared, or the learned cost of
+ * jobs of the same profile, or estimated by number of source streams, encoders and scaling ladder
+ * rungs. a job is rejected if it's cost plus the cost of running jobs and jobs being started
+ * exceeds the capacity, percentage of cpus allowed to gstreamill. learned cost of a profile is the moving average of
+ * cpu_average of jobs.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <gst/gst.h>
+
+#include "jobdesc.h"
+#include "admission.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+typedef struct _Admission {
+        gdouble capacity; /* in cpus */
+        gint online; /* online cpus, cpu_average of job is percentage of them */
+        GHashTable *learned; /* profile -> learned cost */
+        gdouble reserved; /* cost of admitted jobs not in job list yet */
+} Admission;
+
+/* accessed with job_list_mutex of gstreamill */
+static Admission *admission = NULL;
+
+/**
+ * admission_start:
+ * @capacity: (in): percentage of cpus allowed to gstreamill, 0 if no admission control.
+ *
+ * Returns: 0 on success, 1 on failure.
+ */
+gint admission_start (gint capacity)
+{
+        cpu_set_t set;
+
+        if (capacity <= 0) {
+                return 0;
+        }
+        if (sched_getaffinity (0, sizeof (cpu_set_t), &set) == -1) {
+                GST_ERROR ("sched_getaffinity error: %s", g_strerror (errno));
+                return 1;
+        }
+
+        admission = g_new0 (Admission, 1);
+        admission->capacity = CPU_COUNT (&set) * capacity / 100.0;
+        admission->online = sysconf (_SC_NPROCESSORS_ONLN);
+        admission->learned = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+        GST_WARNING ("admission control, capacity %.2f cpus", admission->capacity);
+
+        return 0;
+}
+
+gboolean admission_is_running (void)
+{
+        return admission != NULL;
+}
+
+/**
+ * admission_estimate:
+ * @spec: (in): job spec.
+ *
+ * Returns: estimated cost of job in cpus.
+ */
+gdouble admission_estimate (JobSpec *spec)
+{
+        gdouble *learned;
+
+        if (jobdesc_cpu_cost (spec) > 0) {
+                return jobdesc_cpu_cost (spec);
+        }
+        learned = g_hash_table_lookup (admission->learned, spec->profile);
+        if (learned != NULL) {
+                return *learned;
+        }
+
+        /* decoded streams of source, rungs of scaling ladder are counted as rungs */
+        return (spec->source_stream_count - spec->ladder_rungs) * ADMISSION_SOURCE_STREAM_COST +
+               jobdesc_encoders_count (spec) * ADMISSION_ENCODER_COST +
+               spec->ladder_rungs * ADMISSION_RUNG_COST;
+}
+
+/*
+ * cost of running job, measured if it has been measured.
+ */
+static gdouble job_cost (Job *job)
+{
+        if (job->cpu_average > 0) {
+                return job->cpu_average * admission->online / 100.0;
+        }
+
+        return job->cost;
+}
+
+/**
+ * admission_check:
+ * @spec: (in): spec of new job.
+ * @jobs: (in): jobs of gstreamill.
+ * @cost: (out): estimated cost of new job in cpus.
+ *
+ * called with job_list_mutex. cost of admitted job is reserved until admission_release,
+ * which should be called with the same lock held when the job is added to job list or failed.
+ *
+ * Returns: NULL if the job is admitted, reason of rejection otherwise.
+ */
+gchar * admission_check (JobSpec *spec, GSList *jobs, gdouble *cost)
+{
+        gdouble used;
+        Job *job;
+
+        if (admission == NULL) {
+                *cost = 0;
+                return NULL;
+        }
+
+        *cost = admission_estimate (spec);
+        used = admission->reserved;
+        for (; jobs != NULL; jobs = jobs->next) {
+                job = jobs->data;
+                /* worker of new job is running but not playing yet, it's counted */
+                if (job->eos || ((*(job->output->state) == GST_STATE_NULL) && (job->worker_pid == 0))) {
+                        continue;
+                }
+                used += job_cost (job);
+        }
+        if (used + *cost > admission->capacity) {
+                return g_strdup_printf ("start job failure, host capacity exceeded: job %s needs %.2f cpus, %.2f of %.2f cpus used.",
+                                        spec->name,
+                                        *cost,
+                                        used,
+                                        admission->capacity);
+        }
+        GST_INFO ("admit job %s, cost %.2f cpus, %.2f of %.2f cpus used", spec->name, *cost, used, admission->capacity);
+        admission->reserved += *cost;
+
+        return NULL;
+}
+
+/**
+ * admission_release:
+ * @cost: (in): cost of admitted job, returned by admission_check.
+ *
+ * release cost reserved by admission_check, the job is in job list or failed to start.
+ * called with job_list_mutex.
+ *
+ * Returns: none
+ */
+void admission_release (gdouble cost)
+{
+        if (admission == NULL) {
+                return;
+        }
+        admission->reserved -= cost;
+}
+
+/**
+ * admission_learn:
+ * @job: (in): running job, cpu stat updated.
+ *
+ * learn cost of the profile of job from it's cpu_average. called with job_list_mutex.
+ *
+ * Returns: none
+ */
+void admission_learn (Job *job)
+{
+        gdouble *learned, cost;
+
+        if ((admission == NULL) || (job->cpu_average <= 0) || (*(job->output->state) != GST_STATE_PLAYING)) {
+                return;
+        }
+        cost = job->cpu_average * admission->online / 100.0;
+        learned = g_hash_table_lookup (admission->learned, job->spec->profile);
+        if (learned == NULL) {
+                learned = g_new (gdouble, 1);
+                *learned = cost;
+                g_hash_table_insert (admission->learned, g_strdup (job->spec->profile), learned);
+                return;
+        }
+        *learned = *learned * (1 - ADMISSION_LEARN_WEIGHT) + cost * ADMISSION_LEARN_WEIGHT;
+}
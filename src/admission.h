@@ -0,0 +1,27 @@
+/*
+ * admission control of jobs by cpu capacity of host.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__
+
+#include <gst/gst.h>
+
+#include "job.h"
+
+#define ADMISSION_SOURCE_STREAM_COST 0.5 /* cpus of demuxing and decoding a source stream of unknown profile */
+#define ADMISSION_ENCODER_COST 1.0 /* cpus of an encoder of unknown profile */
+#define ADMISSION_RUNG_COST 0.25 /* cpus of a scaling ladder rung of unknown profile */
+#define ADMISSION_LEARN_WEIGHT 0.1 /* weight of new cpu_average sample in learned cost */
+
+gint admission_start (gint capacity);
+gboolean admission_is_running (void);
+gdouble admission_estimate (JobSpec *spec);
+gchar * admission_check (JobSpec *spec, GSList *jobs, gdouble *cost);
+void admission_release (gdouble cost);
+void admission_learn (Job *job);
+
+#endif /* __ADMISSION_H__ */
@@ -0,0 +1,343 @@
+/*
+ * archive of encoder output, gops are saved in preallocated data files.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <gst/gst.h>
+
+#include "archive.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+static void index_write_begin (ArchiveIndex *index)
+{
+        __atomic_add_fetch (&(index->seqlock), 1, __ATOMIC_SEQ_CST);
+}
+
+static void index_write_end (ArchiveIndex *index)
+{
+        __atomic_add_fetch (&(index->seqlock), 1, __ATOMIC_SEQ_CST);
+}
+
+static guint32 index_read_begin (ArchiveIndex *index)
+{
+        guint32 sequence;
+
+        for (;;) {
+                sequence = __atomic_load_n (&(index->seqlock), __ATOMIC_ACQUIRE);
+                if ((sequence & 1) == 0) {
+                        return sequence;
+                }
+                g_thread_yield ();
+        }
+}
+
+static gboolean index_read_retry (ArchiveIndex *index, guint32 sequence)
+{
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+        return __atomic_load_n (&(index->seqlock), __ATOMIC_RELAXED) != sequence;
+}
+
+/**
+ * archive_open:
+ * @path: (in): directory of archive.
+ * @file_size: (in): size of data file.
+ * @file_count: (in): count of data files.
+ * @reset: (in): reset index, FALSE to keep gops archived, e.g. job warm restart.
+ *
+ * open archive, create and preallocate data files if not exist.
+ *
+ * Returns: the archive, NULL on error.
+ */
+Archive * archive_open (gchar *path, gsize file_size, gint file_count, gboolean reset)
+{
+        Archive *archive;
+        gchar *name;
+        gint i, ret;
+
+        if (g_mkdir_with_parents (path, 0755) == -1) {
+                GST_ERROR ("mkdir %s error: %s", path, g_strerror (errno));
+                return NULL;
+        }
+
+        archive = g_new0 (Archive, 1);
+        archive->path = g_strdup (path);
+        archive->file_size = file_size;
+        archive->file_count = file_count;
+        archive->index_fd = -1;
+        archive->fds = g_new (gint, file_count);
+        for (i = 0; i < file_count; i++) {
+                archive->fds[i] = -1;
+        }
+
+        for (i = 0; i < file_count; i++) {
+                name = g_strdup_printf ("%s/%d.dat", path, i);
+                archive->fds[i] = open (name, O_CREAT | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+                if (archive->fds[i] == -1) {
+                        GST_ERROR ("open %s error: %s", name, g_strerror (errno));
+                        g_free (name);
+                        archive_close (archive);
+                        return NULL;
+                }
+                /* preallocate, no fragment and no ENOSPC while writing */
+                ret = posix_fallocate (archive->fds[i], 0, file_size);
+                if (ret != 0) {
+                        GST_ERROR ("fallocate %s error: %s", name, g_strerror (ret));
+                        g_free (name);
+                        archive_close (archive);
+                        return NULL;
+                }
+                g_free (name);
+        }
+
+        name = g_strdup_printf ("%s/index", path);
+        archive->index_fd = open (name, O_CREAT | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if ((archive->index_fd == -1) || (ftruncate (archive->index_fd, sizeof (ArchiveIndex)) == -1)) {
+                GST_ERROR ("open %s error: %s", name, g_strerror (errno));
+                g_free (name);
+                archive_close (archive);
+                return NULL;
+        }
+        archive->index = mmap (NULL, sizeof (ArchiveIndex), PROT_READ | PROT_WRITE, MAP_SHARED, archive->index_fd, 0);
+        if (archive->index == MAP_FAILED) {
+                GST_ERROR ("mmap %s error: %s", name, g_strerror (errno));
+                archive->index = NULL;
+                g_free (name);
+                archive_close (archive);
+                return NULL;
+        }
+        g_free (name);
+
+        if (!reset) {
+                return archive;
+        }
+
+        /* timestamps restart with encoder, reset index */
+        archive->index->head = 0;
+        archive->index->tail = 0;
+        archive->index->file = 0;
+        archive->index->offset = 0;
+        archive->index->seqlock = 0;
+
+        return archive;
+}
+
+/**
+ * archive_close:
+ * @archive: (in): archive to be closed.
+ *
+ * close archive, archive files are kept.
+ */
+void archive_close (Archive *archive)
+{
+        gint i;
+
+        g_return_if_fail (archive != NULL);
+
+        for (i = 0; i < archive->file_count; i++) {
+                if (archive->fds[i] != -1) {
+                        close (archive->fds[i]);
+                }
+        }
+        if (archive->index != NULL) {
+                munmap (archive->index, sizeof (ArchiveIndex));
+        }
+        if (archive->index_fd != -1) {
+                close (archive->index_fd);
+        }
+        g_free (archive->fds);
+        g_free (archive->path);
+        g_free (archive);
+}
+
+/**
+ * archive_write:
+ * @archive: (in): the archive.
+ * @data: (in): gop data.
+ * @size: (in): gop size.
+ *
+ * write gop data to data file, the gop is not visible to readers until archive_commit,
+ * gops in the data file going to be reused are removed from index.
+ *
+ * Returns: 0 on success, 1 on error.
+ */
+gint archive_write (Archive *archive, gchar *data, gsize size)
+{
+        ArchiveIndex *index = archive->index;
+        gsize sent;
+        gssize ret;
+
+        if (size > archive->file_size) {
+                GST_ERROR ("gop size %lu larger than archive file size %lu", size, archive->file_size);
+                return 1;
+        }
+
+        archive->write_file = index->file;
+        archive->write_offset = index->offset;
+        if (archive->write_offset + size > archive->file_size) {
+                /* next data file, remove gops in it. */
+                index_write_begin (index);
+                archive->write_file = (archive->write_file + 1) % archive->file_count;
+                archive->write_offset = 0;
+                while ((index->head < index->tail) &&
+                       (index->entries[index->head % ARCHIVE_INDEX_SIZE].file == archive->write_file)) {
+                        index->head++;
+                }
+                index->file = archive->write_file;
+                index->offset = 0;
+                index_write_end (index);
+        }
+
+        sent = 0;
+        while (sent < size) {
+                ret = pwrite (archive->fds[archive->write_file], data + sent, size - sent, archive->write_offset + sent);
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        GST_ERROR ("write archive %s error: %s", archive->path, g_strerror (errno));
+                        return 1;
+                }
+                sent += ret;
+        }
+
+        return 0;
+}
+
+/**
+ * archive_commit:
+ * @archive: (in): the archive.
+ * @timestamp: (in): timestamp of the gop.
+ * @duration: (in): duration of the gop.
+ * @size: (in): gop size.
+ *
+ * add gop written by archive_write to index.
+ */
+void archive_commit (Archive *archive, GstClockTime timestamp, GstClockTime duration, gsize size)
+{
+        ArchiveIndex *index = archive->index;
+        ArchiveIndexEntry *entry;
+
+        index_write_begin (index);
+        if (index->tail - index->head == ARCHIVE_INDEX_SIZE) {
+                index->head++;
+        }
+        entry = &(index->entries[index->tail % ARCHIVE_INDEX_SIZE]);
+        entry->timestamp = timestamp;
+        entry->duration = duration;
+        entry->size = size;
+        entry->file = archive->write_file;
+        entry->offset = archive->write_offset;
+        index->tail++;
+        index->offset = archive->write_offset + size;
+        index_write_end (index);
+}
+
+/**
+ * archive_seek:
+ * @archive: (in): the archive.
+ * @timestamp: (in): timestamp of the gop.
+ * @entry: (out): index entry of the gop.
+ *
+ * binary search gop of timestamp in archive.
+ *
+ * Returns: sequence of the gop, -1 if not found.
+ */
+gint64 archive_seek (Archive *archive, GstClockTime timestamp, ArchiveIndexEntry *entry)
+{
+        ArchiveIndex *index = archive->index;
+        ArchiveIndexEntry *e;
+        guint64 low, high, middle;
+        gint64 sequence;
+        guint32 read_sequence;
+
+        do {
+                read_sequence = index_read_begin (index);
+                sequence = -1;
+                low = index->head;
+                high = index->tail;
+                while (low < high) {
+                        middle = low + (high - low) / 2;
+                        e = &(index->entries[middle % ARCHIVE_INDEX_SIZE]);
+                        if (e->timestamp == timestamp) {
+                                *entry = *e;
+                                sequence = middle;
+                                break;
+
+                        } else if (e->timestamp < timestamp) {
+                                low = middle + 1;
+
+                        } else {
+                                high = middle;
+                        }
+                }
+        } while (index_read_retry (index, read_sequence));
+
+        return sequence;
+}
+
+/**
+ * archive_evicted:
+ * @archive: (in): the archive.
+ * @sequence: (in): sequence of the gop.
+ *
+ * check if the gop has been removed from archive, data read from the gop is invalid if so.
+ *
+ * Returns: TRUE if the gop has been removed.
+ */
+gboolean archive_evicted (Archive *archive, guint64 sequence)
+{
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+        return sequence < __atomic_load_n (&(archive->index->head), __ATOMIC_RELAXED);
+}
+
+/**
+ * archive_sendfile:
+ * @archive: (in): the archive.
+ * @sock: (in): socket send to.
+ * @entry: (in): index entry of the gop.
+ * @position: (in): bytes of the gop sent already.
+ *
+ * send gop in archive to sock by sendfile from position. never wait for non-blocking sock,
+ * caller resume the rest when sock writable.
+ *
+ * Returns: bytes sent, less than the rest if sock would block, -1 on error if nothing sent.
+ */
+gssize archive_sendfile (Archive *archive, gint sock, ArchiveIndexEntry *entry, gsize position)
+{
+        off_t offset;
+        gsize sent;
+        gssize ret;
+
+        sent = 0;
+        offset = entry->offset + position;
+        while (position + sent < entry->size) {
+                ret = sendfile (sock, archive->fds[entry->file], &offset, entry->size - position - sent);
+                if (ret == -1) {
+                        if (errno != EAGAIN) {
+                                GST_INFO ("sendfile error: %s", g_strerror (errno));
+                                return sent > 0 ? sent : -1;
+                        }
+                        /* would block */
+                        break;
+
+                } else if (ret == 0) {
+                        break;
+                }
+                sent += ret;
+        }
+
+        return sent;
+}
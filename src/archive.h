@@ -0,0 +1,60 @@
+/*
+ * archive of encoder output, gops are saved in preallocated data files.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <gst/gst.h>
+
+#define ARCHIVE_INDEX_SIZE 65536
+#define ARCHIVE_FILE_SIZE 256*1024*1024
+#define ARCHIVE_FILE_COUNT 16
+
+typedef struct _ArchiveIndexEntry {
+        GstClockTime timestamp;
+        GstClockTime duration;
+        guint64 size;
+        guint64 file; /* data file index */
+        guint64 offset; /* offset in data file */
+} ArchiveIndexEntry;
+
+/*
+ * index file is mapped by both writer(worker) and readers(gstreamill),
+ * entry of sequence n is at n % ARCHIVE_INDEX_SIZE.
+ */
+typedef struct _ArchiveIndex {
+        guint32 seqlock; /* odd while writer updating index */
+        guint32 reserved;
+        guint64 head; /* sequence of the oldest gop */
+        guint64 tail; /* sequence of the next gop */
+        guint64 file; /* current writing data file */
+        guint64 offset; /* current writing offset in data file */
+        ArchiveIndexEntry entries[ARCHIVE_INDEX_SIZE];
+} ArchiveIndex;
+
+typedef struct _Archive {
+        gchar *path;
+        gsize file_size;
+        gint file_count;
+        gint *fds; /* data files */
+        gint index_fd;
+        ArchiveIndex *index;
+
+        /*< Private >*/
+        guint64 write_file; /* data file of the gop being written */
+        guint64 write_offset;
+} Archive;
+
+Archive * archive_open (gchar *path, gsize file_size, gint file_count, gboolean reset);
+void archive_close (Archive *archive);
+gint archive_write (Archive *archive, gchar *data, gsize size);
+void archive_commit (Archive *archive, GstClockTime timestamp, GstClockTime duration, gsize size);
+gint64 archive_seek (Archive *archive, GstClockTime timestamp, ArchiveIndexEntry *entry);
+gboolean archive_evicted (Archive *archive, guint64 sequence);
+gssize archive_sendfile (Archive *archive, gint sock, ArchiveIndexEntry *entry, gsize position);
+
+#endif /* __ARCHIVE_H__ */
@@ -0,0 +1,267 @@
+/*
+ * mpeg dash live output.
+ *
+ * a dynamic mpd is rendered from the gop index of the encoders, segments are the gops served for hls,
+ * mpeg2 ts, or fragmented mp4 of cmaf encoders, so no second packager is needed. SegmentTemplate uses
+ * $Time$ of timescale nanoseconds, $Time$ of a segment is the timestamp of it's gop, the same as the
+ * timestamp of hls segment url. availabilityStartTime is the wall clock of timestamp 0, fixed when the first mpd is
+ * rendered and kept across warm restart, as timestamps continue then. timestamps restart on cold restart, a new
+ * period starts then, it's start is fixed when the first mpd of it is rendered.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "httpserver.h"
+#include "dash.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+/**
+ * dash_reset:
+ * @job: (in): the job, cold restarted.
+ *
+ * timestamps of encoders restart, drop mpd and start a new period.
+ *
+ * Returns: none
+ */
+void dash_reset (Job *job)
+{
+        g_mutex_lock (&(job->output->mpd_mutex));
+        if (job->output->mpd != NULL) {
+                g_bytes_unref (job->output->mpd);
+                job->output->mpd = NULL;
+        }
+        if (job->output->availability_start_time != 0) {
+                job->output->period++;
+                job->output->period_start = -1;
+        }
+        g_mutex_unlock (&(job->output->mpd_mutex));
+}
+
+static gchar * iso8601 (gint64 time)
+{
+        GDateTime *date_time;
+        gchar *p, *seconds;
+
+        date_time = g_date_time_new_from_unix_utc (time / G_USEC_PER_SEC);
+        seconds = g_date_time_format (date_time, "%Y-%m-%dT%H:%M:%S");
+        g_date_time_unref (date_time);
+        p = g_strdup_printf ("%s.%03dZ", seconds, (gint)(time % G_USEC_PER_SEC / 1000));
+        g_free (seconds);
+
+        return p;
+}
+
+static void render_timeline_run (GString *mpd, GstClockTime t, GstClockTime d, gint r)
+{
+        if (r == 0) {
+                g_string_append_printf (mpd, "            <S t=\"%lu\" d=\"%lu\"/>\n", t, d);
+
+        } else {
+                g_string_append_printf (mpd, "            <S t=\"%lu\" d=\"%lu\" r=\"%d\"/>\n", t, d, r);
+        }
+}
+
+/*
+ * render representation of the encoder, completed gops in window are segments,
+ * contiguous segments of the same duration are one S element.
+ * FALSE if the encoder stalled while writing output.
+ */
+static gboolean render_representation (Job *job, gint index, GString *mpd, GstClockTime *max_duration, GstClockTime *depth)
+{
+        EncoderOutput *encoder_output = &(job->output->encoders[index]);
+        GOPIndexEntry *entry;
+        GstClockTime t, d, next;
+        guint64 first, current, gop, bandwidth;
+        guint window;
+        gsize len;
+        gint r;
+        guint32 sequence;
+        gchar *p, *value;
+
+        p = g_strdup_printf ("encoder.%d.elements.x264enc.property.bitrate", index);
+        value = jobdesc_element_property_value (job->spec, p);
+        bandwidth = (value != NULL) ? g_ascii_strtoull (value, NULL, 10) * 1000 : 0;
+        g_free (value);
+        g_free (p);
+        window = jobdesc_m3u8streaming_window_size (job->spec);
+
+        len = mpd->len;
+        do {
+                g_string_truncate (mpd, len);
+                sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (sequence)) {
+                        return FALSE;
+                }
+                current = *(encoder_output->gop_index_tail) - 1;
+                first = *(encoder_output->gop_index_head);
+                if ((window > 0) && (current - first > window)) {
+                        first = current - window;
+                }
+                g_string_append_printf (mpd,
+                                        MPD_REPRESENTATION_TAG,
+                                        index,
+                                        encoder_output->cmaf ? "video/mp4" : "video/mp2t",
+                                        bandwidth);
+                g_string_append_printf (mpd,
+                                        MPD_SEGMENT_TEMPLATE_TAG,
+                                        DASH_TIMESCALE,
+                                        encoder_output_segment_extension (encoder_output),
+                                        encoder_output->cmaf ? MPD_INITIALIZATION : "");
+                g_string_append (mpd, "          <SegmentTimeline>\n");
+                t = d = next = 0;
+                r = -1;
+                *depth = 0;
+                for (gop = first; gop < current; gop++) {
+                        entry = encoder_output_gop_index_entry (encoder_output, gop);
+                        if ((r >= 0) && (entry->timestamp == next) && (entry->duration == d)) {
+                                r++;
+
+                        } else {
+                                if (r >= 0) {
+                                        render_timeline_run (mpd, t, d, r);
+                                }
+                                t = entry->timestamp;
+                                d = entry->duration;
+                                r = 0;
+                        }
+                        next = entry->timestamp + entry->duration;
+                        *depth += entry->duration;
+                        if (entry->duration > *max_duration) {
+                                *max_duration = entry->duration;
+                        }
+                }
+                if (r >= 0) {
+                        render_timeline_run (mpd, t, d, r);
+                }
+                g_string_append (mpd, "          </SegmentTimeline>\n");
+                g_string_append (mpd, "        </SegmentTemplate>\n");
+                g_string_append (mpd, "      </Representation>\n");
+        } while (encoder_output_read_retry (encoder_output, sequence));
+
+        return TRUE;
+}
+
+/*
+ * Returns: the mpd, NULL if some encoder stalled while writing output.
+ */
+static gchar * render_mpd (Job *job)
+{
+        JobOutput *output = job->output;
+        GString *representations, *mpd;
+        GstClockTime max_duration, depth, encoder_depth, segment_duration;
+        gchar *availability_start_time, *publish_time;
+        gint64 now;
+        gint i;
+
+        now = g_get_real_time ();
+        if (output->availability_start_time == 0) {
+                /* the last output is now */
+                output->availability_start_time = now - *(output->encoders[0].end_timestamp) / GST_USECOND;
+                output->period_start = 0;
+
+        } else if (output->period_start == -1) {
+                /* timestamp 0 of new period */
+                output->period_start = now - output->availability_start_time - *(output->encoders[0].end_timestamp) / GST_USECOND;
+        }
+
+        representations = g_string_sized_new (4096);
+        max_duration = depth = 0;
+        for (i = 0; i < output->encoder_count; i++) {
+                if (!render_representation (job, i, representations, &max_duration, &encoder_depth)) {
+                        g_string_free (representations, TRUE);
+                        return NULL;
+                }
+                if (i == 0) {
+                        /* time shift buffer of the first encoder */
+                        depth = encoder_depth;
+                }
+        }
+        segment_duration = max_duration > 0 ? max_duration : jobdesc_m3u8streaming_segment_duration (job->spec);
+        if (segment_duration == 0) {
+                segment_duration = GST_SECOND;
+        }
+
+        availability_start_time = iso8601 (output->availability_start_time);
+        publish_time = iso8601 (now);
+        mpd = g_string_sized_new (representations->len + 1024);
+        g_string_append (mpd, MPD_HEADER);
+        g_string_append_printf (mpd,
+                                MPD_TAG,
+                                DASH_PROFILES,
+                                availability_start_time,
+                                publish_time,
+                                (gdouble)segment_duration / GST_SECOND,
+                                (gdouble)segment_duration / GST_SECOND,
+                                (gdouble)MAX (depth, segment_duration) / GST_SECOND,
+                                3.0 * segment_duration / GST_SECOND);
+        g_string_append_printf (mpd, MPD_PERIOD_TAG, output->period, (gdouble)output->period_start / G_USEC_PER_SEC);
+        g_string_append (mpd, MPD_ADAPTATION_SET_TAG);
+        g_string_append_len (mpd, representations->str, representations->len);
+        g_string_append (mpd, "    </AdaptationSet>\n");
+        g_string_append (mpd, "  </Period>\n");
+        g_string_append (mpd, "</MPD>\n");
+        g_string_free (representations, TRUE);
+        g_free (availability_start_time);
+        g_free (publish_time);
+
+        return g_string_free (mpd, FALSE);
+}
+
+/**
+ * dash_get_mpd:
+ * @job: (in): the job.
+ *
+ * get http response of the mpd of job, rendered again if new segment output.
+ *
+ * Returns: the response, NULL if m3u8streaming of the job is not enabled, 503 if the encoder stalled. should be unref after used.
+ */
+GBytes * dash_get_mpd (Job *job)
+{
+        JobOutput *output = job->output;
+        GBytes *response;
+        guint64 segments;
+        gchar *body, *buf;
+        gint i;
+
+        if (!jobdesc_m3u8streaming (job->spec)) {
+                /* segments are cut by m3u8streaming */
+                return NULL;
+        }
+
+        g_mutex_lock (&(output->mpd_mutex));
+        segments = 0;
+        for (i = 0; i < output->encoder_count; i++) {
+                segments += __atomic_load_n (output->encoders[i].gop_index_tail, __ATOMIC_ACQUIRE);
+        }
+        if ((output->mpd == NULL) || (output->mpd_segments != segments)) {
+                body = render_mpd (job);
+                if (body == NULL) {
+                        /* not cached, rendered again when the encoder recovered */
+                        g_mutex_unlock (&(output->mpd_mutex));
+                        buf = g_strdup_printf (http_503, PACKAGE_NAME, PACKAGE_VERSION);
+                        return g_bytes_new_take (buf, strlen (buf));
+                }
+                buf = g_strdup_printf (http_200,
+                                       PACKAGE_NAME,
+                                       PACKAGE_VERSION,
+                                       "application/dash+xml",
+                                       strlen (body),
+                                       body);
+                g_free (body);
+                if (output->mpd != NULL) {
+                        g_bytes_unref (output->mpd);
+                }
+                output->mpd = g_bytes_new_take (buf, strlen (buf));
+                output->mpd_segments = segments;
+        }
+        response = g_bytes_ref (output->mpd);
+        g_mutex_unlock (&(output->mpd_mutex));
+
+        return response;
+}
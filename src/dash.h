@@ -0,0 +1,31 @@
+/*
+ * mpeg dash live output.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __DASH_H__
+#define __DASH_H__
+
+#include <gst/gst.h>
+
+#include "job.h"
+
+#define DASH_TIMESCALE 1000000000 /* timestamps of gop index are in nanoseconds */
+#define DASH_PROFILES "urn:mpeg:dash:profile:isoff-live:2011,urn:mpeg:dash:profile:mp2t-main:2011"
+
+#define MPD_HEADER "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+#define MPD_TAG "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" profiles=\"%s\" type=\"dynamic\" " \
+                "availabilityStartTime=\"%s\" publishTime=\"%s\" minimumUpdatePeriod=\"PT%.3fS\" " \
+                "minBufferTime=\"PT%.3fS\" timeShiftBufferDepth=\"PT%.3fS\" suggestedPresentationDelay=\"PT%.3fS\">\n"
+#define MPD_PERIOD_TAG "  <Period id=\"%u\" start=\"PT%.3fS\">\n"
+#define MPD_ADAPTATION_SET_TAG "    <AdaptationSet segmentAlignment=\"true\" startWithSAP=\"1\">\n"
+#define MPD_REPRESENTATION_TAG "      <Representation id=\"%d\" mimeType=\"%s\" bandwidth=\"%lu\">\n"
+#define MPD_SEGMENT_TEMPLATE_TAG "        <SegmentTemplate timescale=\"%d\" media=\"encoder/$RepresentationID$/$Time$.%s\"%s>\n"
+#define MPD_INITIALIZATION " initialization=\"encoder/$RepresentationID$/init.mp4\""
+
+void dash_reset (Job *job);
+GBytes * dash_get_mpd (Job *job);
+
+#endif /* __DASH_H__ */
@@ -5,6 +5,12 @@
  */
 
 #include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <gst/gst.h>
 #include <gst/app/gstappsrc.h>
 #include <gst/app/gstappsink.h>
@@ -64,6 +70,10 @@ static void encoder_init (Encoder *encoder)
         encoder->system_clock = gst_system_clock_obtain ();
         g_object_set (encoder->system_clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
         encoder->streams = g_array_new (FALSE, FALSE, sizeof (gpointer));
+        g_mutex_init (&(encoder->ring_mutex));
+        g_queue_init (&(encoder->ring_blocks));
+        g_queue_init (&(encoder->ring_pending));
+        encoder->timestamp_offset = GST_CLOCK_TIME_NONE;
 }
 
 GType encoder_get_type (void)
@@ -131,6 +141,22 @@ static void encoder_dispose (GObject *obj)
         Encoder *encoder = ENCODER (obj);
         GObjectClass *parent_class = g_type_class_peek (G_TYPE_OBJECT);
 
+        if (encoder->archive_thread != NULL) {
+                /* G_MAXSIZE tell archive thread to exit. */
+                g_async_queue_push (encoder->archive_queue, GSIZE_TO_POINTER (G_MAXSIZE));
+                g_thread_join (encoder->archive_thread);
+                encoder->archive_thread = NULL;
+                g_async_queue_unref (encoder->archive_queue);
+        }
+
+        if (encoder->ring_allocator != NULL) {
+                gst_object_unref (encoder->ring_allocator);
+                encoder->ring_allocator = NULL;
+        }
+        while (!g_queue_is_empty (&(encoder->ring_pending))) {
+                gst_buffer_unref (g_queue_pop_head (&(encoder->ring_pending)));
+        }
+
         if (encoder->name != NULL) {
                 mq_close (encoder->mqdes);
                 g_free (encoder->name);
@@ -153,6 +179,7 @@ static void encoder_finalize (GObject *obj)
                 g_array_remove_index (encoder->streams, i);
         }
         g_array_free (encoder->streams, FALSE);
+        g_mutex_clear (&(encoder->ring_mutex));
 
         G_OBJECT_CLASS (parent_class)->finalize (obj);
 }
@@ -174,98 +201,536 @@ static EncoderStream * encoder_get_stream (Encoder *encoder, gchar *name)
 }
 
 /*
- * free memory size between tail and head.
+ * free memory size between the end of reserved memory and head.
  */
-static gint cache_free (Encoder *encoder)
+static guint64 cache_free (Encoder *encoder)
 {
-        if (*(encoder->output->head_addr) > *(encoder->output->tail_addr)) {
-                return *(encoder->output->head_addr) - *(encoder->output->tail_addr);
+        if (*(encoder->output->head_addr) > encoder->alloc_addr) {
+                return *(encoder->output->head_addr) - encoder->alloc_addr;
 
         } else {
-                return *(encoder->output->head_addr) + encoder->output->cache_size - *(encoder->output->tail_addr);
+                return *(encoder->output->head_addr) + encoder->output->cache_size - encoder->alloc_addr;
         }
 }
 
 /*
- * move head_addr to next gop.
+ * remove the oldest gop from cache and index.
+ * return FALSE if only the current output gop left.
  */
-static void move_head (Encoder *encoder)
+static gboolean move_head (Encoder *encoder)
 {
-        gint gop_size;
+        GOPIndexEntry *entry;
 
-        gop_size = encoder_output_gop_size (encoder->output, *(encoder->output->head_addr));
+        if (*(encoder->output->gop_index_head) >= *(encoder->output->gop_index_tail) - 1) {
+                return FALSE;
+        }
+        entry = encoder_output_gop_index_entry (encoder->output, *(encoder->output->gop_index_head));
+        (*(encoder->output->gop_index_head))++;
         /* move head. */
-        if (*(encoder->output->head_addr) + gop_size < encoder->output->cache_size) {
-                *(encoder->output->head_addr) += gop_size;
+        *(encoder->output->head_addr) = (entry->offset + entry->size) % encoder->output->cache_size;
 
-        } else {
-                *(encoder->output->head_addr) = *(encoder->output->head_addr) + gop_size - encoder->output->cache_size;
+        return TRUE;
+}
+
+/*
+ * reserve size bytes after alloc_addr, remove the oldest gops if no enough free memory.
+ * return FALSE if the current output gop is too large for the cache.
+ */
+static gboolean cache_reserve (Encoder *encoder, guint64 size)
+{
+        /* never fill up, head == alloc_addr means empty. */
+        while (cache_free (encoder) <= size) {
+                if (!move_head (encoder)) {
+                        return FALSE;
+                }
         }
+        encoder->alloc_addr = (encoder->alloc_addr + size) % encoder->output->cache_size;
+
+        return TRUE;
+}
+
+/*
+ * cache address where gop or part is cut, tail of cache, or the moof of current fragment if cmaf.
+ */
+static guint64 cut_addr (Encoder *encoder)
+{
+        return encoder->output->cmaf ? encoder->fragment_addr : *(encoder->output->tail_addr);
 }
 
 /*
  * move last random access point address.
  */
-static void move_last_rap (Encoder *encoder, GstBuffer *buffer)
+static void move_last_rap (Encoder *encoder, GstClockTime timestamp)
 {
-        gchar buf[12];
-        gint32 size, n;
+        GOPIndexEntry *entry;
+        guint64 size, addr;
 
-        /* calculate and write gop size. */
-        if (*(encoder->output->tail_addr) >= *(encoder->output->last_rap_addr)) {
-                size = *(encoder->output->tail_addr) - *(encoder->output->last_rap_addr);
+        /* calculate gop size */
+        addr = cut_addr (encoder);
+        if (addr >= *(encoder->output->last_rap_addr)) {
+                size = addr - *(encoder->output->last_rap_addr);
 
         } else {
-                size = encoder->output->cache_size - *(encoder->output->last_rap_addr) + *(encoder->output->tail_addr);
+                size = encoder->output->cache_size - *(encoder->output->last_rap_addr) + addr;
+        }
+
+        entry = encoder_output_gop_index_entry (encoder->output, *(encoder->output->gop_index_tail) - 1);
+        if (size == 0) {
+                /* empty gop, size 0 means current output gop in index, just update timestamp. */
+                entry->timestamp = timestamp;
+                return;
         }
 
-        if (*(encoder->output->last_rap_addr) + 12 < encoder->output->cache_size) {
-                memcpy (encoder->output->cache_addr + *(encoder->output->last_rap_addr) + 8, &size, 4);
+        /* complete current gop in index and append the new one. */
+        entry->size = size;
+        entry->duration = timestamp - entry->timestamp;
+        if (*(encoder->output->gop_index_tail) - *(encoder->output->gop_index_head) == GOP_INDEX_SIZE) {
+                /* index is full, the oldest gop removed from cache too. */
+                move_head (encoder);
+        }
+        entry = encoder_output_gop_index_entry (encoder->output, *(encoder->output->gop_index_tail));
+        entry->timestamp = timestamp;
+        entry->offset = addr;
+        entry->size = 0;
+        entry->duration = 0;
+        entry->flags = 0;
+        (*(encoder->output->gop_index_tail))++;
+
+        /* completed gop to be archived, queue item can't be NULL, so push sequence + 1. */
+        if (encoder->archive_queue != NULL) {
+                g_async_queue_push (encoder->archive_queue, GSIZE_TO_POINTER (*(encoder->output->gop_index_tail)));
+        }
 
-        } else if (*(encoder->output->last_rap_addr) + 8 < encoder->output->cache_size) {
-                n = encoder->output->cache_size - *(encoder->output->last_rap_addr) - 8;
-                memcpy (encoder->output->cache_addr + *(encoder->output->last_rap_addr) + 8, &size, n);
-                memcpy (encoder->output->cache_addr, &size + n, 4 - n);
+        *(encoder->output->last_rap_addr) = addr;
+}
 
-        } else {
-                n = *(encoder->output->last_rap_addr) + 8 - encoder->output->cache_size;
-                memcpy (encoder->output->cache_addr + n, &size, 4);
+/*
+ * cmaf, header buffers of the muxer, ftyp and moov, are the init segment. a new init segment begins
+ * with the first header buffer after media, e.g. worker restarted.
+ */
+static void write_init_segment (Encoder *encoder, GstBuffer *buffer)
+{
+        EncoderOutput *output = encoder->output;
+        gsize size;
+
+        if (!encoder->init_writing) {
+                *(output->init_size) = 0;
+                encoder->init_writing = TRUE;
+        }
+        size = gst_buffer_get_size (buffer);
+        if (*(output->init_size) + size > INIT_SEGMENT_SIZE) {
+                GST_ERROR ("%s init segment too large, %lu bytes", encoder->name, *(output->init_size) + size);
+                return;
         }
+        gst_buffer_extract (buffer, 0, output->init_segment + *(output->init_size), size);
+        *(output->init_size) += size;
+}
 
-        /* new gop timestamp, 4bytes reservation for gop size. */
-        *(encoder->output->last_rap_addr) = *(encoder->output->tail_addr);
-        memcpy (buf, &(GST_BUFFER_PTS (buffer)), 8);
-        size = 0;
-        memcpy (buf + 8, &size, 4);
-        if (*(encoder->output->tail_addr) + 12 < encoder->output->cache_size) {
-                memcpy (encoder->output->cache_addr + *(encoder->output->tail_addr), buf, 12);
-                *(encoder->output->tail_addr) += 12;
+/*
+ * complete current part in part index and append the new one, low latency hls.
+ */
+static void move_part (Encoder *encoder, GstClockTime timestamp, gboolean independent)
+{
+        PartIndexEntry *entry;
+        guint64 size, gop, number, addr;
+
+        entry = encoder_output_part_index_entry (encoder->output, *(encoder->output->part_index_tail) - 1);
+        gop = *(encoder->output->gop_index_tail) - 1;
+        number = (entry->gop == gop) ? entry->number + 1 : 0;
+        addr = cut_addr (encoder);
+        if (addr >= entry->offset) {
+                size = addr - entry->offset;
 
         } else {
-                n = encoder->output->cache_size - *(encoder->output->tail_addr);
-                memcpy (encoder->output->cache_addr + *(encoder->output->tail_addr), buf, n);
-                memcpy (encoder->output->cache_addr, buf + n, 12 - n);
-                *(encoder->output->tail_addr) = 12 - n;
+                size = encoder->output->cache_size - entry->offset + addr;
+        }
+        if (size == 0) {
+                /* empty part, size 0 means current output part in index, just restart it. */
+                entry->timestamp = timestamp;
+                entry->offset = addr;
+                entry->number = (entry->gop == gop) ? entry->number : 0;
+                entry->gop = gop;
+                entry->flags = independent ? PART_FLAG_INDEPENDENT : 0;
+                return;
+        }
+
+        /* complete current part. */
+        entry->size = size;
+        entry->duration = timestamp - entry->timestamp;
+        if (*(encoder->output->part_index_tail) - *(encoder->output->part_index_head) == encoder->output->part_index_size) {
+                /* index is full, drop the oldest part. */
+                (*(encoder->output->part_index_head))++;
+        }
+        entry = encoder_output_part_index_entry (encoder->output, *(encoder->output->part_index_tail));
+        entry->timestamp = timestamp;
+        entry->offset = addr;
+        entry->size = 0;
+        entry->duration = 0;
+        entry->gop = gop;
+        entry->number = number;
+        entry->flags = independent ? PART_FLAG_INDEPENDENT : 0;
+        (*(encoder->output->part_index_tail))++;
+}
+
+/*
+ * save completed gops to archive, gop is archived as soon as completed,
+ * so that there is plenty of time before it's overwritten in cache.
+ */
+static gpointer archive_thread (gpointer data)
+{
+        Encoder *encoder = (Encoder *)data;
+        EncoderOutput *output = encoder->output;
+        GOPIndexEntry entry;
+        guint64 sequence;
+        guint32 read_sequence;
+
+        for (;;) {
+                sequence = GPOINTER_TO_SIZE (g_async_queue_pop (encoder->archive_queue));
+                if (sequence == G_MAXSIZE) {
+                        break;
+                }
+                sequence -= 1;
+                do {
+                        read_sequence = encoder_output_read_begin (output);
+                        entry = *encoder_output_gop_index_entry (output, sequence);
+                } while (encoder_output_read_retry (output, read_sequence));
+                if (encoder_output_read_stalled (read_sequence)) {
+                        continue;
+                }
+                if (encoder_output_gop_evicted (output, sequence)) {
+                        GST_WARNING ("%s gop %lu evicted before archived", encoder->name, sequence);
+                        continue;
+                }
+
+                if (archive_write (output->archive, output->cache_addr + entry.offset, entry.size) != 0) {
+                        continue;
+                }
+                if (encoder_output_gop_evicted (output, sequence)) {
+                        GST_WARNING ("%s gop %lu evicted while archiving", encoder->name, sequence);
+                        continue;
+                }
+                archive_commit (output->archive, entry.timestamp, entry.duration, entry.size);
+        }
+
+        return NULL;
+}
+
+/*
+ * encoder is the only writer of output, readers never block it, see encoder_output_read_begin.
+ */
+static void output_write_begin (EncoderOutput *encoder_output)
+{
+        __atomic_add_fetch (encoder_output->seqlock, 1, __ATOMIC_SEQ_CST);
+}
+
+static void output_write_end (EncoderOutput *encoder_output)
+{
+        __atomic_add_fetch (encoder_output->seqlock, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * new output available, wake up the waiter in gstreamill if any.
+ */
+static void notify_output (EncoderOutput *encoder_output)
+{
+        __atomic_add_fetch (encoder_output->generation, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n (encoder_output->waiting, __ATOMIC_SEQ_CST) != 0) {
+                syscall (SYS_futex, encoder_output->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        }
+}
+
+/*
+ * ring allocator, memory allocated is reserved in cache right after the tail, in order and
+ * exactly the size allocated, no prefix, padding or alignment, so that blocks committed in
+ * allocation order are at the tail already. muxer output lands in cache directly and
+ * new_sample_callback only need commit it. blocks not committed are tracked in allocation
+ * order, a block is moved down to the tail only over blocks dropped. a buffer output while
+ * ring memory allocated before it is outstanding is copied and deferred, output is in order.
+ */
+typedef struct _RingAllocator {
+        GstAllocator parent;
+        Encoder *encoder;
+} RingAllocator;
+
+typedef struct _RingAllocatorClass {
+        GstAllocatorClass parent;
+} RingAllocatorClass;
+
+typedef struct _RingBlock {
+        Encoder *encoder;
+        guint64 offset; /* offset in cache */
+        gsize size;
+        gboolean committed; /* committed to cache, not in ring_blocks */
+        gboolean freed; /* memory freed */
+} RingBlock;
+
+static GQuark ring_block_quark;
+
+static void output_buffer (Encoder *encoder, GstBuffer *buffer);
+
+/*
+ * ring memory allocated, neither committed nor freed, called with ring_mutex.
+ */
+static gboolean ring_outstanding (Encoder *encoder)
+{
+        GList *list;
+
+        for (list = encoder->ring_blocks.head; list != NULL; list = list->next) {
+                if (!((RingBlock *)list->data)->freed) {
+                        return TRUE;
+                }
+        }
+
+        return FALSE;
+}
+
+/*
+ * forget blocks dropped at the head of allocation order, called with ring_mutex.
+ */
+static void ring_trim (Encoder *encoder)
+{
+        RingBlock *block;
+
+        for (;;) {
+                block = g_queue_peek_head (&(encoder->ring_blocks));
+                if ((block == NULL) || !block->freed) {
+                        break;
+                }
+                g_queue_pop_head (&(encoder->ring_blocks));
+                g_free (block);
+        }
+        if (g_queue_is_empty (&(encoder->ring_blocks))) {
+                /* nothing reserved after tail, reclaim memory of dropped blocks if any. */
+                encoder->alloc_addr = *(encoder->output->tail_addr);
+        }
+}
+
+/*
+ * output buffers deferred, called with ring_mutex when no ring memory outstanding.
+ */
+static void ring_flush (Encoder *encoder)
+{
+        GstBuffer *buffer;
+
+        output_write_begin (encoder->output);
+        for (;;) {
+                buffer = g_queue_pop_head (&(encoder->ring_pending));
+                if (buffer == NULL) {
+                        break;
+                }
+                output_buffer (encoder, buffer);
+                /* copy in system memory, no ring block to free */
+                gst_buffer_unref (buffer);
         }
+        output_write_end (encoder->output);
 }
 
-static void copy_buffer (Encoder *encoder, GstBuffer *buffer)
+static void ring_block_free (gpointer data)
 {
-        gint size;
+        RingBlock *block = (RingBlock *)data;
+        Encoder *encoder = block->encoder;
+        gboolean flushed;
+
+        flushed = FALSE;
+        g_mutex_lock (&(encoder->ring_mutex));
+        block->freed = TRUE;
+        if (block->committed) {
+                g_mutex_unlock (&(encoder->ring_mutex));
+                g_free (block);
+                return;
+        }
+        /* dropped by upstream */
+        ring_trim (encoder);
+        if (!g_queue_is_empty (&(encoder->ring_pending)) && !ring_outstanding (encoder)) {
+                ring_flush (encoder);
+                flushed = TRUE;
+        }
+        g_mutex_unlock (&(encoder->ring_mutex));
+
+        if (flushed) {
+                notify_output (encoder->output);
+        }
+}
+
+static GstMemory * ring_allocator_alloc (GstAllocator *allocator, gsize size, GstAllocationParams *params)
+{
+        Encoder *encoder = ((RingAllocator *)allocator)->encoder;
+        EncoderOutput *output = encoder->output;
+        RingBlock *block;
+        GstMemory *memory;
+        gchar *data;
+
+        if (size >= output->cache_size / 4) {
+                /* too large, don't make holes in cache. */
+                return gst_allocator_alloc (NULL, size, params);
+        }
+
+        g_mutex_lock (&(encoder->ring_mutex));
+        if (!g_queue_is_empty (&(encoder->ring_pending))) {
+                /* output deferred, memory reserved now would be copied anyway. */
+                g_mutex_unlock (&(encoder->ring_mutex));
+                return gst_allocator_alloc (NULL, size, params);
+        }
+        block = g_new (RingBlock, 1);
+        block->encoder = encoder;
+        block->offset = encoder->alloc_addr;
+        block->size = size;
+        block->committed = FALSE;
+        block->freed = FALSE;
+        data = output->cache_addr + encoder->alloc_addr;
+        output_write_begin (output);
+        if (!cache_reserve (encoder, size)) {
+                output_write_end (output);
+                g_mutex_unlock (&(encoder->ring_mutex));
+                g_free (block);
+                GST_ERROR ("%s gop too large, cache size %lu", encoder->name, output->cache_size);
+                return gst_allocator_alloc (NULL, size, params);
+        }
+        /* readers see gop removed from index before it is overwritten. */
+        __atomic_thread_fence (__ATOMIC_RELEASE);
+        output_write_end (output);
+        g_queue_push_tail (&(encoder->ring_blocks), block);
+        g_mutex_unlock (&(encoder->ring_mutex));
+
+        /* cache is mirror mapped, memory never split. */
+        memory = gst_memory_new_wrapped (0, data, size, 0, size, block, ring_block_free);
+        gst_mini_object_set_qdata (GST_MINI_OBJECT (memory), ring_block_quark, block, NULL);
+
+        return memory;
+}
+
+static void ring_allocator_class_init (RingAllocatorClass *ringallocatorclass)
+{
+        GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (ringallocatorclass);
+
+        allocator_class->alloc = ring_allocator_alloc;
+        ring_block_quark = g_quark_from_static_string ("gstreamill-ring-block");
+}
+
+static void ring_allocator_init (RingAllocator *ring_allocator)
+{
+        GstAllocator *allocator = GST_ALLOCATOR (ring_allocator);
+
+        allocator->mem_type = "ring";
+        GST_OBJECT_FLAG_SET (allocator, GST_ALLOCATOR_FLAG_CUSTOM_ALLOC);
+}
+
+static GType ring_allocator_get_type (void)
+{
+        static GType type = 0;
+
+        if (type) return type;
+        static const GTypeInfo info = {
+                sizeof (RingAllocatorClass),
+                NULL, /* base class initializer */
+                NULL, /* base class finalizer */
+                (GClassInitFunc)ring_allocator_class_init,
+                NULL,
+                NULL,
+                sizeof (RingAllocator),
+                0,
+                (GInstanceInitFunc)ring_allocator_init,
+                NULL
+        };
+        type = g_type_register_static (GST_TYPE_ALLOCATOR, "RingAllocator", &info, 0);
+
+        return type;
+}
+
+/*
+ * ring block of buffer of one memory from ring allocator of the encoder, NULL if not.
+ * memory is wrapped, allocator of it is the system memory allocator, it's known by qdata.
+ */
+static RingBlock * ring_block (Encoder *encoder, GstBuffer *buffer)
+{
+        RingBlock *block;
+
+        if ((encoder->ring_allocator == NULL) || (gst_buffer_n_memory (buffer) != 1)) {
+                return NULL;
+        }
+        block = gst_mini_object_get_qdata (GST_MINI_OBJECT (gst_buffer_peek_memory (buffer, 0)), ring_block_quark);
+        if ((block == NULL) || (block->encoder != encoder)) {
+                return NULL;
+        }
+
+        return block;
+}
+
+/*
+ * buffer could be committed at tail now, called with ring_mutex.
+ * buffer of ring memory is committed if blocks allocated before it are all dropped,
+ * other buffer is committed if no ring memory outstanding.
+ */
+static gboolean ring_committable (Encoder *encoder, GstBuffer *buffer)
+{
+        RingBlock *block;
+        GList *list;
+
+        block = ring_block (encoder, buffer);
+        for (list = encoder->ring_blocks.head; list != NULL; list = list->next) {
+                if (list->data == block) {
+                        break;
+                }
+                if (!((RingBlock *)list->data)->freed) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+/*
+ * commit buffer at tail, called with ring_mutex and ring_committable.
+ * buffer from ring allocator is in place already if no block dropped before it,
+ * otherwise move it down to the tail over the dropped blocks. other buffer is copied to the tail.
+ */
+static void commit_buffer (Encoder *encoder, GstBuffer *buffer)
+{
+        EncoderOutput *output = encoder->output;
         GstMapInfo info;
+        RingBlock *block, *dropped;
+        guint64 offset, distance;
 
+        block = ring_block (encoder, buffer);
+        if ((block != NULL) && block->committed) {
+                /* pushed again, copy it. */
+                block = NULL;
+        }
         gst_buffer_map (buffer, &info, GST_MAP_READ);
-        if (*(encoder->output->tail_addr) + gst_buffer_get_size (buffer) < encoder->output->cache_size) {
-                memcpy (encoder->output->cache_addr + *(encoder->output->tail_addr), info.data, gst_buffer_get_size (buffer));
-                *(encoder->output->tail_addr) = *(encoder->output->tail_addr) + gst_buffer_get_size (buffer);
+        if (block != NULL) {
+                /* cache is mirror mapped, data is at cache_addr + offset too. */
+                offset = ((gchar *)info.data - output->cache_addr) % output->cache_size;
+                distance = (offset + output->cache_size - *(output->tail_addr)) % output->cache_size;
+                if (distance != 0) {
+                        /* blocks before it dropped, move down to tail, never overlap with memory reserved after it. */
+                        memmove (output->cache_addr + *(output->tail_addr),
+                                 output->cache_addr + *(output->tail_addr) + distance,
+                                 info.size);
+                }
+                for (;;) {
+                        dropped = g_queue_pop_head (&(encoder->ring_blocks));
+                        if (dropped == block) {
+                                break;
+                        }
+                        g_free (dropped);
+                }
+                block->committed = TRUE;
 
         } else {
-                size = encoder->output->cache_size - *(encoder->output->tail_addr);
-                memcpy (encoder->output->cache_addr + *(encoder->output->tail_addr), info.data, size);
-                memcpy (encoder->output->cache_addr, info.data + size, gst_buffer_get_size (buffer) - size);
-                *(encoder->output->tail_addr) = gst_buffer_get_size (buffer) - size;
+                /* ring blocks dropped only, reserve after the tail */
+                ring_trim (encoder);
+                if (!cache_reserve (encoder, info.size)) {
+                        GST_ERROR ("%s gop too large, cache size %lu, drop buffer", encoder->name, output->cache_size);
+                        gst_buffer_unmap (buffer, &info);
+                        return;
+                }
+                /* readers see gop removed from index before it is overwritten. */
+                __atomic_thread_fence (__ATOMIC_RELEASE);
+                memmove (output->cache_addr + *(output->tail_addr), info.data, info.size);
         }
+        *(output->tail_addr) = (*(output->tail_addr) + info.size) % output->cache_size;
         gst_buffer_unmap (buffer, &info);
+        ring_trim (encoder);
 }
 
 static void udp_streaming (Encoder *encoder, GstBuffer *buffer)
@@ -313,40 +778,94 @@ static void udp_streaming (Encoder *encoder, GstBuffer *buffer)
         }
 }
 
-static GstFlowReturn new_sample_callback (GstAppSink * sink, gpointer user_data)
+/*
+ * cmaf, fragment begins with moof box, mp4mux may push moof and mdat header before samples.
+ */
+static gboolean is_moof (GstBuffer *buffer)
 {
-        GstBuffer *buffer;
-        GstSample *sample;
-        Encoder *encoder = (Encoder *)user_data;
+        guint8 header[8];
 
-        *(encoder->output->heartbeat) = gst_clock_get_time (encoder->system_clock);
-        sample = gst_app_sink_pull_sample (GST_APP_SINK (sink));
-        buffer = gst_sample_get_buffer (sample);
+        if (gst_buffer_extract (buffer, 0, header, 8) != 8) {
+                return FALSE;
+        }
+
+        return memcmp (header + 4, "moof", 4) == 0;
+}
 
-        sem_wait (encoder->output->semaphore);
+/*
+ * index and commit buffer, called with ring_mutex and output write begun.
+ */
+static void output_buffer (Encoder *encoder, GstBuffer *buffer)
+{
+        GstClockTime timestamp;
+        guint64 gop_index_tail, gop_sequence;
+        PartIndexEntry *part;
 
         (*(encoder->output->total_count)) += gst_buffer_get_size (buffer);
+        gop_sequence = *(encoder->output->gop_index_tail);
+
+        /* output timestamp, continue from the crashed worker if warm restarted. */
+        timestamp = GST_BUFFER_PTS (buffer);
+        if (encoder->output->discontinuity && (encoder->timestamp_offset == GST_CLOCK_TIME_NONE)) {
+                encoder->timestamp_offset = 0;
+                if (GST_CLOCK_TIME_IS_VALID (timestamp) && (*(encoder->output->end_timestamp) > timestamp)) {
+                        encoder->timestamp_offset = *(encoder->output->end_timestamp) - timestamp;
+                }
+                GST_WARNING ("%s warm restart, timestamp offset %" GST_TIME_FORMAT, encoder->name, GST_TIME_ARGS (encoder->timestamp_offset));
+        }
+        if (GST_CLOCK_TIME_IS_VALID (timestamp) && (encoder->timestamp_offset != GST_CLOCK_TIME_NONE)) {
+                timestamp += encoder->timestamp_offset;
+        }
+        if (GST_CLOCK_TIME_IS_VALID (timestamp) && (timestamp > *(encoder->output->end_timestamp))) {
+                *(encoder->output->end_timestamp) = timestamp;
+        }
 
-        /* update head_addr, free enough memory for current buffer. */
-        while (cache_free (encoder) < gst_buffer_get_size (buffer) + 12) { /* timestamp + gop size = 12 */
-                move_head (encoder);
+        /* cmaf, cut only before a fragment, when it's first sample output. */
+        if (encoder->output->cmaf && is_moof (buffer)) {
+                encoder->fragment_begin = TRUE;
+                encoder->fragment_addr = *(encoder->output->tail_addr);
+                commit_buffer (encoder, buffer);
+                return;
         }
+        if (encoder->output->cmaf && (!encoder->fragment_begin || !GST_CLOCK_TIME_IS_VALID (GST_BUFFER_PTS (buffer)))) {
+                /* mdat header, or sample not the first of fragment */
+                commit_buffer (encoder, buffer);
+                return;
+        }
+        encoder->fragment_begin = FALSE;
+
+        if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) && encoder->output->discontinuity) {
+                /*
+                 * first random access point after warm restart, complete the gop of the crashed worker,
+                 * the new gop is marked discontinuous.
+                 */
+                gop_index_tail = *(encoder->output->gop_index_tail);
+                move_last_rap (encoder, timestamp);
+                encoder_output_gop_index_entry (encoder->output, *(encoder->output->gop_index_tail) - 1)->flags |= GOP_FLAG_DISCONTINUITY;
+                if ((encoder->mqdes != -1) && (*(encoder->output->gop_index_tail) != gop_index_tail)) {
+                        gchar *msg;
+
+                        msg = g_strdup_printf ("%lu", encoder_output_gop_index_entry (encoder->output, gop_index_tail - 1)->duration);
+                        if (mq_send (encoder->mqdes, msg, strlen (msg), 1) == -1) {
+                                GST_ERROR ("mq_send error: %s", g_strerror (errno));
+                        }
+                        g_free (msg);
+                }
+                encoder->output->discontinuity = FALSE;
 
-        if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        } else if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
                 /* 
                  * random access point found.
-                 * write previous gop size to 4 bytes reservation,
-                 * write current gop timestamp,
-                 * reserve 4 bytes for size of current gop,
+                 * complete previous gop and append current gop in gop index.
                  */
                 if (encoder->mqdes == -1) {
                         /* no m3u8 output */
-                        move_last_rap (encoder, buffer);
+                        move_last_rap (encoder, timestamp);
 
                 } else if (GST_BUFFER_PTS (buffer) == encoder->last_running_time) {
                         gchar *msg;
 
-                        move_last_rap (encoder, buffer);
+                        move_last_rap (encoder, timestamp);
                         msg = g_strdup_printf ("%lu", encoder->last_segment_duration);
                         if (mq_send (encoder->mqdes, msg, strlen (msg), 1) == -1) {
                                 GST_ERROR ("mq_send error: %s", g_strerror (errno));
@@ -356,18 +875,72 @@ static GstFlowReturn new_sample_callback (GstAppSink * sink, gpointer user_data)
                 }
         }
 
-        /* udpstreaming? */
-        if (encoder->udpstreaming) {
-                udp_streaming (encoder, buffer);
+        /* low latency hls, new part on new gop, or part target duration reached. */
+        if ((encoder->part_duration != 0) && GST_CLOCK_TIME_IS_VALID (timestamp)) {
+                part = encoder_output_part_index_entry (encoder->output, *(encoder->output->part_index_tail) - 1);
+                if ((*(encoder->output->gop_index_tail) != gop_sequence) || (timestamp >= part->timestamp + encoder->part_duration)) {
+                        move_part (encoder, timestamp, !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT));
+                }
         }
 
         /*
-         * copy buffer to cache.
+         * commit buffer to cache.
          * update tail_addr
          */
-        copy_buffer (encoder, buffer);
+        commit_buffer (encoder, buffer);
+}
+
+static GstFlowReturn new_sample_callback (GstAppSink * sink, gpointer user_data)
+{
+        GstBuffer *buffer;
+        GstSample *sample;
+        Encoder *encoder = (Encoder *)user_data;
+
+        *(encoder->output->heartbeat) = gst_clock_get_time (encoder->system_clock);
+        sample = gst_app_sink_pull_sample (GST_APP_SINK (sink));
+        buffer = gst_sample_get_buffer (sample);
+
+        /* udpstreaming? regions of ring memory would alias cache moved or overwritten after commit. */
+        if (encoder->udpstreaming && (ring_block (encoder, buffer) != NULL)) {
+                GstBuffer *copy;
 
-        sem_post (encoder->output->semaphore);
+                copy = gst_buffer_copy_deep (buffer);
+                udp_streaming (encoder, copy);
+                gst_buffer_unref (copy);
+
+        } else if (encoder->udpstreaming) {
+                udp_streaming (encoder, buffer);
+        }
+
+        g_mutex_lock (&(encoder->ring_mutex));
+        output_write_begin (encoder->output);
+
+        if (encoder->output->cmaf && GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER)) {
+                /* init segment is kept aside of cache */
+                write_init_segment (encoder, buffer);
+                output_write_end (encoder->output);
+                g_mutex_unlock (&(encoder->ring_mutex));
+                gst_sample_unref (sample);
+                return GST_FLOW_OK;
+        }
+        encoder->init_writing = FALSE;
+
+        if (!g_queue_is_empty (&(encoder->ring_pending)) || !ring_committable (encoder, buffer)) {
+                /*
+                 * ring memory allocated before is outstanding, output in order after it is
+                 * committed or dropped, keep a copy, the ring memory is released with sample.
+                 */
+                GST_DEBUG ("%s ring memory outstanding, defer buffer", encoder->name);
+                g_queue_push_tail (&(encoder->ring_pending), gst_buffer_copy_deep (buffer));
+
+        } else {
+                output_buffer (encoder, buffer);
+        }
+
+        output_write_end (encoder->output);
+        g_mutex_unlock (&(encoder->ring_mutex));
+
+        notify_output (encoder->output);
 
         gst_sample_unref (sample);
 
@@ -377,78 +950,86 @@ static GstFlowReturn new_sample_callback (GstAppSink * sink, gpointer user_data)
 static void need_data_callback (GstAppSrc *src, guint length, gpointer user_data)
 {
         EncoderStream *stream = (EncoderStream *)user_data;
-        gint current_position;
+        GstSample *sample;
+        GstCaps *caps;
         GstBuffer *buffer;
         GstPad *pad;
         GstEvent *event;
 
-        current_position = (stream->current_position + 1) % SOURCE_RING_SIZE;
+        g_mutex_lock (&(stream->source->mutex));
         for (;;) {
                 if (stream->state != NULL) {
                         stream->state->last_heartbeat = gst_clock_get_time (stream->system_clock);
                 }
-                /* insure next buffer isn't current buffer */
-                if ((current_position == stream->source->current_position) || stream->source->current_position == -1) {
-                        if ((current_position == stream->source->current_position) && stream->source->eos) {
-                                gst_app_src_end_of_stream (src);
-                                break;
-                        }
-                        GST_DEBUG ("waiting %s source ready", stream->name);
-                        g_usleep (50000); /* wiating 50ms */
-                        continue;
+                /* caught up with source? */
+                if (stream->current_position != stream->source->current_position) {
+                        break;
                 }
-
-                /* first buffer, set caps. */
-                if (stream->current_position == -1) {
-                        GstCaps *caps;
-                        caps = gst_sample_get_caps (stream->source->ring[current_position]);
-                        gst_app_src_set_caps (src, caps);
-                        if (!g_str_has_prefix (gst_caps_to_string (caps), "video")) {
-                                /* only for video stream, force key unit */
-                                stream->encoder = NULL;
-                        }
-                        GST_INFO ("set stream %s caps: %s", stream->name, gst_caps_to_string (caps));
-                }
-
-                buffer = gst_sample_get_buffer (stream->source->ring[current_position]);
-                GST_DEBUG ("%s encoder position %d; timestamp %" GST_TIME_FORMAT " source position %d",
-                        stream->name,   
-                        stream->current_position,
-                        GST_TIME_ARGS (GST_BUFFER_PTS (buffer)),
-                        stream->source->current_position);
-
-                /* force key unit? */
-                if ((stream->encoder != NULL) && (stream->encoder->segment_duration != 0)) {
-                        if (stream->encoder->duration_accumulation >= stream->encoder->segment_duration) {
-                                GstClockTime running_time;
-
-                                stream->encoder->last_segment_duration = stream->encoder->duration_accumulation;
-                                running_time = GST_BUFFER_PTS (buffer);
-                                pad = gst_element_get_static_pad ((GstElement *)src, "src");
-                                event = gst_video_event_new_downstream_force_key_unit (running_time,
-                                                                                       running_time,
-                                                                                       running_time,
-                                                                                       TRUE,
-                                                                                       stream->encoder->force_key_count);
-                                gst_pad_push_event (pad, event);
-                                stream->encoder->force_key_count++;
-                                stream->encoder->duration_accumulation = 0;
-                        }
-                        stream->encoder->duration_accumulation += GST_BUFFER_DURATION (buffer);
+                if (stream->source->eos) {
+                        g_mutex_unlock (&(stream->source->mutex));
+                        gst_app_src_end_of_stream (src);
+                        return;
                 }
-
-                /* push buffer */
-                if (gst_app_src_push_buffer (src, gst_buffer_ref (buffer)) != GST_FLOW_OK) {
-                        GST_ERROR ("%s, gst_app_src_push_buffer failure.", stream->name);
+                GST_DEBUG ("waiting %s source ready", stream->name);
+                /* woken up by source output, time out to keep heartbeat while source stalled. */
+                g_cond_wait_until (&(stream->source->cond),
+                                   &(stream->source->mutex),
+                                   g_get_monotonic_time () + G_TIME_SPAN_SECOND / 2);
+        }
+        sample = source_stream_read (stream->source, &(stream->current_position));
+        g_mutex_unlock (&(stream->source->mutex));
+
+        /* first buffer, set caps, first samples may have been dropped for slow encoder. */
+        caps = gst_app_src_get_caps (src);
+        if (caps == NULL) {
+                caps = gst_sample_get_caps (sample);
+                gst_app_src_set_caps (src, caps);
+                if (!g_str_has_prefix (gst_caps_to_string (caps), "video")) {
+                        /* only for video stream, force key unit */
+                        stream->encoder = NULL;
                 }
+                GST_INFO ("set stream %s caps: %s", stream->name, gst_caps_to_string (caps));
 
-                if (stream->state != NULL) {
-                        stream->state->current_timestamp = GST_BUFFER_PTS (buffer);
+        } else {
+                gst_caps_unref (caps);
+        }
+
+        buffer = gst_sample_get_buffer (sample);
+        GST_DEBUG ("%s encoder position %d; timestamp %" GST_TIME_FORMAT " source position %d",
+                stream->name,   
+                stream->current_position,
+                GST_TIME_ARGS (GST_BUFFER_PTS (buffer)),
+                stream->source->current_position);
+
+        /* force key unit? */
+        if ((stream->encoder != NULL) && (stream->encoder->segment_duration != 0)) {
+                if (stream->encoder->duration_accumulation >= stream->encoder->segment_duration) {
+                        GstClockTime running_time;
+
+                        stream->encoder->last_segment_duration = stream->encoder->duration_accumulation;
+                        running_time = GST_BUFFER_PTS (buffer);
+                        pad = gst_element_get_static_pad ((GstElement *)src, "src");
+                        event = gst_video_event_new_downstream_force_key_unit (running_time,
+                                                                               running_time,
+                                                                               running_time,
+                                                                               TRUE,
+                                                                               stream->encoder->force_key_count);
+                        gst_pad_push_event (pad, event);
+                        stream->encoder->force_key_count++;
+                        stream->encoder->duration_accumulation = 0;
                 }
+                stream->encoder->duration_accumulation += GST_BUFFER_DURATION (buffer);
+        }
 
-                break;
+        /* push buffer */
+        if (gst_app_src_push_buffer (src, gst_buffer_ref (buffer)) != GST_FLOW_OK) {
+                GST_ERROR ("%s, gst_app_src_push_buffer failure.", stream->name);
+        }
+
+        if (stream->state != NULL) {
+                stream->state->current_timestamp = GST_BUFFER_PTS (buffer);
         }
-        stream->current_position = current_position;
+        gst_sample_unref (sample);
 }
 
 static GstPadProbeReturn encoder_appsink_event_probe (GstPad *pad, GstPadProbeInfo *info, gpointer data)
@@ -478,6 +1059,25 @@ static GstPadProbeReturn encoder_appsink_event_probe (GstPad *pad, GstPadProbeIn
         return GST_PAD_PROBE_OK;
 }
 
+/*
+ * offer ring allocator to upstream, so that muxer output lands in cache directly.
+ */
+static GstPadProbeReturn encoder_appsink_query_probe (GstPad *pad, GstPadProbeInfo *info, gpointer data)
+{
+        GstQuery *query = gst_pad_probe_info_get_query (info);
+        Encoder *encoder = data;
+        GstAllocationParams params;
+
+        if (GST_QUERY_TYPE (query) != GST_QUERY_ALLOCATION) {
+                return GST_PAD_PROBE_OK;
+        }
+
+        gst_allocation_params_init (&params);
+        gst_query_add_allocation_param (query, encoder->ring_allocator, &params);
+
+        return GST_PAD_PROBE_HANDLED;
+}
+
 static gint create_encoder_pipeline (Encoder *encoder)
 {
         GstElement *pipeline, *element;
@@ -540,9 +1140,17 @@ static gint create_encoder_pipeline (Encoder *encoder)
                         if (g_strcmp0 ("GstAppSink", g_type_name (type)) == 0) {
                                 GST_INFO ("Encoder appsink found.");
                                 gst_app_sink_set_callbacks (GST_APP_SINK (element), &encoder_appsink_callbacks, encoder, NULL);
+                                if (encoder->output->cache_fd != -1) {
+                                        encoder->alloc_addr = *(encoder->output->tail_addr);
+                                        encoder->ring_allocator = g_object_new (ring_allocator_get_type (), NULL);
+                                        ((RingAllocator *)encoder->ring_allocator)->encoder = encoder;
+                                }
                         }
                         pad = gst_element_get_static_pad (element, "sink");
                         gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, encoder_appsink_event_probe, encoder, NULL);
+                        if (encoder->ring_allocator != NULL) {
+                                gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, encoder_appsink_query_probe, encoder, NULL);
+                        }
                 }
                 links = bin->links;
                 while (links != NULL) {
@@ -570,40 +1178,51 @@ static gint create_encoder_pipeline (Encoder *encoder)
 
 static gint encoder_extract_streams (Encoder *encoder, gchar **bins)
 {
-        GRegex *regex;
-        GMatchInfo *match_info;
         EncoderStream *stream;
-        gchar *bin, **p;
+        GArray *tokens;
+        BinToken *token;
+        gchar *bin, *name, **p;
+        gint i;
 
         p = bins;
         while (*p != NULL) {
                 bin = *p;
-                regex = g_regex_new ("appsrc *name=(?<name>[^ ]*)", G_REGEX_OPTIMIZE, 0, NULL);
-                g_regex_match (regex, bin, 0, &match_info);
-                g_regex_unref (regex);
-                if (g_match_info_matches (match_info)) {
+                tokens = bin_tokenize (bin);
+                if (tokens == NULL) {
+                        return 1;
+                }
+                name = NULL;
+                for (i = 0; i < tokens->len; i++) {
+                        token = &g_array_index (tokens, BinToken, i);
+                        if ((token->pad == NULL) && (g_strcmp0 (token->factory, "appsrc") == 0)) {
+                                name = bin_token_property (token, "name");
+                                break;
+                        }
+                }
+                if (name != NULL) {
                         stream = (EncoderStream *)g_malloc (sizeof (EncoderStream));
-                        stream->name = g_match_info_fetch_named (match_info, "name");
-                        g_match_info_free (match_info);
+                        stream->name = g_strdup (name);
                         g_array_append_val (encoder->streams, stream);
                         GST_INFO ("encoder stream %s found %s", stream->name, bin);
 
                 } else if (g_str_has_prefix (bin, "appsrc")) {
                         GST_ERROR ("appsrc name property must be set");
+                        bin_tokens_free (tokens);
                         return 1;
                 }
+                bin_tokens_free (tokens);
                 p++;
         }
 
         return 0;
 }
 
-static void udpstreaming_parse (gchar *job, Encoder *encoder)
+static void udpstreaming_parse (JobSpec *spec, Encoder *encoder)
 {
         gchar *udpstreaming, **pp;
         GstElement *udpsink;
 
-        udpstreaming = jobdesc_udpstreaming (job, encoder->name);
+        udpstreaming = jobdesc_udpstreaming (spec, encoder->name);
         if (udpstreaming == NULL) {
                 encoder->udpstreaming = NULL;
                 encoder->appsrc = NULL;
@@ -658,7 +1277,7 @@ static void complete_request_element (GSList *bins)
         }
 }
 
-guint encoder_initialize (GArray *earray, gchar *job, EncoderOutput *encoders, Source *source)
+guint encoder_initialize (GArray *earray, JobSpec *spec, EncoderOutput *encoders, Source *source)
 {
         gint i, j, k;
         gchar *job_name, *pipeline;
@@ -668,20 +1287,21 @@ guint encoder_initialize (GArray *earray, gchar *job, EncoderOutput *encoders, S
         gchar **bins;
         gsize count;
 
-        job_name = jobdesc_get_name (job);
-        count = jobdesc_encoders_count (job);
+        job_name = jobdesc_get_name (spec);
+        count = jobdesc_encoders_count (spec);
         for (i = 0; i < count; i++) {
                 pipeline = g_strdup_printf ("encoder.%d", i);
                 encoder = encoder_new ("name", pipeline, NULL);
                 encoder->id = i;
                 encoder->last_running_time = GST_CLOCK_TIME_NONE;
                 encoder->output = &(encoders[i]);
-                encoder->segment_duration = jobdesc_m3u8streaming_segment_duration (job);
+                encoder->segment_duration = jobdesc_m3u8streaming_segment_duration (spec);
+                encoder->part_duration = jobdesc_m3u8streaming_part_duration (spec);
                 encoder->duration_accumulation = 0;
                 encoder->last_segment_duration = 0;
                 encoder->force_key_count = 0;
 
-                bins = jobdesc_bins (job, pipeline);
+                bins = jobdesc_bins (spec, pipeline);
                 if (encoder_extract_streams (encoder, bins) != 0) {
                         g_free (job_name);
                         g_free (pipeline);
@@ -715,7 +1335,7 @@ guint encoder_initialize (GArray *earray, gchar *job, EncoderOutput *encoders, S
                 }
 
                 /* parse bins and create pipeline. */
-                encoder->bins = bins_parse (job, pipeline);
+                encoder->bins = bins_parse (spec, pipeline);
                 if (encoder->bins == NULL) {
                         g_free (job_name);
                         g_free (pipeline);
@@ -729,10 +1349,10 @@ guint encoder_initialize (GArray *earray, gchar *job, EncoderOutput *encoders, S
                 }
 
                 /* parse udpstreaming */
-                udpstreaming_parse (job, encoder);
+                udpstreaming_parse (spec, encoder);
 
                 /* m3u8 playlist */
-                if (jobdesc_m3u8streaming (job)) {
+                if (jobdesc_m3u8streaming (spec)) {
                         gchar *mq_name;
 
                         mq_name = g_strdup_printf ("/%s.%d", job_name, i);
@@ -749,6 +1369,12 @@ guint encoder_initialize (GArray *earray, gchar *job, EncoderOutput *encoders, S
                         encoder->mqdes = -1;
                 }
 
+                /* time-shift archive */
+                if (encoder->output->archive != NULL) {
+                        encoder->archive_queue = g_async_queue_new ();
+                        encoder->archive_thread = g_thread_new ("archive", archive_thread, encoder);
+                }
+
                 g_free (pipeline);
                 g_array_append_val (earray, encoder);
         }
@@ -758,95 +1384,491 @@ guint encoder_initialize (GArray *earray, gchar *job, EncoderOutput *encoders, S
 }
 
 /*
- * encoder_output_rap_timestamp:
+ * encoder_output_read_begin:
  * @encoder_output: (in): the encoder output.
- * @rap_addr: (in): the rap addr to get its timestamp
  *
- * get the timestamp of random access point of encoder_output.
+ * begin reading of encoder output, spin while encoder writing, at most ENCODER_OUTPUT_READ_TIMEOUT.
+ * the worker died or stopped while writing if the same write not end in time, readers fail
+ * at once from now on until the seqlock changed.
  *
- * Returns: GstClockTime type timestamp.
+ * Returns: sequence to be validated by encoder_output_read_retry, odd if stalled, see
+ * encoder_output_read_stalled.
  *
  */
-GstClockTime encoder_output_rap_timestamp (EncoderOutput *encoder_output, guint64 rap_addr)
+guint32 encoder_output_read_begin (EncoderOutput *encoder_output)
 {
-        GstClockTime timestamp;
+        guint32 sequence;
+        gint64 deadline;
+
+        deadline = 0;
+        for (;;) {
+                sequence = __atomic_load_n (encoder_output->seqlock, __ATOMIC_ACQUIRE);
+                if ((sequence & 1) == 0) {
+                        return sequence;
+                }
+                if (sequence == __atomic_load_n (&(encoder_output->stalled), __ATOMIC_RELAXED)) {
+                        return sequence;
+                }
+                if (deadline == 0) {
+                        deadline = g_get_monotonic_time () + ENCODER_OUTPUT_READ_TIMEOUT / GST_USECOND;
 
-        if (rap_addr + 8 <= encoder_output->cache_size) {
-                memcpy (&timestamp, encoder_output->cache_addr + rap_addr, 8);
+                } else if (g_get_monotonic_time () >= deadline) {
+                        GST_ERROR ("%s stalled while writing output", encoder_output->name);
+                        __atomic_store_n (&(encoder_output->stalled), sequence, __ATOMIC_RELAXED);
+                        return sequence;
+                }
+                g_thread_yield ();
+        }
+}
 
-        } else {
-                gint n;
+/*
+ * encoder_output_read_stalled:
+ * @sequence: (in): sequence returned by encoder_output_read_begin.
+ *
+ * Returns: TRUE if encoder output is not readable, the worker stalled while writing.
+ *
+ */
+gboolean encoder_output_read_stalled (guint32 sequence)
+{
+        return (sequence & 1) != 0;
+}
 
-                n = encoder_output->cache_size - rap_addr;
-                memcpy (&timestamp, encoder_output->cache_addr + rap_addr, n);
-                memcpy (&timestamp + n, encoder_output->cache_addr, 8 - n);
+/*
+ * encoder_output_read_retry:
+ * @encoder_output: (in): the encoder output.
+ * @sequence: (in): sequence returned by encoder_output_read_begin.
+ *
+ * validate what read since encoder_output_read_begin.
+ *
+ * Returns: TRUE if encoder output changed while reading, should read again. FALSE if stalled,
+ * what read is invalid.
+ *
+ */
+gboolean encoder_output_read_retry (EncoderOutput *encoder_output, guint32 sequence)
+{
+        if (encoder_output_read_stalled (sequence)) {
+                return FALSE;
         }
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+        return __atomic_load_n (encoder_output->seqlock, __ATOMIC_RELAXED) != sequence;
+}
+
+/*
+ * encoder_output_gop_evicted:
+ * @encoder_output: (in): the encoder output.
+ * @gop_sequence: (in): sequence of the gop.
+ *
+ * check if the gop has been removed from cache, data read from the gop is invalid if so.
+ *
+ * Returns: TRUE if the gop has been removed.
+ *
+ */
+gboolean encoder_output_gop_evicted (EncoderOutput *encoder_output, guint64 gop_sequence)
+{
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
 
-        return timestamp;
+        return gop_sequence < __atomic_load_n (encoder_output->gop_index_head, __ATOMIC_RELAXED);
 }
 
 /*
- * encoder_output_rap_next:
+ * encoder_output_gop_index_entry:
  * @encoder_output: (in): the encoder output.
- * @rap_addr: (in): the rap addr
+ * @sequence: (in): sequence of the gop.
  *
- * get next random access address.
+ * get gop index entry of sequence.
  *
- * Returns: next random access address.
+ * Returns: the index entry.
  *
  */
-guint64 encoder_output_rap_next (EncoderOutput *encoder_output, guint64 rap_addr)
+GOPIndexEntry * encoder_output_gop_index_entry (EncoderOutput *encoder_output, guint64 sequence)
 {
-        gint gop_size;
-        guint64 next_rap_addr;
+        return &(encoder_output->gop_index[sequence % GOP_INDEX_SIZE]);
+}
 
-        /* gop size */
-        gop_size = encoder_output_gop_size (encoder_output, rap_addr);
+/*
+ * encoder_output_part_index_entry:
+ * @encoder_output: (in): the encoder output.
+ * @sequence: (in): sequence of the part.
+ *
+ * get part index entry of sequence.
+ *
+ * Returns: the index entry.
+ *
+ */
+PartIndexEntry * encoder_output_part_index_entry (EncoderOutput *encoder_output, guint64 sequence)
+{
+        return &(encoder_output->part_index[sequence % encoder_output->part_index_size]);
+}
 
-        /* next random access address */
-        next_rap_addr = rap_addr + gop_size;
-        if (next_rap_addr >= encoder_output->cache_size) {
-                next_rap_addr -= encoder_output->cache_size;
+/*
+ * encoder_output_part_evicted:
+ * @encoder_output: (in): the encoder output.
+ * @part_sequence: (in): sequence of the part.
+ *
+ * check if the part has been removed from part index or it's gop removed from cache.
+ *
+ * Returns: TRUE if the part has been removed.
+ *
+ */
+gboolean encoder_output_part_evicted (EncoderOutput *encoder_output, guint64 part_sequence)
+{
+        PartIndexEntry *entry;
+
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (part_sequence < __atomic_load_n (encoder_output->part_index_head, __ATOMIC_RELAXED)) {
+                return TRUE;
         }
+        entry = encoder_output_part_index_entry (encoder_output, part_sequence);
 
-        return next_rap_addr;
+        return encoder_output_gop_evicted (encoder_output, entry->gop);
 }
 
 /*
- * encoder_output_gop_size:
+ * encoder_output_part_seek:
  * @encoder_output: (in): the encoder output.
- * @rap_addr: (in): the rap addr
+ * @timestamp: (in): timestamp of the gop of the part.
+ * @number: (in): number of the part in the gop.
  *
- * get gop size.
+ * search part in part index from the newest, parts requested are the recent ones.
+ * should be called between encoder_output_read_begin and encoder_output_read_retry.
  *
- * Returns: size of gop.
+ * Returns: sequence of the part, -1 if not found.
  *
  */
-guint64 encoder_output_gop_size (EncoderOutput *encoder_output, guint64 rap_addr)
+gint64 encoder_output_part_seek (EncoderOutput *encoder_output, GstClockTime timestamp, guint64 number)
 {
-        gint gop_size;
-        guint64 gop_size_addr;
+        PartIndexEntry *entry;
+        gint64 gop;
+        guint64 sequence;
+
+        gop = encoder_output_gop_seek (encoder_output, timestamp);
+        if ((gop == -1) && (*(encoder_output->gop_index_tail) > 0) &&
+            (encoder_output_gop_index_entry (encoder_output, *(encoder_output->gop_index_tail) - 1)->timestamp == timestamp)) {
+                /* current output gop */
+                gop = *(encoder_output->gop_index_tail) - 1;
+        }
+        if (gop == -1) {
+                return -1;
+        }
+        for (sequence = *(encoder_output->part_index_tail); sequence > *(encoder_output->part_index_head); sequence--) {
+                entry = encoder_output_part_index_entry (encoder_output, sequence - 1);
+                if (entry->gop < gop) {
+                        break;
+                }
+                if ((entry->gop == gop) && (entry->number == number)) {
+                        return sequence - 1;
+                }
+        }
 
-        /* gop size address */
-        if (rap_addr + 8 < encoder_output->cache_size) {
-                gop_size_addr = rap_addr + 8;
+        return -1;
+}
 
-        } else {
-                gop_size_addr = rap_addr + 8 - encoder_output->cache_size;
+/*
+ * encoder_output_gop_seek:
+ * @encoder_output: (in): the encoder output.
+ * @timestamp: (in): timestamp of the gop.
+ *
+ * binary search completely output gop of timestamp in gop index.
+ *
+ * Returns: sequence of the gop, -1 if not found.
+ *
+ */
+gint64 encoder_output_gop_seek (EncoderOutput *encoder_output, GstClockTime timestamp)
+{
+        GOPIndexEntry *entry;
+        guint64 low, high, middle;
+
+        /* current output gop excluded, index may be empty, or torn if read while encoder writing. */
+        low = *(encoder_output->gop_index_head);
+        high = *(encoder_output->gop_index_tail);
+        if (low >= high) {
+                return -1;
         }
+        high--;
+        while (low < high) {
+                middle = low + (high - low) / 2;
+                entry = encoder_output_gop_index_entry (encoder_output, middle);
+                if (entry->timestamp == timestamp) {
+                        return middle;
 
-        /* gop size */
-        if (gop_size_addr + 4 < encoder_output->cache_size) {
-                memcpy (&gop_size, encoder_output->cache_addr + gop_size_addr, 4);
+                } else if (entry->timestamp < timestamp) {
+                        low = middle + 1;
 
-        } else {
-                gint n;
+                } else {
+                        high = middle;
+                }
+        }
+
+        return -1;
+}
+
+/*
+ * encoder_output_send:
+ * @encoder_output: (in): the encoder output.
+ * @sock: (in): socket send to.
+ * @addr: (in): start address in cache.
+ * @count: (in): bytes to be sent, should not cross the end of cache.
+ *
+ * send data in cache to sock once by sendfile, write from mapped cache if
+ * the cache file can't be sent by sendfile, e.g. on hugetlbfs.
+ *
+ * Returns: bytes sent, -1 on error.
+ *
+ */
+gssize encoder_output_send (EncoderOutput *encoder_output, gint sock, guint64 addr, gsize count)
+{
+        off_t offset;
+        gssize ret;
+
+        offset = addr;
+        ret = sendfile (sock, encoder_output->cache_fd, &offset, count);
+        if ((ret == -1) && ((errno == EINVAL) || (errno == ENOSYS))) {
+                ret = write (sock, encoder_output->cache_addr + addr, count);
+        }
+
+        return ret;
+}
+
+/*
+ * encoder_output_sendfile:
+ * @encoder_output: (in): the encoder output.
+ * @sock: (in): socket send to.
+ * @addr: (in): start address in cache.
+ * @count: (in): bytes to be sent.
+ *
+ * send data in cache to sock by sendfile, no copy in user space, wrap of cache is handled.
+ * never wait for non-blocking sock, caller resume the rest when sock writable.
+ *
+ * Returns: bytes sent, less than count if sock would block, -1 on error if nothing sent.
+ *
+ */
+gssize encoder_output_sendfile (EncoderOutput *encoder_output, gint sock, guint64 addr, gsize count)
+{
+        guint64 offset;
+        gsize sent, len;
+        gssize ret;
 
-                n = encoder_output->cache_size - gop_size_addr;
-                memcpy (&gop_size, encoder_output->cache_addr + gop_size_addr, n);
-                memcpy (&gop_size + n, encoder_output->cache_addr, 4 - n);
+        if (addr >= encoder_output->cache_size) {
+                addr -= encoder_output->cache_size;
+        }
+        sent = 0;
+        while (sent < count) {
+                /* to cache end first if wrapped */
+                offset = addr + sent;
+                if (offset >= encoder_output->cache_size) {
+                        offset -= encoder_output->cache_size;
+                }
+                len = encoder_output->cache_size - offset;
+                if (len > count - sent) {
+                        len = count - sent;
+                }
+                ret = encoder_output_send (encoder_output, sock, offset, len);
+                if (ret == -1) {
+                        if (errno != EAGAIN) {
+                                GST_INFO ("sendfile error: %s", g_strerror (errno));
+                                return sent > 0 ? sent : -1;
+                        }
+                        /* would block */
+                        break;
+
+                } else if (ret == 0) {
+                        break;
+                }
+                sent += ret;
         }
 
-        return gop_size;
+        return sent;
 }
 
+
+/*
+ * encoder_output_generation:
+ * @encoder_output: (in): the encoder output.
+ *
+ * get current generation of the encoder output, generation increase on every output.
+ *
+ * Returns: current generation.
+ *
+ */
+guint32 encoder_output_generation (EncoderOutput *encoder_output)
+{
+        return __atomic_load_n (encoder_output->generation, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * encoder_output_segment_extension:
+ * @encoder_output: (in): the encoder output.
+ *
+ * Returns: file extension of segments of the encoder output, m4s for cmaf, ts otherwise.
+ *
+ */
+const gchar * encoder_output_segment_extension (EncoderOutput *encoder_output)
+{
+        return encoder_output->cmaf ? "m4s" : "ts";
+}
+
+/*
+ * encoder_output_content_type:
+ * @encoder_output: (in): the encoder output.
+ *
+ * Returns: http content type of segments of the encoder output.
+ *
+ */
+const gchar * encoder_output_content_type (EncoderOutput *encoder_output)
+{
+        return encoder_output->cmaf ? "video/mp4" : "video/mpeg";
+}
+
+static gpointer waiter_thread (gpointer data)
+{
+        EncoderOutput *encoder_output = data;
+        EncoderOutputWaiter *waiter;
+        GSList *wakeup_list, *list, *next;
+        struct timespec timeout;
+        guint32 generation;
+
+        g_mutex_lock (&(encoder_output->waiter_mutex));
+        for (;;) {
+                while ((encoder_output->waiters == NULL) && !encoder_output->waiter_stop) {
+                        __atomic_store_n (encoder_output->waiting, 0, __ATOMIC_SEQ_CST);
+                        g_cond_wait (&(encoder_output->waiter_cond), &(encoder_output->waiter_mutex));
+                }
+                if (encoder_output->waiter_stop) {
+                        break;
+                }
+
+                /* set waiting before read generation, the encoder read waiting after increase generation. */
+                __atomic_store_n (encoder_output->waiting, 1, __ATOMIC_SEQ_CST);
+                generation = __atomic_load_n (encoder_output->generation, __ATOMIC_SEQ_CST);
+                wakeup_list = NULL;
+                for (list = encoder_output->waiters; list != NULL; list = next) {
+                        next = list->next;
+                        waiter = list->data;
+                        if (waiter->generation != generation) {
+                                encoder_output->waiters = g_slist_delete_link (encoder_output->waiters, list);
+                                wakeup_list = g_slist_prepend (wakeup_list, waiter);
+                        }
+                }
+                if (wakeup_list != NULL) {
+                        g_mutex_unlock (&(encoder_output->waiter_mutex));
+                        for (list = wakeup_list; list != NULL; list = list->next) {
+                                waiter = list->data;
+                                waiter->func (waiter->data, waiter->user_data);
+                                g_slice_free (EncoderOutputWaiter, waiter);
+                        }
+                        g_slist_free (wakeup_list);
+                        g_mutex_lock (&(encoder_output->waiter_mutex));
+                        continue;
+                }
+                g_mutex_unlock (&(encoder_output->waiter_mutex));
+
+                /* time out in case of the encoder is gone */
+                timeout.tv_sec = 1;
+                timeout.tv_nsec = 0;
+                syscall (SYS_futex, encoder_output->generation, FUTEX_WAIT, generation, &timeout, NULL, 0);
+                g_mutex_lock (&(encoder_output->waiter_mutex));
+        }
+        g_mutex_unlock (&(encoder_output->waiter_mutex));
+
+        return NULL;
+}
+
+/*
+ * encoder_output_wait:
+ * @encoder_output: (in): the encoder output.
+ * @generation: (in): generation read before the encoder output found no more data.
+ * @func: (in): called in the waiter thread when generation changed.
+ * @data: (in): data of func, identify the waiter.
+ * @user_data: (in): user data of func.
+ *
+ * wait for new output of the encoder output, func is called once.
+ *
+ * Returns: FALSE if generation has already changed, func will not be called.
+ *
+ */
+gboolean encoder_output_wait (EncoderOutput *encoder_output, guint32 generation, encoder_output_wakeup_t func, gpointer data, gpointer user_data)
+{
+        EncoderOutputWaiter *waiter;
+        GSList *list;
+
+        if (encoder_output_generation (encoder_output) != generation) {
+                return FALSE;
+        }
+
+        g_mutex_lock (&(encoder_output->waiter_mutex));
+        if (encoder_output->waiter_thread == NULL) {
+                encoder_output->waiter_thread = g_thread_new ("output_waiter", waiter_thread, encoder_output);
+        }
+        for (list = encoder_output->waiters; list != NULL; list = list->next) {
+                waiter = list->data;
+                if (waiter->data == data) {
+                        /* already waiting */
+                        waiter->generation = generation;
+                        g_mutex_unlock (&(encoder_output->waiter_mutex));
+                        return TRUE;
+                }
+        }
+        waiter = g_slice_new (EncoderOutputWaiter);
+        waiter->generation = generation;
+        waiter->func = func;
+        waiter->data = data;
+        waiter->user_data = user_data;
+        encoder_output->waiters = g_slist_prepend (encoder_output->waiters, waiter);
+        g_cond_signal (&(encoder_output->waiter_cond));
+        g_mutex_unlock (&(encoder_output->waiter_mutex));
+
+        return TRUE;
+}
+
+/*
+ * encoder_output_wait_cancel:
+ * @encoder_output: (in): the encoder output.
+ * @data: (in): identify the waiter.
+ *
+ * cancel waiting of data.
+ *
+ */
+void encoder_output_wait_cancel (EncoderOutput *encoder_output, gpointer data)
+{
+        EncoderOutputWaiter *waiter;
+        GSList *list;
+
+        g_mutex_lock (&(encoder_output->waiter_mutex));
+        for (list = encoder_output->waiters; list != NULL; list = list->next) {
+                waiter = list->data;
+                if (waiter->data == data) {
+                        encoder_output->waiters = g_slist_delete_link (encoder_output->waiters, list);
+                        g_slice_free (EncoderOutputWaiter, waiter);
+                        break;
+                }
+        }
+        g_mutex_unlock (&(encoder_output->waiter_mutex));
+}
+
+/*
+ * encoder_output_waiter_stop:
+ * @encoder_output: (in): the encoder output.
+ *
+ * stop the waiter thread and release waiters.
+ *
+ */
+void encoder_output_waiter_stop (EncoderOutput *encoder_output)
+{
+        GSList *list;
+
+        g_mutex_lock (&(encoder_output->waiter_mutex));
+        encoder_output->waiter_stop = TRUE;
+        g_cond_signal (&(encoder_output->waiter_cond));
+        g_mutex_unlock (&(encoder_output->waiter_mutex));
+        if (encoder_output->waiter_thread != NULL) {
+                syscall (SYS_futex, encoder_output->generation, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+                g_thread_join (encoder_output->waiter_thread);
+                encoder_output->waiter_thread = NULL;
+        }
+        for (list = encoder_output->waiters; list != NULL; list = list->next) {
+                g_slice_free (EncoderOutputWaiter, list->data);
+        }
+        g_slist_free (encoder_output->waiters);
+        encoder_output->waiters = NULL;
+}
@@ -7,9 +7,10 @@
 #ifndef __ENCODER_H__
 #define __ENCODER_H__
 
-#include <semaphore.h>
 #include <mqueue.h>
 
+#include "archive.h"
+
 typedef struct _Encoder Encoder;
 typedef struct _EncoderClass EncoderClass;
 
@@ -19,9 +20,59 @@ typedef struct _EncoderStreamState {
         GstClockTime last_heartbeat;
 } EncoderStreamState;
 
+#define GOP_INDEX_SIZE 4096
+
+/* max size of the init segment of cmaf output, ftyp and moov */
+#define INIT_SEGMENT_SIZE 65536
+
+/* max wait for encoder writing output, worker died or stopped while writing if exceeded */
+#define ENCODER_OUTPUT_READ_TIMEOUT (100 * GST_MSECOND)
+
+/* gop follows a discontinuity, first gop of a warm restarted worker */
+#define GOP_FLAG_DISCONTINUITY 1
+
+/*
+ * gop index entry, index is a ring of GOP_INDEX_SIZE entries in share memory,
+ * entry of sequence n is at n % GOP_INDEX_SIZE.
+ */
+typedef struct _GOPIndexEntry {
+        GstClockTime timestamp; /* timestamp of the random access point */
+        guint64 offset; /* random access point address in cache */
+        guint64 size; /* gop size, 0 if current output gop */
+        GstClockTime duration;
+        guint64 flags;
+} GOPIndexEntry;
+
+#define PART_INDEX_SIZE 4096
+
+/* part begins with a random access point */
+#define PART_FLAG_INDEPENDENT 1
+
+/*
+ * part index entry of low latency hls, index is a ring of PART_INDEX_SIZE entries in share memory,
+ * entry of sequence n is at n % PART_INDEX_SIZE. jobs without part-duration reserve just one entry. parts of a gop are numbered from 0.
+ */
+typedef struct _PartIndexEntry {
+        GstClockTime timestamp; /* timestamp of the first output of the part */
+        guint64 offset; /* part address in cache */
+        guint64 size; /* part size, 0 if current output part */
+        GstClockTime duration;
+        guint64 gop; /* sequence of the gop the part belongs to */
+        guint64 number; /* number of the part in the gop */
+        guint64 flags;
+} PartIndexEntry;
+
+typedef void (*encoder_output_wakeup_t) (gpointer data, gpointer user_data);
+
+typedef struct _EncoderOutputWaiter {
+        guint32 generation; /* generation seen by the waiter */
+        encoder_output_wakeup_t func;
+        gpointer data;
+        gpointer user_data;
+} EncoderOutputWaiter;
+
 typedef struct _EncoderOutput {
         gchar name[STREAM_NAME_LEN];
-        sem_t *semaphore; /* access of encoder output should be exclusive */
         GstClockTime *heartbeat;
         gboolean *eos;
         gint cache_fd;
@@ -31,17 +82,54 @@ typedef struct _EncoderOutput {
         guint64 *head_addr;
         guint64 *tail_addr;
         guint64 *last_rap_addr; /* last random access point address */
+        guint64 *gop_index_head; /* sequence of the oldest gop in index */
+        guint64 *gop_index_tail; /* sequence of next gop, tail - 1 is the current output gop */
+        GOPIndexEntry *gop_index;
+        guint32 *generation; /* increased on every output, futex word */
+        guint32 *waiting; /* not zero if someone waiting on generation */
+        guint32 *seqlock; /* odd while encoder writing output, readers retry if changed */
+        guint32 stalled; /* odd seqlock found stalled by reader, later readers fail at once */
+        GstClockTime *end_timestamp; /* timestamp of the last output, kept across warm restart */
+        gboolean discontinuity; /* worker warm restarted, output is appended after a discontinuity */
         gint64 stream_count;
         EncoderStreamState *streams;
 
+        /* cmaf, cache holds fragments and the init segment is kept aside */
+        gboolean cmaf; /* fragmented mp4 output, mpeg2 ts if FALSE */
+        guint64 *init_size; /* 0 if no init segment yet */
+        gchar *init_segment;
+
         /* m3u8 streaming */
         GMutex m3u8_playlist_mutex;
         GThreadPool *m3u8push_thread_pool;
         mqd_t mqdes;
         guint64 sequence_number;
-        guint64 pushed_sequence_number;
+        guint64 pushed_sequence_number; /* last segment pushed successfully */
+        guint64 done_sequence_number; /* last segment push done, succeeded or not, pushes are done in order */
         M3U8Playlist *m3u8_playlist;
         GstClockTime last_timestamp; /* last segment timestamp */
+
+        /* low latency hls */
+        GstClockTime part_duration; /* part target duration, 0 if no low latency hls */
+        guint64 *part_index_head; /* sequence of the oldest part in index */
+        guint64 *part_index_tail; /* sequence of next part, tail - 1 is the current output part */
+        PartIndexEntry *part_index;
+        guint64 part_index_size; /* PART_INDEX_SIZE entries if low latency hls, otherwise just one */
+        GBytes *ll_playlist; /* rendered low latency playlist response */
+        guint64 ll_playlist_part; /* part index tail of the rendered playlist */
+        GstClockTime segment_duration; /* configured, target duration before the first segment completed */
+        guint64 ll_discontinuity_sequence; /* discontinuities slid out of the low latency playlist */
+        guint64 ll_discontinuity_gop; /* gops before it are counted in ll_discontinuity_sequence */
+
+        /* time-shift archive, NULL if not configured */
+        Archive *archive;
+
+        /* waiting for new output */
+        GMutex waiter_mutex;
+        GCond waiter_cond;
+        GSList *waiters;
+        GThread *waiter_thread;
+        gboolean waiter_stop;
 } EncoderOutput;
 
 typedef struct _EncoderStream {
@@ -80,6 +168,29 @@ struct _Encoder {
         mqd_t mqdes;
         GstClockTime last_segment_duration;
         GstClockTime last_running_time;
+
+        /* low latency hls, part target duration, 0 if none */
+        GstClockTime part_duration;
+
+        /* cmaf, header buffers of muxer are being written to init segment */
+        gboolean init_writing;
+        /* cmaf, gop and part are cut at moof, decided by the first sample of the fragment */
+        gboolean fragment_begin; /* moof output, first sample of the fragment not yet */
+        guint64 fragment_addr; /* cache address of the moof of current fragment */
+
+        /* warm restart, output timestamp continue from the crashed worker */
+        GstClockTime timestamp_offset;
+
+        /* ring allocator, muxer output lands in cache directly */
+        GstAllocator *ring_allocator;
+        GMutex ring_mutex; /* serialize allocation and commit */
+        guint64 alloc_addr; /* end of cache reserved by ring allocator */
+        GQueue ring_blocks; /* ring memory not committed, in allocation order */
+        GQueue ring_pending; /* buffers deferred until ring memory allocated before committed or dropped */
+
+        /* time-shift archive */
+        GAsyncQueue *archive_queue; /* sequence + 1 of completed gops */
+        GThread *archive_thread;
 };
 
 struct _EncoderClass {
@@ -96,9 +207,23 @@ struct _EncoderClass {
 
 GType encoder_get_type (void);
 
-guint encoder_initialize (GArray *earray, gchar *job, EncoderOutput *encoders, Source *source);
-GstClockTime encoder_output_rap_timestamp (EncoderOutput *encoder_output, guint64 rap_addr);
-guint64 encoder_output_rap_next (EncoderOutput *encoder_output, guint64 rap_addr);
-guint64 encoder_output_gop_size (EncoderOutput *encoder_output, guint64 rap_addr);
+guint encoder_initialize (GArray *earray, JobSpec *spec, EncoderOutput *encoders, Source *source);
+guint32 encoder_output_read_begin (EncoderOutput *encoder_output);
+gboolean encoder_output_read_retry (EncoderOutput *encoder_output, guint32 sequence);
+gboolean encoder_output_read_stalled (guint32 sequence);
+gboolean encoder_output_gop_evicted (EncoderOutput *encoder_output, guint64 gop_sequence);
+gint64 encoder_output_gop_seek (EncoderOutput *encoder_output, GstClockTime timestamp);
+GOPIndexEntry * encoder_output_gop_index_entry (EncoderOutput *encoder_output, guint64 sequence);
+PartIndexEntry * encoder_output_part_index_entry (EncoderOutput *encoder_output, guint64 sequence);
+gboolean encoder_output_part_evicted (EncoderOutput *encoder_output, guint64 part_sequence);
+gint64 encoder_output_part_seek (EncoderOutput *encoder_output, GstClockTime timestamp, guint64 number);
+gssize encoder_output_send (EncoderOutput *encoder_output, gint sock, guint64 addr, gsize count);
+gssize encoder_output_sendfile (EncoderOutput *encoder_output, gint sock, guint64 addr, gsize count);
+guint32 encoder_output_generation (EncoderOutput *encoder_output);
+const gchar * encoder_output_segment_extension (EncoderOutput *encoder_output);
+const gchar * encoder_output_content_type (EncoderOutput *encoder_output);
+gboolean encoder_output_wait (EncoderOutput *encoder_output, guint32 generation, encoder_output_wakeup_t func, gpointer data, gpointer user_data);
+void encoder_output_wait_cancel (EncoderOutput *encoder_output, gpointer data);
+void encoder_output_waiter_stop (EncoderOutput *encoder_output);
 
 #endif /* __ENCODER_H__ */
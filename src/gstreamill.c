@@ -10,6 +10,7 @@
 #include <glob.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 
@@ -17,6 +18,11 @@
 #include "parson.h"
 #include "jobdesc.h"
 #include "m3u8playlist.h"
+#include "zygote.h"
+#include "supervisor.h"
+#include "placement.h"
+#include "admission.h"
+#include "dash.h"
 
 GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
 #define GST_CAT_DEFAULT GSTREAMILL
@@ -25,6 +31,8 @@ enum {
         GSTREAMILL_PROP_0,
         GSTREAMILL_PROP_LOGDIR,
         GSTREAMILL_PROP_DAEMON,
+        GSTREAMILL_PROP_PLACEMENT,
+        GSTREAMILL_PROP_CAPACITY,
 };
 
 static GObject *gstreamill_constructor (GType type, guint n_construct_properties, GObjectConstructParam *construct_properties);
@@ -54,6 +62,26 @@ static void gstreamill_class_init (GstreamillClass *gstreamillclass)
         );
         g_object_class_install_property (g_object_class, GSTREAMILL_PROP_DAEMON, param);
 
+        param = g_param_spec_boolean (
+                "placement",
+                "placement",
+                "place job workers on cpus and numa nodes",
+                FALSE,
+                G_PARAM_WRITABLE | G_PARAM_READABLE
+        );
+        g_object_class_install_property (g_object_class, GSTREAMILL_PROP_PLACEMENT, param);
+
+        param = g_param_spec_int (
+                "capacity",
+                "capacity",
+                "percentage of cpus for jobs, 0 is no admission control",
+                0,
+                G_MAXINT,
+                0,
+                G_PARAM_WRITABLE | G_PARAM_READABLE
+        );
+        g_object_class_install_property (g_object_class, GSTREAMILL_PROP_CAPACITY, param);
+
         param = g_param_spec_string (
                 "log_dir",
                 "log_dir",
@@ -76,6 +104,7 @@ static void gstreamill_init (Gstreamill *gstreamill)
         gst_date_time_unref (start_time);
         g_mutex_init (&(gstreamill->job_list_mutex));
         gstreamill->job_list = NULL;
+        gstreamill->job_table = g_hash_table_new (g_str_hash, g_str_equal);
 }
 
 static GObject * gstreamill_constructor (GType type, guint n_construct_properties, GObjectConstructParam *construct_properties)
@@ -97,6 +126,14 @@ static void gstreamill_set_property (GObject *obj, guint prop_id, const GValue *
                 GSTREAMILL (obj)->daemon = g_value_get_boolean (value);
                 break;
 
+        case GSTREAMILL_PROP_PLACEMENT:
+                GSTREAMILL (obj)->placement = g_value_get_boolean (value);
+                break;
+
+        case GSTREAMILL_PROP_CAPACITY:
+                GSTREAMILL (obj)->capacity = g_value_get_int (value);
+                break;
+
         case GSTREAMILL_PROP_LOGDIR:
                 GSTREAMILL (obj)->log_dir = (gchar *)g_value_dup_string (value);
                 break;
@@ -116,6 +153,14 @@ static void gstreamill_get_property (GObject *obj, guint prop_id, GValue *value,
                 g_value_set_boolean (value, gstreamill->daemon);
                 break;
 
+        case GSTREAMILL_PROP_PLACEMENT:
+                g_value_set_boolean (value, gstreamill->placement);
+                break;
+
+        case GSTREAMILL_PROP_CAPACITY:
+                g_value_set_int (value, gstreamill->capacity);
+                break;
+
         case GSTREAMILL_PROP_LOGDIR:
                 g_value_set_string (value, gstreamill->log_dir);
                 break;
@@ -144,6 +189,7 @@ static void gstreamill_finalize (GObject *obj)
         Gstreamill *gstreamill = GSTREAMILL (obj);
         GObjectClass *parent_class = g_type_class_peek (G_TYPE_OBJECT);
         g_slist_free (gstreamill->job_list);
+        g_hash_table_unref (gstreamill->job_table);
         G_OBJECT_CLASS (parent_class)->finalize (obj);
 }
 
@@ -225,11 +271,12 @@ log_rotate (Gstreamill *gstreamill)
 
 static void clean_job_list (Gstreamill *gstreamill)
 {
-        gboolean done;
+        gboolean done, removed;
         GSList *list;
         Job *job;
 
         done = FALSE;
+        removed = FALSE;
         while (!done) {
                 list = gstreamill->job_list;
                 while (list != NULL) {
@@ -238,8 +285,11 @@ static void clean_job_list (Gstreamill *gstreamill)
                         /* clean live job */
                         if (job->is_live && (*(job->output->state) == GST_STATE_NULL && job->current_access == 0)) {
                                 GST_WARNING ("Remove live job: %s.", job->name);
+                                supervisor_remove_job (job);
                                 gstreamill->job_list = g_slist_remove (gstreamill->job_list, job);
+                                g_hash_table_remove (gstreamill->job_table, job->name);
                                 g_object_unref (job);
+                                removed = TRUE;
                                 break;
                         }
 
@@ -247,7 +297,9 @@ static void clean_job_list (Gstreamill *gstreamill)
                         if (!job->is_live && job->eos) {
                                 GST_WARNING ("Remove non-live job: %s.", job->name);
                                 gstreamill->job_list = g_slist_remove (gstreamill->job_list, job);
+                                g_hash_table_remove (gstreamill->job_table, job->name);
                                 g_object_unref (job);
+                                removed = TRUE;
                                 break;
                         }
 
@@ -258,6 +310,11 @@ static void clean_job_list (Gstreamill *gstreamill)
                         done = TRUE;
                 }
         }
+
+        /* cpus of removed jobs are free */
+        if (removed) {
+                placement_rebalance (gstreamill->job_list);
+        }
 }
 
 static gint stop_job (Job *job, gint sig)
@@ -310,7 +367,7 @@ static void source_check (Gstreamill *gstreamill, Job *job)
 
                 now = gst_clock_get_time (gstreamill->system_clock);
                 time_diff = GST_CLOCK_DIFF (job->output->source.streams[i].last_heartbeat, now);
-                if ((time_diff > HEARTBEAT_THRESHHOLD) && gstreamill->daemon) {
+                if ((time_diff > HEARTBEAT_THRESHHOLD) && gstreamill->daemon && !supervisor_is_running ()) {
                         GST_ERROR ("%s.source.%s heart beat error %lu, restart job.",
                                         job->name,
                                         job->output->source.streams[i].name,
@@ -360,7 +417,7 @@ static void encoders_check (Gstreamill *gstreamill, Job *job)
 
                         now = gst_clock_get_time (gstreamill->system_clock);
                         time_diff = GST_CLOCK_DIFF (job->output->encoders[j].streams[k].last_heartbeat, now);
-                        if ((time_diff > HEARTBEAT_THRESHHOLD) && gstreamill->daemon) {
+                        if ((time_diff > HEARTBEAT_THRESHHOLD) && gstreamill->daemon && !supervisor_is_running ()) {
                                 GST_ERROR ("%s.encoders.%s.%s heartbeat error %lu, restart",
                                                 job->name,
                                                 job->output->encoders[j].name,
@@ -384,7 +441,7 @@ static void encoders_check (Gstreamill *gstreamill, Job *job)
         for (j = 0; j < job->output->encoder_count; j++) {
                 now = gst_clock_get_time (gstreamill->system_clock);
                 time_diff = GST_CLOCK_DIFF (*(job->output->encoders[j].heartbeat), now);
-                if ((time_diff > ENCODER_OUTPUT_HEARTBEAT_THRESHHOLD) && gstreamill->daemon) {
+                if ((time_diff > ENCODER_OUTPUT_HEARTBEAT_THRESHHOLD) && gstreamill->daemon && !supervisor_is_running ()) {
                         GST_ERROR ("%s.encoders.%s job->output heart beat error %lu, restart",
                                         job->name,
                                         job->output->encoders[j].name,
@@ -458,6 +515,7 @@ static void job_check_func (gpointer data, gpointer user_data)
                                 job->cpu_average,
                                 job->cpu_current,
                                 job->memory);
+                admission_learn (job);
         }
 
         if (*(job->output->state) != GST_STATE_PLAYING) {
@@ -487,7 +545,7 @@ static void job_check_func (gpointer data, gpointer user_data)
                                 gchar *location, *property, *playlist1, *playlist2;
 
                                 property = g_strdup_printf ("encoder.%d.elements.hlssink.property.playlist-location", i);
-                                location = jobdesc_element_property_value (job->description, property);
+                                location = jobdesc_element_property_value (job->spec, property);
                                 g_file_get_contents (location, &playlist1, NULL, NULL);
                                 playlist2 = g_strdup_printf ("%s#EXT-X-ENDLIST\n",  playlist1);
                                 g_file_set_contents (location, playlist2, strlen(playlist2), NULL);
@@ -565,6 +623,21 @@ gint gstreamill_start (Gstreamill *gstreamill)
         GstClockTime t;
         GstClockReturn ret;
 
+        /* worker exit and heartbeat supervisor, monitor checks heartbeat if failure */
+        if (gstreamill->daemon && (supervisor_start () != 0)) {
+                GST_WARNING ("Start supervisor failure, heartbeat checked by monitor");
+        }
+
+        /* cpu and numa placement of job workers */
+        if (gstreamill->daemon && gstreamill->placement && (placement_start () != 0)) {
+                GST_WARNING ("Start placement failure, workers are not placed");
+        }
+
+        /* admission control by cpu capacity */
+        if (gstreamill->daemon && (admission_start (gstreamill->capacity) != 0)) {
+                GST_WARNING ("Start admission control failure, jobs are not checked");
+        }
+
         /* regist gstreamill monitor */
         t = gst_clock_get_time (gstreamill->system_clock)  + 5000 * GST_MSECOND;
         id = gst_clock_new_single_shot_id (gstreamill->system_clock, t); 
@@ -621,9 +694,13 @@ static void child_watch_cb (GPid pid, gint status, Job *job)
 {
         /* Close pid */
         g_spawn_close_pid (pid);
-        job->age += 1;
         job->worker_pid = 0;
 
+        /* clients of previous worker are disconnected, except warm restart. */
+        if (!WIFSIGNALED (status) || (*(job->output->state) == GST_STATE_PAUSED) || !job_warm_restart (job)) {
+                job->age += 1;
+        }
+
         if (WIFEXITED (status) && (WEXITSTATUS (status) == 0)) {
                 GST_ERROR ("Job with pid %d normaly exit, status is %d", pid, WEXITSTATUS (status));
                 *(job->output->state) = GST_STATE_NULL;
@@ -645,7 +722,7 @@ static void child_watch_cb (GPid pid, gint status, Job *job)
                         return;
                 }
 
-                GST_ERROR ("Job with pid %d exit on an unhandled signal, restart.", pid);
+                GST_ERROR ("Job with pid %d exit on an unhandled signal, %s restart.", pid, *(job->output->warm_restart) ? "warm" : "cold");
                 job_reset (job);
                 ret = create_job_process (job);
                 if (g_str_has_suffix (ret, "failure")) {
@@ -659,6 +736,16 @@ static void child_watch_cb (GPid pid, gint status, Job *job)
         return;
 }
 
+/*
+ * watch worker exit, by pidfd in supervisor if possible.
+ */
+static void watch_job_process (Job *job, GPid pid)
+{
+        if (!supervisor_watch_child (pid, (GChildWatchFunc)child_watch_cb, job)) {
+                g_child_watch_add (pid, (GChildWatchFunc)child_watch_cb, job);
+        }
+}
+
 static gchar * create_job_process (Job *job)
 {
         GError *error = NULL;
@@ -666,6 +753,17 @@ static gchar * create_job_process (Job *job)
         GPid pid;
         gint i, j;
 
+        /* fork from zygote, fast path */
+        p = jobdesc_get_debug (job->spec);
+        pid = zygote_fork_worker (job->name, strlen (job->description), p);
+        g_free (p);
+        if (pid > 0) {
+                job->worker_pid = pid;
+                watch_job_process (job, pid);
+                supervisor_rearm_job (job);
+                return g_strdup ("create live job process success");
+        }
+
         memset (path, '\0', sizeof (path));
         if (readlink ("/proc/self/exe", path, sizeof (path)) == -1) {
                 GST_ERROR ("Read /proc/self/exe error.");
@@ -679,7 +777,7 @@ static gchar * create_job_process (Job *job)
         argv[i++] = g_strdup_printf ("%s", job->name);
         argv[i++] = g_strdup ("-q");
         argv[i++] = g_strdup_printf ("%ld", strlen (job->description));
-        p = jobdesc_get_debug (job->description);
+        p = jobdesc_get_debug (job->spec);
         if (p != NULL) {
                 argv[i++] = g_strdup_printf ("--gst-debug=%s", p);
                 g_free (p);
@@ -702,7 +800,8 @@ static gchar * create_job_process (Job *job)
                 }
         }
         job->worker_pid = pid;
-        g_child_watch_add (pid, (GChildWatchFunc)child_watch_cb, job);
+        watch_job_process (job, pid);
+        supervisor_rearm_job (job);
 
         return g_strdup ("create live job process success");
 }
@@ -710,25 +809,9 @@ static gchar * create_job_process (Job *job)
 static Job * get_job (Gstreamill *gstreamill, gchar *name)
 {
         Job *job;
-        GSList *list;
 
         g_mutex_lock (&(gstreamill->job_list_mutex));
-        list = gstreamill->job_list;
-        if (list == NULL) {
-                g_mutex_unlock (&(gstreamill->job_list_mutex));
-                return NULL;
-        }
-
-        while (list != NULL) {
-                job = list->data;
-                if (g_strcmp0 (job->name, name) == 0) {
-                        break;
-
-                } else {
-                        job = NULL;
-                }
-                list = list->next;
-        }
+        job = g_hash_table_lookup (gstreamill->job_table, name);
         g_mutex_unlock (&(gstreamill->job_list_mutex));
 
         return job;
@@ -742,15 +825,18 @@ static Job * get_job (Gstreamill *gstreamill, gchar *name)
  */
 gchar * gstreamill_job_start (Gstreamill *gstreamill, gchar *job_desc)
 {
-        gchar *p, *name;
+        gchar *p;
+        gdouble cost;
+        JobSpec *spec;
         Job *job;
 
-        if (!jobdesc_is_valid (job_desc)) {
+        spec = jobspec_new (job_desc);
+        if (spec == NULL) {
                 p = g_strdup ("Invalid job");
                 return p;
         }
 
-        if (jobdesc_is_live (job_desc)) {
+        if (jobdesc_is_live (spec)) {
                 GST_ERROR ("live job arrived");
 
         } else {
@@ -758,26 +844,44 @@ gchar * gstreamill_job_start (Gstreamill *gstreamill, gchar *job_desc)
         }
 
         /* create job object */
-        name = jobdesc_get_name (job_desc);
-        if (get_job (gstreamill, name) != NULL) {
-                GST_ERROR ("start live job failure, duplicated name %s.", name);
-                p = g_strdup_printf ("start live job failure, duplicated name %s.", name);
-                g_free (name);
+        if (get_job (gstreamill, spec->name) != NULL) {
+                GST_ERROR ("start live job failure, duplicated name %s.", spec->name);
+                p = g_strdup_printf ("start live job failure, duplicated name %s.", spec->name);
+                jobspec_free (spec);
                 return p;
         }
-        job = job_new ("job", job_desc, "name", name, NULL);
-        g_free (name);
+
+        /* admission control, cost is reserved until the job is added to job list or failed */
+        g_mutex_lock (&(gstreamill->job_list_mutex));
+        p = admission_check (spec, gstreamill->job_list, &cost);
+        g_mutex_unlock (&(gstreamill->job_list_mutex));
+        if (p != NULL) {
+                GST_ERROR ("%s", p);
+                jobspec_free (spec);
+                return p;
+        }
+
+        job = job_new ("job", job_desc, "name", spec->name, NULL);
+        job->spec = spec;
+        job->cost = cost;
+        if (gstreamill->daemon) {
+                /* output left by previous gstreamill if it crashed, start from scratch. */
+                shm_unlink (job->name);
+        }
 
         /* job initialize */
         job->log_dir = gstreamill->log_dir;
         g_mutex_init (&(job->access_mutex));
-        job->is_live = jobdesc_is_live (job_desc);
+        job->is_live = jobdesc_is_live (spec);
         job->eos = FALSE;
         job->current_access = 0;
         job->age = 0;
         job->last_start_time = NULL;
         if (job_initialize (job, gstreamill->daemon) != 0) {
                 p = g_strdup ("initialize job failure");
+                g_mutex_lock (&(gstreamill->job_list_mutex));
+                admission_release (cost);
+                g_mutex_unlock (&(gstreamill->job_list_mutex));
                 g_object_unref (job);
                 return p;
         }
@@ -785,14 +889,25 @@ gchar * gstreamill_job_start (Gstreamill *gstreamill, gchar *job_desc)
         /* reset and start job */
         job_reset (job);
         if (gstreamill->daemon) {
+                g_mutex_lock (&(gstreamill->job_list_mutex));
+                placement_assign (job, gstreamill->job_list);
+                g_mutex_unlock (&(gstreamill->job_list_mutex));
                 p = create_job_process (job);
                 GST_ERROR ("%s: %s", p, job->name);
                 if (g_str_has_suffix (p, "success")) {
                         g_mutex_lock (&(gstreamill->job_list_mutex));
                         gstreamill->job_list = g_slist_append (gstreamill->job_list, job);
+                        g_hash_table_insert (gstreamill->job_table, job->name, job);
+                        admission_release (cost);
                         g_mutex_unlock (&(gstreamill->job_list_mutex));
+                        if (job->is_live) {
+                                supervisor_add_job (job);
+                        }
 
                 } else {
+                        g_mutex_lock (&(gstreamill->job_list_mutex));
+                        admission_release (cost);
+                        g_mutex_unlock (&(gstreamill->job_list_mutex));
                         g_object_unref (job);
                 }
 
@@ -800,10 +915,15 @@ gchar * gstreamill_job_start (Gstreamill *gstreamill, gchar *job_desc)
                 if (job_start (job) == 0) {
                         g_mutex_lock (&(gstreamill->job_list_mutex));
                         gstreamill->job_list = g_slist_append (gstreamill->job_list, job);
+                        g_hash_table_insert (gstreamill->job_table, job->name, job);
+                        admission_release (cost);
                         g_mutex_unlock (&(gstreamill->job_list_mutex));
                         p = g_strdup ("success");
 
                 } else {
+                        g_mutex_lock (&(gstreamill->job_list_mutex));
+                        admission_release (cost);
+                        g_mutex_unlock (&(gstreamill->job_list_mutex));
                         p = g_strdup ("failure");
                 }
         }
@@ -833,36 +953,15 @@ gchar * gstreamill_job_stop (Gstreamill *gstreamill, gchar *name)
 
 /**
  * gstreamill_get_job:
- * @uri: (in): access uri, e.g. /live/test/encoder/0
+ * @name: (in): job name, e.g. test of /live/test/encoder/0
  *
- * Get the Job by access uri.
+ * Get the Job by name.
  *
  * Returns: job
  */
-Job *gstreamill_get_job (Gstreamill *gstreamill, gchar *uri)
+Job *gstreamill_get_job (Gstreamill *gstreamill, gchar *name)
 {
-        Job *job = NULL;
-        GRegex *regex;
-        GMatchInfo *match_info;
-        gchar *name = NULL;
-
-        regex = g_regex_new ("^/live/(?<name>[^/]*)/.*", G_REGEX_OPTIMIZE, 0, NULL);
-        match_info = NULL;
-        g_regex_match (regex, uri, 0, &match_info);
-        g_regex_unref (regex);
-        if (g_match_info_matches (match_info)) {
-                name = g_match_info_fetch_named (match_info, "name");
-        }
-
-        if (name != NULL) {
-                job = get_job (gstreamill, name);
-                g_free (name);
-        }
-        if (match_info != NULL) {
-                g_match_info_free (match_info);
-        }
-
-        return job;
+        return get_job (gstreamill, name);
 }
 
 gint gstreamill_job_number (Gstreamill *gstreamill)
@@ -878,123 +977,132 @@ gint gstreamill_job_number (Gstreamill *gstreamill)
 
 /**
  * gstreamill_get_encoder_output:
- * @uri: (in): access uri, e.g. /live/test/encoder/0
+ * @route: (in): route of access uri, e.g. /live/test/encoder/0
  *
- * Get the EncoderOutput by access uri.
+ * Get the EncoderOutput by route of access uri.
  *
  * Returns: the encoder output
  */
-EncoderOutput * gstreamill_get_encoder_output (Gstreamill *gstreamill, gchar *uri)
+EncoderOutput * gstreamill_get_encoder_output (Gstreamill *gstreamill, Route *route)
 {
         Job *job;
-        gint index;
-        GRegex *regex = NULL;
-        GMatchInfo *match_info = NULL;
-        gchar *e;
 
-        index = -1;
-        regex = g_regex_new ("^/live/.*/encoder/(?<encoder>[0-9]+).*", G_REGEX_OPTIMIZE, 0, NULL);
-        g_regex_match (regex, uri, 0, &match_info);
-        if (g_match_info_matches (match_info)) {
-                e = g_match_info_fetch_named (match_info, "encoder");
-                index = g_ascii_strtoll (e, NULL, 10);
-                g_free (e);
-        }
-        if (match_info != NULL) {
-                g_match_info_free (match_info);
-        }
-        if (regex != NULL) {
-                g_regex_unref (regex);
-        }
-        if (index == -1) {
-                GST_INFO ("Not a encoder uri: %s", uri);
+        if (route->encoder == -1) {
+                GST_INFO ("Not a encoder route, job %s", route->job);
                 return NULL;
         }
-        job = gstreamill_get_job (gstreamill, uri);
+        job = get_job (gstreamill, route->job);
         if (job == NULL) {
-                GST_ERROR ("Job %s not found.", uri);
+                GST_ERROR ("Job %s not found.", route->job);
                 return NULL;
         }
-        if (index >= job->output->encoder_count) {
-                GST_ERROR ("Encoder %s not found.", uri);
+        if (route->encoder >= job->output->encoder_count) {
+                GST_ERROR ("Encoder %d of job %s not found.", route->encoder, route->job);
                 return NULL;
         }
         g_mutex_lock (&(job->access_mutex));
         job->current_access += 1;
         g_mutex_unlock (&(job->access_mutex));
 
-        return &job->output->encoders[index];
+        return &job->output->encoders[route->encoder];
 }
 
 /**
  * gstreamill_get_m3u8playlist:
  * @encoder_output: (in): the encoder output to get its m3u8 playlist
  *
- * Get EncoderOutput' m3u8 playlist.
+ * Get EncoderOutput' m3u8 playlist, the http response rendered when the playlist updated.
  *
- * Returns: m3u8 playlist
+ * Returns: http response of m3u8 playlist, NULL if no m3u8 playlist. should be unref after used.
  */
-gchar * gstreamill_get_m3u8playlist (Gstreamill *gstreamill, EncoderOutput *encoder_output)
+GBytes * gstreamill_get_m3u8playlist (Gstreamill *gstreamill, EncoderOutput *encoder_output)
 {
-        gchar *m3u8playlist;
+        GBytes *response;
 
+        g_mutex_lock (&(encoder_output->m3u8_playlist_mutex));
         if (encoder_output->m3u8_playlist == NULL) {
-                return g_strdup ("not fount");
-        }
+                response = NULL;
 
-        g_mutex_lock (&(encoder_output->m3u8_playlist_mutex));
-        m3u8playlist = m3u8playlist_render (encoder_output->m3u8_playlist);
+        } else {
+                response = m3u8playlist_get_response (encoder_output->m3u8_playlist);
+        }
         g_mutex_unlock (&(encoder_output->m3u8_playlist_mutex));
 
-        return m3u8playlist;
+        return response;
 }
 
 /**
  * gstreamill_get_master_m3u8playlist:
- * @uri: (in): job uri
+ * @route: (in): route of job uri
  *
  * Get Job's master playlist.
  *
  * Returns: master m3u8 playlist
  */
-gchar * gstreamill_get_master_m3u8playlist (Gstreamill *gstreamill, gchar *uri)
+gchar * gstreamill_get_master_m3u8playlist (Gstreamill *gstreamill, Route *route)
 {
         Job *job;
-        gchar *master_m3u8_playlist, *p;
 
-        job = gstreamill_get_job (gstreamill, uri);
+        if (route->type != ROUTE_MASTER_PLAYLIST) {
+                return NULL;
+        }
+        job = get_job (gstreamill, route->job);
         if (job == NULL) {
-                GST_ERROR ("Job %s not found.", uri);
+                GST_ERROR ("Job %s not found.", route->job);
                 return NULL;
         }
 
-        p = g_strdup_printf ("/live/%s/playlist.m3u8", job->name);
-        if (g_strcmp0 (p, uri) == 0) {
-                master_m3u8_playlist = g_strdup (job->output->master_m3u8_playlist);
+        return g_strdup (job->output->master_m3u8_playlist);
+}
 
-        } else {
-                master_m3u8_playlist = NULL;
+/**
+ * gstreamill_get_mpd:
+ * @route: (in): route of job uri
+ *
+ * Get Job's mpeg dash mpd, current_access of the job is increased if found.
+ *
+ * Returns: http response of mpd, NULL if not found. should be unref after used.
+ */
+GBytes * gstreamill_get_mpd (Gstreamill *gstreamill, Route *route)
+{
+        Job *job;
+        GBytes *mpd;
+
+        if (route->type != ROUTE_MPD) {
+                return NULL;
+        }
+        job = get_job (gstreamill, route->job);
+        if ((job == NULL) || !(job->is_live)) {
+                GST_ERROR ("Live job %s not found.", route->job);
+                return NULL;
+        }
+        g_mutex_lock (&(job->access_mutex));
+        job->current_access += 1;
+        g_mutex_unlock (&(job->access_mutex));
+
+        mpd = dash_get_mpd (job);
+        if (mpd == NULL) {
+                gstreamill_unaccess (gstreamill, route->job);
         }
-        g_free (p);
 
-        return master_m3u8_playlist;
+        return mpd;
 }
 
 /**
  * gstreamill_unaccess:
- * @uri: (in): job access uri.
+ * @name: (in): job name.
  *
  * current_access minus 1.
  *
  * Returns: none
  */
-void gstreamill_unaccess (Gstreamill *gstreamill, gchar *uri)
+void gstreamill_unaccess (Gstreamill *gstreamill, gchar *name)
 {
         Job *job;
 
-        job = gstreamill_get_job (gstreamill, uri);
+        job = get_job (gstreamill, name);
         if (job == NULL) {
-                GST_ERROR ("Job %s not found.", uri);
+                GST_ERROR ("Job %s not found.", name);
                 return;
         }
         g_mutex_lock (&(job->access_mutex));
@@ -1066,7 +1174,10 @@ static gchar * source_streams_stat (Job *job)
         gchar *template_source_stream = "            {\n"
                                         "                \"name\": \"%s\",\n"
                                         "                \"timestamp\": %lu,\n"
-                                        "                \"heartbeat\": %s\n"
+                                        "                \"heartbeat\": %s,\n"
+                                        "                \"ring-count\": %lu,\n"
+                                        "                \"ring-bytes\": %lu,\n"
+                                        "                \"dropped\": %lu\n"
                                         "            }";
 
         stat = &(job->output->source.streams[0]);
@@ -1076,7 +1187,10 @@ static gchar * source_streams_stat (Job *job)
         source_streams = g_strdup_printf (template_source_stream,
                                           stat->name,
                                           stat->current_timestamp,
-                                          p1);
+                                          p1,
+                                          stat->ring_count,
+                                          stat->ring_bytes,
+                                          stat->dropped);
         g_free (p1);
         for (i = 1; i < job->output->source.stream_count; i++) {
                 stat = &(job->output->source.streams[i]);
@@ -1086,7 +1200,10 @@ static gchar * source_streams_stat (Job *job)
                 p2 = g_strdup_printf (template_source_stream,
                                       stat->name,
                                       stat->current_timestamp,
-                                      p1);
+                                      p1,
+                                      stat->ring_count,
+                                      stat->ring_bytes,
+                                      stat->dropped);
                 g_free (p1);
                 p1 = source_streams;
                 source_streams = g_strdup_printf ("%s,\n%s", p1, p2);
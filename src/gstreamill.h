@@ -13,6 +13,7 @@
 
 #include "config.h"
 #include "job.h"
+#include "route.h"
 
 #define SYNC_THRESHHOLD 3000000000 /* 1000ms */
 #define HEARTBEAT_THRESHHOLD 7000000000 /* 2000ms */
@@ -29,12 +30,15 @@ struct _Gstreamill {
 
         gboolean stop; /* gstreamill exit if stop == TURE */
         gboolean daemon; /* run as daemon? */
+        gboolean placement; /* place job workers on cpus and numa nodes? */
+        gint capacity; /* percentage of cpus for jobs, 0 if no admission control */
         GstClock *system_clock;
         gchar *start_time;
         gchar *log_dir;
 
         GMutex job_list_mutex;
         GSList *job_list;
+        GHashTable *job_table; /* job name -> job, protected by job_list_mutex too */
 };
 
 struct _GstreamillClass {
@@ -58,11 +62,12 @@ gchar * gstreamill_job_stop (Gstreamill *gstreamill, gchar *name);
 gchar * gstreamill_stat (Gstreamill *gstreamill);
 gchar * gstreamill_job_stat (Gstreamill *gstreamill, gchar *name);
 gchar * gstreamill_gstreamer_stat (Gstreamill *gstreamill, gchar *uri);
-void gstreamill_unaccess (Gstreamill *gstreamill, gchar *uri);
-Job * gstreamill_get_job (Gstreamill *gstreamill, gchar *uri);
+void gstreamill_unaccess (Gstreamill *gstreamill, gchar *name);
+Job * gstreamill_get_job (Gstreamill *gstreamill, gchar *name);
 gint gstreamill_job_number (Gstreamill *gstreamill);
-EncoderOutput * gstreamill_get_encoder_output (Gstreamill *gstreamill, gchar *uri);
-gchar * gstreamill_get_m3u8playlist (Gstreamill *gstreamill, EncoderOutput *encoder_output);
-gchar * gstreamill_get_master_m3u8playlist (Gstreamill *gstreamill, gchar *uri);
+EncoderOutput * gstreamill_get_encoder_output (Gstreamill *gstreamill, Route *route);
+GBytes * gstreamill_get_m3u8playlist (Gstreamill *gstreamill, EncoderOutput *encoder_output);
+gchar * gstreamill_get_master_m3u8playlist (Gstreamill *gstreamill, Route *route);
+GBytes * gstreamill_get_mpd (Gstreamill *gstreamill, Route *route);
 
 #endif /* __GSTREAMILL_H__ */
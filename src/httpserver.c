@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
@@ -26,6 +27,7 @@ enum {
         HTTPSERVER_PROP_NODE,
         HTTPSERVER_PROP_SERVICE,
         HTTPSERVER_PROP_MAXTHREADS,
+        HTTPSERVER_PROP_REACTORS,
 };
 
 static void httpserver_class_init (HTTPServerClass *httpserverclass);
@@ -71,6 +73,17 @@ static void httpserver_class_init (HTTPServerClass *httpserverclass)
                 G_PARAM_WRITABLE | G_PARAM_READABLE
         );
         g_object_class_install_property (g_object_class, HTTPSERVER_PROP_MAXTHREADS, param);
+
+        param = g_param_spec_int (
+                "reactors",
+                "reactorsf",
+                "number of reactors, 0 means thread pool mode",
+                0,
+                256,
+                0,
+                G_PARAM_WRITABLE | G_PARAM_READABLE
+        );
+        g_object_class_install_property (g_object_class, HTTPSERVER_PROP_REACTORS, param);
 }
 
 static gint compare_func (gconstpointer a, gconstpointer b)
@@ -88,12 +101,15 @@ static void httpserver_init (HTTPServer *http_server)
 
         http_server->listen_thread = NULL;
         http_server->thread_pool = NULL;
+        http_server->reactor_count = 0;
+        http_server->reactors = NULL;
         g_mutex_init (&(http_server->request_data_queue_mutex));
         http_server->request_data_queue = g_queue_new ();
         for (i=0; i<kMaxRequests; i++) {
                 request_data = (RequestData *)g_malloc (sizeof (RequestData));
                 g_mutex_init (&(request_data->events_mutex));
                 request_data->id = i;
+                request_data->reactor = NULL;
                 http_server->request_data_pointers[i] = request_data;
                 g_queue_push_head (http_server->request_data_queue, &http_server->request_data_pointers[i]);
         }
@@ -139,6 +155,10 @@ static void httpserver_set_property (GObject *obj, guint prop_id, const GValue *
                 HTTPSERVER (obj)->max_threads = g_value_get_int (value);
                 break;
 
+        case HTTPSERVER_PROP_REACTORS:
+                HTTPSERVER (obj)->reactor_count = g_value_get_int (value);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
                 break;
@@ -162,6 +182,10 @@ static void httpserver_get_property (GObject *obj, guint prop_id, GValue *value,
                 g_value_set_int (value, httpserver->max_threads);
                 break;
 
+        case HTTPSERVER_PROP_REACTORS:
+                g_value_set_int (value, httpserver->reactor_count);
+                break;
+
         default:
                 G_OBJECT_WARN_INVALID_PROPERTY_ID (obj, prop_id, pspec);
                 break;
@@ -402,7 +426,7 @@ static void close_socket_gracefully (gint sock)
         (void) close (sock);
 }
 
-static gint accept_socket (HTTPServer *http_server)
+static gint accept_socket (HTTPServer *http_server, HTTPReactor *reactor)
 {
         struct epoll_event ee;
         gint accepted_sock, ret;
@@ -410,11 +434,21 @@ static gint accept_socket (HTTPServer *http_server)
         socklen_t in_len;
         RequestData **request_data_pointer;
         RequestData *request_data;
-        gint request_data_queue_len;
+        gint request_data_queue_len, listen_sock, epollfd;
+
+        if (reactor != NULL) {
+                listen_sock = reactor->listen_sock;
+                epollfd = reactor->epollfd;
+
+        } else {
+                listen_sock = http_server->listen_sock;
+                epollfd = http_server->epollfd;
+        }
 
         for (;;) {
                  /* repeat accept until -1 returned */
-                accepted_sock = accept (http_server->listen_sock, &in_addr, &in_len);
+                in_len = sizeof (in_addr);
+                accepted_sock = accept (listen_sock, &in_addr, &in_len);
                 if (accepted_sock == -1) {
                         if (( errno == EAGAIN) || (errno == EWOULDBLOCK)) {
                                 /* We have processed all incoming connections. */
@@ -456,9 +490,11 @@ static gint accept_socket (HTTPServer *http_server)
                 request_data->birth_time = gst_clock_get_time (http_server->system_clock);
                 request_data->status = HTTP_CONNECTED;
                 request_data->request_length = 0;
+                request_data->wakeup_pending = FALSE;
+                request_data->reactor = reactor;
                 ee.events = EPOLLIN | EPOLLOUT | EPOLLET;
                 ee.data.ptr = request_data_pointer;
-                ret = epoll_ctl (http_server->epollfd, EPOLL_CTL_ADD, accepted_sock, &ee);
+                ret = epoll_ctl (epollfd, EPOLL_CTL_ADD, accepted_sock, &ee);
                 if (ret == -1) {
                         GST_ERROR ("epoll_ctl add error %s sock %d", g_strerror (errno), accepted_sock);
                         close_socket_gracefully (accepted_sock);
@@ -516,12 +552,11 @@ static gchar * epoll_event_string (struct epoll_event event)
         }
 }
 
-static gint socket_prepare (HTTPServer *http_server)
+static gint listen_socket_open (HTTPServer *http_server, gboolean reuseport)
 {
         struct addrinfo hints;
         struct addrinfo *result, *rp;
         gint ret, listen_sock;
-        struct epoll_event event;
 
         memset (&hints, 0, sizeof (struct addrinfo));
         hints.ai_family = AF_UNSPEC; /* Return IPv4 and IPv6 choices */
@@ -530,7 +565,7 @@ static gint socket_prepare (HTTPServer *http_server)
         ret = getaddrinfo (http_server->node, http_server->service, &hints, &result);
         if (ret != 0) {
                 GST_ERROR ("node %s, service: %s, getaddrinfo error: %s\n", http_server->node, http_server->service, gai_strerror (ret));
-                return 1;
+                return -1;
         }
 
         GST_INFO ("start http server on %s:%s", http_server->node, http_server->service);
@@ -538,9 +573,15 @@ static gint socket_prepare (HTTPServer *http_server)
                 int opt = 1;
 
                 listen_sock = socket (rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-                setsockopt (listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof (opt));
                 if (listen_sock == -1)
                         continue;
+                setsockopt (listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof (opt));
+                if (reuseport && (setsockopt (listen_sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof (opt)) == -1)) {
+                        GST_ERROR ("Set SO_REUSEPORT on socket %d error: %s", listen_sock, g_strerror (errno));
+                        close (listen_sock);
+                        freeaddrinfo (result);
+                        return -1;
+                }
                 ret = bind (listen_sock, rp->ai_addr, rp->ai_addrlen);
                 if (ret == 0) {
                         /* bind successfully! */
@@ -549,37 +590,62 @@ static gint socket_prepare (HTTPServer *http_server)
 
                 } else if (ret == -1) {
                         GST_ERROR ("Bind socket %d error: %s", listen_sock, g_strerror (errno));
-                        return 1;
+                        close (listen_sock);
+                        freeaddrinfo (result);
+                        return -1;
                 }
                 close_socket_gracefully (listen_sock);
         }
 
+        freeaddrinfo (result);
         if (rp == NULL) {
                 GST_ERROR ("Could not bind %s\n", http_server->service);
-                return 1;
+                return -1;
         }
 
-        freeaddrinfo (result);
-
         ret = listen (listen_sock, SOMAXCONN);
         if (ret == -1) {
                 GST_ERROR ("listen error");
-                return 1;
+                close (listen_sock);
+                return -1;
         }
-
         set_nonblock (listen_sock);
-        http_server->listen_sock = listen_sock;
-        http_server->epollfd = epoll_create1 (0);
-        if (http_server->epollfd == -1) {
+
+        return listen_sock;
+}
+
+static gint epoll_prepare (gint listen_sock)
+{
+        struct epoll_event event;
+        gint epollfd;
+
+        epollfd = epoll_create1 (0);
+        if (epollfd == -1) {
                 GST_ERROR ("epoll_create error %s", g_strerror (errno));
-                return 1;
+                return -1;
         }
 
+        /* data.ptr NULL means event of listen socket */
         event.data.ptr = NULL;
         event.events = EPOLLIN | EPOLLOUT | EPOLLET;
-        ret = epoll_ctl (http_server->epollfd, EPOLL_CTL_ADD, listen_sock, &event);
-        if (ret == -1) {
+        if (epoll_ctl (epollfd, EPOLL_CTL_ADD, listen_sock, &event) == -1) {
                 GST_ERROR ("epoll_ctl add epollfd error %s", g_strerror (errno));
+                close (epollfd);
+                return -1;
+        }
+
+        return epollfd;
+}
+
+static gint socket_prepare (HTTPServer *http_server)
+{
+        http_server->listen_sock = listen_socket_open (http_server, FALSE);
+        if (http_server->listen_sock == -1) {
+                return 1;
+        }
+
+        http_server->epollfd = epoll_prepare (http_server->listen_sock);
+        if (http_server->epollfd == -1) {
                 return 1;
         }
 
@@ -603,7 +669,7 @@ static gpointer listen_thread (gpointer data)
 
                         if (event_list[i].data.ptr == NULL) {
                                 /* new request arrived */
-                                accept_socket (http_server);
+                                accept_socket (http_server, NULL);
                                 continue;
                         }
 
@@ -738,10 +804,96 @@ static gpointer block_thread (gpointer data)
         }
 }
 
-static void thread_pool_func (gpointer data, gpointer user_data)
+static void request_data_release (HTTPServer *http_server, RequestData **request_data_pointer)
+{
+        RequestData *request_data = *request_data_pointer;
+
+        request_data->status = HTTP_NONE;
+        close_socket_gracefully (request_data->sock);
+        g_mutex_lock (&(http_server->request_data_queue_mutex));
+        request_data->events = 0;
+        g_queue_push_head (http_server->request_data_queue, request_data_pointer);
+        g_mutex_unlock (&(http_server->request_data_queue_mutex));
+}
+
+static void request_data_unidle (HTTPServer *http_server, RequestData **request_data_pointer)
+{
+        RequestData *request_data = *request_data_pointer;
+        HTTPReactor *reactor = request_data->reactor;
+
+        /* only remove the node belongs to the request, others may have the same wakeup time */
+        if (reactor != NULL) {
+                if (g_tree_lookup (reactor->idle_queue, &(request_data->wakeup_time)) == request_data_pointer) {
+                        g_tree_remove (reactor->idle_queue, &(request_data->wakeup_time));
+                }
+                return;
+        }
+
+        g_mutex_lock (&(http_server->idle_queue_mutex));
+        if (g_tree_lookup (http_server->idle_queue, &(request_data->wakeup_time)) == request_data_pointer) {
+                g_tree_remove (http_server->idle_queue, &(request_data->wakeup_time));
+        }
+        g_mutex_unlock (&(http_server->idle_queue_mutex));
+}
+
+static void request_data_idle (HTTPServer *http_server, RequestData **request_data_pointer, GstClockTime wakeup_time)
+{
+        RequestData *request_data = *request_data_pointer;
+        HTTPReactor *reactor = request_data->reactor;
+
+        request_data->wakeup_time = wakeup_time;
+        if (reactor != NULL) {
+                /* timers of a reactor are only accessed in the reactor thread, no lock */
+                while (g_tree_lookup (reactor->idle_queue, &(request_data->wakeup_time)) != NULL) {
+                        /* avoid time conflict */
+                        request_data->wakeup_time++;
+                }
+                request_data->status = HTTP_IDLE;
+                g_tree_insert (reactor->idle_queue, &(request_data->wakeup_time), request_data_pointer);
+                return;
+        }
+
+        g_mutex_lock (&(http_server->idle_queue_mutex));
+        if (request_data->wakeup_pending) {
+                /* waked up while processing, don't wait */
+                request_data->wakeup_pending = FALSE;
+                request_data->wakeup_time = gst_clock_get_time (http_server->system_clock);
+        }
+        while (g_tree_lookup (http_server->idle_queue, &(request_data->wakeup_time)) != NULL) {
+                /* avoid time conflict */
+                request_data->wakeup_time++;
+        }
+        request_data->status = HTTP_IDLE;
+        g_tree_insert (http_server->idle_queue, &(request_data->wakeup_time), request_data_pointer);
+        g_cond_signal (&(http_server->idle_queue_cond));
+        g_mutex_unlock (&(http_server->idle_queue_mutex));
+}
+
+static void request_data_block (HTTPServer *http_server, RequestData **request_data_pointer)
+{
+        RequestData *request_data = *request_data_pointer;
+        HTTPReactor *reactor = request_data->reactor;
+
+        /* block time out is 300ms */
+        request_data->wakeup_time = gst_clock_get_time (http_server->system_clock) + 300 * GST_MSECOND;
+        if (reactor != NULL) {
+                /* reactor wait epoll event or time out with the same timers as idle */
+                while (g_tree_lookup (reactor->idle_queue, &(request_data->wakeup_time)) != NULL) {
+                        request_data->wakeup_time++;
+                }
+                request_data->status = HTTP_BLOCK;
+                g_tree_insert (reactor->idle_queue, &(request_data->wakeup_time), request_data_pointer);
+                return;
+        }
+
+        g_mutex_lock (&(http_server->block_queue_mutex));
+        request_data->status = HTTP_BLOCK;
+        g_queue_push_head (http_server->block_queue, request_data_pointer);
+        g_mutex_unlock (&(http_server->block_queue_mutex));
+}
+
+static void request_process (HTTPServer *http_server, RequestData **request_data_pointer)
 {
-        HTTPServer *http_server = (HTTPServer *)user_data;
-        RequestData **request_data_pointer = data;
         RequestData *request_data = *request_data_pointer;
         gint ret;
         GstClockTime cb_ret;
@@ -787,12 +939,7 @@ static void thread_pool_func (gpointer data, gpointer user_data)
                 ret = read_request (request_data);
                 if (ret <= 0) {
                         GST_ERROR ("no data, sock is %d", request_data->sock);
-                        request_data->status = HTTP_NONE;
-                        close_socket_gracefully (request_data->sock);
-                        g_mutex_lock (&(http_server->request_data_queue_mutex));
-                        request_data->events = 0;
-                        g_queue_push_head (http_server->request_data_queue, request_data_pointer);
-                        g_mutex_unlock (&(http_server->request_data_queue_mutex));
+                        request_data_release (http_server, request_data_pointer);
                         return;
                 } 
 
@@ -805,33 +952,22 @@ static void thread_pool_func (gpointer data, gpointer user_data)
                                 /* idle */
                                 GST_DEBUG ("insert idle queue end, sock %d wakeuptime %lu", request_data->sock, cb_ret);
                                 http_server->encoder_click += 1;
-                                request_data->wakeup_time = cb_ret;
-                                g_mutex_lock (&(http_server->idle_queue_mutex));
-                                while (g_tree_lookup (http_server->idle_queue, &(request_data->wakeup_time)) != NULL) {
-                                        /* avoid time conflict */
-                                        request_data->wakeup_time++;
-                                }
-                                request_data->status = HTTP_IDLE;
-                                g_tree_insert (http_server->idle_queue, &(request_data->wakeup_time), request_data_pointer);
-                                g_cond_signal (&(http_server->idle_queue_cond));
-                                g_mutex_unlock (&(http_server->idle_queue_mutex));
+                                request_data_idle (http_server, request_data_pointer, cb_ret);
 
                         } else {
                                 /* finish */
                                 GST_DEBUG ("callback return 0, request finish, sock %d", request_data->sock);
-                                request_data->status = HTTP_NONE;
-                                close_socket_gracefully (request_data->sock);
-                                g_mutex_lock (&(http_server->request_data_queue_mutex));
-                                request_data->events = 0;
-                                g_queue_push_head (http_server->request_data_queue, request_data_pointer);
-                                g_mutex_unlock (&(http_server->request_data_queue_mutex));
+                                request_data_release (http_server, request_data_pointer);
                         }
 
                 } else if (ret == 1) {
                         /* need read more data */
-                        g_mutex_lock (&(http_server->block_queue_mutex));
-                        g_queue_push_head (http_server->block_queue, request_data_pointer);
-                        g_mutex_unlock (&(http_server->block_queue_mutex));
+                        if (request_data->reactor == NULL) {
+                                g_mutex_lock (&(http_server->block_queue_mutex));
+                                g_queue_push_head (http_server->block_queue, request_data_pointer);
+                                g_mutex_unlock (&(http_server->block_queue_mutex));
+                        }
+                        /* reactor process the request again on next EPOLLIN */
                         return;
 
                 } else {
@@ -842,93 +978,258 @@ static void thread_pool_func (gpointer data, gpointer user_data)
                                 GST_ERROR ("write sock %d error.", request_data->sock);
                         }
                         g_free (buf);
-                        request_data->status = HTTP_NONE;
-                        close_socket_gracefully (request_data->sock);
-                        g_mutex_lock (&(http_server->request_data_queue_mutex));
-                        request_data->events = 0;
-                        g_queue_push_head (http_server->request_data_queue, request_data_pointer);
-                        g_mutex_unlock (&(http_server->request_data_queue_mutex));
+                        request_data_release (http_server, request_data_pointer);
                 }
 
         } else if (request_data->status == HTTP_CONTINUE) {
                 cb_ret = http_server->user_callback (request_data, http_server->user_data);
                 if (cb_ret == GST_CLOCK_TIME_NONE) {
                         /* block */
-                        g_mutex_lock (&(http_server->block_queue_mutex));
-                        request_data->status = HTTP_BLOCK;
-                        /* block time out is 300ms */
-                        request_data->wakeup_time = gst_clock_get_time (http_server->system_clock) + 300 * GST_MSECOND;
-                        g_queue_push_head (http_server->block_queue, request_data_pointer);
-                        g_mutex_unlock (&(http_server->block_queue_mutex));
+                        request_data_block (http_server, request_data_pointer);
 
                 } else if (cb_ret > 0) {
                         /* idle */
-                        int iiii=0;
-                        request_data->wakeup_time = cb_ret;
-                        g_mutex_lock (&(http_server->idle_queue_mutex));
-                        if (request_data->status != HTTP_CONTINUE) {
-                                GST_FIXME ("insert a un continue request to idle queue sock %d", request_data->sock);
-                        }
-                        if (g_tree_nnodes (http_server->idle_queue) > 0) {
-                                RequestData **rr;
-                                RequestData *r;
-                                while ((rr = (RequestData **)g_tree_lookup (http_server->idle_queue, &(request_data->wakeup_time))) != NULL) {
-                                        /* avoid time conflict */
-                                        r = *rr;
-                                        GST_WARNING ("tree node number %d find sock %d wakeuptime %lu", g_tree_nnodes (http_server->idle_queue), request_data->sock, request_data->wakeup_time);
-                                        GST_WARNING ("look up, find sock %d wakeuptime %lu", r->sock, r->wakeup_time);
-                                        request_data->wakeup_time++;
-                                        if (iiii++==10) exit (0);
-                                }
-                        }
-                        request_data->status = HTTP_IDLE;
                         GST_DEBUG ("insert idle queue end, sock %d wakeuptime %lu", request_data->sock, cb_ret);
-                        g_tree_insert (http_server->idle_queue, &(request_data->wakeup_time), request_data_pointer);
-                        g_cond_signal (&(http_server->idle_queue_cond));
-                        g_mutex_unlock (&(http_server->idle_queue_mutex));
+                        request_data_idle (http_server, request_data_pointer, cb_ret);
 
                 } else {
                         /* finish */
-                        g_mutex_lock (&(http_server->idle_queue_mutex));
-                        g_tree_remove (http_server->idle_queue, &(request_data->wakeup_time));
-                        g_mutex_unlock (&(http_server->idle_queue_mutex));
-                        request_data->status = HTTP_NONE;
-                        close_socket_gracefully (request_data->sock);
-                        g_mutex_lock (&(http_server->request_data_queue_mutex));
-                        request_data->events = 0;
-                        g_queue_push_head (http_server->request_data_queue, request_data_pointer);
-                        g_mutex_unlock (&(http_server->request_data_queue_mutex));
+                        request_data_unidle (http_server, request_data_pointer);
+                        request_data_release (http_server, request_data_pointer);
                 }
 
         } else if (request_data->status == HTTP_FINISH) { // FIXME: how about if have continue request in idle queue??
                 cb_ret = http_server->user_callback (request_data, http_server->user_data);
                 GST_DEBUG ("request finish %d callback return %lu, send %lu", request_data->sock, cb_ret, request_data->bytes_send);
                 if (cb_ret == 0) {
-                        g_mutex_lock (&(http_server->idle_queue_mutex));
-                        g_tree_remove (http_server->idle_queue, &(request_data->wakeup_time));
-                        g_mutex_unlock (&(http_server->idle_queue_mutex));
-                        request_data->status = HTTP_NONE;
-                        close_socket_gracefully (request_data->sock);
-                        g_mutex_lock (&(http_server->request_data_queue_mutex));
-                        request_data->events = 0;
-                        g_queue_push_head (http_server->request_data_queue, request_data_pointer);
-                        g_mutex_unlock (&(http_server->request_data_queue_mutex));
+                        request_data_unidle (http_server, request_data_pointer);
+                        request_data_release (http_server, request_data_pointer);
                 }
         }
 }
 
+static void thread_pool_func (gpointer data, gpointer user_data)
+{
+        request_process ((HTTPServer *)user_data, (RequestData **)data);
+}
+
+typedef struct _ReactorTimers {
+        HTTPReactor *reactor;
+        GstClockTime current_time;
+        GstClockTime first_time; /* earliest timer not expired */
+        GSList *expired_list;
+} ReactorTimers;
+
+static gboolean reactor_timers_foreach_func (gpointer key, gpointer value, gpointer data)
+{
+        ReactorTimers *timers = data;
+
+        if (timers->current_time >= *(GstClockTime *)key) {
+                timers->expired_list = g_slist_append (timers->expired_list, value);
+                return FALSE;
+
+        } else {
+                /* timers are sorted, the rest are not expired */
+                timers->first_time = *(GstClockTime *)key;
+                return TRUE;
+        }
+}
+
+/*
+ * process expired timers, return epoll_wait timeout in milliseconds of the next timer.
+ */
+static gint reactor_timers_process (HTTPReactor *reactor)
+{
+        HTTPServer *http_server = reactor->http_server;
+        ReactorTimers timers;
+        RequestData **request_data_pointer;
+        RequestData *request_data;
+        GSList *list;
+        gboolean expired;
+
+        timers.reactor = reactor;
+        timers.expired_list = NULL;
+        timers.first_time = GST_CLOCK_TIME_NONE;
+        timers.current_time = gst_clock_get_time (http_server->system_clock);
+        g_tree_foreach (reactor->idle_queue, reactor_timers_foreach_func, &timers);
+        for (list = timers.expired_list; list != NULL; list = list->next) {
+                request_data_pointer = list->data;
+                request_data = *request_data_pointer;
+                g_tree_remove (reactor->idle_queue, &(request_data->wakeup_time));
+                request_process (http_server, request_data_pointer);
+        }
+        expired = (timers.expired_list != NULL);
+        g_slist_free (timers.expired_list);
+
+        if (expired) {
+                /* timers may be changed by the request processing, poll without waiting */
+                return 0;
+        }
+        if (timers.first_time == GST_CLOCK_TIME_NONE) {
+                return -1;
+        }
+
+        return (timers.first_time - timers.current_time + GST_MSECOND - 1) / GST_MSECOND;
+}
+
+/*
+ * process requests waked up by httpserver_wakeup.
+ */
+static void reactor_wakeup_process (HTTPReactor *reactor)
+{
+        HTTPServer *http_server = reactor->http_server;
+        RequestData **request_data_pointer;
+        RequestData *request_data;
+        GSList *wakeup_list, *list;
+        guint64 value;
+
+        if (read (reactor->wakeup_fd, &value, sizeof (value)) == -1) {
+                if (errno != EAGAIN) {
+                        GST_ERROR ("reactor %d read wakeup fd error %s", reactor->id, g_strerror (errno));
+                }
+        }
+        g_mutex_lock (&(reactor->wakeup_mutex));
+        wakeup_list = g_slist_reverse (reactor->wakeup_list);
+        reactor->wakeup_list = NULL;
+        g_mutex_unlock (&(reactor->wakeup_mutex));
+        for (list = wakeup_list; list != NULL; list = list->next) {
+                request_data_pointer = list->data;
+                request_data = *request_data_pointer;
+                /* the request may be processed already */
+                if ((request_data->status == HTTP_IDLE) &&
+                    (g_tree_lookup (reactor->idle_queue, &(request_data->wakeup_time)) == request_data_pointer)) {
+                        g_tree_remove (reactor->idle_queue, &(request_data->wakeup_time));
+                        request_process (http_server, request_data_pointer);
+                }
+        }
+        g_slist_free (wakeup_list);
+}
+
+static gpointer reactor_thread (gpointer data)
+{
+        HTTPReactor *reactor = (HTTPReactor *)data;
+        HTTPServer *http_server = reactor->http_server;
+        struct epoll_event event_list[kMaxRequests];
+        RequestData **request_data_pointer;
+        RequestData *request_data;
+        gint n, i, timeout;
+
+        timeout = -1;
+        for (;;) {
+                n = epoll_wait (reactor->epollfd, event_list, kMaxRequests, timeout);
+                if (n == -1) {
+                        if (errno != EINTR) {
+                                GST_ERROR ("reactor %d epoll_wait error %s", reactor->id, g_strerror (errno));
+                        }
+                        n = 0;
+                }
+                for (i = 0; i < n; i++) {
+                        if (event_list[i].data.ptr == NULL) {
+                                /* new request arrived */
+                                accept_socket (http_server, reactor);
+                                continue;
+                        }
+                        if (event_list[i].data.ptr == reactor) {
+                                reactor_wakeup_process (reactor);
+                                continue;
+                        }
+
+                        request_data_pointer = event_list[i].data.ptr;
+                        request_data = *request_data_pointer;
+                        g_mutex_lock (&(request_data->events_mutex));
+                        request_data->events |= event_list[i].events;
+                        g_mutex_unlock (&(request_data->events_mutex));
+                        GST_DEBUG ("reactor %d event on sock %d events %s", reactor->id, request_data->sock, epoll_event_string (event_list[i]));
+
+                        if (event_list[i].events & EPOLLIN) {
+                                if (request_data->status == HTTP_CONNECTED) {
+                                        request_data->status = HTTP_REQUEST;
+                                        request_process (http_server, request_data_pointer);
+                                        continue;
+
+                                } else if (request_data->status == HTTP_REQUEST) {
+                                        /* rest of the request */
+                                        request_process (http_server, request_data_pointer);
+                                        continue;
+                                }
+                        }
+
+                        if ((event_list[i].events & (EPOLLOUT | EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+                            (request_data->status == HTTP_BLOCK)) {
+                                request_data_unidle (http_server, request_data_pointer);
+                                request_process (http_server, request_data_pointer);
+                        }
+                }
+                timeout = reactor_timers_process (reactor);
+        }
+
+        return NULL;
+}
+
+static gint reactors_start (HTTPServer *http_server)
+{
+        struct epoll_event event;
+        HTTPReactor *reactor;
+        gchar *name;
+        gint i;
+
+        http_server->reactors = g_new0 (HTTPReactor, http_server->reactor_count);
+        for (i = 0; i < http_server->reactor_count; i++) {
+                reactor = &(http_server->reactors[i]);
+                reactor->http_server = http_server;
+                reactor->id = i;
+                reactor->idle_queue = g_tree_new ((GCompareFunc)compare_func);
+                /* each reactor has its own listen socket, kernel balance connections among them */
+                reactor->listen_sock = listen_socket_open (http_server, TRUE);
+                if (reactor->listen_sock == -1) {
+                        return 1;
+                }
+                reactor->epollfd = epoll_prepare (reactor->listen_sock);
+                if (reactor->epollfd == -1) {
+                        return 1;
+                }
+                reactor->wakeup_fd = eventfd (0, EFD_NONBLOCK);
+                if (reactor->wakeup_fd == -1) {
+                        GST_ERROR ("reactor %d eventfd error %s", i, g_strerror (errno));
+                        return 1;
+                }
+                g_mutex_init (&(reactor->wakeup_mutex));
+                reactor->wakeup_list = NULL;
+                event.data.ptr = reactor;
+                event.events = EPOLLIN;
+                if (epoll_ctl (reactor->epollfd, EPOLL_CTL_ADD, reactor->wakeup_fd, &event) == -1) {
+                        GST_ERROR ("reactor %d epoll_ctl add wakeup fd error %s", i, g_strerror (errno));
+                        return 1;
+                }
+        }
+
+        for (i = 0; i < http_server->reactor_count; i++) {
+                reactor = &(http_server->reactors[i]);
+                name = g_strdup_printf ("reactor_%d", i);
+                reactor->thread = g_thread_new (name, reactor_thread, reactor);
+                g_free (name);
+        }
+
+        return 0;
+}
+
 gint httpserver_start (HTTPServer *http_server, http_callback_t user_callback, gpointer user_data)
 {
         GError *err = NULL;
 
+        http_server->user_callback = user_callback;
+        http_server->user_data = user_data;
+        if (http_server->reactor_count > 0) {
+                GST_INFO ("start http server with %d reactors", http_server->reactor_count);
+                return reactors_start (http_server);
+        }
+
         http_server->thread_pool = g_thread_pool_new (thread_pool_func, http_server, http_server->max_threads, TRUE, &err);
         if (err != NULL) {
                 GST_ERROR ("Create thread pool error %s", err->message);
                 g_error_free (err);
                 return -1;
         }
-        http_server->user_callback = user_callback;
-        http_server->user_data = user_data;
         if (socket_prepare (http_server) != 0) {
                 return 1;
         }
@@ -940,6 +1241,48 @@ gint httpserver_start (HTTPServer *http_server, http_callback_t user_callback, g
         return 0;
 }
 
+/**
+ * httpserver_wakeup:
+ * @http_server: (in): http server
+ * @request_data: (in): request in idle status
+ *
+ * process the idle request now rather than at its wakeup time, can be called in any thread.
+ */
+void httpserver_wakeup (HTTPServer *http_server, RequestData *request_data)
+{
+        RequestData **request_data_pointer = http_server->request_data_pointers + request_data->id;
+        HTTPReactor *reactor = request_data->reactor;
+        GError *err = NULL;
+        guint64 value = 1;
+
+        if (reactor != NULL) {
+                /* idle queue of the reactor is only accessed in the reactor thread */
+                g_mutex_lock (&(reactor->wakeup_mutex));
+                reactor->wakeup_list = g_slist_prepend (reactor->wakeup_list, request_data_pointer);
+                g_mutex_unlock (&(reactor->wakeup_mutex));
+                if (write (reactor->wakeup_fd, &value, sizeof (value)) == -1) {
+                        GST_ERROR ("reactor %d write wakeup fd error %s", reactor->id, g_strerror (errno));
+                }
+                return;
+        }
+
+        g_mutex_lock (&(http_server->idle_queue_mutex));
+        if ((request_data->status == HTTP_IDLE) &&
+            (g_tree_lookup (http_server->idle_queue, &(request_data->wakeup_time)) == request_data_pointer)) {
+                g_tree_remove (http_server->idle_queue, &(request_data->wakeup_time));
+                g_thread_pool_push (http_server->thread_pool, request_data_pointer, &err);
+                if (err != NULL) {
+                        GST_FIXME ("Thread pool push error %s", err->message);
+                        g_error_free (err);
+                }
+
+        } else if (request_data->status == HTTP_CONTINUE) {
+                /* being processed in thread pool, not in idle queue yet */
+                request_data->wakeup_pending = TRUE;
+        }
+        g_mutex_unlock (&(http_server->idle_queue_mutex));
+}
+
 /**
  * httpserver_write:
  * @sock: (in): socket
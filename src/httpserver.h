@@ -18,6 +18,13 @@
                  "Connection: Close\r\n\r\n" \
                  "<h1>Internal Server Error</h1>"
 
+#define http_503 "HTTP/1.1 503 Service Unavailable\r\n" \
+                 "Server: %s-%s\r\n" \
+                 "Content-Type: text/html\r\n" \
+                 "Content-Length: 28\r\n" \
+                 "Connection: Close\r\n\r\n" \
+                 "<h1>Service Unavailable</h1>"
+
 #define http_404 "HTTP/1.1 404 Not Found\r\n" \
                  "Server: %s-%s\r\n" \
                  "Content-Type: text/html\r\n" \
@@ -89,6 +96,7 @@ typedef struct _RequestData {
         guint32 events; /* epoll events */
         enum session_status status; /* live over http need keeping tcp link */
         GstClockTime wakeup_time; /* used in idle queue */
+        gboolean wakeup_pending; /* waked up before entering idle queue */
         gchar raw_request[kRequestBufferSize];
         gint request_length;
         enum request_method method;
@@ -99,8 +107,25 @@ typedef struct _RequestData {
         gint num_headers;
         struct http_headers headers[64];
         gpointer priv_data; /* private user data */
+        gpointer reactor; /* reactor accepted the request, NULL in thread pool mode */
 } RequestData;
 
+/*
+ * reactor: an epoll loop with its own SO_REUSEPORT listen socket and timers,
+ * a request is served by the reactor accepted it for its whole life.
+ */
+typedef struct _HTTPReactor {
+        HTTPServer *http_server;
+        gint id;
+        gint listen_sock;
+        gint epollfd;
+        GThread *thread;
+        GTree *idle_queue; /* timers, only accessed in reactor thread */
+        gint wakeup_fd; /* eventfd, wake up the reactor from other threads */
+        GMutex wakeup_mutex;
+        GSList *wakeup_list; /* requests to be waked up */
+} HTTPReactor;
+
 struct _HTTPServer {
         GObject parent;
 
@@ -111,6 +136,8 @@ struct _HTTPServer {
         gchar *node;
         gchar *service;
         gint max_threads;
+        gint reactor_count; /* 0 means thread pool mode */
+        HTTPReactor *reactors;
         gint listen_sock;
         gint epollfd;
         GThread *listen_thread;
@@ -149,6 +176,7 @@ struct _HTTPServerClass {
 GType httpserver_get_type (void);
 gint httpserver_start (HTTPServer *httpserver, http_callback_t user_callback, gpointer user_data);
 gint httpserver_report_request_data (HTTPServer *http_server);
+void httpserver_wakeup (HTTPServer *http_server, RequestData *request_data);
 gint httpserver_write (gint sock, gchar *buf, gsize count);
 
 #endif /* __HTTPSERVER_H__ */
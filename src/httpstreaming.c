@@ -6,12 +6,14 @@
  */
 
 #include <unistd.h>
+#include <errno.h>
 #include <gst/gst.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 
 #include "httpstreaming.h"
+#include "llhls.h"
 
 GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
 #define GST_CAT_DEFAULT GSTREAMILL
@@ -129,86 +131,118 @@ GType httpstreaming_get_type (void)
         return type;
 }
 
+/*
+ * send chunk of progressive streaming, chunk data is sent from cache fd by sendfile.
+ * return bytes sent, -1 if nothing sent and error.
+ */
 static gint send_data (EncoderOutput *encoder_output, RequestData *request_data)
 {
         PrivateData *priv_data;
-        struct iovec iov[3];
-        gint ret;
+        gint ret, count, n;
 
         priv_data = request_data->priv_data;
-        iov[0].iov_base = NULL;
-        iov[0].iov_len = 0;
-        iov[1].iov_base = NULL;
-        iov[1].iov_len = 0;
-        iov[2].iov_base = "\r\n";
-        iov[2].iov_len = 2;
-        if (priv_data->send_count < priv_data->chunk_size_str_len) {
-                iov[0].iov_base = priv_data->chunk_size_str + priv_data->send_count;
-                iov[0].iov_len = priv_data->chunk_size_str_len - priv_data->send_count;
-                iov[1].iov_base = encoder_output->cache_addr + priv_data->send_position;
-                iov[1].iov_len = priv_data->chunk_size;
-
-        } else if (priv_data->send_count < (priv_data->chunk_size_str_len + priv_data->chunk_size)) {
-                iov[1].iov_base = encoder_output->cache_addr + priv_data->send_position + (priv_data->send_count - priv_data->chunk_size_str_len);
-                iov[1].iov_len = priv_data->chunk_size - (priv_data->send_count - priv_data->chunk_size_str_len);
-
-        } else if (priv_data->send_count > (priv_data->chunk_size_str_len + priv_data->chunk_size)) {
-                iov[2].iov_base = "\n";
-                iov[2].iov_len = 1;
-        }
-        ret = writev (request_data->sock, iov, 3);
-        if (ret == -1) {
-                GST_DEBUG ("write error %s sock %d", g_strerror (errno), request_data->sock);
+        count = 0;
+
+        /* chunk size */
+        n = priv_data->send_count;
+        if (n < priv_data->chunk_size_str_len) {
+                ret = write (request_data->sock, priv_data->chunk_size_str + n, priv_data->chunk_size_str_len - n);
+                if (ret == -1) {
+                        goto error;
+                }
+                count += ret;
+                if (ret < priv_data->chunk_size_str_len - n) {
+                        return count;
+                }
+        }
+
+        /* chunk data, chunk never cross the end of cache */
+        n = priv_data->send_count + count - priv_data->chunk_size_str_len;
+        if (n < priv_data->chunk_size) {
+                ret = encoder_output_send (encoder_output, request_data->sock, priv_data->send_position + n, priv_data->chunk_size - n);
+                if (ret == -1) {
+                        goto error;
+                }
+                count += ret;
+                if (ret < priv_data->chunk_size - n) {
+                        return count;
+                }
         }
 
-        return ret;
+        /* chunk end */
+        n = priv_data->send_count + count - priv_data->chunk_size_str_len - priv_data->chunk_size;
+        if (n < 2) {
+                ret = write (request_data->sock, "\r\n" + n, 2 - n);
+                if (ret == -1) {
+                        goto error;
+                }
+                count += ret;
+        }
+
+        return count;
+
+error:
+        GST_DEBUG ("write error %s sock %d", g_strerror (errno), request_data->sock);
+        return count > 0 ? count : -1;
 }
 
 /*
- * return -1 means the gop is current output gop.
+ * return -1 means the gop is current output gop, -2 means the gop has been removed from cache.
  */
 static gint64 get_current_gop_end (EncoderOutput *encoder_output, PrivateData *priv_data)
 {
-        gint32 current_gop_size, n;
+        GOPIndexEntry *entry;
         gint64 current_gop_end_addr;
 
-        /* read gop size. */
-        n = encoder_output->cache_size - priv_data->rap_addr;
-        if (n >= 12) {
-                memcpy (&current_gop_size, encoder_output->cache_addr + priv_data->rap_addr + 8, 4);
-
-        } else if (n > 8) {
-                memcpy (&current_gop_size, encoder_output->cache_addr + priv_data->rap_addr + 8, n - 8);
-                memcpy (&current_gop_size + n - 8, encoder_output->cache_addr, 12 - n);
-
-        } else {
-                memcpy (&current_gop_size, encoder_output->cache_addr + 8 - n, 4);
+        if (priv_data->gop_sequence < *(encoder_output->gop_index_head)) {
+                /* too slow, overwritten by encoder. */
+                return -2;
         }
-
-        if (current_gop_size == 0) {
+        entry = encoder_output_gop_index_entry (encoder_output, priv_data->gop_sequence);
+        if (entry->size == 0) {
                 /* current output gop. */
                 return -1;
         }
-        current_gop_end_addr = priv_data->rap_addr + current_gop_size;
-        if (current_gop_end_addr > encoder_output->cache_size) {
+        current_gop_end_addr = priv_data->rap_addr + entry->size;
+        if (current_gop_end_addr >= encoder_output->cache_size) {
                 current_gop_end_addr -= encoder_output->cache_size;
         }
 
         return current_gop_end_addr;
 }
 
-static GstClockTime send_chunk (EncoderOutput *encoder_output, RequestData *request_data)
+static void wakeup_request (gpointer data, gpointer user_data)
+{
+        HTTPStreaming *httpstreaming = (HTTPStreaming *)user_data;
+
+        httpserver_wakeup (httpstreaming->httpserver, (RequestData *)data);
+}
+
+/*
+ * wait for new output of the encoder, time out in 1s in case of the encoder stopped.
+ */
+static GstClockTime wait_encoder_output (HTTPStreaming *httpstreaming, EncoderOutput *encoder_output, RequestData *request_data, guint32 generation)
+{
+        GstClock *system_clock = httpstreaming->httpserver->system_clock;
+
+        if (encoder_output_wait (encoder_output, generation, wakeup_request, request_data, httpstreaming)) {
+                return gst_clock_get_time (system_clock) + GST_SECOND;
+        }
+
+        /* new output arrived already. */
+        return gst_clock_get_time (system_clock);
+}
+
+static GstClockTime send_chunk (HTTPStreaming *httpstreaming, EncoderOutput *encoder_output, RequestData *request_data, guint32 generation)
 {
+        GstClock *system_clock = httpstreaming->httpserver->system_clock;
         PrivateData *priv_data;
         gint64 current_gop_end_addr, tail_addr;
+        guint32 sequence;
         gint32 ret;
 
         priv_data = request_data->priv_data;
 
-        sem_wait (encoder_output->semaphore);
-        tail_addr = *(encoder_output->tail_addr);
-        current_gop_end_addr = get_current_gop_end (encoder_output, priv_data);
-
         if (priv_data->send_count == priv_data->chunk_size + priv_data->chunk_size_str_len + 2) {
                 /* completly send a chunk, prepare next. */
                 priv_data->send_position += priv_data->send_count - priv_data->chunk_size_str_len - 2;
@@ -220,18 +254,30 @@ static GstClockTime send_chunk (EncoderOutput *encoder_output, RequestData *requ
                 priv_data->chunk_size = 0;
         }
 
-        if (priv_data->send_position == current_gop_end_addr) {
-                /* next gop. */
-                priv_data->rap_addr = current_gop_end_addr;
-                if (priv_data->send_position + 12 < encoder_output->cache_size) {
-                        priv_data->send_position += 12;
+        for (;;) {
+                /* snapshot of encoder output, retry if encoder output changed while reading. */
+                do {
+                        sequence = encoder_output_read_begin (encoder_output);
+                        if (encoder_output_read_stalled (sequence)) {
+                                GST_WARNING ("sock %d encoder stalled, stop streaming", request_data->sock);
+                                return 0;
+                        }
+                        tail_addr = *(encoder_output->tail_addr);
+                        current_gop_end_addr = get_current_gop_end (encoder_output, priv_data);
+                } while (encoder_output_read_retry (encoder_output, sequence));
 
-                } else {
-                        priv_data->send_position = priv_data->send_position + 12 - encoder_output->cache_size;
+                if (current_gop_end_addr == -2) {
+                        GST_WARNING ("sock %d too slow, gop %lu removed from cache", request_data->sock, priv_data->gop_sequence);
+                        return 0;
                 }
-                current_gop_end_addr = get_current_gop_end (encoder_output, priv_data);
+                if (priv_data->send_position != current_gop_end_addr) {
+                        break;
+                }
+
+                /* next gop. */
+                priv_data->rap_addr = current_gop_end_addr;
+                priv_data->gop_sequence++;
         }
-        sem_post (encoder_output->semaphore);
 
         if (priv_data->chunk_size == 0) {
                 if (current_gop_end_addr == -1) {
@@ -244,8 +290,8 @@ static GstClockTime send_chunk (EncoderOutput *encoder_output, RequestData *requ
                                 priv_data->chunk_size = tail_addr - priv_data->send_position;
 
                         } else if (tail_addr == priv_data->send_position) {
-                                /* no data available, wait a while. */
-                                return 100 * GST_MSECOND + g_random_int_range (1, 1000000);
+                                /* no data available, wait for encoder output. */
+                                return wait_encoder_output (httpstreaming, encoder_output, request_data, generation);
 
                         } else if ((encoder_output->cache_size - priv_data->send_position) > 16384) {
                                 priv_data->chunk_size = 16384;
@@ -264,8 +310,8 @@ static GstClockTime send_chunk (EncoderOutput *encoder_output, RequestData *requ
                                 priv_data->chunk_size = current_gop_end_addr - priv_data->send_position;
 
                         } else if (current_gop_end_addr == priv_data->send_position) {
-                                /* no data available, wait a while. */
-                                return 100 * GST_MSECOND + g_random_int_range (1, 1000000); //FIXME FIXME
+                                /* no data available, wait for encoder output. */
+                                return wait_encoder_output (httpstreaming, encoder_output, request_data, generation);
 
                         } else {
                                 /* send to cache end. */
@@ -286,102 +332,350 @@ static GstClockTime send_chunk (EncoderOutput *encoder_output, RequestData *requ
                 priv_data->send_count += ret;
                 request_data->bytes_send += ret;
         }
+
+        /* data sent is valid only if the gop is still in cache. */
+        if (encoder_output_gop_evicted (encoder_output, priv_data->gop_sequence)) {
+                GST_WARNING ("sock %d too slow, gop %lu overwritten while sending", request_data->sock, priv_data->gop_sequence);
+                return 0;
+        }
         if (priv_data->send_count == priv_data->chunk_size + priv_data->chunk_size_str_len + 2) {
-                /* send complete, wait 10 ms. */
-                return 10 * GST_MSECOND + g_random_int_range (1, 1000000);
+                /* send complete, continue with next chunk. */
+                return gst_clock_get_time (system_clock);
+
+        } else {
+                /* not send complete, blocking until socket writable. */
+                return GST_CLOCK_TIME_NONE;
+        }
+}
+
+/*
+ * send body of segment or part response from where it stopped, never wait for socket writable.
+ * return 0 if sent completely or failed, GST_CLOCK_TIME_NONE if blocking until socket writable.
+ */
+static GstClockTime send_body (RequestData *request_data)
+{
+        PrivateData *priv_data = request_data->priv_data;
+        EncoderOutput *encoder_output = priv_data->encoder_output;
+        gboolean evicted;
+        gssize ret;
+
+        if (priv_data->body_size == 0) {
+                return 0;
+        }
+        if (priv_data->body_archived) {
+                ret = archive_sendfile (encoder_output->archive, request_data->sock, &(priv_data->body_entry), priv_data->body_sent);
+
+        } else {
+                ret = encoder_output_sendfile (encoder_output,
+                                               request_data->sock,
+                                               priv_data->body_addr + priv_data->body_sent,
+                                               priv_data->body_size - priv_data->body_sent);
+        }
+        if (ret == -1) {
+                GST_ERROR ("Write %s error: %s", request_data->uri, g_strerror (errno));
+                return 0;
+        }
+        priv_data->body_sent += ret;
+        request_data->bytes_send += ret;
+
+        /* data sent is valid only if it is still in cache or archive. */
+        if (priv_data->body_archived) {
+                evicted = archive_evicted (encoder_output->archive, priv_data->body_sequence);
+
+        } else if (priv_data->route.type == ROUTE_PART) {
+                evicted = encoder_output_part_evicted (encoder_output, priv_data->body_sequence);
 
         } else {
-                /* not send complete, blocking, wait 200 ms. */
-                return 200 * GST_MSECOND + g_random_int_range (1, 1000000);
+                evicted = encoder_output_gop_evicted (encoder_output, priv_data->body_sequence);
+        }
+        if (evicted) {
+                GST_ERROR ("%s overwritten while sending", request_data->uri);
+                return 0;
+        }
+        if (priv_data->body_sent < priv_data->body_size) {
+                /* not send complete, blocking until socket writable. */
+                return GST_CLOCK_TIME_NONE;
         }
+
+        return 0;
 }
 
-static void get_mpeg2ts_segment (RequestData *request_data, EncoderOutput *encoder_output)
+/*
+ * send segment aged out of cache from time-shift archive.
+ * return FALSE if segment not found in archive.
+ */
+static gboolean get_archived_segment (RequestData *request_data, EncoderOutput *encoder_output, GstClockTime timestamp)
 {
-        GstClockTime timestamp, t;
+        ArchiveIndexEntry entry;
+        PrivateData *priv_data;
+        gint64 sequence;
         gchar *buf;
-        guint64 rap_addr;
 
-        sscanf (request_data->uri, "/live/%*[^/]/encoder/%*[^/]/%lu.ts", &timestamp);
-        sem_wait (encoder_output->semaphore);
+        if (encoder_output->archive == NULL) {
+                return FALSE;
+        }
+        sequence = archive_seek (encoder_output->archive, timestamp, &entry);
+        if (sequence == -1) {
+                return FALSE;
+        }
+
+        buf = g_strdup_printf (http_200, PACKAGE_NAME, PACKAGE_VERSION, encoder_output_content_type (encoder_output), entry.size, ""); 
+        if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                GST_ERROR ("Write segment http head error: %s", g_strerror (errno));
+        }
+        g_free (buf);
+        priv_data = request_data->priv_data;
+        priv_data->body_archived = TRUE;
+        priv_data->body_entry = entry;
+        priv_data->body_size = entry.size;
+        priv_data->body_sequence = sequence;
+
+        return TRUE;
+}
+
+/*
+ * response head of segment, body is sent by send_body.
+ */
+static void get_mpeg2ts_segment (RequestData *request_data, EncoderOutput *encoder_output, GstClockTime timestamp)
+{
+        PrivateData *priv_data;
+        GOPIndexEntry *entry;
+        gint64 sequence;
+        guint64 rap_addr;
+        gsize segment_size;
+        guint32 read_sequence;
+        gchar *buf;
 
         /* seek gop */
-        rap_addr = *(encoder_output->head_addr);
-        while (rap_addr != *(encoder_output->last_rap_addr)) {
-                t = encoder_output_rap_timestamp (encoder_output, rap_addr);
-                if (timestamp == t) {
+        do {
+                read_sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (read_sequence)) {
                         break;
                 }
-                rap_addr = encoder_output_rap_next (encoder_output, rap_addr);
+                sequence = encoder_output_gop_seek (encoder_output, timestamp);
+                if (sequence != -1) {
+                        entry = encoder_output_gop_index_entry (encoder_output, sequence);
+                        rap_addr = entry->offset;
+                        segment_size = entry->size;
+                }
+        } while (encoder_output_read_retry (encoder_output, read_sequence));
+        if (encoder_output_read_stalled (read_sequence)) {
+                buf = g_strdup_printf (http_503, PACKAGE_NAME, PACKAGE_VERSION);
+                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                }
+                g_free (buf);
+                return;
+        }
+        if ((sequence == -1) && get_archived_segment (request_data, encoder_output, timestamp)) {
+                return;
+        }
+        if (sequence == -1) {
+                /* segment not found */
+                buf = g_strdup_printf (http_404, PACKAGE_NAME, PACKAGE_VERSION);
+                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                }
+                g_free (buf);
+                return;
         }
 
         /* segment found, send it */
-        if (t == timestamp) {
-                gsize gop_size;
+        buf = g_strdup_printf (http_200, PACKAGE_NAME, PACKAGE_VERSION, encoder_output_content_type (encoder_output), segment_size, ""); 
+        if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                GST_ERROR ("Write segment http head error: %s", g_strerror (errno));
+        }
+        g_free (buf);
+        priv_data = request_data->priv_data;
+        priv_data->body_addr = rap_addr;
+        priv_data->body_size = segment_size;
+        priv_data->body_sequence = sequence;
+}
 
-                gop_size = encoder_output_gop_size (encoder_output, rap_addr);
-                sem_post (encoder_output->semaphore);
-                buf = g_strdup_printf (http_200, PACKAGE_NAME, PACKAGE_VERSION, "video/mpeg", gop_size, ""); 
+/*
+ * send init segment of cmaf encoder, it is copied out of shm under seqlock, as it's small.
+ */
+static void get_init_segment (RequestData *request_data, EncoderOutput *encoder_output)
+{
+        gchar *buf, *init_segment;
+        gsize size;
+        guint32 sequence;
+
+        init_segment = NULL;
+        do {
+                g_free (init_segment);
+                sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (sequence)) {
+                        break;
+                }
+                size = MIN (*(encoder_output->init_size), INIT_SEGMENT_SIZE);
+                init_segment = g_memdup (encoder_output->init_segment, size);
+        } while (encoder_output_read_retry (encoder_output, sequence));
+        if (encoder_output_read_stalled (sequence)) {
+                buf = g_strdup_printf (http_503, PACKAGE_NAME, PACKAGE_VERSION);
                 if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
-                        GST_ERROR ("Write segment http head error: %s", g_strerror (errno));
+                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
                 }
                 g_free (buf);
-                if (rap_addr + gop_size + 12 < encoder_output->cache_size) {
-                        if (httpserver_write (request_data->sock, encoder_output->cache_addr + rap_addr + 12, gop_size) != gop_size) {
-                                GST_ERROR ("Write segment error: %s", g_strerror (errno));
-                        }
-
-                } else {
-                        gint n;
+                return;
+        }
 
-                        n = encoder_output->cache_size - rap_addr - 12;
-                        if (httpserver_write (request_data->sock, encoder_output->cache_addr + rap_addr + 12, n) != n) {
-                                GST_ERROR ("Write segment error: %s", g_strerror (errno));
-                        }
-                        if (httpserver_write (request_data->sock, encoder_output->cache_addr, gop_size - n) != gop_size - n) {
-                                GST_ERROR ("Write segment error: %s", g_strerror (errno));
-                        }
+        if (!encoder_output->cmaf || (size == 0)) {
+                buf = g_strdup_printf (http_404, PACKAGE_NAME, PACKAGE_VERSION);
+                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
                 }
+                g_free (buf);
+                g_free (init_segment);
                 return;
         }
 
-        /* segment not found */
-        sem_post (encoder_output->semaphore);
-        buf = g_strdup_printf (http_404, PACKAGE_NAME, PACKAGE_VERSION);
+        buf = g_strdup_printf (http_200, PACKAGE_NAME, PACKAGE_VERSION, "video/mp4", size, "");
         if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
-                GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                GST_ERROR ("Write init segment http head error: %s", g_strerror (errno));
         }
         g_free (buf);
+        if (httpserver_write (request_data->sock, init_segment, size) != size) {
+                GST_ERROR ("Write init segment error: %s", g_strerror (errno));
+        }
+        g_free (init_segment);
 }
 
-static is_http_progress_play_url (RequestData *request_data)
+/*
+ * response head of part of low latency hls, body is sent by send_body.
+ * return FALSE if the part is the current output part, should wait.
+ */
+static gboolean get_part (RequestData *request_data, EncoderOutput *encoder_output, Route *route)
 {
-        GRegex *regex = NULL;
-        GMatchInfo *match_info = NULL;
-        gchar *e;
-        gint index;
+        PrivateData *priv_data;
+        PartIndexEntry entry;
+        gint64 sequence;
+        guint32 read_sequence;
+        gchar *buf;
 
-        if (request_data->parameters[0] != '\0') {
-                GST_ERROR ("parameters is needless : %s?%s", request_data->uri, request_data->parameters);
+        do {
+                read_sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (read_sequence)) {
+                        break;
+                }
+                sequence = encoder_output_part_seek (encoder_output, route->timestamp, route->part);
+                if (sequence != -1) {
+                        entry = *encoder_output_part_index_entry (encoder_output, sequence);
+                }
+        } while (encoder_output_read_retry (encoder_output, read_sequence));
+        if (encoder_output_read_stalled (read_sequence)) {
+                buf = g_strdup_printf (http_503, PACKAGE_NAME, PACKAGE_VERSION);
+                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                }
+                g_free (buf);
+                return TRUE;
+        }
+        if (sequence == -1) {
+                /* part not found */
+                buf = g_strdup_printf (http_404, PACKAGE_NAME, PACKAGE_VERSION);
+                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                }
+                g_free (buf);
+                return TRUE;
+        }
+        if (entry.size == 0) {
+                /* preload hint, the part is being output */
+                return FALSE;
+        }
+
+        /* part found, send it */
+        buf = g_strdup_printf (http_200, PACKAGE_NAME, PACKAGE_VERSION, encoder_output_content_type (encoder_output), entry.size, "");
+        if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                GST_ERROR ("Write part http head error: %s", g_strerror (errno));
+        }
+        g_free (buf);
+        priv_data = request_data->priv_data;
+        priv_data->body_addr = entry.offset;
+        priv_data->body_size = entry.size;
+        priv_data->body_sequence = sequence;
+
+        return TRUE;
+}
+
+/*
+ * send low latency hls playlist.
+ * return FALSE if the part of blocking playlist reload is not output yet, should wait.
+ */
+static gboolean get_ll_m3u8playlist (RequestData *request_data, EncoderOutput *encoder_output, Route *route)
+{
+        GBytes *m3u8playlist;
+        gconstpointer data;
+        gsize size;
+
+        if ((route->msn != -1) && !llhls_part_ready (encoder_output, route->msn, route->part)) {
                 return FALSE;
         }
+        m3u8playlist = llhls_get_playlist (encoder_output);
+        data = g_bytes_get_data (m3u8playlist, &size);
+        if (httpserver_write (request_data->sock, (gchar *)data, size) != size) {
+                GST_ERROR ("Write sock error: %s", g_strerror (errno));
+        }
+        g_bytes_unref (m3u8playlist);
 
-        index = -1;
-        regex = g_regex_new ("^/live/.*/encoder/(?<encoder>[0-9]+)$", G_REGEX_OPTIMIZE, 0, NULL);
-        g_regex_match (regex, request_data->uri, 0, &match_info);
-        if (g_match_info_matches (match_info)) {
-                e = g_match_info_fetch_named (match_info, "encoder");
-                index = g_ascii_strtoll (e, NULL, 10);
-                g_free (e);
+        return TRUE;
+}
+
+/*
+ * low latency hls request, blocking until the part output.
+ * return 0 if responded, or wake up time of the waiting request.
+ */
+static GstClockTime ll_request (HTTPStreaming *httpstreaming, RequestData *request_data, EncoderOutput *encoder_output, Route *route)
+{
+        guint32 generation;
+        gboolean done;
+
+        /* read generation before check, output after this would change generation. */
+        generation = encoder_output_generation (encoder_output);
+        if (route->type == ROUTE_PART) {
+                done = get_part (request_data, encoder_output, route);
+
+        } else {
+                done = get_ll_m3u8playlist (request_data, encoder_output, route);
         }
-        if (match_info != NULL) {
-                g_match_info_free (match_info);
+        if (done) {
+                /* part body if any */
+                encoder_output_wait_cancel (encoder_output, request_data);
+                return send_body (request_data);
+        }
+
+        return wait_encoder_output (httpstreaming, encoder_output, request_data, generation);
+}
+
+/*
+ * private data of request responded in more than one dispatch.
+ */
+static PrivateData * private_data_new (HTTPStreaming *httpstreaming, EncoderOutput *encoder_output, Route *route)
+{
+        PrivateData *priv_data;
+
+        priv_data = (PrivateData *)g_malloc0 (sizeof (PrivateData));
+        priv_data->job = gstreamill_get_job (httpstreaming->gstreamill, route->job);
+        priv_data->livejob_age = priv_data->job->age;
+        priv_data->encoder_output = encoder_output;
+        priv_data->route = *route;
+
+        return priv_data;
+}
+
+static gboolean is_http_progress_play_url (RequestData *request_data, EncoderOutput *encoder_output, Route *route)
+{
+        if (route->type != ROUTE_PROGRESSIVE) {
+                return FALSE;
         }
-        if (regex != NULL) {
-                g_regex_unref (regex);
+        if (encoder_output->cmaf) {
+                /* fragments without init segment are not playable */
+                GST_ERROR ("progressive play of cmaf output is not supported : %s", request_data->uri);
+                return FALSE;
         }
-        if (index == -1) {
-                GST_ERROR ("invalid uri: %s", request_data->uri);
+        if (request_data->parameters[0] != '\0') {
+                GST_ERROR ("parameters is needless : %s?%s", request_data->uri, request_data->parameters);
                 return FALSE;
         }
 
@@ -396,16 +690,44 @@ static GstClockTime httpstreaming_dispatcher (gpointer data, gpointer user_data)
         EncoderOutput *encoder_output;
         PrivateData *priv_data;
         GstClock *system_clock = httpstreaming->httpserver->system_clock;
+        guint32 generation, sequence;
+        GstClockTime ret;
+        Route route;
 
         switch (request_data->status) {
         case HTTP_REQUEST:
                 GST_INFO ("new request arrived, socket is %d, uri is %s", request_data->sock, request_data->uri);
-                encoder_output = gstreamill_get_encoder_output (httpstreaming->gstreamill, request_data->uri);
-                if (encoder_output == NULL) {
+                route_parse (request_data->uri, &route);
+                encoder_output = gstreamill_get_encoder_output (httpstreaming->gstreamill, &route);
+                if (route.type == ROUTE_MPD) {
+                        /* mpeg dash mpd */
+                        GBytes *mpd;
+                        gconstpointer data;
+                        gsize size;
+
+                        mpd = gstreamill_get_mpd (httpstreaming->gstreamill, &route);
+                        if (mpd != NULL) {
+                                data = g_bytes_get_data (mpd, &size);
+                                if (httpserver_write (request_data->sock, (gchar *)data, size) != size) {
+                                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                                }
+                                g_bytes_unref (mpd);
+                                gstreamill_unaccess (httpstreaming->gstreamill, route.job);
+
+                        } else {
+                                buf = g_strdup_printf (http_404, PACKAGE_NAME, PACKAGE_VERSION);
+                                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                                }
+                                g_free (buf);
+                        }
+                        return 0;
+
+                } else if (encoder_output == NULL) {
                         /* no such encoder */
                         gchar *master_m3u8_playlist;
 
-                        master_m3u8_playlist = gstreamill_get_master_m3u8playlist (httpstreaming->gstreamill, request_data->uri);
+                        master_m3u8_playlist = gstreamill_get_master_m3u8playlist (httpstreaming->gstreamill, &route);
                         if (master_m3u8_playlist != NULL) {
                                 buf = g_strdup_printf (http_200,
                                                        PACKAGE_NAME,
@@ -432,47 +754,112 @@ static GstClockTime httpstreaming_dispatcher (gpointer data, gpointer user_data)
                                 GST_ERROR ("Write sock error: %s", g_strerror (errno));
                         }
                         g_free (buf);
-                        gstreamill_unaccess (httpstreaming->gstreamill, request_data->uri);
+                        gstreamill_unaccess (httpstreaming->gstreamill, route.job);
                         return 0;
 
-                } else if (g_str_has_suffix (request_data->uri, ".ts")) {
-                        /* get mpeg2 transport stream segment */
-                        get_mpeg2ts_segment (request_data, encoder_output);
-                        gstreamill_unaccess (httpstreaming->gstreamill, request_data->uri);
+                } else if (route.type == ROUTE_SEGMENT) {
+                        /* get mpeg2 transport stream or fragmented mp4 segment */
+                        request_data->priv_data = private_data_new (httpstreaming, encoder_output, &route);
+                        get_mpeg2ts_segment (request_data, encoder_output, route.timestamp);
+                        ret = send_body (request_data);
+                        if (ret == 0) {
+                                g_free (request_data->priv_data);
+                                request_data->priv_data = NULL;
+                                gstreamill_unaccess (httpstreaming->gstreamill, route.job);
+                        }
+                        return ret;
+
+                } else if (route.type == ROUTE_INIT) {
+                        /* get init segment of cmaf */
+                        get_init_segment (request_data, encoder_output);
+                        gstreamill_unaccess (httpstreaming->gstreamill, route.job);
                         return 0;
 
-                } else if (g_str_has_suffix (request_data->uri, "playlist.m3u8")) {
-                        /* get m3u8 playlist */
-                        gchar *m3u8playlist;
+                } else if (((route.type == ROUTE_PLAYLIST) || (route.type == ROUTE_PART)) && (encoder_output->part_duration != 0)) {
+                        /* low latency hls, playlist with parts or part */
+                        if (!route_parse_parameters (request_data->parameters, &route) ||
+                            !llhls_msn_valid (encoder_output, route.msn)) {
+                                buf = g_strdup_printf (http_400, PACKAGE_NAME, PACKAGE_VERSION);
+                                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                                }
+                                g_free (buf);
+                                gstreamill_unaccess (httpstreaming->gstreamill, route.job);
+                                return 0;
+                        }
+                        priv_data = private_data_new (httpstreaming, encoder_output, &route);
+                        request_data->priv_data = priv_data;
+                        ret = ll_request (httpstreaming, request_data, encoder_output, &route);
+                        if (ret == 0) {
+                                g_free (request_data->priv_data);
+                                request_data->priv_data = NULL;
+                                gstreamill_unaccess (httpstreaming->gstreamill, route.job);
+                                return 0;
+                        }
+
+                        /* not output yet, blocking for at most three target durations, or sending part */
+                        priv_data->deadline = gst_clock_get_time (system_clock) + 3 * MAX (jobdesc_m3u8streaming_segment_duration (priv_data->job->spec), GST_SECOND);
+                        return ret;
+
+                } else if (route.type == ROUTE_PLAYLIST) {
+                        /* get m3u8 playlist, response is rendered when playlist updated */
+                        GBytes *m3u8playlist;
+                        gconstpointer data;
+                        gsize size;
 
                         m3u8playlist = gstreamill_get_m3u8playlist (httpstreaming->gstreamill, encoder_output);
-                        buf = g_strdup_printf (http_200,
-                                               PACKAGE_NAME,
-                                               PACKAGE_VERSION,
-                                               "application/vnd.apple.mpegurl",
-                                               strlen (m3u8playlist),
-                                               m3u8playlist); 
-                        if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
-                                GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                        if (m3u8playlist != NULL) {
+                                data = g_bytes_get_data (m3u8playlist, &size);
+                                if (httpserver_write (request_data->sock, (gchar *)data, size) != size) {
+                                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                                }
+                                g_bytes_unref (m3u8playlist);
+
+                        } else {
+                                buf = g_strdup_printf (http_404, PACKAGE_NAME, PACKAGE_VERSION);
+                                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                                }
+                                g_free (buf);
                         }
-                        g_free (m3u8playlist);
-                        g_free (buf);
-                        gstreamill_unaccess (httpstreaming->gstreamill, request_data->uri);
+                        gstreamill_unaccess (httpstreaming->gstreamill, route.job);
                         return 0;
 
-                } else if (is_http_progress_play_url (request_data)) {
+                } else if (is_http_progress_play_url (request_data, encoder_output, &route)) {
                         /* http progressive streaming request */
+                        guint64 gop_sequence, rap_addr;
+
                         GST_INFO ("Play %s.", request_data->uri);
-                        priv_data = (PrivateData *)g_malloc (sizeof (PrivateData));
-                        priv_data->job = gstreamill_get_job (httpstreaming->gstreamill, request_data->uri);
+                        /* start from current output gop */
+                        do {
+                                sequence = encoder_output_read_begin (encoder_output);
+                                if (encoder_output_read_stalled (sequence)) {
+                                        break;
+                                }
+                                gop_sequence = *(encoder_output->gop_index_tail) - 1;
+                                rap_addr = encoder_output_gop_index_entry (encoder_output, gop_sequence)->offset;
+                        } while (encoder_output_read_retry (encoder_output, sequence));
+                        if (encoder_output_read_stalled (sequence)) {
+                                buf = g_strdup_printf (http_503, PACKAGE_NAME, PACKAGE_VERSION);
+                                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                                }
+                                g_free (buf);
+                                gstreamill_unaccess (httpstreaming->gstreamill, route.job);
+                                return 0;
+                        }
+                        priv_data = (PrivateData *)g_malloc0 (sizeof (PrivateData));
+                        priv_data->job = gstreamill_get_job (httpstreaming->gstreamill, route.job);
                         priv_data->livejob_age = priv_data->job->age;
                         priv_data->chunk_size = 0;
                         priv_data->send_count = 2;
                         priv_data->chunk_size_str = g_strdup ("");
                         priv_data->chunk_size_str_len = 0;
                         priv_data->encoder_output = encoder_output;
-                        priv_data->rap_addr = *(encoder_output->last_rap_addr);
-                        priv_data->send_position = *(encoder_output->last_rap_addr) + 12;
+                        priv_data->route = route;
+                        priv_data->gop_sequence = gop_sequence;
+                        priv_data->rap_addr = rap_addr;
+                        priv_data->send_position = priv_data->rap_addr;
                         request_data->priv_data = priv_data;
                         request_data->bytes_send = 0;
                         buf = g_strdup_printf (http_chunked, PACKAGE_NAME, PACKAGE_VERSION);
@@ -488,7 +875,7 @@ static GstClockTime httpstreaming_dispatcher (gpointer data, gpointer user_data)
                                 GST_ERROR ("Write sock error: %s", g_strerror (errno));
                         }
                         g_free (buf);
-                        gstreamill_unaccess (httpstreaming->gstreamill, request_data->uri);
+                        gstreamill_unaccess (httpstreaming->gstreamill, route.job);
                         return 0;
                 }
                 break;
@@ -497,23 +884,70 @@ static GstClockTime httpstreaming_dispatcher (gpointer data, gpointer user_data)
                 priv_data = request_data->priv_data;
                 if ((priv_data->livejob_age != priv_data->job->age) ||
                     (*(priv_data->job->output->state) != GST_STATE_PLAYING)) {
+                        encoder_output_wait_cancel (priv_data->encoder_output, request_data);
+                        gstreamill_unaccess (httpstreaming->gstreamill, priv_data->job->name);
                         g_free (request_data->priv_data);
                         request_data->priv_data = NULL;
-                        gstreamill_unaccess (httpstreaming->gstreamill, request_data->uri);
                         return 0;
                 }
                 encoder_output = priv_data->encoder_output;
+                if (priv_data->body_size != 0) {
+                        /* socket writable, continue sending segment or part */
+                        ret = send_body (request_data);
+                        if (ret == 0) {
+                                encoder_output_wait_cancel (encoder_output, request_data);
+                                gstreamill_unaccess (httpstreaming->gstreamill, priv_data->job->name);
+                                g_free (request_data->priv_data);
+                                request_data->priv_data = NULL;
+                        }
+                        return ret;
+                }
+                if ((priv_data->route.type == ROUTE_PLAYLIST) || (priv_data->route.type == ROUTE_PART)) {
+                        /* low latency hls blocking request */
+                        ret = ll_request (httpstreaming, request_data, encoder_output, &(priv_data->route));
+                        if ((ret != 0) && (gst_clock_get_time (system_clock) >= priv_data->deadline)) {
+                                GST_WARNING ("%s?%s blocking timeout", request_data->uri, request_data->parameters);
+                                buf = g_strdup_printf (http_503, PACKAGE_NAME, PACKAGE_VERSION);
+                                if (httpserver_write (request_data->sock, buf, strlen (buf)) != strlen (buf)) {
+                                        GST_ERROR ("Write sock error: %s", g_strerror (errno));
+                                }
+                                g_free (buf);
+                                ret = 0;
+                        }
+                        if (ret == 0) {
+                                encoder_output_wait_cancel (encoder_output, request_data);
+                                gstreamill_unaccess (httpstreaming->gstreamill, priv_data->job->name);
+                                g_free (request_data->priv_data);
+                                request_data->priv_data = NULL;
+                        }
+                        return ret;
+                }
+                /* read generation before tail, output after this would change generation. */
+                generation = encoder_output_generation (encoder_output);
                 if (priv_data->send_position == *(encoder_output->tail_addr)) {
-                        /* no more stream, wait 10ms */
+                        /* no more stream, wait for encoder output */
                         GST_DEBUG ("current:%lu == tail:%lu", priv_data->send_position, *(encoder_output->tail_addr));
-                        return gst_clock_get_time (system_clock) + 500 * GST_MSECOND + g_random_int_range (1, 1000000);
+                        return wait_encoder_output (httpstreaming, encoder_output, request_data, generation);
                 }
-                return send_chunk (encoder_output, request_data) + gst_clock_get_time (system_clock);
+                ret = send_chunk (httpstreaming, encoder_output, request_data, generation);
+                if (ret == 0) {
+                        /* client too slow, finish */
+                        encoder_output_wait_cancel (encoder_output, request_data);
+                        gstreamill_unaccess (httpstreaming->gstreamill, priv_data->job->name);
+                        g_free (request_data->priv_data);
+                        request_data->priv_data = NULL;
+                }
+                return ret;
 
         case HTTP_FINISH:
+                if (request_data->priv_data != NULL) {
+                        priv_data = request_data->priv_data;
+                        encoder_output_wait_cancel (priv_data->encoder_output, request_data);
+                }
                 g_free (request_data->priv_data);
                 request_data->priv_data = NULL;
-                gstreamill_unaccess (httpstreaming->gstreamill, request_data->uri);
+                route_parse (request_data->uri, &route);
+                gstreamill_unaccess (httpstreaming->gstreamill, route.job);
                 return 0;
 
         default:
@@ -527,7 +961,7 @@ static GstClockTime httpstreaming_dispatcher (gpointer data, gpointer user_data)
         }
 }
 
-gint httpstreaming_start (HTTPStreaming *httpstreaming, gint maxthreads)
+gint httpstreaming_start (HTTPStreaming *httpstreaming, gint maxthreads, gint reactors)
 {
         gchar node[128], service[32];
 
@@ -538,7 +972,7 @@ gint httpstreaming_start (HTTPStreaming *httpstreaming, gint maxthreads)
         }
 
         /* start http streaming */
-        httpstreaming->httpserver = httpserver_new ("maxthreads", maxthreads, "node", node, "service", service, NULL);
+        httpstreaming->httpserver = httpserver_new ("maxthreads", maxthreads, "reactors", reactors, "node", node, "service", service, NULL);
         if (httpserver_start (httpstreaming->httpserver, httpstreaming_dispatcher, httpstreaming) != 0) {
                 GST_ERROR ("Start streaming httpserver error!");
                 return 1;
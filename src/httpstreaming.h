@@ -18,12 +18,22 @@ typedef struct _PrivateData {
         Job *job;
         gint64 livejob_age;
         gint64 rap_addr;
+        guint64 gop_sequence; /* sequence of the gop in gop index */
         gint64 send_position;
         gint chunk_size;
         gchar *chunk_size_str;
         gint chunk_size_str_len;
         gint send_count;
         gpointer encoder_output;
+        Route route; /* route of the request */
+        GstClockTime deadline; /* low latency hls blocking request, 503 if not ready before it */
+        /* body of segment or part response, sent as socket writable */
+        gboolean body_archived; /* body in time-shift archive */
+        ArchiveIndexEntry body_entry; /* archived segment */
+        guint64 body_addr; /* body in cache */
+        gsize body_size; /* 0 if no body being sent */
+        gsize body_sent;
+        guint64 body_sequence; /* sequence of gop, part or archived segment, check if evicted */
 } PrivateData;
 
 typedef struct _HTTPStreaming      HTTPStreaming;
@@ -50,6 +60,6 @@ struct _HTTPStreamingClass {
 #define httpstreaming_new(...)       (g_object_new(TYPE_HTTPSTREAMING, ## __VA_ARGS__, NULL))
 
 GType httpstreaming_get_type (void);
-gint httpstreaming_start (HTTPStreaming *httpstreaming, gint maxthreads);
+gint httpstreaming_start (HTTPStreaming *httpstreaming, gint maxthreads, gint reactors);
 
 #endif /* __HTTPSTREAMING_H__ */
@@ -5,15 +5,13 @@
  */
 
 #include <stdio.h>
-#include <sys/socket.h>
-#include <arpa/inet.h>
-#include <netdb.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <string.h>
 
 #include "jobdesc.h"
 #include "job.h"
+#include "dash.h"
 
 GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
 #define GST_CAT_DEFAULT GSTREAMILL
@@ -64,6 +62,7 @@ static void job_init (Job *job)
         g_object_set (job->system_clock, "clock-type", GST_CLOCK_TYPE_REALTIME, NULL);
         job->encoder_array = g_array_new (FALSE, FALSE, sizeof (gpointer));
         job->m3u8push_thread_pool = NULL;
+        job->m3u8push_client = NULL;
 }
 
 static void job_set_property (GObject *obj, guint prop_id, const GValue *value, GParamSpec *pspec)
@@ -110,31 +109,71 @@ static void job_dispose (GObject *obj)
         GObjectClass *parent_class = g_type_class_peek (G_TYPE_OBJECT);
         JobOutput *output;
         gint i;
-        gchar *name;
+        gchar *name, *huge_page, *path;
 
         output = job->output;
+
+        /* pushes in progress are finished before output released */
+        if (job->m3u8push_thread_pool != NULL) {
+                for (i = 0; i < output->encoder_count; i++) {
+                        /* notify_function pushes under the mutex */
+                        g_mutex_lock (&(output->encoders[i].m3u8_playlist_mutex));
+                        output->encoders[i].m3u8push_thread_pool = NULL;
+                        g_mutex_unlock (&(output->encoders[i].m3u8_playlist_mutex));
+                }
+                g_thread_pool_free (job->m3u8push_thread_pool, FALSE, TRUE);
+                job->m3u8push_thread_pool = NULL;
+        }
+        if (job->m3u8push_client != NULL) {
+                pushclient_free (job->m3u8push_client);
+                job->m3u8push_client = NULL;
+        }
+
         for (i = 0; i < output->encoder_count; i++) {
+                /* no more waiting on output */
+                if (job->is_live) {
+                        encoder_output_waiter_stop (&(output->encoders[i]));
+                }
+                g_mutex_clear (&(output->encoders[i].waiter_mutex));
+                g_cond_clear (&(output->encoders[i].waiter_cond));
+
                 /* share memory release */
                 name = g_strdup_printf ("%s.%d", job->name, i);
                 if (output->encoders[i].cache_fd != -1) {
                         g_close (output->encoders[i].cache_fd, NULL);
-                        if (munmap (output->encoders[i].cache_addr, SHM_SIZE) == -1) {
+                        /* cache is mirror mapped */
+                        if (munmap (output->encoders[i].cache_addr, 2 * output->encoders[i].cache_size) == -1) {
                                 GST_ERROR ("munmap %s error: %s", name, g_strerror (errno));
                         }
-                        if (shm_unlink (name) == -1) {
+                        /* memfd cache if not daemon */
+                        huge_page = jobdesc_encoder_cache_huge_page (job->spec, output->encoders[i].name);
+                        if ((job->output_fd != -1) && (g_strcmp0 (huge_page, "hugetlbfs") == 0)) {
+                                path = g_strdup_printf ("%s/%s", HUGETLBFS_PATH, name);
+                                if (unlink (path) == -1) {
+                                        GST_ERROR ("unlink %s error: %s", path, g_strerror (errno));
+                                }
+                                g_free (path);
+
+                        } else if ((job->output_fd != -1) && (shm_unlink (name) == -1)) {
                                 GST_ERROR ("shm_unlink %s error: %s", name, g_strerror (errno));
                         }
+                        g_free (huge_page);
                 }
                 g_free (name);
 
-                /* semaphore and message queue release */
-                name = g_strdup_printf ("/%s.%d", job->name, i);
-                if (sem_close (output->encoders[i].semaphore) == -1) {
-                        GST_ERROR ("sem_close %s error: %s", name, g_strerror (errno));
+                if (output->encoders[i].archive != NULL) {
+                        archive_close (output->encoders[i].archive);
+                }
+                if (output->encoders[i].ll_playlist != NULL) {
+                        g_bytes_unref (output->encoders[i].ll_playlist);
                 }
-                if (sem_unlink (name) == -1) {
-                        GST_ERROR ("sem_unlink %s error: %s", name, g_strerror (errno));
+                if (output->encoders[i].m3u8_playlist != NULL) {
+                        m3u8playlist_free (output->encoders[i].m3u8_playlist);
                 }
+                g_mutex_clear (&(output->encoders[i].m3u8_playlist_mutex));
+
+                /* message queue release */
+                name = g_strdup_printf ("/%s.%d", job->name, i);
                 if ((output->encoders[i].mqdes != -1) && (mq_close (output->encoders[i].mqdes) == -1)) {
                         GST_ERROR ("mq_close %s error: %s", name, g_strerror (errno));
                 }
@@ -143,6 +182,10 @@ static void job_dispose (GObject *obj)
                 }
                 g_free (name);
         }
+        g_mutex_clear (&(output->mpd_mutex));
+        if (output->mpd != NULL) {
+                g_bytes_unref (output->mpd);
+        }
 
         if (job->output_fd != -1) {
                 g_close (job->output_fd, NULL);
@@ -165,6 +208,11 @@ static void job_dispose (GObject *obj)
                 job->description = NULL;
         }
 
+        if (job->spec != NULL) {
+                jobspec_free (job->spec);
+                job->spec = NULL;
+        }
+
         G_OBJECT_CLASS (parent_class)->dispose (obj);
 }
 
@@ -200,163 +248,209 @@ GType job_get_type (void)
         return type;
 }
 
-static gsize status_output_size (gchar *job)
+/*
+ * parts are indexed for low latency hls only, others keep the first entry to
+ * have a uniform layout of share memory.
+ */
+static guint64 part_index_size (Job *job)
+{
+        if (jobdesc_m3u8streaming_part_duration (job->spec) != 0) {
+                return PART_INDEX_SIZE;
+        }
+
+        return 1;
+}
+
+static gsize status_output_size (Job *job)
 {
         gsize size;
         gint i;
         gchar *pipeline;
 
-        size = (strlen (job) / 8 + 1) * 8; /* job description, 64 bit alignment */
+        size = (strlen (job->description) / 8 + 1) * 8; /* job description, 64 bit alignment */
         size += sizeof (guint64); /* state */
-        size += jobdesc_streams_count (job, "source") * sizeof (struct _SourceStreamState);
-        for (i = 0; i < jobdesc_encoders_count (job); i++) {
+        size += sizeof (guint64); /* warm restart */
+        size += CPUSET_WORDS * sizeof (guint64); /* cpuset */
+        size += sizeof (gint64); /* numa node */
+        size += jobdesc_streams_count (job->spec, "source") * sizeof (struct _SourceStreamState);
+        for (i = 0; i < jobdesc_encoders_count (job->spec); i++) {
                 size += sizeof (GstClockTime); /* encoder heartbeat */
                 size += sizeof (gboolean); /* end of stream */
                 pipeline = g_strdup_printf ("encoder.%d", i);
-                size += jobdesc_streams_count (job, pipeline) * sizeof (struct _EncoderStreamState); /* encoder state */
+                size += jobdesc_streams_count (job->spec, pipeline) * sizeof (struct _EncoderStreamState); /* encoder state */
                 g_free (pipeline);
                 size += sizeof (guint64); /* cache head */
                 size += sizeof (guint64); /* cache tail */
                 size += sizeof (guint64); /* last rap (random access point) */
+                size += sizeof (guint64); /* gop index head */
+                size += sizeof (guint64); /* gop index tail */
+                size += GOP_INDEX_SIZE * sizeof (GOPIndexEntry); /* gop index */
+                size += sizeof (guint64); /* part index head */
+                size += sizeof (guint64); /* part index tail */
+                size += part_index_size (job) * sizeof (PartIndexEntry); /* part index */
                 size += sizeof (guint64); /* total count */
+                size += sizeof (guint32); /* generation */
+                size += sizeof (guint32); /* waiting */
+                size += sizeof (guint32); /* seqlock */
+                size += sizeof (GstClockTime); /* end timestamp */
+                size += sizeof (guint64); /* init segment size */
+                size += INIT_SEGMENT_SIZE; /* init segment */
         }
 
         return size;
 }
 
-static gint http_client_request (Job *job, guint8 *data, gsize count)
+/*
+ * request of init segment of cmaf, copied out of shm. FALSE if no init segment or encoder stalled.
+ */
+static gboolean init_segment_request (Job *job, EncoderOutput *encoder_output, gchar *encoder_output_path, PushRequest *request)
 {
-	gint socketfd;
-        struct hostent *hostp;
-        struct sockaddr_in serveraddr;
-        gint ret, len;
-        gsize sent;
-
-        socketfd = socket (AF_INET, SOCK_STREAM, 0);
-        memset (&serveraddr, 0x00, sizeof (struct sockaddr_in));
-        serveraddr.sin_family = AF_INET;
-        serveraddr.sin_port = htons (job->m3u8push_port);
-        serveraddr.sin_addr.s_addr = inet_addr (job->m3u8push_host);
-        if ((serveraddr.sin_addr.s_addr = inet_addr (job->m3u8push_host)) == (unsigned long)INADDR_NONE) {
-                hostp = gethostbyname (job->m3u8push_host);
-                if (hostp == (struct hostent *)NULL) {
-                        GST_ERROR ("put segment, host %s not found", job->m3u8push_host);
-                        g_free (data);
-                        return -1;
-                }
-                memcpy (&serveraddr.sin_addr, hostp->h_addr, sizeof (serveraddr.sin_addr));
-        }
-        ret = connect (socketfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr));
-        if (ret < 0) {
-                GST_ERROR ("put segment, connect error: %s", g_strerror (errno));
-                g_free (data);
-                return  -1;
-        }
-
-        sent = 0;
-        while (sent < count) {
-                len = INT_MAX < count - sent ? INT_MAX : count - sent;
-                ret = write (socketfd, data + sent, len);
-                if (ret == -1) {
-                        if (errno == EAGAIN) {
-                                /* block, wait 50ms */
-                                g_usleep (50000);
-                                continue;
-                        }
-                        GST_INFO ("Write error: %s", g_strerror (errno));
-                        break;
+        gchar *header, *request_uri, *buf;
+        guint64 size;
+        gsize len;
+        guint32 sequence;
+
+        request_uri = g_strdup_printf ("%s/%s/init.mp4", job->m3u8push_path, encoder_output_path);
+        buf = NULL;
+        do {
+                g_free (buf);
+                sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (sequence)) {
+                        g_free (request_uri);
+                        return FALSE;
                 }
-                sent += ret;
+                size = MIN (*(encoder_output->init_size), INIT_SEGMENT_SIZE);
+                header = g_strdup_printf (HTTP_PUT, request_uri, PACKAGE_NAME, PACKAGE_VERSION, job->m3u8push_host, size);
+                len = strlen (header);
+                buf = g_malloc (len + size);
+                memcpy (buf, header, len);
+                memcpy (buf + len, encoder_output->init_segment, size);
+                g_free (header);
+        } while (encoder_output_read_retry (encoder_output, sequence));
+        if (size == 0) {
+                GST_ERROR ("init segment %s not found", request_uri);
+                g_free (request_uri);
+                g_free (buf);
+                return FALSE;
         }
-        close (socketfd);
-        g_free (data);
+        g_free (request_uri);
+        memset (request, 0, sizeof (PushRequest));
+        request->data = buf;
+        request->count = len + size;
 
-        return sent;
+        return TRUE;
 }
 
 static void m3u8push_thread_func (gpointer data, gpointer user_data)
 {
         Job *job = (Job *)user_data;
         m3u8PushRequest *m3u8_push_request = (m3u8PushRequest *)data;
-        gchar *header, *request_uri, *encoder_output_path, *p;
+        EncoderOutput *encoder_output = m3u8_push_request->encoder_output;
+        PushRequest requests[4];
+        gchar *header, *request_uri, *segment_uri, *encoder_output_path, *p, *playlist;
+        GOPIndexEntry *entry;
+        gint64 sequence;
         guint64 rap_addr;
-        GstClockTime t;
-        gsize segment_size, count;
-        guint8 *buf, *playlist;
+        gsize segment_size;
+        guint32 read_sequence;
+        gboolean pushed;
+        gint n;
 
         /* seek gop it's timestamp is m3u8_push_request->timestamp */
-        sem_wait (m3u8_push_request->encoder_output->semaphore);
-        rap_addr = *(m3u8_push_request->encoder_output->head_addr);
-        while (rap_addr != *(m3u8_push_request->encoder_output->last_rap_addr)) {
-                t = encoder_output_rap_timestamp (m3u8_push_request->encoder_output, rap_addr);
-                if (m3u8_push_request->timestamp == t) {
+        do {
+                read_sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (read_sequence)) {
+                        sequence = -1;
                         break;
                 }
-                rap_addr = encoder_output_rap_next (m3u8_push_request->encoder_output, rap_addr);
-        }
-        sem_post (m3u8_push_request->encoder_output->semaphore);
+                sequence = encoder_output_gop_seek (encoder_output, m3u8_push_request->timestamp);
+                if (sequence != -1) {
+                        entry = encoder_output_gop_index_entry (encoder_output, sequence);
+                        rap_addr = entry->offset;
+                        segment_size = entry->size;
+                }
+        } while (encoder_output_read_retry (encoder_output, read_sequence));
 
         /* encoder output path */
-        encoder_output_path = g_strdup (m3u8_push_request->encoder_output->name);
+        encoder_output_path = g_strdup (encoder_output->name);
         p = strchr (encoder_output_path, '.');
         *p = '/';
 
-        /* header */
-        segment_size = encoder_output_gop_size (m3u8_push_request->encoder_output, rap_addr);
-        request_uri = g_strdup_printf ("%s/%s/%lu.ts", job->m3u8push_path, encoder_output_path, m3u8_push_request->timestamp);
-        header = g_strdup_printf (HTTP_PUT, request_uri, PACKAGE_NAME, PACKAGE_VERSION, job->m3u8push_host, segment_size);
-
-        /* copy header to buffer */
-        count = segment_size + strlen (header);
-        buf = g_malloc (count);
-        memcpy (buf, header, strlen (header));
-
-        /* copy body(segment) to buffer */
-        if (rap_addr + segment_size + 12 < m3u8_push_request->encoder_output->cache_size) {
-                memcpy (buf + strlen (header), m3u8_push_request->encoder_output->cache_addr + rap_addr + 12, segment_size);
+        memset (requests, 0, sizeof (requests));
+        n = 0;
+
+        /* put segment, body is sent from cache directly, playlist is put only if it succeed */
+        segment_uri = g_strdup_printf ("%s/%s/%lu.%s",
+                                       job->m3u8push_path,
+                                       encoder_output_path,
+                                       m3u8_push_request->timestamp,
+                                       encoder_output_segment_extension (encoder_output));
+        pushed = FALSE;
+        if (sequence != -1) {
+                /* put init segment of cmaf before segments until one pushed */
+                if (encoder_output->cmaf && (encoder_output->pushed_sequence_number == 0) &&
+                    init_segment_request (job, encoder_output, encoder_output_path, &requests[n])) {
+                        n++;
+                }
+                requests[n].data = g_strdup_printf (HTTP_PUT, segment_uri, PACKAGE_NAME, PACKAGE_VERSION, job->m3u8push_host, segment_size);
+                requests[n].count = strlen (requests[n].data);
+                requests[n].encoder_output = encoder_output;
+                requests[n].body_addr = rap_addr;
+                requests[n].body_size = segment_size;
+                n++;
+                pushed = pushclient_request (job->m3u8push_client, requests, n) == n;
+                if (pushed && encoder_output_gop_evicted (encoder_output, sequence)) {
+                        GST_ERROR ("segment %s overwritten while pushing", segment_uri);
+                        pushed = FALSE;
+                }
+                memset (requests, 0, sizeof (requests));
+                n = 0;
 
         } else {
-                gint n;
-                guint8 *p;
-
-                n = m3u8_push_request->encoder_output->cache_size - rap_addr - 12;
-                p = buf + strlen (header);
-                memcpy (p, m3u8_push_request->encoder_output->cache_addr + rap_addr + 12, n);
-                p += n;
-                memcpy (p, m3u8_push_request->encoder_output->cache_addr, segment_size - n);
+                GST_ERROR ("segment %s not found", segment_uri);
         }
-        g_free (header);
-
-        /* put segment */
-        http_client_request (job, buf, count);
 
         /* put playlist */
-        while ((m3u8_push_request->encoder_output->pushed_sequence_number + 1) != m3u8_push_request->sequence_number) {
-                /* waiting previous segment pushed */
+        while ((encoder_output->done_sequence_number + 1) != m3u8_push_request->sequence_number) {
+                /* waiting previous segment done */
                 g_usleep (50000);
         }
-        g_free (request_uri);
+        if (!pushed) {
+                GST_ERROR ("push segment %s failure, playlist not put", segment_uri);
+                encoder_output->done_sequence_number++;
+                g_free (m3u8_push_request->rm_segment);
+                g_free (segment_uri);
+                g_free (m3u8_push_request);
+                g_free (encoder_output_path);
+                return;
+        }
         request_uri = g_strdup_printf ("%s/%s/playlist.m3u8", job->m3u8push_path, encoder_output_path);
-        g_mutex_lock (&(m3u8_push_request->encoder_output->m3u8_playlist_mutex));
-        playlist = m3u8playlist_render (m3u8_push_request->encoder_output->m3u8_playlist);
-        g_mutex_unlock (&(m3u8_push_request->encoder_output->m3u8_playlist_mutex));
+        g_mutex_lock (&(encoder_output->m3u8_playlist_mutex));
+        playlist = m3u8playlist_render (encoder_output->m3u8_playlist);
+        g_mutex_unlock (&(encoder_output->m3u8_playlist_mutex));
         header = g_strdup_printf (HTTP_PUT, request_uri, PACKAGE_NAME, PACKAGE_VERSION, job->m3u8push_host, strlen (playlist));
-        buf = g_strdup_printf ("%s%s", header, playlist);
+        requests[n].data = g_strdup_printf ("%s%s", header, playlist);
+        requests[n].count = strlen (requests[n].data);
+        n++;
         g_free (header);
-        http_client_request (job, buf, strlen (buf));
-        m3u8_push_request->encoder_output->pushed_sequence_number++;
+        g_free (playlist);
+        g_free (request_uri);
 
         /* remove segment */
         if (m3u8_push_request->rm_segment != NULL) {
-                g_free (request_uri);
                 request_uri = g_strdup_printf ("%s/%s/%s", job->m3u8push_path, encoder_output_path, m3u8_push_request->rm_segment);
-                header = g_strdup_printf (HTTP_DELETE, request_uri,  PACKAGE_NAME, PACKAGE_VERSION, job->m3u8push_host);
-                http_client_request (job, header, strlen (header));
+                requests[n].data = g_strdup_printf (HTTP_DELETE, request_uri,  PACKAGE_NAME, PACKAGE_VERSION, job->m3u8push_host);
+                requests[n].count = strlen (requests[n].data);
+                n++;
+                g_free (request_uri);
                 g_free (m3u8_push_request->rm_segment);
         }
 
-        g_free (playlist);
-        g_free (request_uri);
+        pushclient_request (job->m3u8push_client, requests, n);
+        encoder_output->pushed_sequence_number = m3u8_push_request->sequence_number;
+        encoder_output->done_sequence_number++;
+
+        g_free (segment_uri);
         g_free (m3u8_push_request);
         g_free (encoder_output_path);
 }
@@ -365,25 +459,31 @@ static gchar * render_master_m3u8_playlist (Job *job)
 {
         GString *master_m3u8_playlist;
         gchar *p, *value;
+        guint version;
         gint i;
 
-        if (!jobdesc_m3u8streaming (job->description)) {
+        if (!jobdesc_m3u8streaming (job->spec)) {
                 /* m3u8streaming no enabled */
                 return "not found";
         }
 
         master_m3u8_playlist = g_string_new ("");
         g_string_append_printf (master_m3u8_playlist, M3U8_HEADER_TAG);
-        if (jobdesc_m3u8streaming_version (job->description) == 0) {
-                g_string_append_printf (master_m3u8_playlist, M3U8_VERSION_TAG, 3);
-
-        } else {
-                g_string_append_printf (master_m3u8_playlist, M3U8_VERSION_TAG, jobdesc_m3u8streaming_version (job->description));
+        version = jobdesc_m3u8streaming_version (job->spec);
+        if (version == 0) {
+                version = 3;
+        }
+        for (i = 0; i < job->output->encoder_count; i++) {
+                if (job->output->encoders[i].cmaf) {
+                        /* fragmented mp4 */
+                        version = MAX (version, 7);
+                }
         }
+        g_string_append_printf (master_m3u8_playlist, M3U8_VERSION_TAG, version);
 
         for (i = 0; i < job->output->encoder_count; i++) {
                 p = g_strdup_printf ("encoder.%d.elements.x264enc.property.bitrate", i);
-                value = jobdesc_element_property_value (job->description, p);
+                value = jobdesc_element_property_value (job->spec, p);
                 g_string_append_printf (master_m3u8_playlist, M3U8_STREAM_INF_TAG, 1, value);
                 g_string_append_printf (master_m3u8_playlist, "encoder/%d/playlist.m3u8\n", i);
                 g_free (p);
@@ -396,6 +496,79 @@ static gchar * render_master_m3u8_playlist (Job *job)
         return p;
 }
 
+/*
+ * open cache file of encoder: share memory or hugetlbfs file if daemon, otherwise memfd.
+ */
+static gint cache_open (Job *job, gint index, gboolean daemon, gchar *huge_page)
+{
+        gchar *name, *path;
+        gint fd;
+
+        name = g_strdup_printf ("%s.%d", job->name, index);
+        if (g_strcmp0 (huge_page, "hugetlbfs") == 0) {
+                if (daemon) {
+                        /* shared with worker by path */
+                        path = g_strdup_printf ("%s/%s", HUGETLBFS_PATH, name);
+                        fd = open (path, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+                        g_free (path);
+
+                } else {
+                        fd = memfd_create (name, MFD_CLOEXEC | MFD_HUGETLB);
+                }
+
+        } else if (daemon) {
+                /* daemon, use share memory. */
+                fd = shm_open (name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+
+        } else {
+                /* memfd rather than heap, so that cache can be sent by sendfile. */
+                fd = memfd_create (name, MFD_CLOEXEC);
+        }
+        if (fd == -1) {
+                GST_ERROR ("open cache %s error: %s", name, g_strerror (errno));
+        }
+        g_free (name);
+
+        return fd;
+}
+
+/*
+ * map cache twice back to back, data cross the end of cache is contiguous in memory.
+ * the mapping is huge page aligned, hugetlbfs maps need it and so does transparent huge page.
+ */
+static gchar * cache_mmap (gint fd, gsize size, gchar *huge_page)
+{
+        gchar *reserved, *addr;
+        gsize head;
+
+        if ((huge_page != NULL) && (size % HUGE_PAGE_SIZE != 0)) {
+                GST_ERROR ("cache size %lu is not multiple of huge page size", size);
+                return NULL;
+        }
+
+        /* reserve address space, one more huge page for alignment */
+        reserved = mmap (NULL, 2 * size + HUGE_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED) {
+                GST_ERROR ("mmap reserve error: %s", g_strerror (errno));
+                return NULL;
+        }
+        addr = (gchar *)(((guintptr)reserved + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+        head = addr - reserved;
+        if (head > 0) {
+                munmap (reserved, head);
+        }
+        /* tail slack, at least one page as head is less than a huge page */
+        munmap (addr + 2 * size, HUGE_PAGE_SIZE - head);
+        if ((mmap (addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) ||
+            (mmap (addr + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+                GST_ERROR ("mmap mirror error: %s", g_strerror (errno));
+                munmap (addr, 2 * size);
+                return NULL;
+        }
+
+        return addr;
+}
+
 /**
  * job_initialize:
  * @job: (in): the job to be initialized.
@@ -409,10 +582,15 @@ static gchar * render_master_m3u8_playlist (Job *job)
 gint job_initialize (Job *job, gboolean daemon)
 {
         gint i, fd;
+        gsize cache_size;
+        gchar *huge_page;
         JobOutput *output;
-        gchar *name, *p;
+        gchar *name, *p, *archive_path, *path;
+        gsize archive_file_size;
+        gint archive_files;
+        gboolean warm;
 
-        job->output_size = status_output_size (job->description);
+        job->output_size = status_output_size (job);
         if (daemon) {
                 /* daemon, use share memory */
                 fd = shm_open (job->name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
@@ -433,27 +611,28 @@ gint job_initialize (Job *job, gboolean daemon)
         p += (strlen (job->description) / 8 + 1) * 8;
         output->state = (guint64 *)p;
         p += sizeof (guint64); /* state */
+        output->warm_restart = (guint64 *)p;
+        warm = daemon && (*(output->warm_restart) != 0);
+        *(output->warm_restart) = 0;
+        p += sizeof (guint64); /* warm restart */
+        /* placement is written by gstreamill, worker applies it */
+        output->cpuset = (guint64 *)p;
+        p += CPUSET_WORDS * sizeof (guint64); /* cpuset */
+        output->numa_node = (gint64 *)p;
+        p += sizeof (gint64); /* numa node */
         output->source.sync_error_times = 0;
-        output->source.stream_count = jobdesc_streams_count (job->description, "source");
+        output->source.stream_count = jobdesc_streams_count (job->spec, "source");
         output->source.streams = (struct _SourceStreamState *)p;
         for (i = 0; i < output->source.stream_count; i++) {
                 output->source.streams[i].last_heartbeat = gst_clock_get_time (job->system_clock);
         }
         p += output->source.stream_count * sizeof (struct _SourceStreamState);
-        output->encoder_count = jobdesc_encoders_count (job->description);
+        output->encoder_count = jobdesc_encoders_count (job->spec);
         output->encoders = (struct _EncoderOutput *)g_malloc (output->encoder_count * sizeof (struct _EncoderOutput));
         for (i = 0; i < output->encoder_count; i++) {
                 name = g_strdup_printf ("encoder.%d", i);
                 g_strlcpy (output->encoders[i].name, name, STREAM_NAME_LEN);
-                output->encoders[i].stream_count = jobdesc_streams_count (job->description, name);
-                g_free (name);
-                name = g_strdup_printf ("/%s.%d", job->name, i);
-                output->encoders[i].semaphore = sem_open (name, O_CREAT, 0600, 1);
-                if (output->encoders[i].semaphore == SEM_FAILED) {
-                        GST_ERROR ("sem_open %s error: %s", name, g_strerror (errno));
-                        g_free (name);
-                        return 1;
-                }
+                output->encoders[i].stream_count = jobdesc_streams_count (job->spec, name);
                 g_free (name);
                 output->encoders[i].heartbeat = (GstClockTime *)p;
                 *(output->encoders[i].heartbeat) = gst_clock_get_time (job->system_clock);
@@ -465,6 +644,12 @@ gint job_initialize (Job *job, gboolean daemon)
                 p += output->encoders[i].stream_count * sizeof (struct _EncoderStreamState); /* encoder state */
 
                 output->encoders[i].mqdes = -1;
+                g_mutex_init (&(output->encoders[i].waiter_mutex));
+                g_cond_init (&(output->encoders[i].waiter_cond));
+                output->encoders[i].waiters = NULL;
+                output->encoders[i].waiter_thread = NULL;
+                output->encoders[i].waiter_stop = FALSE;
+                output->encoders[i].archive = NULL;
 
                 /* non live job has no output */
                 if (!job->is_live) {
@@ -472,62 +657,156 @@ gint job_initialize (Job *job, gboolean daemon)
                         continue;
                 }
 
-                if (daemon) {
-                        /* daemon, use share memory. */
-                        name = g_strdup_printf ("%s.%d", job->name, i);
-                        fd = shm_open (name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-                        if (ftruncate (fd, SHM_SIZE) == -1) {
-                                GST_ERROR ("ftruncate error: %s", g_strerror (errno));
-                                return 1;
-                        }
-                        output->encoders[i].cache_addr = mmap (NULL, SHM_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-                        output->encoders[i].cache_fd = fd;
-                        /* initialize gop size = 0. */
-                        *(gint32 *)(output->encoders[i].cache_addr + 8) = 0;
-                        g_free (name);
-
-                } else {
-                        output->encoders[i].cache_fd = -1;
-                        output->encoders[i].cache_addr = g_malloc (SHM_SIZE);
+                /* cache size, multiple of huge page size, mirror map need it page aligned too. */
+                cache_size = jobdesc_encoder_cache_size (job->spec, output->encoders[i].name);
+                if (cache_size == 0) {
+                        cache_size = SHM_SIZE;
+                }
+                cache_size = (cache_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+                huge_page = jobdesc_encoder_cache_huge_page (job->spec, output->encoders[i].name);
+                fd = cache_open (job, i, daemon, huge_page);
+                if (fd == -1) {
+                        g_free (huge_page);
+                        return 1;
+                }
+                if (ftruncate (fd, cache_size) == -1) {
+                        GST_ERROR ("ftruncate error: %s", g_strerror (errno));
+                        g_free (huge_page);
+                        return 1;
                 }
-                /* first gop timestamp is 0 */
-                *(GstClockTime *)(output->encoders[i].cache_addr) = 0;
-                output->encoders[i].cache_size = SHM_SIZE;
+                output->encoders[i].cache_addr = cache_mmap (fd, cache_size, huge_page);
+                if (output->encoders[i].cache_addr == NULL) {
+                        g_free (huge_page);
+                        return 1;
+                }
+                if ((g_strcmp0 (huge_page, "transparent") == 0) &&
+                    (madvise (output->encoders[i].cache_addr, 2 * cache_size, MADV_HUGEPAGE) == -1)) {
+                        GST_WARNING ("madvise huge page error: %s", g_strerror (errno));
+                }
+                g_free (huge_page);
+                output->encoders[i].cache_fd = fd;
+                GST_INFO ("%s cache size %lu", output->encoders[i].name, cache_size);
+                output->encoders[i].cache_size = cache_size;
                 output->encoders[i].head_addr = (guint64 *)p;
-                *(output->encoders[i].head_addr) = 0;
                 p += sizeof (guint64); /* cache head */
                 output->encoders[i].tail_addr = (guint64 *)p;
-                /* timestamp + gop size = 12 */
-                *(output->encoders[i].tail_addr) = 12;
                 p += sizeof (guint64); /* cache tail */
                 output->encoders[i].last_rap_addr = (guint64 *)p;
-                *(output->encoders[i].last_rap_addr) = 0;
                 p += sizeof (guint64); /* last rap addr */
+                output->encoders[i].gop_index_head = (guint64 *)p;
+                p += sizeof (guint64); /* gop index head */
+                output->encoders[i].gop_index_tail = (guint64 *)p;
+                p += sizeof (guint64); /* gop index tail */
+                output->encoders[i].gop_index = (GOPIndexEntry *)p;
+                p += GOP_INDEX_SIZE * sizeof (GOPIndexEntry); /* gop index */
+                output->encoders[i].part_index_head = (guint64 *)p;
+                p += sizeof (guint64); /* part index head */
+                output->encoders[i].part_index_tail = (guint64 *)p;
+                p += sizeof (guint64); /* part index tail */
+                output->encoders[i].part_index = (PartIndexEntry *)p;
+                output->encoders[i].part_index_size = part_index_size (job);
+                p += output->encoders[i].part_index_size * sizeof (PartIndexEntry); /* part index */
                 output->encoders[i].total_count = (guint64 *)p;
-                *(output->encoders[i].total_count) = 0;
                 p += sizeof (guint64); /* total count */
+                output->encoders[i].generation = (guint32 *)p;
+                p += sizeof (guint32); /* generation */
+                output->encoders[i].waiting = (guint32 *)p;
+                p += sizeof (guint32); /* waiting */
+                output->encoders[i].seqlock = (guint32 *)p;
+                output->encoders[i].stalled = 0;
+                p += sizeof (guint32); /* seqlock */
+                output->encoders[i].end_timestamp = (GstClockTime *)p;
+                p += sizeof (GstClockTime); /* end timestamp */
+                output->encoders[i].init_size = (guint64 *)p;
+                p += sizeof (guint64); /* init segment size */
+                output->encoders[i].init_segment = p;
+                p += INIT_SEGMENT_SIZE; /* init segment */
+                output->encoders[i].cmaf = jobdesc_encoder_is_cmaf (job->spec, output->encoders[i].name);
+                output->encoders[i].discontinuity = warm;
+                if (!warm) {
+                        *(output->encoders[i].head_addr) = 0;
+                        *(output->encoders[i].tail_addr) = 0;
+                        *(output->encoders[i].last_rap_addr) = 0;
+                        *(output->encoders[i].gop_index_head) = 0;
+                        /* first gop at cache head */
+                        memset (output->encoders[i].gop_index, 0, sizeof (GOPIndexEntry));
+                        *(output->encoders[i].gop_index_tail) = 1;
+                        /* first part of the first gop */
+                        *(output->encoders[i].part_index_head) = 0;
+                        memset (output->encoders[i].part_index, 0, sizeof (PartIndexEntry));
+                        *(output->encoders[i].part_index_tail) = 1;
+                        *(output->encoders[i].total_count) = 0;
+                        *(output->encoders[i].generation) = 0;
+                        *(output->encoders[i].waiting) = 0;
+                        *(output->encoders[i].seqlock) = 0;
+                        *(output->encoders[i].end_timestamp) = 0;
+                        *(output->encoders[i].init_size) = 0;
+
+                } else {
+                        /* gops of the crashed worker are kept, clients keep going. */
+                        GST_WARNING ("%s warm restart, attach to output of the crashed worker", output->encoders[i].name);
+                }
                 output->encoders[i].m3u8_playlist = NULL;
+                g_mutex_init (&(output->encoders[i].m3u8_playlist_mutex));
                 output->encoders[i].last_timestamp = 0;
                 output->encoders[i].sequence_number = 0;
                 output->encoders[i].pushed_sequence_number = 0;
+                output->encoders[i].done_sequence_number = 0;
+                output->encoders[i].part_duration = jobdesc_m3u8streaming_part_duration (job->spec);
+                output->encoders[i].ll_playlist = NULL;
+                output->encoders[i].ll_playlist_part = 0;
+                output->encoders[i].segment_duration = jobdesc_m3u8streaming_segment_duration (job->spec);
+                output->encoders[i].ll_discontinuity_sequence = 0;
+                output->encoders[i].ll_discontinuity_gop = 0;
+
+                /* time-shift archive, gops aged out of cache are still available from it. */
+                archive_path = jobdesc_archive_path (job->spec);
+                if (archive_path != NULL) {
+                        archive_file_size = jobdesc_archive_file_size (job->spec);
+                        if (archive_file_size == 0) {
+                                archive_file_size = ARCHIVE_FILE_SIZE;
+                        }
+                        archive_files = jobdesc_archive_files (job->spec);
+                        if (archive_files == 0) {
+                                archive_files = ARCHIVE_FILE_COUNT;
+                        }
+                        path = g_strdup_printf ("%s/%s/%d", archive_path, job->name, i);
+                        output->encoders[i].archive = archive_open (path, archive_file_size, archive_files, !warm);
+                        if (output->encoders[i].archive == NULL) {
+                                GST_ERROR ("open archive %s failure", path);
+                                g_free (path);
+                                g_free (archive_path);
+                                return 1;
+                        }
+                        g_free (path);
+                        g_free (archive_path);
+                }
         }
+        g_mutex_init (&(output->mpd_mutex));
+        output->mpd = NULL;
+        output->mpd_segments = 0;
+        output->availability_start_time = 0;
+        output->period = 0;
+        output->period_start = 0;
         job->output = output;
 
         /* m3u8 master playlist */
-        if (jobdesc_m3u8streaming (job->description)) {
+        if (jobdesc_m3u8streaming (job->spec)) {
                 job->output->master_m3u8_playlist = render_master_m3u8_playlist (job);
         }
 
         /* push to web server? */
-        job->m3u8push_uri = jobdesc_m3u8streaming_push_server_uri (job->description);
+        job->m3u8push_uri = jobdesc_m3u8streaming_push_server_uri (job->spec);
         if (job->m3u8push_uri != NULL) {
                 GError *err = NULL;
-                gchar *header, *request_uri, *buf;
+                PushRequest request;
+                gchar *header, *request_uri;
 
                 sscanf (job->m3u8push_uri, "http://%[^:/]", job->m3u8push_host);
                 job->m3u8push_port = 80;
                 sscanf (job->m3u8push_uri, "http://%*[^:]:%hu", &(job->m3u8push_port));
                 sscanf (job->m3u8push_uri, "http://%*[^/]%s", job->m3u8push_path);
+                job->m3u8push_client = pushclient_new (job->m3u8push_host, job->m3u8push_port);
                 job->m3u8push_thread_pool = g_thread_pool_new (m3u8push_thread_func, job, 10, TRUE, &err);
                 if (err != NULL) {
                         GST_ERROR ("Create m3u8push thread pool error %s", err->message);
@@ -543,8 +822,10 @@ gint job_initialize (Job *job, gboolean daemon)
                                           PACKAGE_VERSION,
                                           job->m3u8push_host,
                                           strlen (job->output->master_m3u8_playlist));
-                buf = g_strdup_printf ("%s%s", header, job->output->master_m3u8_playlist);
-                http_client_request (job, buf, strlen (buf));
+                memset (&request, 0, sizeof (PushRequest));
+                request.data = g_strdup_printf ("%s%s", header, job->output->master_m3u8_playlist);
+                request.count = strlen (request.data);
+                pushclient_request (job->m3u8push_client, &request, 1);
                 g_free (request_uri);
                 g_free (header);
         }
@@ -604,6 +885,8 @@ static void notify_function (union sigval sv)
         struct sigevent sev;
         GstClockTime last_timestamp;
         GstClockTime segment_duration;
+        gboolean discontinuity;
+        guint32 sequence;
         gsize size;
         gchar *url, buf[128];
         m3u8PushRequest *m3u8_push_request;
@@ -628,8 +911,16 @@ static void notify_function (union sigval sv)
         buf[size] = '\0';
         sscanf (buf, "%lu", &segment_duration);
 
-        last_timestamp = encoder_output_rap_timestamp (encoder_output, *(encoder_output->last_rap_addr));
-        url = g_strdup_printf ("%lu.ts", encoder_output->last_timestamp);
+        do {
+                sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (sequence)) {
+                        return;
+                }
+                last_timestamp = encoder_output_gop_index_entry (encoder_output, *(encoder_output->gop_index_tail) - 1)->timestamp;
+                /* the segment just completed */
+                discontinuity = encoder_output_gop_index_entry (encoder_output, *(encoder_output->gop_index_tail) - 2)->flags & GOP_FLAG_DISCONTINUITY;
+        } while (encoder_output_read_retry (encoder_output, sequence));
+        url = g_strdup_printf ("%lu.%s", encoder_output->last_timestamp, encoder_output_segment_extension (encoder_output));
 
         g_mutex_lock (&(encoder_output->m3u8_playlist_mutex));
 
@@ -649,7 +940,7 @@ static void notify_function (union sigval sv)
         }
 
         /* add new m3u8 playlist entry */
-        m3u8playlist_add_entry (encoder_output->m3u8_playlist, url, segment_duration);
+        m3u8playlist_add_entry (encoder_output->m3u8_playlist, url, segment_duration, discontinuity);
 
         g_mutex_unlock (&(encoder_output->m3u8_playlist_mutex));
 
@@ -657,6 +948,35 @@ static void notify_function (union sigval sv)
         g_free (url);
 }
 
+/**
+ * job_warm_restart:
+ * @job: (in): the job crashed.
+ *
+ * check if the crashed job can be warm restarted: the new worker attaches to the output of the crashed one,
+ * gops in cache and clients are kept, and playlist continues after a discontinuity. output being written
+ * when crashed maybe inconsistent, cold restart if so. must be called before job_reset.
+ *
+ * Returns: TRUE if warm restart.
+ */
+gboolean job_warm_restart (Job *job)
+{
+        gint i;
+
+        *(job->output->warm_restart) = 0;
+        if (!job->is_live || !jobdesc_is_warm_restart (job->spec)) {
+                return FALSE;
+        }
+        for (i = 0; i < job->output->encoder_count; i++) {
+                if (*(job->output->encoders[i].seqlock) & 1) {
+                        GST_WARNING ("%s crashed while writing output, cold restart", job->output->encoders[i].name);
+                        return FALSE;
+                }
+        }
+        *(job->output->warm_restart) = 1;
+
+        return TRUE;
+}
+
 /*
  * job_reset:
  * @job: job object
@@ -670,6 +990,7 @@ void job_reset (Job *job)
         GstDateTime *start_time;
         gint i;
         EncoderOutput *encoder;
+        M3U8Playlist *playlist, *old;
         guint version, window_size;
         struct sigevent sev;
         struct mq_attr attr;
@@ -700,25 +1021,45 @@ void job_reset (Job *job)
                 return;
         }
 
-        version = jobdesc_m3u8streaming_version (job->description);
+        /* timestamps of encoders continue only if warm restart */
+        if (*(job->output->warm_restart) == 0) {
+                dash_reset (job);
+        }
+
+        version = jobdesc_m3u8streaming_version (job->spec);
         if (version == 0) {
                 version = 3;
         }
-        window_size = jobdesc_m3u8streaming_window_size (job->description);
+        window_size = jobdesc_m3u8streaming_window_size (job->spec);
 
         for (i = 0; i < job->output->encoder_count; i++) {
                 encoder = &(job->output->encoders[i]);
                 name = g_strdup_printf ("/%s.%d", job->name, i);
 
-                if (jobdesc_m3u8streaming (job->description)) {
-                        /* reset m3u8 playlist */
-                        if (encoder->m3u8_playlist != NULL) {
-                                g_mutex_clear (&(encoder->m3u8_playlist_mutex));
-                                m3u8playlist_free (encoder->m3u8_playlist);
+                /* warm restart, playlist continues after a discontinuity. */
+                if (jobdesc_m3u8streaming (job->spec) && (*(job->output->warm_restart) == 0)) {
+                        /* reset m3u8 playlist, replaced under mutex as http requests may be reading it */
+                        if (encoder->cmaf) {
+                                /* fragmented mp4 segments need EXT-X-MAP of version 6 and fmp4 of version 7 */
+                                playlist = m3u8playlist_new (MAX (version, 7), window_size, FALSE, "init.mp4");
+
+                        } else {
+                                playlist = m3u8playlist_new (version, window_size, FALSE, NULL);
+                        }
+                        g_mutex_lock (&(encoder->m3u8_playlist_mutex));
+                        old = encoder->m3u8_playlist;
+                        encoder->m3u8_playlist = playlist;
+                        if (encoder->ll_playlist != NULL) {
+                                g_bytes_unref (encoder->ll_playlist);
+                                encoder->ll_playlist = NULL;
                         }
+                        encoder->ll_discontinuity_sequence = 0;
+                        encoder->ll_discontinuity_gop = 0;
                         encoder->m3u8push_thread_pool = job->m3u8push_thread_pool;
-                        encoder->m3u8_playlist = m3u8playlist_new (version, window_size, FALSE);
-                        g_mutex_init (&(encoder->m3u8_playlist_mutex));
+                        g_mutex_unlock (&(encoder->m3u8_playlist_mutex));
+                        if (old != NULL) {
+                                m3u8playlist_free (old);
+                        }
 
                         /* reset message queue */
                         if (encoder->mqdes != -1) {
@@ -745,18 +1086,9 @@ void job_reset (Job *job)
                         }
                 }
 
-                /* reset semaphore */
-                if (job->age > 0) {
-                        if (sem_close (encoder->semaphore) == -1) {
-                                GST_ERROR ("sem_close %s error: %s", name, g_strerror (errno));
-                        }
-                        if (sem_unlink (name) == -1) {
-                                GST_ERROR ("sem_unlink %s error: %s", name, g_strerror (errno));
-                        }
-                        encoder->semaphore = sem_open (name, O_CREAT, 0600, 1);
-                        if (encoder->semaphore == SEM_FAILED) {
-                                GST_ERROR ("sem_open %s error: %s", name, g_strerror (errno));
-                        }
+                /* worker may exit while writing output, readers would spin on odd seqlock */
+                if (job->is_live && (*(encoder->seqlock) & 1)) {
+                        __atomic_add_fetch (encoder->seqlock, 1, __ATOMIC_SEQ_CST);
                 }
 
                 g_free (name);
@@ -778,13 +1110,13 @@ gint job_start (Job *job)
         GstStateChangeReturn ret;
         gint i;
 
-        job->source = source_initialize (job->description, &(job->output->source));
+        job->source = source_initialize (job->spec, &(job->output->source));
         if (job->source == NULL) {
                 GST_ERROR ("Initialize job source error.");
                 return 1;
         }
 
-        if (encoder_initialize (job->encoder_array, job->description, job->output->encoders, job->source) != 0) {
+        if (encoder_initialize (job->encoder_array, job->spec, job->output->encoders, job->source) != 0) {
                 GST_ERROR ("Initialize job encoder error.");
                 return 1;
         }
@@ -10,8 +10,12 @@
 #include "config.h"
 #include "source.h"
 #include "encoder.h"
+#include "pushclient.h"
 
-#define SHM_SIZE 64*1024*1024
+#define SHM_SIZE (64 * 1024 * 1024)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define HUGETLBFS_PATH "/dev/hugepages"
+#define CPUSET_WORDS 16 /* cpu bitmap of worker placement, 1024 cpus */
 
 #define HTTP_PUT "PUT %s HTTP/1.1\r\n" \
                  "User-Agent: %s-%s\r\n" \
@@ -38,17 +42,29 @@ typedef struct _m3u8PushRequest {
 typedef struct _JobOutput {
         gchar *job_description;
         guint64 *state;
+        guint64 *warm_restart; /* not zero if worker attaches to output of the crashed worker */
+        guint64 *cpuset; /* cpus of worker, CPUSET_WORDS words bitmap, all zero if not placed */
+        gint64 *numa_node; /* numa node of worker memory, valid if cpuset is not empty */
         SourceState source;
         gint64 encoder_count;
         EncoderOutput *encoders;
 
         gchar *master_m3u8_playlist;
+
+        /* mpeg dash, mpd rendered when new segment output */
+        GMutex mpd_mutex;
+        GBytes *mpd;
+        guint64 mpd_segments; /* sum of gop index tails of encoders when mpd rendered */
+        gint64 availability_start_time; /* wall clock of timestamp 0 in microseconds, 0 if not fixed */
+        guint period; /* id of period, new period on cold restart */
+        gint64 period_start; /* start of period from availability start time in microseconds, -1 if not fixed */
 } JobOutput;
 
 struct _Job {
         GObject parent;
 
         gchar *description;
+        JobSpec *spec; /* parsed description */
         gchar *name; /* same as the name in job config file */
         gboolean is_live;
         gboolean eos;
@@ -70,6 +86,7 @@ struct _Job {
         guint64 last_ctime; /* last process cpu time */
         guint64 start_ctime; /* cpu time at process start */
         gint cpu_average;
+        gdouble cost; /* cpus estimated by admission control */
         gint cpu_current;
         gint memory;
 
@@ -81,6 +98,7 @@ struct _Job {
         gchar m3u8push_path[128];
         guint16 m3u8push_port;
         GThreadPool *m3u8push_thread_pool;
+        PushClient *m3u8push_client;
 };
 
 struct _JobClass {
@@ -99,6 +117,7 @@ GType job_get_type (void);
 
 gint job_initialize (Job *job, gboolean daemon);
 void job_reset (Job *job);
+gboolean job_warm_restart (Job *job);
 void job_stat_update (Job *job);
 gint job_start (Job *job);
 
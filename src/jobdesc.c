@@ -1,247 +1,426 @@
 /*
  * json type of job description parser
  *
+ * job description is parsed once into JobSpec, accessors read from it.
+ *
  * Copyright (C) Zhang Ping <dqzhangp@163.com>
  *
  */
 
 #include <stdio.h>
 
-#include "parson.h"
 #include "jobdesc.h"
 
 GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
 #define GST_CAT_DEFAULT GSTREAMILL
 
-gboolean jobdesc_is_valid (gchar *job)
+static gchar ** strings_dup (JSON_Array *array)
+{
+        gchar **strings;
+        gint i, count;
+
+        count = json_array_get_count (array);
+        strings = g_malloc ((count + 1) * sizeof (gchar *));
+        for (i = 0; i < count; i++) {
+                strings[i] = g_strdup (json_array_get_string (array, i));
+        }
+        strings[i] = NULL;
+
+        return strings;
+}
+
+static gint bins_stream_count (gchar **bins, gchar *ptype)
+{
+        gint count;
+
+        count = 0;
+        for (; *bins != NULL; bins++) {
+                if (g_strrstr (*bins, ptype) != NULL) {
+                        count += 1;
+                }
+        }
+
+        return count;
+}
+
+/*
+ * cache size of encoder, configured by size in bytes or duration in seconds,
+ * bitrate(bit/s) is estimated by x264enc bitrate with 25% overhead if not configured.
+ * return 0 if not configured.
+ */
+static gsize encoder_cache_size (JSON_Object *obj, gint index)
+{
+        gdouble size, duration, bitrate;
+
+        size = json_object_dotget_number (obj, "cache.size");
+        duration = json_object_dotget_number (obj, "cache.duration");
+        if ((size == 0) && (duration > 0)) {
+                bitrate = json_object_dotget_number (obj, "cache.bitrate");
+                if (bitrate == 0) {
+                        /* x264enc bitrate in kbit/s */
+                        bitrate = json_object_dotget_number (obj, "elements.x264enc.property.bitrate") * 1000 * 1.25;
+                }
+                if (bitrate == 0) {
+                        GST_WARNING ("encoder.%d cache duration configured without bitrate", index);
+                }
+                size = duration * bitrate / 8;
+        }
+
+        return size;
+}
+
+/*
+ * append bins, numeric and boolean element properties of a pipeline to profile.
+ */
+static void pipeline_profile (GString *profile, JSON_Object *pipeline)
+{
+        JSON_Array *bins;
+        JSON_Object *elements, *properties;
+        JSON_Value *value;
+        const gchar *element, *property;
+        gint i, j;
+
+        bins = json_object_get_array (pipeline, "bins");
+        for (i = 0; i < json_array_get_count (bins); i++) {
+                g_string_append_printf (profile, "|%s", json_array_get_string (bins, i));
+        }
+        elements = json_object_get_object (pipeline, "elements");
+        for (i = 0; i < json_object_get_count (elements); i++) {
+                element = json_object_get_name (elements, i);
+                properties = json_object_dotget_object (json_object_get_object (elements, element), "property");
+                for (j = 0; j < json_object_get_count (properties); j++) {
+                        property = json_object_get_name (properties, j);
+                        value = json_object_get_value (properties, property);
+                        if (json_value_get_type (value) == JSONNumber) {
+                                g_string_append_printf (profile, "|%s.%s=%g", element, property, json_value_get_number (value));
+
+                        } else if (json_value_get_type (value) == JSONBoolean) {
+                                g_string_append_printf (profile, "|%s.%s=%d", element, property, json_value_get_boolean (value));
+                        }
+                }
+        }
+}
+
+/*
+ * profile of job: bins, numeric and boolean element properties of source, encoders and scaling ladder.
+ * string properties are left out, they are locations, hosts and names of channels mostly.
+ */
+static gchar * job_profile (JSON_Object *obj)
+{
+        GString *profile;
+        JSON_Array *encoders, *rungs;
+        JSON_Object *ladder;
+        gint i, j;
+
+        profile = g_string_new ("source");
+        /* demux and decode of source, a multi rendition source costs as much as encoders */
+        pipeline_profile (profile, json_object_get_object (obj, "source"));
+        g_string_append (profile, "\n");
+        encoders = json_object_get_array (obj, "encoders");
+        for (i = 0; i < json_array_get_count (encoders); i++) {
+                g_string_append_printf (profile, "encoder.%d", i);
+                pipeline_profile (profile, json_array_get_object (encoders, i));
+                g_string_append (profile, "\n");
+        }
+        ladder = json_object_dotget_object (obj, "source.ladder");
+        for (i = 0; i < json_object_get_count (ladder); i++) {
+                rungs = json_object_get_array (ladder, json_object_get_name (ladder, i));
+                for (j = 0; j < json_array_get_count (rungs); j++) {
+                        g_string_append_printf (profile, "|ladder=%s", json_array_get_string (rungs, j));
+                }
+        }
+
+        return g_string_free (profile, FALSE);
+}
+
+/*
+ * encoder index of pipeline, encoder.n or encoder.n.elements..., -1 if invalid.
+ */
+static gint encoder_index (JobSpec *spec, gchar *pipeline)
+{
+        gint index;
+
+        if ((sscanf (pipeline, "encoder.%d", &index) != 1) || (index < 0) || (index >= spec->encoder_count)) {
+                return -1;
+        }
+
+        return index;
+}
+
+/*
+ * json object of encoder.n or source.
+ */
+static JSON_Object * pipeline_object (JobSpec *spec, gchar *pipeline)
 {
-        JSON_Value *val;
         JSON_Object *obj;
+        gint index;
+
+        obj = json_value_get_object (spec->root);
+        if (g_str_has_prefix (pipeline, "encoder")) {
+                index = encoder_index (spec, pipeline);
+                if (index == -1) {
+                        return NULL;
+                }
+                return json_array_get_object (json_object_get_array (obj, "encoders"), index);
+        }
+
+        return json_object_get_object (obj, "source");
+}
+
+/**
+ * jobspec_new:
+ * @job: (in): json type of job description.
+ *
+ * parse job description, the only place job description is parsed.
+ *
+ * Returns: JobSpec, NULL if job description is invalid.
+ */
+JobSpec * jobspec_new (gchar *job)
+{
+        JSON_Value *val;
+        JSON_Object *obj, *source, *encoder, *ladder;
+        JSON_Array *encoders;
+        JobSpec *spec;
+        JobSpecEncoder *e;
+        gint i;
 
-        val = json_parse_string(job);
+        val = json_parse_string (job);
         if (val == NULL) {
                 GST_ERROR ("parse job error.");
-                return FALSE;
+                return NULL;
 
         } else if (json_value_get_type (val) != JSONObject){
                 GST_ERROR ("job is not a json object.");
                 json_value_free (val);
-                return FALSE;
+                return NULL;
         }
         obj = json_value_get_object (val);
 
         if (json_object_get_string (obj, "name") == NULL) {
                 GST_ERROR ("invalid job without name property.");
                 json_value_free (val);
-                return FALSE;
+                return NULL;
         }
-        json_value_free (val);
 
-        return TRUE;
+        spec = g_malloc0 (sizeof (JobSpec));
+        spec->root = val;
+        spec->name = g_strdup (json_object_get_string (obj, "name"));
+        /* without is-live or warm-restart configure item, default is TRUE */
+        spec->is_live = json_object_dotget_boolean (obj, "is-live") ? TRUE : FALSE;
+        spec->warm_restart = json_object_dotget_boolean (obj, "warm-restart") ? TRUE : FALSE;
+        spec->heartbeat_timeout = json_object_dotget_number (obj, "heartbeat-timeout");
+        spec->cpu_cost = json_object_dotget_number (obj, "cpu-cost");
+        spec->debug = g_strdup (json_object_get_string (obj, "debug"));
+        spec->log_path = g_strdup (json_object_get_string (obj, "log-path"));
+
+        source = json_object_get_object (obj, "source");
+        spec->source_bins = strings_dup (json_object_get_array (source, "bins"));
+        spec->source_stream_count = bins_stream_count (spec->source_bins, "appsink");
+        /* every rung of scaling ladder is a source stream */
+        ladder = json_object_get_object (source, "ladder");
+        for (i = 0; i < json_object_get_count (ladder); i++) {
+                spec->ladder_rungs += json_array_get_count (json_object_get_array (ladder, json_object_get_name (ladder, i)));
+        }
+        spec->source_stream_count += spec->ladder_rungs;
+
+        encoders = json_object_get_array (obj, "encoders");
+        spec->encoder_count = json_array_get_count (encoders);
+        spec->encoders = g_malloc0 (spec->encoder_count * sizeof (JobSpecEncoder));
+        for (i = 0; i < spec->encoder_count; i++) {
+                encoder = json_array_get_object (encoders, i);
+                e = &(spec->encoders[i]);
+                e->bins = strings_dup (json_object_get_array (encoder, "bins"));
+                e->stream_count = bins_stream_count (e->bins, "appsrc");
+                e->udpstreaming = g_strdup (json_object_get_string (encoder, "udpstreaming"));
+                e->cache_size = encoder_cache_size (encoder, i);
+                e->cache_huge_page = g_strdup (json_object_dotget_string (encoder, "cache.huge-page"));
+                e->cmaf = (g_strcmp0 (json_object_get_string (encoder, "format"), "cmaf") == 0);
+        }
+
+        spec->m3u8streaming = (json_object_get_object (obj, "m3u8streaming") != NULL);
+        spec->m3u8streaming_version = json_object_dotget_number (obj, "m3u8streaming.version");
+        spec->m3u8streaming_window_size = json_object_dotget_number (obj, "m3u8streaming.window-size");
+        spec->m3u8streaming_segment_duration = GST_SECOND * json_object_dotget_number (obj, "m3u8streaming.segment-duration");
+        spec->m3u8streaming_part_duration = GST_SECOND * json_object_dotget_number (obj, "m3u8streaming.part-duration");
+        spec->m3u8streaming_push_server_uri = g_strdup (json_object_dotget_string (obj, "m3u8streaming.push-server-uri"));
+
+        spec->archive_path = g_strdup (json_object_dotget_string (obj, "archive.path"));
+        spec->archive_file_size = json_object_dotget_number (obj, "archive.file-size");
+        spec->archive_files = json_object_dotget_number (obj, "archive.files");
+
+        spec->profile = job_profile (obj);
+
+        /* parts are cut at buffer boundaries, a part of fragmented mp4 would not be a moof and mdat */
+        for (i = 0; i < spec->encoder_count; i++) {
+                if (spec->encoders[i].cmaf && (spec->m3u8streaming_part_duration != 0)) {
+                        GST_ERROR ("invalid job %s, part-duration is not supported by cmaf encoder.", spec->name);
+                        jobspec_free (spec);
+                        return NULL;
+                }
+        }
+
+        return spec;
 }
 
-gchar * jobdesc_get_name (gchar *job)
+void jobspec_free (JobSpec *spec)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        gchar *name, *ret;
+        gint i;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        name = (gchar *)json_object_get_string (obj, "name");
-        ret = g_strdup (name);
-        json_value_free (val);
+        for (i = 0; i < spec->encoder_count; i++) {
+                g_strfreev (spec->encoders[i].bins);
+                g_free (spec->encoders[i].udpstreaming);
+                g_free (spec->encoders[i].cache_huge_page);
+        }
+        g_free (spec->encoders);
+        g_strfreev (spec->source_bins);
+        g_free (spec->name);
+        g_free (spec->debug);
+        g_free (spec->log_path);
+        g_free (spec->m3u8streaming_push_server_uri);
+        g_free (spec->archive_path);
+        g_free (spec->profile);
+        json_value_free (spec->root);
+        g_free (spec);
+}
 
-        return ret;
+gchar * jobdesc_get_name (JobSpec *spec)
+{
+        return g_strdup (spec->name);
 }
 
-gint jobdesc_streams_count (gchar *job, gchar *pipeline)
+gint jobdesc_streams_count (JobSpec *spec, gchar *pipeline)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        JSON_Array *array;
-        gsize size, i;
-        gint count, index;
-        gchar *bin, *ptype;
+        gint index;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
         if (g_str_has_prefix (pipeline, "encoder")) {
-                ptype = "appsrc";
-                array = json_object_dotget_array (obj, "encoders");
-                sscanf (pipeline, "encoder.%d", &index);
-                obj = json_array_get_object (array, index);
-
-        } else if (g_str_has_prefix (pipeline, "source")) {
-                ptype = "appsink";
-                obj = json_object_get_object (obj, "source");
+                index = encoder_index (spec, pipeline);
+                return index == -1 ? 0 : spec->encoders[index].stream_count;
         }
-        array = json_object_dotget_array (obj, "bins");
-        size = json_array_get_count (array);
-        count = 0;
-        for (i = 0; i < size; i++) {
-                bin = (gchar *)json_array_get_string (array, i);
-                if (g_strrstr (bin, ptype) != NULL)
-                        count += 1;
-        }
-        json_value_free (val);
 
-        return count;
+        return spec->source_stream_count;
 }
 
-gint jobdesc_encoders_count (gchar *job)
+gint jobdesc_encoders_count (JobSpec *spec)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        JSON_Array *encoders;
-        gint count;
-
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        encoders = json_object_dotget_array (obj, "encoders");
-        count = json_array_get_count (encoders);
-        json_value_free (val);
+        return spec->encoder_count;
+}
 
-        return count;
+gboolean jobdesc_is_live (JobSpec *spec)
+{
+        return spec->is_live;
 }
 
-gboolean jobdesc_is_live (gchar *job)
+gboolean jobdesc_is_warm_restart (JobSpec *spec)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
+        return spec->warm_restart;
+}
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
+gint64 jobdesc_heartbeat_timeout (JobSpec *spec)
+{
+        return spec->heartbeat_timeout;
+}
 
-        /* without is-live configure item, default is live */
-        if (json_object_dotget_boolean (obj, "is-live")) {
-                json_value_free (val);
-                return TRUE;
-        }
-        json_value_free (val);
+gdouble jobdesc_cpu_cost (JobSpec *spec)
+{
+        return spec->cpu_cost;
+}
 
-        return FALSE;
+gchar * jobdesc_get_debug (JobSpec *spec)
+{
+        return g_strdup (spec->debug);
 }
 
-gchar * jobdesc_get_debug (gchar *job)
+gchar * jobdesc_get_log_path (JobSpec *spec)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        gchar *debug, *p;
+        return g_strdup (spec->log_path);
+}
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        p = (gchar *)json_object_get_string (obj, "debug");
-        if (p == NULL) {
-                debug = NULL;
+gchar ** jobdesc_bins (JobSpec *spec, gchar *pipeline)
+{
+        gint index;
 
-        } else {
-                debug = g_strdup (p);
+        if (g_str_has_prefix (pipeline, "encoder")) {
+                index = encoder_index (spec, pipeline);
+                if (index == -1) {
+                        return g_malloc0 (sizeof (gchar *));
+                }
+                return g_strdupv (spec->encoders[index].bins);
         }
-        json_value_free (val);
 
-        return debug;
+        return g_strdupv (spec->source_bins);
 }
 
-gchar * jobdesc_get_log_path (gchar *job)
+gchar * jobdesc_udpstreaming (JobSpec *spec, gchar *pipeline)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        gchar *log_path, *p;
-
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        p = (gchar *)json_object_get_string (obj, "log-path");
-        if (p == NULL) {
-                log_path = NULL;
+        gint index;
 
-        } else {
-                log_path = g_strdup (p);
+        index = encoder_index (spec, pipeline);
+        if (index == -1) {
+                return NULL;
         }
-        json_value_free (val);
 
-        return log_path;
+        return g_strdup (spec->encoders[index].udpstreaming);
 }
 
-gchar ** jobdesc_bins (gchar *job, gchar *pipeline)
+gsize jobdesc_encoder_cache_size (JobSpec *spec, gchar *pipeline)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        JSON_Array *array;
-        gint i, count, index;
-        gchar **p, *bin;
-
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        if (g_str_has_prefix (pipeline, "encoder")) {
-                array = json_object_dotget_array (obj, "encoders");
-                sscanf (pipeline, "encoder.%d", &index);
-                obj = json_array_get_object (array, index);
+        gint index;
 
-        } else if (g_str_has_prefix (pipeline, "source")) {
-                obj = json_object_get_object (obj, "source");
+        index = encoder_index (spec, pipeline);
+        if (index == -1) {
+                return 0;
         }
-        array = json_object_get_array (obj, "bins");
-        count = json_array_get_count (array);
-        p = g_malloc ((count + 1) * sizeof (gchar *));
-        for (i = 0; i < count; i++) {
-                bin = (gchar *)json_array_get_string (array, i);
-                p[i] = g_strdup (bin);
+
+        return spec->encoders[index].cache_size;
+}
+
+/*
+ * output format of encoder, fragmented mp4 if "format" is "cmaf", mpeg2 ts otherwise.
+ */
+gboolean jobdesc_encoder_is_cmaf (JobSpec *spec, gchar *pipeline)
+{
+        gint index;
+
+        index = encoder_index (spec, pipeline);
+        if (index == -1) {
+                return FALSE;
         }
-        p[i] = NULL;
-        json_value_free (val);
 
-        return p;
+        return spec->encoders[index].cmaf;
 }
 
-gchar * jobdesc_udpstreaming (gchar *job, gchar *pipeline)
+/*
+ * huge page backing of encoder cache, "transparent" or "hugetlbfs", NULL if not configured.
+ */
+gchar * jobdesc_encoder_cache_huge_page (JobSpec *spec, gchar *pipeline)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        JSON_Array *array;
         gint index;
-        gchar *p, *udpstreaming;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        array = json_object_dotget_array (obj, "encoders");
-        sscanf (pipeline, "encoder.%d", &index);
-        obj = json_array_get_object (array, index);
-        p = (gchar *)json_object_get_string (obj, "udpstreaming");
-        if (p == NULL) {
-                udpstreaming = NULL;
-
-        } else {
-                udpstreaming = g_strdup (p);
+        index = encoder_index (spec, pipeline);
+        if (index == -1) {
+                return NULL;
         }
-        json_value_free (val);
 
-        return udpstreaming;
+        return g_strdup (spec->encoders[index].cache_huge_page);
 }
 
-gchar ** jobdesc_element_properties (gchar *job, gchar *element)
+gchar ** jobdesc_element_properties (JobSpec *spec, gchar *element)
 {
-        JSON_Value *val;
         JSON_Object *obj;
-        JSON_Array *array;
         gchar *p, **properties, **pp;
         gsize count;
-        gint i, index;
+        gint i;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
+        obj = NULL;
         if (g_str_has_prefix (element, "encoder")) {
-                array = json_object_get_array (obj, "encoders");
-                sscanf (element, "encoder.%d", &index);
-                obj = json_array_get_object (array, index);
+                obj = pipeline_object (spec, element);
                 p = g_strrstr (element, "elements");
                 obj = json_object_dotget_object (obj, p);
 
         } else if (g_str_has_prefix (element, "source")) {
-                obj = json_object_dotget_object (obj, element);
+                obj = json_object_dotget_object (json_value_get_object (spec->root), element);
         }
         if (obj == NULL) {
-                json_value_free (val);
                 return NULL;
         }
         count = json_object_get_count (obj);
@@ -253,7 +432,6 @@ gchar ** jobdesc_element_properties (gchar *job, gchar *element)
                 pp++;
         }
         *pp = NULL;
-        json_value_free (val);
 
         return properties;
 }
@@ -262,30 +440,23 @@ gchar ** jobdesc_element_properties (gchar *job, gchar *element)
  *
  * @property: (in): encoders.x.elements.element.property.name or source.elements.element.property.name
  */
-gchar * jobdesc_element_property_value (gchar *job, gchar *property)
+gchar * jobdesc_element_property_value (JobSpec *spec, gchar *property)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        JSON_Array *array;
         JSON_Value_Type type;
         JSON_Value *value;
         gchar *p;
         gint64 i;
         gdouble n;
-        gint index;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
+        value = NULL;
         if (g_str_has_prefix (property, "encoder")) {
-                array = json_object_dotget_array (obj, "encoders");
-                sscanf (property, "encoder.%d", &index);
-                obj = json_array_get_object (array, index);
                 p = g_strrstr (property, "elements");
-                value = json_object_dotget_value (obj, p);
+                value = json_object_dotget_value (pipeline_object (spec, property), p);
 
         } else if (g_str_has_prefix (property, "source")) {
-                value = json_object_dotget_value (obj, property);
+                value = json_object_dotget_value (json_value_get_object (spec->root), property);
         }
+        p = NULL;
         type = json_value_get_type (value);
         switch (type) {
         case JSONString:
@@ -315,114 +486,125 @@ gchar * jobdesc_element_property_value (gchar *job, gchar *property)
         default:
                 GST_ERROR ("property value invalid.");
         }
-        json_value_free (val);
 
         return p;
 }
 
-gchar * jobdesc_element_caps (gchar *job, gchar *element)
+gchar * jobdesc_element_caps (JobSpec *spec, gchar *element)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        JSON_Array *array;
-        gchar *p, *caps;
-        gint index;
-
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        if (g_str_has_prefix (element, "encoder")) {
-                array = json_object_dotget_array (obj, "encoders");
-                sscanf (element, "encoder.%d", &index);
-                obj = json_array_get_object (array, index);
+        gchar *p;
 
-        } else {
-                obj = json_object_get_object (obj, "source");
-        }
         p = g_strrstr (element, "elements");
-        caps = (gchar *)json_object_dotget_string (obj, p);
-        if (caps == NULL) {
-                p = NULL;
 
-        } else {
-	        p = g_strdup (caps);
-        }
-        json_value_free (val);
+        return g_strdup (json_object_dotget_string (pipeline_object (spec, element), p));
+}
 
-        return p;
+gboolean jobdesc_m3u8streaming (JobSpec *spec)
+{
+        return spec->m3u8streaming;
 }
 
-gboolean jobdesc_m3u8streaming (gchar *job)
+guint jobdesc_m3u8streaming_version (JobSpec *spec)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        gboolean m3u8streaming;
+        return spec->m3u8streaming_version;
+}
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        if (json_object_get_object (obj, "m3u8streaming") != NULL) {
-                m3u8streaming = TRUE;
+guint jobdesc_m3u8streaming_window_size (JobSpec *spec)
+{
+        return spec->m3u8streaming_window_size;
+}
 
-        } else {
-                m3u8streaming = FALSE;
-        }
-        json_value_free (val);
+GstClockTime jobdesc_m3u8streaming_segment_duration (JobSpec *spec)
+{
+        return spec->m3u8streaming_segment_duration;
+}
 
-        return m3u8streaming;
+GstClockTime jobdesc_m3u8streaming_part_duration (JobSpec *spec)
+{
+        return spec->m3u8streaming_part_duration;
 }
 
-guint jobdesc_m3u8streaming_version (gchar *job)
+gchar * jobdesc_m3u8streaming_push_server_uri (JobSpec *spec)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        guint version;
+        return g_strdup (spec->m3u8streaming_push_server_uri);
+}
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        version = json_object_dotget_number (obj, "m3u8streaming.version");
-        json_value_free (val);
+/*
+ * directory of time-shift archive, NULL if not configured.
+ */
+gchar * jobdesc_archive_path (JobSpec *spec)
+{
+        return g_strdup (spec->archive_path);
+}
+
+gsize jobdesc_archive_file_size (JobSpec *spec)
+{
+        return spec->archive_file_size;
+}
 
-        return version;
+gint jobdesc_archive_files (JobSpec *spec)
+{
+        return spec->archive_files;
 }
 
-guint jobdesc_m3u8streaming_window_size (gchar *job)
+/*
+ * ring slots of source stream, 0 if not configured.
+ */
+gint jobdesc_source_stream_ring_size (JobSpec *spec, gchar *stream)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        guint window_size;
+        gchar *name;
+        gint ring_size;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        window_size = json_object_dotget_number (obj, "m3u8streaming.window-size");
-        json_value_free (val);
+        name = g_strdup_printf ("source.streams.%s.ring-size", stream);
+        ring_size = json_object_dotget_number (json_value_get_object (spec->root), name);
+        g_free (name);
 
-        return window_size;
+        return ring_size;
 }
 
-GstClockTime jobdesc_m3u8streaming_segment_duration (gchar *job)
+/*
+ * bytes limit of samples in ring of source stream, 0 if not configured.
+ */
+gsize jobdesc_source_stream_ring_bytes (JobSpec *spec, gchar *stream)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        GstClockTime segment_duration;
+        gchar *name;
+        gsize ring_bytes;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        segment_duration = GST_SECOND * json_object_dotget_number (obj, "m3u8streaming.segment-duration");
-        json_value_free (val);
+        name = g_strdup_printf ("source.streams.%s.ring-bytes", stream);
+        ring_bytes = json_object_dotget_number (json_value_get_object (spec->root), name);
+        g_free (name);
 
-        return segment_duration;
+        return ring_bytes;
 }
 
-gchar * jobdesc_m3u8streaming_push_server_uri (gchar *job)
+/*
+ * overflow policy of ring of source stream, "block", "drop" or "report", NULL if not configured.
+ */
+gchar * jobdesc_source_stream_overflow (JobSpec *spec, gchar *stream)
 {
-        JSON_Value *val;
-        JSON_Object *obj;
-        gchar *ret, *push_url;
+        gchar *name, *overflow;
 
-        val = json_parse_string (job);
-        obj = json_value_get_object (val);
-        push_url = (gchar *)json_object_dotget_string (obj, "m3u8streaming.push-server-uri");
-        ret = g_strdup (push_url);
-        json_value_free (val);
+        name = g_strdup_printf ("source.streams.%s.overflow", stream);
+        overflow = g_strdup (json_object_dotget_string (json_value_get_object (spec->root), name));
+        g_free (name);
+
+        return overflow;
+}
+
+/*
+ * rungs of scaling ladder of source stream, "widthxheight" strings, NULL if not configured.
+ */
+gchar ** jobdesc_source_ladder (JobSpec *spec, gchar *stream)
+{
+        JSON_Array *array;
+        gchar *name;
+
+        name = g_strdup_printf ("source.ladder.%s", stream);
+        array = json_object_dotget_array (json_value_get_object (spec->root), name);
+        g_free (name);
+        if (array == NULL) {
+                return NULL;
+        }
 
-        return ret;
+        return strings_dup (array);
 }
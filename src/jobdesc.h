@@ -10,22 +10,78 @@
 
 #include <gst/gst.h>
 
-gboolean jobdesc_is_valid (gchar *job);
-gchar * jobdesc_get_name (gchar *job);
-gint jobdesc_encoders_count (gchar *job);
-gint jobdesc_streams_count (gchar *job, gchar *pipeline);
-gboolean jobdesc_is_live (gchar *job);
-gchar * jobdesc_get_debug (gchar *job);
-gchar * jobdesc_get_log_path (gchar *job);
-gchar ** jobdesc_bins (gchar *job, gchar *pipeline);
-gchar * jobdesc_udpstreaming (gchar *job, gchar *pipeline);
-gchar ** jobdesc_element_properties (gchar *job, gchar *element);
-gchar * jobdesc_element_property_value (gchar *job, gchar *property);
-gchar * jobdesc_element_caps (gchar *job, gchar *element);
-gboolean jobdesc_m3u8streaming (gchar *job);
-guint jobdesc_m3u8streaming_version (gchar *job);
-guint jobdesc_m3u8streaming_window_size (gchar *job);
-GstClockTime jobdesc_m3u8streaming_segment_duration (gchar *job);
-gchar * jobdesc_m3u8streaming_push_server_uri (gchar *job);
+#include "parson.h"
+
+typedef struct _JobSpecEncoder {
+        gchar **bins;
+        gint stream_count;
+        gchar *udpstreaming; /* NULL if not configured */
+        gsize cache_size; /* 0 if not configured */
+        gchar *cache_huge_page; /* NULL if not configured */
+        gboolean cmaf; /* fragmented mp4 output, mpeg2 ts if FALSE */
+} JobSpecEncoder;
+
+/*
+ * job description parsed once, read only after jobspec_new.
+ * element properties, caps and per stream items are looked up in root.
+ */
+typedef struct _JobSpec {
+        JSON_Value *root;
+        gchar *name;
+        gboolean is_live;
+        gboolean warm_restart;
+        gint64 heartbeat_timeout; /* in millisecond, 0 if not configured */
+        gdouble cpu_cost; /* cpus needed by the job, 0 if not configured */
+        gchar *debug;
+        gchar *log_path;
+        gchar **source_bins;
+        gint source_stream_count;
+        gint ladder_rungs; /* rungs of scaling ladder of all source streams */
+        gint encoder_count;
+        JobSpecEncoder *encoders;
+        gboolean m3u8streaming;
+        guint m3u8streaming_version;
+        guint m3u8streaming_window_size;
+        GstClockTime m3u8streaming_segment_duration;
+        GstClockTime m3u8streaming_part_duration; /* low latency hls, 0 if none */
+        gchar *m3u8streaming_push_server_uri;
+        gchar *archive_path;
+        gsize archive_file_size;
+        gint archive_files;
+        gchar *profile; /* jobs of the same profile cost about the same cpus */
+} JobSpec;
+
+JobSpec * jobspec_new (gchar *job);
+void jobspec_free (JobSpec *spec);
+gchar * jobdesc_get_name (JobSpec *spec);
+gint jobdesc_encoders_count (JobSpec *spec);
+gint jobdesc_streams_count (JobSpec *spec, gchar *pipeline);
+gboolean jobdesc_is_live (JobSpec *spec);
+gboolean jobdesc_is_warm_restart (JobSpec *spec);
+gint64 jobdesc_heartbeat_timeout (JobSpec *spec);
+gdouble jobdesc_cpu_cost (JobSpec *spec);
+gchar * jobdesc_get_debug (JobSpec *spec);
+gchar * jobdesc_get_log_path (JobSpec *spec);
+gchar ** jobdesc_bins (JobSpec *spec, gchar *pipeline);
+gint jobdesc_source_stream_ring_size (JobSpec *spec, gchar *stream);
+gsize jobdesc_source_stream_ring_bytes (JobSpec *spec, gchar *stream);
+gchar * jobdesc_source_stream_overflow (JobSpec *spec, gchar *stream);
+gchar ** jobdesc_source_ladder (JobSpec *spec, gchar *stream);
+gchar * jobdesc_udpstreaming (JobSpec *spec, gchar *pipeline);
+gsize jobdesc_encoder_cache_size (JobSpec *spec, gchar *pipeline);
+gboolean jobdesc_encoder_is_cmaf (JobSpec *spec, gchar *pipeline);
+gchar * jobdesc_encoder_cache_huge_page (JobSpec *spec, gchar *pipeline);
+gchar ** jobdesc_element_properties (JobSpec *spec, gchar *element);
+gchar * jobdesc_element_property_value (JobSpec *spec, gchar *property);
+gchar * jobdesc_element_caps (JobSpec *spec, gchar *element);
+gboolean jobdesc_m3u8streaming (JobSpec *spec);
+guint jobdesc_m3u8streaming_version (JobSpec *spec);
+guint jobdesc_m3u8streaming_window_size (JobSpec *spec);
+GstClockTime jobdesc_m3u8streaming_segment_duration (JobSpec *spec);
+GstClockTime jobdesc_m3u8streaming_part_duration (JobSpec *spec);
+gchar * jobdesc_m3u8streaming_push_server_uri (JobSpec *spec);
+gchar * jobdesc_archive_path (JobSpec *spec);
+gsize jobdesc_archive_file_size (JobSpec *spec);
+gint jobdesc_archive_files (JobSpec *spec);
 
 #endif /* __JOBDESC_H__ */
@@ -0,0 +1,267 @@
+/*
+ * low latency hls, partial segments playlist.
+ *
+ * parts are cut by the encoder every part-duration and at every gop, see move_part of encoder.c,
+ * and indexed in the part index of the encoder output. the playlist is rendered from the gop index
+ * and part index, media sequence number of a segment is the sequence of it's gop, so that the
+ * blocking playlist reload of _HLS_msn and _HLS_part is answered from the indexes directly. the
+ * rendered playlist is kept until a new part is output.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "httpserver.h"
+#include "llhls.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+/**
+ * llhls_part_ready:
+ * @encoder_output: (in): the encoder output.
+ * @msn: (in): media sequence number of the segment.
+ * @part: (in): part number in the segment, -1 for the whole segment.
+ *
+ * check if the segment or the part of the segment is completely output.
+ *
+ * Returns: TRUE if completed, FALSE if not yet or the encoder stalled while writing output.
+ */
+gboolean llhls_part_ready (EncoderOutput *encoder_output, gint64 msn, gint64 part)
+{
+        PartIndexEntry last;
+        guint64 gop_index_tail, part_index_tail;
+        guint32 sequence;
+
+        do {
+                sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (sequence)) {
+                        return FALSE;
+                }
+                gop_index_tail = *(encoder_output->gop_index_tail);
+                part_index_tail = *(encoder_output->part_index_tail);
+                if (part_index_tail >= 2) {
+                        /* the last completed part */
+                        last = *encoder_output_part_index_entry (encoder_output, part_index_tail - 2);
+                }
+        } while (encoder_output_read_retry (encoder_output, sequence));
+
+        if (msn < gop_index_tail - 1) {
+                /* segment completed */
+                return TRUE;
+        }
+        if ((part == -1) || (part_index_tail < 2)) {
+                return FALSE;
+        }
+
+        return (last.gop > msn) || ((last.gop == msn) && (last.number >= part));
+}
+
+/*
+ * llhls_msn_valid:
+ * @encoder_output: (in): the encoder output.
+ * @msn: (in): _HLS_msn of blocking playlist reload, -1 if none.
+ *
+ * the segment of msn must be at most LLHLS_MSN_AHEAD segments beyond the last
+ * segment of the playlist, the current output one.
+ *
+ * Returns: TRUE if the request could be answered by blocking, FALSE if bad request.
+ */
+gboolean llhls_msn_valid (EncoderOutput *encoder_output, gint64 msn)
+{
+        guint64 gop_index_tail;
+
+        if (msn == -1) {
+                return TRUE;
+        }
+        gop_index_tail = *(encoder_output->gop_index_tail);
+
+        /* gop_index_tail - 1 is the current output segment */
+        return msn <= (gint64)(gop_index_tail - 1 + LLHLS_MSN_AHEAD);
+}
+
+static void render_parts (EncoderOutput *encoder_output, GString *body, guint64 *part_sequence, guint64 part_index_tail, guint64 gop)
+{
+        PartIndexEntry *part;
+        GOPIndexEntry *gop_entry;
+
+        gop_entry = encoder_output_gop_index_entry (encoder_output, gop);
+        /* completed parts only, tail - 1 is the current output part */
+        for (; *part_sequence < part_index_tail - 1; (*part_sequence)++) {
+                part = encoder_output_part_index_entry (encoder_output, *part_sequence);
+                if (part->gop > gop) {
+                        break;
+                }
+                if (part->gop < gop) {
+                        continue;
+                }
+                g_string_append_printf (body,
+                                        M3U8_PART_TAG,
+                                        (gdouble)part->duration / GST_SECOND,
+                                        gop_entry->timestamp,
+                                        part->number,
+                                        encoder_output_segment_extension (encoder_output),
+                                        (part->flags & PART_FLAG_INDEPENDENT) ? ",INDEPENDENT=YES" : "");
+        }
+}
+
+/*
+ * called with m3u8_playlist_mutex locked, it guards the discontinuity sequence.
+ *
+ * Returns: the playlist, NULL if the encoder stalled while writing output.
+ */
+static gchar * render_playlist (EncoderOutput *encoder_output, guint64 *part_index_tail)
+{
+        M3U8Playlist *playlist = encoder_output->m3u8_playlist;
+        GString *body;
+        GOPIndexEntry *gop_entry;
+        PartIndexEntry *part;
+        GstClockTime target_duration, part_target;
+        guint64 first, current, gop, part_sequence, parts_gop, discontinuity_sequence;
+        guint32 sequence;
+
+        body = g_string_sized_new (4096);
+        do {
+                g_string_truncate (body, 0);
+                sequence = encoder_output_read_begin (encoder_output);
+                if (encoder_output_read_stalled (sequence)) {
+                        g_string_free (body, TRUE);
+                        return NULL;
+                }
+                current = *(encoder_output->gop_index_tail) - 1;
+                first = *(encoder_output->gop_index_head);
+                if ((playlist->window_size > 0) && (current - first > playlist->window_size)) {
+                        first = current - playlist->window_size;
+                }
+                target_duration = 0;
+                for (gop = first; gop < current; gop++) {
+                        gop_entry = encoder_output_gop_index_entry (encoder_output, gop);
+                        if (gop_entry->duration > target_duration) {
+                                target_duration = gop_entry->duration;
+                        }
+                }
+                if (target_duration == 0) {
+                        /* no segment completed yet */
+                        target_duration = encoder_output->segment_duration;
+                }
+
+                /* discontinuities of gops slid out of the window since last rendered */
+                discontinuity_sequence = encoder_output->ll_discontinuity_sequence;
+                for (gop = MAX (encoder_output->ll_discontinuity_gop, *(encoder_output->gop_index_head)); gop < first; gop++) {
+                        if (encoder_output_gop_index_entry (encoder_output, gop)->flags & GOP_FLAG_DISCONTINUITY) {
+                                discontinuity_sequence++;
+                        }
+                }
+
+                /* parts of the last segments, part target is at least the longest part listed */
+                *part_index_tail = *(encoder_output->part_index_tail);
+                parts_gop = (current - first > LLHLS_PART_SEGMENTS) ? current - LLHLS_PART_SEGMENTS : first;
+                part_target = encoder_output->part_duration;
+                for (part_sequence = *part_index_tail - 1; part_sequence > *(encoder_output->part_index_head); part_sequence--) {
+                        part = encoder_output_part_index_entry (encoder_output, part_sequence - 1);
+                        if (part->gop < parts_gop) {
+                                break;
+                        }
+                        if (part->duration > part_target) {
+                                part_target = part->duration;
+                        }
+                }
+
+                /* #EXTM3U */
+                g_string_append (body, M3U8_HEADER_TAG);
+                /* #EXT-X-VERSION, version of cmaf playlist is 7 already */
+                g_string_append_printf (body, M3U8_VERSION_TAG, MAX (playlist->version, LLHLS_VERSION));
+                /* #EXT-X-TARGETDURATION */
+                g_string_append_printf (body, M3U8_TARGETDURATION_TAG, (gint)((target_duration + 500 * GST_MSECOND) / GST_SECOND));
+                /* #EXT-X-SERVER-CONTROL */
+                g_string_append_printf (body, M3U8_SERVER_CONTROL_TAG, 3.0 * part_target / GST_SECOND);
+                /* #EXT-X-PART-INF */
+                g_string_append_printf (body, M3U8_PART_INF_TAG, (gdouble)part_target / GST_SECOND);
+                /* #EXT-X-MEDIA-SEQUENCE */
+                g_string_append_printf (body, M3U8_MEDIA_SEQUENCE_TAG, first);
+                /* #EXT-X-DISCONTINUITY-SEQUENCE */
+                if (discontinuity_sequence > 0) {
+                        g_string_append_printf (body, M3U8_DISCONTINUITY_SEQUENCE_TAG, discontinuity_sequence);
+                }
+                /* #EXT-X-MAP */
+                if (playlist->map != NULL) {
+                        g_string_append_printf (body, M3U8_MAP_TAG, playlist->map);
+                }
+                g_string_append (body, "\n");
+
+                /* segments, with parts if recent ones */
+                for (gop = first; gop <= current; gop++) {
+                        gop_entry = encoder_output_gop_index_entry (encoder_output, gop);
+                        if (gop_entry->flags & GOP_FLAG_DISCONTINUITY) {
+                                g_string_append (body, M3U8_DISCONTINUITY_TAG);
+                        }
+                        if (gop >= parts_gop) {
+                                render_parts (encoder_output, body, &part_sequence, *part_index_tail, gop);
+                        }
+                        if (gop < current) {
+                                g_string_append_printf (body,
+                                                        "#EXTINF:%.3f,\n%lu.%s\n",
+                                                        (gdouble)gop_entry->duration / GST_SECOND,
+                                                        gop_entry->timestamp,
+                                                        encoder_output_segment_extension (encoder_output));
+                        }
+                }
+
+                /* the current output part */
+                part = encoder_output_part_index_entry (encoder_output, *part_index_tail - 1);
+                gop_entry = encoder_output_gop_index_entry (encoder_output, part->gop);
+                g_string_append_printf (body, M3U8_PRELOAD_HINT_TAG, gop_entry->timestamp, part->number, encoder_output_segment_extension (encoder_output));
+        } while (encoder_output_read_retry (encoder_output, sequence));
+        if (first > encoder_output->ll_discontinuity_gop) {
+                encoder_output->ll_discontinuity_sequence = discontinuity_sequence;
+                encoder_output->ll_discontinuity_gop = first;
+        }
+
+        return g_string_free (body, FALSE);
+}
+
+/**
+ * llhls_get_playlist:
+ * @encoder_output: (in): the encoder output.
+ *
+ * get http response of low latency playlist, rendered again if new part output.
+ *
+ * Returns: the response, 503 if the encoder stalled, should be unref after used.
+ */
+GBytes * llhls_get_playlist (EncoderOutput *encoder_output)
+{
+        GBytes *response;
+        guint64 part_index_tail;
+        gchar *body, *buf;
+
+        g_mutex_lock (&(encoder_output->m3u8_playlist_mutex));
+        part_index_tail = __atomic_load_n (encoder_output->part_index_tail, __ATOMIC_ACQUIRE);
+        if ((encoder_output->ll_playlist == NULL) || (encoder_output->ll_playlist_part != part_index_tail)) {
+                body = render_playlist (encoder_output, &part_index_tail);
+                if (body == NULL) {
+                        /* not cached, rendered again when the encoder recovered */
+                        g_mutex_unlock (&(encoder_output->m3u8_playlist_mutex));
+                        buf = g_strdup_printf (http_503, PACKAGE_NAME, PACKAGE_VERSION);
+                        return g_bytes_new_take (buf, strlen (buf));
+                }
+                buf = g_strdup_printf (http_200,
+                                       PACKAGE_NAME,
+                                       PACKAGE_VERSION,
+                                       "application/vnd.apple.mpegurl",
+                                       strlen (body),
+                                       body);
+                g_free (body);
+                if (encoder_output->ll_playlist != NULL) {
+                        g_bytes_unref (encoder_output->ll_playlist);
+                }
+                encoder_output->ll_playlist = g_bytes_new_take (buf, strlen (buf));
+                encoder_output->ll_playlist_part = part_index_tail;
+        }
+        response = g_bytes_ref (encoder_output->ll_playlist);
+        g_mutex_unlock (&(encoder_output->m3u8_playlist_mutex));
+
+        return response;
+}
@@ -0,0 +1,28 @@
+/*
+ * low latency hls, partial segments playlist.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __LLHLS_H__
+#define __LLHLS_H__
+
+#include <gst/gst.h>
+
+#include "job.h"
+
+#define LLHLS_VERSION 6 /* minimum version of playlist with parts */
+#define LLHLS_PART_SEGMENTS 3 /* parts are listed for the last segments and the current one */
+#define LLHLS_MSN_AHEAD 2 /* max _HLS_msn beyond the last segment of the playlist */
+
+#define M3U8_SERVER_CONTROL_TAG "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=%.3f\n"
+#define M3U8_PART_INF_TAG "#EXT-X-PART-INF:PART-TARGET=%.3f\n"
+#define M3U8_PART_TAG "#EXT-X-PART:DURATION=%.3f,URI=\"%lu.%lu.%s\"%s\n"
+#define M3U8_PRELOAD_HINT_TAG "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%lu.%lu.%s\"\n"
+
+gboolean llhls_part_ready (EncoderOutput *encoder_output, gint64 msn, gint64 part);
+gboolean llhls_msn_valid (EncoderOutput *encoder_output, gint64 msn);
+GBytes * llhls_get_playlist (EncoderOutput *encoder_output);
+
+#endif /* __LLHLS_H__ */
@@ -7,9 +7,12 @@
 
 #include <gst/gst.h>
 
+#include "httpserver.h"
 #include "m3u8playlist.h"
 
-M3U8Playlist * m3u8playlist_new (guint version, guint window_size, gboolean allow_cache)
+static void m3u8playlist_update (M3U8Playlist *playlist);
+
+M3U8Playlist * m3u8playlist_new (guint version, guint window_size, gboolean allow_cache, gchar *map)
 {
         M3U8Playlist *playlist;
 
@@ -17,9 +20,12 @@ M3U8Playlist * m3u8playlist_new (guint version, guint window_size, gboolean allo
         playlist->version = version;
         playlist->window_size = window_size;
         playlist->allow_cache = allow_cache;
+        playlist->map = g_strdup (map);
         playlist->adding_entries = g_queue_new ();
         playlist->entries = g_queue_new ();
         playlist->removing_entries = g_queue_new ();
+        playlist->entries_str = g_string_new ("");
+        m3u8playlist_update (playlist);
 
         return playlist;
 }
@@ -40,10 +46,25 @@ void m3u8playlist_free (M3U8Playlist * playlist)
         g_queue_free (playlist->adding_entries);
         g_queue_free (playlist->entries);
         g_queue_free (playlist->removing_entries);
+        g_string_free (playlist->entries_str, TRUE);
+        g_free (playlist->map);
+        g_bytes_unref (playlist->response);
         g_free (playlist);
 }
 
-static M3U8Entry * m3u8entry_new (const gchar * url, gfloat duration)
+static void render_entry (M3U8Entry * entry, M3U8Playlist * playlist)
+{
+        gsize len;
+
+        len = playlist->entries_str->len;
+        if (entry->discontinuity) {
+                g_string_append (playlist->entries_str, M3U8_DISCONTINUITY_TAG);
+        }
+        g_string_append_printf (playlist->entries_str, M3U8_INF_TAG, (float) entry->duration / GST_SECOND, entry->url);
+        entry->rendered_size = playlist->entries_str->len - len;
+}
+
+static M3U8Entry * m3u8entry_new (const gchar * url, gfloat duration, gboolean discontinuity)
 {
         M3U8Entry *entry;
 
@@ -52,18 +73,19 @@ static M3U8Entry * m3u8entry_new (const gchar * url, gfloat duration)
         entry = g_new0 (M3U8Entry, 1);
         entry->url = g_strdup (url);
         entry->duration = duration;
+        entry->discontinuity = discontinuity;
 
         return entry;
 }
 
-gboolean m3u8playlist_add_entry (M3U8Playlist *playlist, const gchar *url, gfloat duration)
+gboolean m3u8playlist_add_entry (M3U8Playlist *playlist, const gchar *url, gfloat duration, gboolean discontinuity)
 {
         M3U8Entry *entry;
 
         g_return_val_if_fail (playlist != NULL, FALSE);
         g_return_val_if_fail (url != NULL, FALSE);
 
-        entry = m3u8entry_new (url, duration);
+        entry = m3u8entry_new (url, duration, discontinuity);
 
         g_queue_push_tail (playlist->adding_entries, entry);
         if (playlist->adding_entries->length < 5) {
@@ -77,27 +99,22 @@ gboolean m3u8playlist_add_entry (M3U8Playlist *playlist, const gchar *url, gfloa
                         M3U8Entry *old_entry;
 
                         old_entry = g_queue_pop_head (playlist->entries);
+                        if (old_entry->discontinuity) {
+                                playlist->discontinuity_sequence++;
+                        }
+                        g_string_erase (playlist->entries_str, 0, old_entry->rendered_size);
                         g_queue_push_tail (playlist->removing_entries, old_entry);
                 }
         }
 
         playlist->sequence_number++;;
         g_queue_push_tail (playlist->entries, entry);
+        render_entry (entry, playlist);
+        m3u8playlist_update (playlist);
 
         return TRUE;
 }
 
-static void render_entry (M3U8Entry * entry, M3U8Playlist * playlist)
-{
-        gchar *entry_str;
-
-        g_return_val_if_fail (entry != NULL, NULL);
-
-        entry_str = g_strdup_printf (M3U8_INF_TAG, (float) entry->duration / GST_SECOND, entry->url);
-        g_string_append_printf (playlist->playlist_str, "%s", entry_str);
-        g_free (entry_str);
-}
-
 static guint m3u8playlist_target_duration (M3U8Playlist * playlist)
 {
         gint i;
@@ -114,33 +131,85 @@ static guint m3u8playlist_target_duration (M3U8Playlist * playlist)
         return (guint) ((target_duration + 500 * GST_MSECOND) / GST_SECOND);
 }
 
+/**
+ * m3u8playlist_render:
+ * @playlist: (in): the playlist to render, called with m3u8_playlist_mutex.
+ *
+ * Returns: rendered playlist, should be freed after used.
+ */
 gchar * m3u8playlist_render (M3U8Playlist * playlist)
 {
-        gchar *p;
+        GString *playlist_str;
 
         g_return_val_if_fail (playlist != NULL, NULL);
 
-        playlist->playlist_str = g_string_new ("");
+        playlist_str = g_string_sized_new (256 + playlist->entries_str->len);
 
         /* #EXTM3U */
-        g_string_append_printf (playlist->playlist_str, M3U8_HEADER_TAG);
+        g_string_append (playlist_str, M3U8_HEADER_TAG);
         /* #EXT-X-VERSION */
-        g_string_append_printf (playlist->playlist_str, M3U8_VERSION_TAG, playlist->version);
+        g_string_append_printf (playlist_str, M3U8_VERSION_TAG, playlist->version);
         /* #EXT-X-ALLOW_CACHE */
-        g_string_append_printf (playlist->playlist_str, M3U8_ALLOW_CACHE_TAG, playlist->allow_cache ? "YES" : "NO");
+        g_string_append_printf (playlist_str, M3U8_ALLOW_CACHE_TAG, playlist->allow_cache ? "YES" : "NO");
         /* #EXT-X-MEDIA-SEQUENCE */
-        g_string_append_printf (playlist->playlist_str, M3U8_MEDIA_SEQUENCE_TAG, playlist->sequence_number - playlist->entries->length);
+        g_string_append_printf (playlist_str, M3U8_MEDIA_SEQUENCE_TAG, playlist->sequence_number - playlist->entries->length);
+        /* #EXT-X-DISCONTINUITY-SEQUENCE */
+        if (playlist->discontinuity_sequence > 0) {
+                g_string_append_printf (playlist_str, M3U8_DISCONTINUITY_SEQUENCE_TAG, playlist->discontinuity_sequence);
+        }
         /* #EXT-X-TARGETDURATION */
-        g_string_append_printf (playlist->playlist_str, M3U8_TARGETDURATION_TAG, m3u8playlist_target_duration (playlist));
-        g_string_append_printf (playlist->playlist_str, "\n");
+        g_string_append_printf (playlist_str, M3U8_TARGETDURATION_TAG, m3u8playlist_target_duration (playlist));
+        /* #EXT-X-MAP */
+        if (playlist->map != NULL) {
+                g_string_append_printf (playlist_str, M3U8_MAP_TAG, playlist->map);
+        }
+        g_string_append (playlist_str, "\n");
 
-        /* Entries */
-        g_queue_foreach (playlist->entries, (GFunc) render_entry, playlist);
+        /* Entries, rendered when added */
+        g_string_append_len (playlist_str, playlist->entries_str->str, playlist->entries_str->len);
+
+        return g_string_free (playlist_str, FALSE);
+}
 
-        p = playlist->playlist_str->str;
-        g_string_free (playlist->playlist_str, FALSE);
+/*
+ * render the http response of playlist and replace the one served, called with m3u8_playlist_mutex.
+ * readers ref the response under the mutex too, the replaced one is released when the last reader
+ * unref it.
+ */
+static void m3u8playlist_update (M3U8Playlist *playlist)
+{
+        GBytes *response;
+        gchar *body, *buf;
+
+        body = m3u8playlist_render (playlist);
+        buf = g_strdup_printf (http_200,
+                               PACKAGE_NAME,
+                               PACKAGE_VERSION,
+                               "application/vnd.apple.mpegurl",
+                               strlen (body),
+                               body);
+        g_free (body);
+        response = g_bytes_new_take (buf, strlen (buf));
+
+        if (playlist->response != NULL) {
+                g_bytes_unref (playlist->response);
+        }
+        playlist->response = response;
+}
+
+/**
+ * m3u8playlist_get_response:
+ * @playlist: (in): the playlist.
+ *
+ * Get the rendered http response of the playlist, called with m3u8_playlist_mutex.
+ *
+ * Returns: the response, should be unref after used.
+ */
+GBytes * m3u8playlist_get_response (M3U8Playlist *playlist)
+{
+        g_return_val_if_fail (playlist != NULL, NULL);
 
-        return p;
+        return g_bytes_ref (playlist->response);
 }
 
 gchar * m3u8playlist_remove_entry (M3U8Playlist *playlist)
@@ -13,6 +13,9 @@
 #define M3U8_ALLOW_CACHE_TAG "#EXT-X-ALLOW-CACHE:%s\n"
 #define M3U8_TARGETDURATION_TAG "#EXT-X-TARGETDURATION:%d\n"
 #define M3U8_MEDIA_SEQUENCE_TAG "#EXT-X-MEDIA-SEQUENCE:%lu\n"
+#define M3U8_DISCONTINUITY_SEQUENCE_TAG "#EXT-X-DISCONTINUITY-SEQUENCE:%lu\n"
+#define M3U8_DISCONTINUITY_TAG "#EXT-X-DISCONTINUITY\n"
+#define M3U8_MAP_TAG "#EXT-X-MAP:URI=\"%s\"\n"
 #define M3U8_INF_TAG "#EXTINF:%.2f,\n%s\n"
 #define M3U8_STREAM_INF_TAG "#EXT-X-STREAM-INF:PROGRAM-ID=%d,BANDWIDTH=%s000\n"
 
@@ -20,6 +23,8 @@ typedef struct _M3U8Entry
 {
         gfloat duration;
         gchar *url;
+        gboolean discontinuity; /* segment follows a discontinuity, e.g. job warm restart */
+        gsize rendered_size; /* size of the entry in entries_str */
 } M3U8Entry;
 
 typedef struct _M3U8Playlist
@@ -28,18 +33,22 @@ typedef struct _M3U8Playlist
         gboolean allow_cache;
         gint window_size;
         guint64 sequence_number;
+        guint64 discontinuity_sequence; /* discontinuities removed from playlist */
+        gchar *map; /* uri of init segment of fragmented mp4, NULL if mpeg2 ts */
 
         /*< Private >*/
         GQueue *adding_entries;
         GQueue *entries;
         GQueue *removing_entries;
-        GString *playlist_str;
+        GString *entries_str; /* rendered entries, appended and truncated with entries */
+        GBytes *response; /* rendered http response of the playlist */
 } M3U8Playlist;
 
-M3U8Playlist * m3u8playlist_new (guint version, guint window_size, gboolean allow_cache);
+M3U8Playlist * m3u8playlist_new (guint version, guint window_size, gboolean allow_cache, gchar *map);
 void m3u8playlist_free (M3U8Playlist *playlist);
-gboolean m3u8playlist_add_entry (M3U8Playlist *playlist, const gchar *url, gfloat duration);
+gboolean m3u8playlist_add_entry (M3U8Playlist *playlist, const gchar *url, gfloat duration, gboolean discontinuity);
 gchar * m3u8playlist_render (M3U8Playlist *playlist); 
+GBytes * m3u8playlist_get_response (M3U8Playlist *playlist);
 gchar * m3u8playlist_remove_entry (M3U8Playlist *playlist);
 
 #endif /* __M3U8PLAYLIST_H__ */
@@ -24,6 +24,8 @@
 #include "parson.h"
 #include "jobdesc.h"
 #include "log.h"
+#include "zygote.h"
+#include "placement.h"
 
 #define PID_FILE "/var/run/gstreamill.pid"
 
@@ -86,6 +88,9 @@ static gchar *job_file = NULL;
 static gchar *log_dir = "/var/log/gstreamill";
 static gchar *http_mgmt = "0.0.0.0:20118";
 static gchar *http_streaming = "0.0.0.0:20119";
+static gint reactors = 0;
+static gboolean placement = FALSE;
+static gint capacity = 0;
 static gchar *job_name = NULL;
 static gint job_length = -1;
 static GOptionEntry options[] = {
@@ -93,6 +98,9 @@ static GOptionEntry options[] = {
         {"log", 'l', 0, G_OPTION_ARG_FILENAME, &log_dir, ("-l /full/path/to/log: Specify log path, full path is must."), NULL},
         {"httpmgmt", 'm', 0, G_OPTION_ARG_STRING, &http_mgmt, ("-m http managment address, default is 0.0.0.0:20118."), NULL},
         {"httpstreaming", 'a', 0, G_OPTION_ARG_STRING, &http_streaming, ("-a http streaming address, default is 0.0.0.0:20119."), NULL},
+        {"reactors", 'r', 0, G_OPTION_ARG_INT, &reactors, ("-r number of http streaming reactors, one epoll loop per reactor, 0 means thread pool mode, default is 0."), NULL},
+        {"placement", 'p', 0, G_OPTION_ARG_NONE, &placement, ("-p place job workers on cpus and numa nodes by cost of jobs, default is not."), NULL},
+        {"capacity", 'c', 0, G_OPTION_ARG_INT, &capacity, ("-c percentage of cpus for jobs, job is rejected if it's estimated cost exceeds, 0 means no admission control, default is 0."), NULL},
         {"name", 'n', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING, &job_name, NULL, NULL},
         {"joblength", 'q', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_INT, &job_length, NULL, NULL},
         {"stop", 's', 0, G_OPTION_ARG_NONE, &stop, ("Stop gstreamill."), NULL},
@@ -118,6 +126,75 @@ static void remove_pid_file ()
         }
 }
 
+/*
+ * job worker, spawned by create_job_process with -n and -q options or forked by zygote.
+ */
+static void run_job (gchar *name, gint length, gchar *debug)
+{
+        GMainLoop *loop;
+        gint fd;
+        gchar *job_desc, *p;
+        JobSpec *spec;
+        Job *job;
+        gchar *log_path;
+        gint ret;
+
+        /* read job description from share memory */
+        job_desc = NULL;
+        fd = shm_open (name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+        if (ftruncate (fd, length) == -1) {
+                exit (2);
+        }
+        p = mmap (NULL, length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        job_desc = g_strdup (p);
+
+        spec = jobspec_new (job_desc);
+        if (spec == NULL) {
+                exit (3);
+        }
+
+        /* initialize log */
+        if (!jobdesc_is_live (spec)) {
+                gchar *p;
+
+                p = jobdesc_get_log_path (spec);
+                log_path = g_build_filename (p, "gstreamill.log", NULL);
+                g_free (p);
+
+        } else {
+                log_path = g_build_filename (log_dir, name, "gstreamill.log", NULL);
+        }
+        ret = init_log (log_path);
+        g_free (log_path);
+        if (ret != 0) {
+                exit (1);
+        }
+
+        /* launch a job. */
+        job = job_new ("name", name, "job", job_desc, NULL);
+        job->spec = spec;
+        job->is_live = jobdesc_is_live (spec);
+        job->eos = FALSE;
+        signal (SIGPIPE, SIG_IGN);
+        signal (SIGUSR1, sighandler);
+        signal (SIGUSR2, stop_job);
+        loop = g_main_loop_new (NULL, FALSE);
+        if (job_initialize (job, TRUE) != 0) {
+                GST_ERROR ("initialize livejob failure, exit");
+                exit (1);
+        }
+        placement_apply (job);
+        if (job_start (job) != 0) {
+                GST_ERROR ("start livejob failure, exit");
+                exit (1);
+        }
+        GST_WARNING ("livejob %s starting ...", name);
+        g_free (job_desc);
+
+        g_main_loop_run (loop);
+        exit (0);
+}
+
 Gstreamill *gstreamill;
 
 static void stop_gstreamill (gint number)
@@ -188,62 +265,7 @@ int main (int argc, char *argv[])
 
         /* subprocess, create_job_process */
         if (job_name != NULL) {
-                gint fd;
-                gchar *job_desc, *p;
-                Job *job;
-                gchar *log_path;
-                gint ret;
-
-                /* read job description from share memory */
-                job_desc = NULL;
-                fd = shm_open (job_name, O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
-                if (ftruncate (fd, job_length) == -1) {
-                        exit (2);
-                }
-                p = mmap (NULL, job_length, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
-                job_desc = g_strdup (p);
-
-                if ((job_desc != NULL) && (!jobdesc_is_valid (job_desc))) {
-                        exit (3);
-                }
-
-                /* initialize log */
-                if (!jobdesc_is_live (job_desc)) {
-                        gchar *p;
-
-                        p = jobdesc_get_log_path (job_desc);
-                        log_path = g_build_filename (p, "gstreamill.log", NULL);
-                        g_free (p);
-
-                } else {
-                        log_path = g_build_filename (log_dir, job_name, "gstreamill.log", NULL);
-                }
-                ret = init_log (log_path);
-                g_free (log_path);
-                if (ret != 0) {
-                        exit (1);
-                }
-
-                /* launch a job. */
-                job = job_new ("name", job_name, "job", job_desc, NULL);
-                job->is_live = jobdesc_is_live (job_desc);
-                job->eos = FALSE;
-                signal (SIGPIPE, SIG_IGN);
-                signal (SIGUSR1, sighandler);
-                signal (SIGUSR2, stop_job);
-                loop = g_main_loop_new (NULL, FALSE);
-                if (job_initialize (job, TRUE) != 0) {
-                        GST_ERROR ("initialize livejob failure, exit");
-                        exit (1);
-                }
-                if (job_start (job) != 0) {
-                        GST_ERROR ("start livejob failure, exit");
-                        exit (1);
-                }
-                GST_WARNING ("livejob %s starting ...", job_name);
-                g_free (job_desc);
-
-                g_main_loop_run (loop);
+                run_job (job_name, job_length, NULL);
         }
 
         /* run in background? */
@@ -263,6 +285,9 @@ int main (int argc, char *argv[])
                         exit (1);
                 }
 
+                /* zygote, fork before any thread created, workers are spawned if failure */
+                zygote_start (run_job);
+
                 /* log to file */
                 log_path = g_build_filename (log_dir, "gstreamill.log", NULL);
                 ret = init_log (log_path);
@@ -297,7 +322,7 @@ int main (int argc, char *argv[])
         loop = g_main_loop_new (NULL, FALSE);
 
         /* gstreamill */
-        gstreamill = gstreamill_new ("daemon", !foreground, "log_dir", log_dir, NULL);
+        gstreamill = gstreamill_new ("daemon", !foreground, "log_dir", log_dir, "placement", placement, "capacity", capacity, NULL);
         if (gstreamill_start (gstreamill) != 0) {
                 GST_ERROR ("start gstreamill error, exit.");
                 remove_pid_file ();
@@ -306,7 +331,7 @@ int main (int argc, char *argv[])
 
         /* httpstreaming, pull */
         httpstreaming = httpstreaming_new ("gstreamill", gstreamill, "address", http_streaming, NULL);
-        if (httpstreaming_start (httpstreaming, 10) != 0) {
+        if (httpstreaming_start (httpstreaming, 10, reactors) != 0) {
                 GST_ERROR ("start httpstreaming error, exit.");
                 remove_pid_file ();
                 exit (1);
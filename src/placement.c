@@ -0,0 +1,487 @@
+/*
+ * cpu and numa placement of job workers.
+ *
+ * every job worker is placed on a numa node when the job starts. a job with cpu-cost declared is
+ * pinned to a set of cpus of the node sized by the cost, other jobs may use all cpus of the node,
+ * as a job pinned by measured or estimated cost could never be measured above it's cpus, and would
+ * be starved there. cost of jobs, declared, measured by cpu_average or estimated by admission
+ * control, is the load of the cpus they use. cpus of jobs are rebalanced when a job starts or stops,
+ * heavy jobs first, each on the least loaded cpus of it's node. placement is written to the share
+ * memory of the job, worker applies it at start up, and gstreamill applies it to the threads of
+ * running worker when rebalanced.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <gst/gst.h>
+
+#include "jobdesc.h"
+#include "placement.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+typedef struct _PlacementNode {
+        gint id; /* numa node id, -1 if no numa */
+        guint64 cpus[CPUSET_WORDS];
+        gint count;
+} PlacementNode;
+
+typedef struct _PlacementJob {
+        Job *job;
+        gdouble cost; /* in cpus */
+        gboolean pinned; /* cost is declared, pinned to cpus of the cost */
+} PlacementJob;
+
+typedef struct _Placement {
+        gint online; /* online cpus, cpu_average of job is percentage of them */
+        gint node_count;
+        PlacementNode nodes[PLACEMENT_MAX_NODES];
+} Placement;
+
+/* accessed with job_list_mutex of gstreamill */
+static Placement *placement = NULL;
+
+static gboolean cpu_isset (guint64 *cpus, gint cpu)
+{
+        return (cpus[cpu / 64] >> (cpu % 64)) & 1;
+}
+
+static void cpu_set (guint64 *cpus, gint cpu)
+{
+        cpus[cpu / 64] |= (guint64)1 << (cpu % 64);
+}
+
+static gint cpuset_count (guint64 *cpus)
+{
+        gint i, count;
+
+        count = 0;
+        for (i = 0; i < CPUSET_WORDS; i++) {
+                count += __builtin_popcountll (cpus[i]);
+        }
+
+        return count;
+}
+
+static gchar * cpuset_string (guint64 *cpus)
+{
+        GString *string;
+        gint cpu;
+
+        string = g_string_new ("");
+        for (cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+                if (cpu_isset (cpus, cpu)) {
+                        g_string_append_printf (string, string->len == 0 ? "%d" : ",%d", cpu);
+                }
+        }
+
+        return g_string_free (string, FALSE);
+}
+
+/*
+ * parse cpulist of sysfs, e.g. 0-3,8-11
+ */
+static gint parse_cpulist (gchar *list, guint64 *cpus)
+{
+        gchar **ranges, **p, *end;
+        gint64 first, last, cpu;
+
+        memset (cpus, 0, CPUSET_WORDS * sizeof (guint64));
+        ranges = g_strsplit (g_strstrip (list), ",", 0);
+        for (p = ranges; *p != NULL; p++) {
+                if (**p == '\0') {
+                        continue;
+                }
+                first = g_ascii_strtoll (*p, &end, 10);
+                last = first;
+                if (*end == '-') {
+                        last = g_ascii_strtoll (end + 1, &end, 10);
+                }
+                if ((*end != '\0') || (first < 0) || (last < first)) {
+                        g_strfreev (ranges);
+                        return 1;
+                }
+                for (cpu = first; (cpu <= last) && (cpu < PLACEMENT_MAX_CPUS); cpu++) {
+                        cpu_set (cpus, cpu);
+                }
+        }
+        g_strfreev (ranges);
+
+        return 0;
+}
+
+/*
+ * numa nodes with cpus allowed to gstreamill.
+ */
+static void read_nodes (guint64 *allowed)
+{
+        PlacementNode *node;
+        GDir *dir;
+        const gchar *name;
+        gchar *path, *list;
+        gint i, ret;
+
+        dir = g_dir_open ("/sys/devices/system/node", 0, NULL);
+        if (dir == NULL) {
+                return;
+        }
+        while ((name = g_dir_read_name (dir)) != NULL) {
+                if (!g_str_has_prefix (name, "node") || !g_ascii_isdigit (name[4])) {
+                        continue;
+                }
+                if (placement->node_count == PLACEMENT_MAX_NODES) {
+                        GST_WARNING ("too many numa nodes, %s skipped", name);
+                        continue;
+                }
+                path = g_strdup_printf ("/sys/devices/system/node/%s/cpulist", name);
+                node = &(placement->nodes[placement->node_count]);
+                list = NULL;
+                ret = g_file_get_contents (path, &list, NULL, NULL) ? parse_cpulist (list, node->cpus) : 1;
+                g_free (list);
+                g_free (path);
+                if (ret != 0) {
+                        GST_WARNING ("read cpulist of %s error", name);
+                        continue;
+                }
+                for (i = 0; i < CPUSET_WORDS; i++) {
+                        node->cpus[i] &= allowed[i];
+                }
+                node->count = cpuset_count (node->cpus);
+                if (node->count == 0) {
+                        /* memory only node or not allowed */
+                        continue;
+                }
+                node->id = atoi (name + 4);
+                placement->node_count++;
+        }
+        g_dir_close (dir);
+}
+
+/**
+ * placement_start:
+ *
+ * read cpus and numa nodes allowed to gstreamill, enable placement of job workers.
+ *
+ * Returns: 0 on success, 1 on failure.
+ */
+gint placement_start (void)
+{
+        guint64 allowed[CPUSET_WORDS];
+        PlacementNode *node;
+        cpu_set_t set;
+        gchar *cpus;
+        gint i;
+
+        if (sched_getaffinity (0, sizeof (cpu_set_t), &set) == -1) {
+                GST_ERROR ("sched_getaffinity error: %s", g_strerror (errno));
+                return 1;
+        }
+        memset (allowed, 0, sizeof (allowed));
+        for (i = 0; (i < CPU_SETSIZE) && (i < PLACEMENT_MAX_CPUS); i++) {
+                if (CPU_ISSET (i, &set)) {
+                        cpu_set (allowed, i);
+                }
+        }
+
+        placement = g_new0 (Placement, 1);
+        placement->online = sysconf (_SC_NPROCESSORS_ONLN);
+        read_nodes (allowed);
+        if (placement->node_count == 0) {
+                /* no numa, one node of all allowed cpus */
+                node = &(placement->nodes[0]);
+                node->id = -1;
+                memcpy (node->cpus, allowed, sizeof (allowed));
+                node->count = cpuset_count (allowed);
+                placement->node_count = 1;
+        }
+        for (i = 0; i < placement->node_count; i++) {
+                node = &(placement->nodes[i]);
+                cpus = cpuset_string (node->cpus);
+                GST_WARNING ("placement numa node %d, cpus %s", node->id, cpus);
+                g_free (cpus);
+        }
+
+        return 0;
+}
+
+gboolean placement_is_running (void)
+{
+        return placement != NULL;
+}
+
+static gboolean job_is_placed (Job *job)
+{
+        return (job->output != NULL) && (cpuset_count (job->output->cpuset) > 0);
+}
+
+static gdouble job_cost (Job *job)
+{
+        gdouble cost;
+
+        cost = jobdesc_cpu_cost (job->spec);
+        if ((cost <= 0) && (job->cpu_average > 0)) {
+                cost = job->cpu_average * placement->online / 100.0;
+        }
+        if (cost <= 0) {
+                /* estimated by admission control */
+                cost = job->cost;
+        }
+
+        return cost > 0 ? cost : 1.0;
+}
+
+static PlacementNode * job_node (Job *job)
+{
+        gint i;
+
+        for (i = 0; i < placement->node_count; i++) {
+                if (placement->nodes[i].id == *(job->output->numa_node)) {
+                        return &(placement->nodes[i]);
+                }
+        }
+
+        return &(placement->nodes[0]);
+}
+
+static gint cost_compare (gconstpointer a, gconstpointer b)
+{
+        const PlacementJob *ja = a, *jb = b;
+
+        if (ja->cost == jb->cost) {
+                return 0;
+        }
+
+        return ja->cost < jb->cost ? 1 : -1;
+}
+
+/*
+ * least loaded cpu of node not chosen yet, cpu in current set is preferred to avoid migration.
+ */
+static gint least_loaded_cpu (PlacementNode *node, gdouble *load, guint64 *chosen, guint64 *current)
+{
+        gint cpu, best;
+
+        best = -1;
+        for (cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+                if (!cpu_isset (node->cpus, cpu) || cpu_isset (chosen, cpu)) {
+                        continue;
+                }
+                if ((best == -1) ||
+                    (load[cpu] < load[best]) ||
+                    ((load[cpu] == load[best]) && cpu_isset (current, cpu) && !cpu_isset (current, best))) {
+                        best = cpu;
+                }
+        }
+
+        return best;
+}
+
+/*
+ * set affinity of all threads of process, threads created later inherit it.
+ */
+static void process_apply (GPid pid, guint64 *cpus)
+{
+        cpu_set_t set;
+        GDir *dir;
+        const gchar *name;
+        gchar *path;
+        gint cpu;
+
+        CPU_ZERO (&set);
+        for (cpu = 0; (cpu < PLACEMENT_MAX_CPUS) && (cpu < CPU_SETSIZE); cpu++) {
+                if (cpu_isset (cpus, cpu)) {
+                        CPU_SET (cpu, &set);
+                }
+        }
+        path = g_strdup_printf ("/proc/%d/task", pid);
+        dir = g_dir_open (path, 0, NULL);
+        g_free (path);
+        if (dir == NULL) {
+                GST_INFO ("process %d not found", pid);
+                return;
+        }
+        while ((name = g_dir_read_name (dir)) != NULL) {
+                if (sched_setaffinity (atoi (name), sizeof (cpu_set_t), &set) == -1) {
+                        GST_WARNING ("set affinity of task %s of %d error: %s", name, pid, g_strerror (errno));
+                }
+        }
+        g_dir_close (dir);
+}
+
+/**
+ * placement_rebalance:
+ * @jobs: (in): jobs of gstreamill.
+ *
+ * place cpus of jobs, heavy jobs first, on the least loaded cpus of their numa node,
+ * threads of running worker are moved if it's cpus changed. called with job_list_mutex.
+ *
+ * Returns: none
+ */
+void placement_rebalance (GSList *jobs)
+{
+        gdouble load[PLACEMENT_MAX_CPUS];
+        guint64 cpus[CPUSET_WORDS];
+        PlacementNode *node;
+        PlacementJob placed_job, *pj;
+        GArray *placed;
+        gchar *p;
+        gint i, j, count, cpu;
+
+        if (placement == NULL) {
+                return;
+        }
+
+        placed = g_array_new (FALSE, FALSE, sizeof (PlacementJob));
+        for (; jobs != NULL; jobs = jobs->next) {
+                placed_job.job = jobs->data;
+                if (!job_is_placed (placed_job.job)) {
+                        continue;
+                }
+                placed_job.cost = job_cost (placed_job.job);
+                placed_job.pinned = jobdesc_cpu_cost (placed_job.job->spec) > 0;
+                g_array_append_val (placed, placed_job);
+        }
+        g_array_sort (placed, cost_compare);
+
+        memset (load, 0, sizeof (load));
+        for (i = 0; i < placed->len; i++) {
+                pj = &g_array_index (placed, PlacementJob, i);
+                node = job_node (pj->job);
+                if (pj->pinned) {
+                        count = pj->cost;
+                        if (count < pj->cost) {
+                                count++;
+                        }
+                        count = CLAMP (count, 1, node->count);
+                        memset (cpus, 0, sizeof (cpus));
+                        for (j = 0; j < count; j++) {
+                                cpu = least_loaded_cpu (node, load, cpus, pj->job->output->cpuset);
+                                cpu_set (cpus, cpu);
+                                load[cpu] += pj->cost / count;
+                        }
+
+                } else {
+                        /* all cpus of node, load spread over them */
+                        memcpy (cpus, node->cpus, sizeof (cpus));
+                        for (cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+                                if (cpu_isset (cpus, cpu)) {
+                                        load[cpu] += pj->cost / node->count;
+                                }
+                        }
+                }
+                if (memcmp (cpus, pj->job->output->cpuset, sizeof (cpus)) == 0) {
+                        continue;
+                }
+                memcpy (pj->job->output->cpuset, cpus, sizeof (cpus));
+                if (pj->job->worker_pid > 0) {
+                        process_apply (pj->job->worker_pid, cpus);
+                }
+                p = cpuset_string (cpus);
+                GST_INFO ("job %s cost %.2f cpus, placed on numa node %d cpus %s", pj->job->name, pj->cost, node->id, p);
+                g_free (p);
+        }
+        g_array_free (placed, TRUE);
+}
+
+/**
+ * placement_assign:
+ * @job: (in): new job, it's output initialized and worker not created.
+ * @jobs: (in): jobs of gstreamill.
+ *
+ * place new job on the least loaded numa node, and rebalance cpus. called with job_list_mutex.
+ *
+ * Returns: none
+ */
+void placement_assign (Job *job, GSList *jobs)
+{
+        gdouble load[PLACEMENT_MAX_CPUS], node_load, best_load;
+        PlacementNode *node, *best;
+        PlacementJob pj;
+        GSList *list;
+        gint i, cpu, count;
+
+        if (placement == NULL) {
+                return;
+        }
+
+        /* load of cpus of placed jobs */
+        memset (load, 0, sizeof (load));
+        for (list = jobs; list != NULL; list = list->next) {
+                pj.job = list->data;
+                if (!job_is_placed (pj.job)) {
+                        continue;
+                }
+                pj.cost = job_cost (pj.job);
+                count = cpuset_count (pj.job->output->cpuset);
+                for (cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+                        if (cpu_isset (pj.job->output->cpuset, cpu)) {
+                                load[cpu] += pj.cost / count;
+                        }
+                }
+        }
+
+        best = NULL;
+        best_load = 0;
+        for (i = 0; i < placement->node_count; i++) {
+                node = &(placement->nodes[i]);
+                node_load = 0;
+                for (cpu = 0; cpu < PLACEMENT_MAX_CPUS; cpu++) {
+                        if (cpu_isset (node->cpus, cpu)) {
+                                node_load += load[cpu];
+                        }
+                }
+                node_load /= node->count;
+                if ((best == NULL) || (node_load < best_load)) {
+                        best = node;
+                        best_load = node_load;
+                }
+        }
+        *(job->output->numa_node) = best->id;
+        memcpy (job->output->cpuset, best->cpus, sizeof (best->cpus));
+
+        list = g_slist_prepend (g_slist_copy (jobs), job);
+        placement_rebalance (list);
+        g_slist_free (list);
+}
+
+/**
+ * placement_apply:
+ * @job: (in): job of the worker.
+ *
+ * worker applies cpus and numa node written by gstreamill, before the pipeline started.
+ *
+ * Returns: none
+ */
+void placement_apply (Job *job)
+{
+        unsigned long nodemask;
+        gint64 node;
+        gchar *p;
+
+        if (cpuset_count (job->output->cpuset) == 0) {
+                return;
+        }
+        process_apply (getpid (), job->output->cpuset);
+
+        /* preferred rather than bind, allocate on other nodes if the node is out of memory */
+        node = *(job->output->numa_node);
+        if ((node >= 0) && (node < 8 * sizeof (nodemask))) {
+                nodemask = 1UL << node;
+                if (syscall (SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, 8 * sizeof (nodemask) + 1) == -1) {
+                        GST_WARNING ("set_mempolicy error: %s", g_strerror (errno));
+                }
+        }
+        p = cpuset_string (job->output->cpuset);
+        GST_WARNING ("job %s worker placed on numa node %ld cpus %s", job->name, node, p);
+        g_free (p);
+}
@@ -0,0 +1,24 @@
+/*
+ * cpu and numa placement of job workers.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+
+#include <gst/gst.h>
+
+#include "job.h"
+
+#define PLACEMENT_MAX_CPUS (CPUSET_WORDS * 64)
+#define PLACEMENT_MAX_NODES 64
+
+gint placement_start (void);
+gboolean placement_is_running (void);
+void placement_assign (Job *job, GSList *jobs);
+void placement_rebalance (GSList *jobs);
+void placement_apply (Job *job);
+
+#endif /* __PLACEMENT_H__ */
@@ -0,0 +1,443 @@
+/*
+ * http client of m3u8 push, keep-alive connections to the push server.
+ *
+ * address of the push server is resolved once and resolved again only if connect failed. idle
+ * connections are kept in a small pool and reused by push threads, requests of a push, segment,
+ * playlist and delete, are pipelined on one connection and responses are read after all sent.
+ * sockets are non-blocking, poll with timeout when would block, so that a stalled push server
+ * doesn't hold push threads forever. an idle connection closed by server is detected before reuse,
+ * and requests are sent again on a new connection if a reused connection failed without response.
+ * requests not answered yet are sent again on a new connection if the server closed the connection
+ * in the middle of the pipeline.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <gst/gst.h>
+
+#include "pushclient.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+typedef struct _Response {
+        gchar buf[PUSHCLIENT_RESPONSE_SIZE];
+        gsize len; /* bytes in buf, pipelined responses may be read at once */
+} Response;
+
+/**
+ * pushclient_new:
+ * @host: (in): host of push server.
+ * @port: (in): port of push server.
+ *
+ * Returns: the push client, nothing is connected until request.
+ */
+PushClient * pushclient_new (gchar *host, guint16 port)
+{
+        PushClient *client;
+
+        client = g_new0 (PushClient, 1);
+        client->host = g_strdup (host);
+        client->port = port;
+        client->resolved = FALSE;
+        g_mutex_init (&(client->mutex));
+        g_queue_init (&(client->idle));
+
+        return client;
+}
+
+/**
+ * pushclient_free:
+ * @client: (in): the push client, requests should be finished.
+ *
+ * close idle connections and free the client.
+ *
+ * Returns: none
+ */
+void pushclient_free (PushClient *client)
+{
+        while (!g_queue_is_empty (&(client->idle))) {
+                close (GPOINTER_TO_INT (g_queue_pop_head (&(client->idle))));
+        }
+        g_mutex_clear (&(client->mutex));
+        g_free (client->host);
+        g_free (client);
+}
+
+/* called with mutex locked */
+static gboolean resolve (PushClient *client)
+{
+        struct addrinfo hints, *result;
+        gint ret;
+
+        memset (&(client->address), 0, sizeof (struct sockaddr_in));
+        client->address.sin_family = AF_INET;
+        client->address.sin_port = htons (client->port);
+        client->address.sin_addr.s_addr = inet_addr (client->host);
+        if (client->address.sin_addr.s_addr == INADDR_NONE) {
+                memset (&hints, 0, sizeof (struct addrinfo));
+                hints.ai_family = AF_INET;
+                hints.ai_socktype = SOCK_STREAM;
+                ret = getaddrinfo (client->host, NULL, &hints, &result);
+                if (ret != 0) {
+                        GST_ERROR ("push, host %s not found: %s", client->host, gai_strerror (ret));
+                        return FALSE;
+                }
+                client->address.sin_addr = ((struct sockaddr_in *)result->ai_addr)->sin_addr;
+                freeaddrinfo (result);
+        }
+        client->resolved = TRUE;
+
+        return TRUE;
+}
+
+static gboolean wait_socket (gint sock, gshort events)
+{
+        struct pollfd pfd;
+        gint ret;
+
+        pfd.fd = sock;
+        pfd.events = events;
+        do {
+                ret = poll (&pfd, 1, PUSHCLIENT_TIMEOUT);
+        } while ((ret == -1) && (errno == EINTR));
+        if (ret == 0) {
+                GST_ERROR ("push, socket %d timeout", sock);
+                return FALSE;
+        }
+
+        return ret > 0;
+}
+
+static gint connect_server (PushClient *client)
+{
+        struct sockaddr_in address;
+        socklen_t len;
+        gint sock, error, one;
+
+        g_mutex_lock (&(client->mutex));
+        if (!client->resolved && !resolve (client)) {
+                g_mutex_unlock (&(client->mutex));
+                return -1;
+        }
+        address = client->address;
+        g_mutex_unlock (&(client->mutex));
+
+        sock = socket (AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sock == -1) {
+                GST_ERROR ("push, socket error: %s", g_strerror (errno));
+                return -1;
+        }
+        /* pipelined requests are small */
+        one = 1;
+        setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+        error = 0;
+        if (connect (sock, (struct sockaddr *)&address, sizeof (address)) == -1) {
+                error = errno;
+                if ((error == EINPROGRESS) && wait_socket (sock, POLLOUT)) {
+                        len = sizeof (error);
+                        getsockopt (sock, SOL_SOCKET, SO_ERROR, &error, &len);
+                }
+        }
+        if (error != 0) {
+                GST_ERROR ("push, connect %s:%d error: %s", client->host, client->port, g_strerror (error));
+                close (sock);
+                /* address of host may be changed */
+                g_mutex_lock (&(client->mutex));
+                client->resolved = FALSE;
+                g_mutex_unlock (&(client->mutex));
+                return -1;
+        }
+
+        return sock;
+}
+
+/*
+ * get an idle connection, or a new connection if no idle one or fresh is TRUE.
+ */
+static gint get_connection (PushClient *client, gboolean fresh, gboolean *reused)
+{
+        gchar c;
+        gint sock;
+
+        g_mutex_lock (&(client->mutex));
+        while (!fresh && !g_queue_is_empty (&(client->idle))) {
+                sock = GPOINTER_TO_INT (g_queue_pop_head (&(client->idle)));
+                if ((recv (sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) == -1) && (errno == EAGAIN)) {
+                        g_mutex_unlock (&(client->mutex));
+                        *reused = TRUE;
+                        return sock;
+                }
+                /* closed by server, or unexpected data */
+                close (sock);
+        }
+        g_mutex_unlock (&(client->mutex));
+        *reused = FALSE;
+
+        return connect_server (client);
+}
+
+static void put_connection (PushClient *client, gint sock)
+{
+        g_mutex_lock (&(client->mutex));
+        if (g_queue_get_length (&(client->idle)) < PUSHCLIENT_CONNECTIONS) {
+                g_queue_push_tail (&(client->idle), GINT_TO_POINTER (sock));
+                sock = -1;
+        }
+        g_mutex_unlock (&(client->mutex));
+        if (sock != -1) {
+                close (sock);
+        }
+}
+
+static gboolean write_data (gint sock, gchar *data, gsize count)
+{
+        gsize sent;
+        gssize ret;
+
+        sent = 0;
+        while (sent < count) {
+                ret = send (sock, data + sent, count - sent, MSG_NOSIGNAL);
+                if ((ret == -1) && (errno == EAGAIN)) {
+                        if (!wait_socket (sock, POLLOUT)) {
+                                return FALSE;
+                        }
+                        continue;
+                }
+                if (ret == -1) {
+                        GST_INFO ("push, write error: %s", g_strerror (errno));
+                        return FALSE;
+                }
+                sent += ret;
+        }
+
+        return TRUE;
+}
+
+/*
+ * send body in cache, body is sent by sendfile, to cache end first if wrapped.
+ */
+static gboolean send_body (gint sock, EncoderOutput *encoder_output, guint64 addr, gsize count)
+{
+        guint64 offset;
+        gsize sent, len;
+        gssize ret;
+
+        if (addr >= encoder_output->cache_size) {
+                addr -= encoder_output->cache_size;
+        }
+        sent = 0;
+        while (sent < count) {
+                offset = addr + sent;
+                if (offset >= encoder_output->cache_size) {
+                        offset -= encoder_output->cache_size;
+                }
+                len = MIN (encoder_output->cache_size - offset, count - sent);
+                ret = encoder_output_send (encoder_output, sock, offset, len);
+                if ((ret == -1) && (errno == EAGAIN)) {
+                        if (!wait_socket (sock, POLLOUT)) {
+                                return FALSE;
+                        }
+                        continue;
+                }
+                if (ret <= 0) {
+                        GST_INFO ("push, sendfile error: %s", g_strerror (errno));
+                        return FALSE;
+                }
+                sent += ret;
+        }
+
+        return TRUE;
+}
+
+static gboolean send_request (gint sock, PushRequest *request)
+{
+        if (!write_data (sock, request->data, request->count)) {
+                return FALSE;
+        }
+        if (request->encoder_output != NULL) {
+                return send_body (sock, request->encoder_output, request->body_addr, request->body_size);
+        }
+
+        return TRUE;
+}
+
+static gboolean receive (gint sock, gchar *buf, gsize size, gsize *len)
+{
+        gssize ret;
+
+        for (;;) {
+                ret = recv (sock, buf, size, 0);
+                if ((ret == -1) && (errno == EAGAIN)) {
+                        if (!wait_socket (sock, POLLIN)) {
+                                return FALSE;
+                        }
+                        continue;
+                }
+                if (ret == -1) {
+                        GST_INFO ("push, read error: %s", g_strerror (errno));
+                        return FALSE;
+                }
+                if (ret == 0) {
+                        /* closed by server */
+                        return FALSE;
+                }
+                *len = ret;
+                return TRUE;
+        }
+}
+
+/*
+ * read a response, the body is discarded, bytes of the next pipelined response are kept in response.
+ * return status code, -1 on error. keep_alive is FALSE if the connection can't be reused.
+ */
+static gint read_response (gint sock, Response *response, gboolean *keep_alive)
+{
+        gchar *end, *head, *p, scratch[PUSHCLIENT_RESPONSE_SIZE];
+        gsize head_len, len;
+        guint64 body;
+        gint minor, status;
+
+        /* response head */
+        while ((end = g_strstr_len (response->buf, response->len, "\r\n\r\n")) == NULL) {
+                if (response->len == PUSHCLIENT_RESPONSE_SIZE) {
+                        GST_ERROR ("push, response head too large");
+                        return -1;
+                }
+                if (!receive (sock, response->buf + response->len, PUSHCLIENT_RESPONSE_SIZE - response->len, &len)) {
+                        return -1;
+                }
+                response->len += len;
+        }
+        head_len = end - response->buf + 4;
+        head = g_ascii_strdown (response->buf, head_len);
+        if (sscanf (head, "http/1.%d %d", &minor, &status) != 2) {
+                GST_ERROR ("push, bad response");
+                g_free (head);
+                return -1;
+        }
+        *keep_alive = (minor >= 1) && (strstr (head, "\r\nconnection: close") == NULL);
+        p = strstr (head, "\r\ncontent-length:");
+        if (p != NULL) {
+                body = g_ascii_strtoull (p + strlen ("\r\ncontent-length:"), NULL, 10);
+
+        } else if ((status == 204) || (status == 304) || (status / 100 == 1)) {
+                body = 0;
+
+        } else {
+                /* chunked or till close, the rest of connection is unknown */
+                body = 0;
+                *keep_alive = FALSE;
+        }
+        g_free (head);
+
+        /* discard body */
+        len = MIN (body, response->len - head_len);
+        body -= len;
+        head_len += len;
+        response->len -= head_len;
+        memmove (response->buf, response->buf + head_len, response->len);
+        while (body > 0) {
+                if (!receive (sock, scratch, MIN (body, sizeof (scratch)), &len)) {
+                        return -1;
+                }
+                body -= len;
+        }
+
+        return status;
+}
+
+static void log_failure (PushRequest *request, gint status)
+{
+        gchar *line;
+
+        line = g_strndup (request->data, strcspn (request->data, "\r\n"));
+        if (status == -1) {
+                GST_ERROR ("push %s failure", line);
+
+        } else {
+                GST_WARNING ("push %s, status %d", line, status);
+        }
+        g_free (line);
+}
+
+/**
+ * pushclient_request:
+ * @client: (in): the push client.
+ * @requests: (in): requests pipelined on a connection, data of requests are freed.
+ * @n: (in): number of requests.
+ *
+ * send requests in order on one connection, and read responses of them.
+ *
+ * Returns: number of requests succeed with 2xx status.
+ */
+gint pushclient_request (PushClient *client, PushRequest *requests, gint n)
+{
+        Response response;
+        gboolean reused, keep_alive, fresh;
+        gint i, sock, first, sent, done, succeed, status;
+
+        succeed = 0;
+        fresh = FALSE;
+        first = 0;
+        while (first < n) {
+                sock = get_connection (client, fresh, &reused);
+                if (sock == -1) {
+                        log_failure (&requests[first], -1);
+                        break;
+                }
+                for (sent = first; sent < n; sent++) {
+                        if (!send_request (sock, &requests[sent])) {
+                                break;
+                        }
+                }
+                response.len = 0;
+                keep_alive = TRUE;
+                for (done = first; (done < sent) && keep_alive; done++) {
+                        status = read_response (sock, &response, &keep_alive);
+                        if (status == -1) {
+                                break;
+                        }
+                        if (status / 100 == 2) {
+                                succeed++;
+
+                        } else {
+                                log_failure (&requests[done], status);
+                        }
+                }
+                if ((done == n) && keep_alive) {
+                        put_connection (client, sock);
+                        break;
+                }
+                close (sock);
+                if (done > first) {
+                        /* closed by server after some responses, e.g. Connection: close, the rest on a new one */
+                        first = done;
+                        fresh = TRUE;
+                        continue;
+                }
+                if (reused && !fresh) {
+                        /* connection closed by server when reused, send again on a new one */
+                        fresh = TRUE;
+                        continue;
+                }
+                log_failure (&requests[first], -1);
+                break;
+        }
+
+        for (i = 0; i < n; i++) {
+                g_free (requests[i].data);
+        }
+
+        return succeed;
+}
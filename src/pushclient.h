@@ -0,0 +1,42 @@
+/*
+ * http client of m3u8 push, keep-alive connections to the push server.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __PUSHCLIENT_H__
+#define __PUSHCLIENT_H__
+
+#include <netinet/in.h>
+#include <gst/gst.h>
+
+#include "source.h"
+#include "encoder.h"
+
+#define PUSHCLIENT_CONNECTIONS 4 /* max idle keep-alive connections kept in pool */
+#define PUSHCLIENT_TIMEOUT 10000 /* io timeout in milliseconds */
+#define PUSHCLIENT_RESPONSE_SIZE 4096 /* max size of response head */
+
+typedef struct _PushClient {
+        gchar *host;
+        guint16 port;
+        GMutex mutex;
+        gboolean resolved;
+        struct sockaddr_in address; /* resolved address of host */
+        GQueue idle; /* idle keep-alive connections */
+} PushClient;
+
+typedef struct _PushRequest {
+        gchar *data; /* request head, or the whole request */
+        gsize count;
+        EncoderOutput *encoder_output; /* body in cache of encoder output if not NULL */
+        guint64 body_addr;
+        gsize body_size;
+} PushRequest;
+
+PushClient * pushclient_new (gchar *host, guint16 port);
+void pushclient_free (PushClient *client);
+gint pushclient_request (PushClient *client, PushRequest *requests, gint n);
+
+#endif /* __PUSHCLIENT_H__ */
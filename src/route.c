@@ -0,0 +1,190 @@
+/*
+ * route of http streaming request uri.
+ *
+ * uri is parsed once by hand, no regex compile per request.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "route.h"
+
+/*
+ * parse decimal number at p, end is set to the first non digit character.
+ * FALSE if no digit or the number overflows guint64.
+ */
+static gboolean parse_number (const gchar *p, guint64 *number, const gchar **end)
+{
+        guint64 n, digit;
+
+        if (!g_ascii_isdigit (*p)) {
+                return FALSE;
+        }
+        n = 0;
+        while (g_ascii_isdigit (*p)) {
+                digit = *p - '0';
+                if (n > (G_MAXUINT64 - digit) / 10) {
+                        /* overflow */
+                        return FALSE;
+                }
+                n = n * 10 + digit;
+                p++;
+        }
+        *number = n;
+        *end = p;
+
+        return TRUE;
+}
+
+/*
+ * segment file extension, mpeg2 ts or fragmented mp4.
+ */
+static gboolean is_segment_extension (const gchar *p)
+{
+        return (strcmp (p, ".ts") == 0) || (strcmp (p, ".m4s") == 0);
+}
+
+/**
+ * route_parse:
+ * @uri: (in): request uri.
+ * @route: (out): route of the uri.
+ *
+ * parse http streaming request uri:
+ *     /live/job/playlist.m3u8
+ *     /live/job/manifest.mpd
+ *     /live/job/encoder/n
+ *     /live/job/encoder/n/playlist.m3u8
+ *     /live/job/encoder/n/timestamp.ts
+ *     /live/job/encoder/n/timestamp.part.ts
+ *     /live/job/encoder/n/timestamp.m4s
+ *     /live/job/encoder/n/timestamp.part.m4s
+ *     /live/job/encoder/n/init.mp4
+ *
+ * Returns: TRUE if uri is valid, route->type is ROUTE_NONE if not.
+ */
+gboolean route_parse (const gchar *uri, Route *route)
+{
+        const gchar *p, *name;
+        guint64 n;
+        gsize len;
+
+        route->type = ROUTE_NONE;
+        route->job[0] = '\0';
+        route->encoder = -1;
+        route->timestamp = GST_CLOCK_TIME_NONE;
+        route->part = -1;
+        route->msn = -1;
+
+        if (!g_str_has_prefix (uri, "/live/")) {
+                return FALSE;
+        }
+
+        /* job name */
+        name = uri + strlen ("/live/");
+        p = strchr (name, '/');
+        if ((p == NULL) || (p == name) || (p - name >= ROUTE_JOB_NAME_LEN)) {
+                return FALSE;
+        }
+        len = p - name;
+        memcpy (route->job, name, len);
+        route->job[len] = '\0';
+        p++;
+
+        if (strcmp (p, "playlist.m3u8") == 0) {
+                route->type = ROUTE_MASTER_PLAYLIST;
+                return TRUE;
+        }
+        if (strcmp (p, "manifest.mpd") == 0) {
+                route->type = ROUTE_MPD;
+                return TRUE;
+        }
+
+        /* encoder index */
+        if (!g_str_has_prefix (p, "encoder/") || !parse_number (p + strlen ("encoder/"), &n, &p) || (n > G_MAXINT)) {
+                return FALSE;
+        }
+        route->encoder = n;
+        if (*p == '\0') {
+                route->type = ROUTE_PROGRESSIVE;
+                return TRUE;
+        }
+        if (*p != '/') {
+                return FALSE;
+        }
+        p++;
+
+        if (strcmp (p, "playlist.m3u8") == 0) {
+                route->type = ROUTE_PLAYLIST;
+                return TRUE;
+        }
+        if (strcmp (p, "init.mp4") == 0) {
+                route->type = ROUTE_INIT;
+                return TRUE;
+        }
+        if (!parse_number (p, &n, &p)) {
+                return FALSE;
+        }
+        route->timestamp = n;
+        if (is_segment_extension (p)) {
+                route->type = ROUTE_SEGMENT;
+                return TRUE;
+        }
+        if ((*p == '.') && parse_number (p + 1, &n, &p) && is_segment_extension (p) && (n <= G_MAXINT64)) {
+                route->part = n;
+                route->type = ROUTE_PART;
+                return TRUE;
+        }
+
+        return FALSE;
+}
+
+/**
+ * route_parse_parameters:
+ * @parameters: (in): query of request uri.
+ * @route: (in/out): route of the uri.
+ *
+ * parse blocking playlist reload parameters of low latency hls, _HLS_msn=n&_HLS_part=n,
+ * other parameters are ignored.
+ *
+ * Returns: FALSE if parameters are invalid.
+ */
+gboolean route_parse_parameters (const gchar *parameters, Route *route)
+{
+        const gchar *p;
+        gint64 *value;
+        guint64 n;
+
+        p = parameters;
+        while (*p != '\0') {
+                value = NULL;
+                if (g_str_has_prefix (p, "_HLS_msn=")) {
+                        value = &(route->msn);
+                        p += strlen ("_HLS_msn=");
+
+                } else if (g_str_has_prefix (p, "_HLS_part=")) {
+                        value = &(route->part);
+                        p += strlen ("_HLS_part=");
+                }
+                if (value != NULL) {
+                        if (!parse_number (p, &n, &p) || (n > G_MAXINT64)) {
+                                return FALSE;
+                        }
+                        *value = n;
+                }
+                /* next parameter */
+                p = strchr (p, '&');
+                if (p == NULL) {
+                        break;
+                }
+                p++;
+        }
+        if ((route->part != -1) && (route->msn == -1)) {
+                /* _HLS_part without _HLS_msn */
+                return FALSE;
+        }
+
+        return TRUE;
+}
@@ -0,0 +1,38 @@
+/*
+ * route of http streaming request uri.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __ROUTE_H__
+#define __ROUTE_H__
+
+#include <gst/gst.h>
+
+#define ROUTE_JOB_NAME_LEN 256
+
+typedef enum {
+        ROUTE_NONE = 0,
+        ROUTE_MASTER_PLAYLIST, /* /live/job/playlist.m3u8 */
+        ROUTE_MPD, /* /live/job/manifest.mpd */
+        ROUTE_PROGRESSIVE, /* /live/job/encoder/n */
+        ROUTE_PLAYLIST, /* /live/job/encoder/n/playlist.m3u8 */
+        ROUTE_SEGMENT, /* /live/job/encoder/n/timestamp.ts or timestamp.m4s */
+        ROUTE_PART, /* /live/job/encoder/n/timestamp.part.ts or timestamp.part.m4s, low latency hls */
+        ROUTE_INIT /* /live/job/encoder/n/init.mp4, init segment of cmaf */
+} RouteType;
+
+typedef struct _Route {
+        RouteType type;
+        gchar job[ROUTE_JOB_NAME_LEN]; /* job name */
+        gint encoder; /* encoder index, -1 if none */
+        GstClockTime timestamp; /* segment timestamp */
+        gint64 part; /* part number of part uri, or _HLS_part of playlist, -1 if none */
+        gint64 msn; /* _HLS_msn of playlist, blocking playlist reload, -1 if none */
+} Route;
+
+gboolean route_parse (const gchar *uri, Route *route);
+gboolean route_parse_parameters (const gchar *parameters, Route *route);
+
+#endif /* __ROUTE_H__ */
@@ -4,6 +4,7 @@
  *  Copyright (C) Zhang Ping <zhangping@163.com>
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -126,12 +127,20 @@ static void source_finalize (GObject *obj)
 {
         Source *source = SOURCE (obj);
         GObjectClass *parent_class = g_type_class_peek (G_TYPE_OBJECT);
-        gint i;
+        gint i, j;
         SourceStream *stream;
 
         for (i = source->streams->len - 1; i >= 0; i--) {
                 stream = g_array_index (source->streams, gpointer, i);
                 g_array_free (stream->encoders, FALSE);
+                for (j = 0; (stream->ring != NULL) && (j < stream->ring_size); j++) {
+                        if (stream->ring[j] != NULL) {
+                                gst_sample_unref (stream->ring[j]);
+                        }
+                }
+                g_free (stream->ring);
+                g_mutex_clear (&(stream->mutex));
+                g_cond_clear (&(stream->cond));
                 g_free (stream);
                 g_array_remove_index (source->streams, i);
         }
@@ -259,62 +268,154 @@ gboolean bus_callback (GstBus *bus, GstMessage *msg, gpointer user_data)
         return TRUE;
 }
 
-static gchar** get_property_names (gchar *param)
-{
-        gchar *p1, *p2, **pp, **pp1;
-        GRegex *regex;
-
-        /* strip space at begin */
-        regex = g_regex_new ("[^ ]* *(.*)", 0, 0, NULL);
-        p1 = g_regex_replace (regex, param, -1, 0, "\\1", 0, NULL);
-        g_regex_unref (regex);
-        /* strip space beside = */
-        regex = g_regex_new ("( *= *)", 0, 0, NULL);
-        p2 = g_regex_replace (regex, p1, -1, 0, "=", 0, NULL);
-        g_free (p1);
-        g_regex_unref (regex);
-        /* strip redundant space */
-        regex = g_regex_new ("( +)", 0, 0, NULL);
-        p1 = g_regex_replace (regex, p2, -1, 0, " ", 0, NULL);
-        g_free (p2);
-        g_regex_unref (regex);
-        pp = g_strsplit (p1, " ", 0);
-        g_free (p1);
-
-        pp1 = pp;
-        while (*pp1 != NULL) {
-                if (g_strrstr (*pp1, "=") == NULL) {
-                        GST_ERROR ("Configure error: %s", *pp1);
-                        g_strfreev (pp);
+static gchar * skip_space (gchar *p)
+{
+        while (*p == ' ') {
+                p++;
+        }
+
+        return p;
+}
+
+/*
+ * end of a word of bin, stop at space, "!", "=" and end of bin.
+ */
+static gchar * word_end (gchar *p)
+{
+        while ((*p != '\0') && (*p != ' ') && (*p != '!') && (*p != '=')) {
+                p++;
+        }
+
+        return p;
+}
+
+/**
+ * bin_tokenize:
+ * @bin: (in): bin of job description, e.g. "appsrc name=video ! queue ! x264enc ! muxer."
+ *
+ * split bin to elements and pads with their properties in one walk.
+ *
+ * Returns: array of BinToken, NULL if bin is invalid.
+ */
+GArray * bin_tokenize (gchar *bin)
+{
+        GArray *tokens;
+        GPtrArray *names, *values;
+        BinToken token;
+        gchar *p, *start, *word, *dot;
+
+        tokens = g_array_new (FALSE, FALSE, sizeof (BinToken));
+        p = bin;
+        for (;;) {
+                start = p = skip_space (p);
+
+                /* element factory name or element.pad */
+                word = p;
+                p = word_end (p);
+                if (p == word) {
+                        GST_ERROR ("Configure error, element expected: %s", bin);
+                        bin_tokens_free (tokens);
                         return NULL;
                 }
-                regex = g_regex_new ("([^=]*)=.*", 0, 0, NULL);
-                p1 = g_regex_replace (regex, *pp1, -1, 0, "\\1", 0, NULL);
-                g_free (*pp1);
-                g_regex_unref (regex);
-                *pp1 = p1;
-                pp1++;
+                token.factory = g_strndup (word, p - word);
+                dot = strrchr (token.factory, '.');
+                if (dot != NULL) {
+                        token.pad = g_strdup (dot + 1);
+                        *dot = '\0';
+
+                } else {
+                        token.pad = NULL;
+                }
+
+                /* name=value pairs, space beside "=" is allowed */
+                names = g_ptr_array_new ();
+                values = g_ptr_array_new ();
+                for (;;) {
+                        p = skip_space (p);
+                        if ((*p == '!') || (*p == '\0')) {
+                                break;
+                        }
+                        word = p;
+                        p = word_end (p);
+                        if (p == word) {
+                                break;
+                        }
+                        g_ptr_array_add (names, g_strndup (word, p - word));
+                        p = skip_space (p);
+                        if (*p != '=') {
+                                break;
+                        }
+                        p = skip_space (p + 1);
+                        word = p;
+                        while ((*p != '\0') && (*p != ' ') && (*p != '!')) {
+                                p++;
+                        }
+                        if (p == word) {
+                                break;
+                        }
+                        g_ptr_array_add (values, g_strndup (word, p - word));
+                }
+                g_ptr_array_add (names, NULL);
+                g_ptr_array_add (values, NULL);
+                token.names = (gchar **)g_ptr_array_free (names, FALSE);
+                token.values = (gchar **)g_ptr_array_free (values, FALSE);
+                token.text = g_strstrip (g_strndup (start, p - start));
+                g_array_append_val (tokens, token);
+                if ((*p != '!') && (*p != '\0')) {
+                        GST_ERROR ("Configure error: %s", token.text);
+                        bin_tokens_free (tokens);
+                        return NULL;
+                }
+                if (g_strv_length (token.names) != g_strv_length (token.values)) {
+                        GST_ERROR ("Configure error: %s", token.text);
+                        bin_tokens_free (tokens);
+                        return NULL;
+                }
+                if (*p == '\0') {
+                        break;
+                }
+                p++;
         }
 
-        return pp;
+        return tokens;
 }
 
-static gchar* get_property_value (gchar *param, gchar *property)
+void bin_tokens_free (GArray *tokens)
 {
-        gchar *r, *v;
-        GRegex *regex;
+        BinToken *token;
+        gint i;
 
-        r = g_strdup_printf (".* *%s *= *([^ ]*).*", property);
-        regex = g_regex_new (r, 0, 0, NULL);
-        v = g_regex_replace (regex, param, -1, 0, "\\1", 0, NULL);
-        g_regex_unref (regex);
-        g_free (r);
-        if (g_strcmp0 (param, v) == 0) {
-                g_free (v);
-                v = NULL;
+        for (i = 0; i < tokens->len; i++) {
+                token = &g_array_index (tokens, BinToken, i);
+                g_free (token->text);
+                g_free (token->factory);
+                g_free (token->pad);
+                g_strfreev (token->names);
+                g_strfreev (token->values);
         }
+        g_array_free (tokens, TRUE);
+}
 
-        return v;
+/**
+ * bin_token_property:
+ * @token: (in): element token.
+ * @name: (in): property name.
+ *
+ * Returns: (transfer none): value of the last one if property set more than once, NULL if not set.
+ */
+gchar * bin_token_property (BinToken *token, gchar *name)
+{
+        gchar *value;
+        gint i;
+
+        value = NULL;
+        for (i = 0; token->names[i] != NULL; i++) {
+                if (g_strcmp0 (token->names[i], name) == 0) {
+                        value = token->values[i];
+                }
+        }
+
+        return value;
 }
 
 static gboolean set_element_property (GstElement *element, gchar* name, gchar* value)
@@ -335,72 +436,53 @@ static gboolean set_element_property (GstElement *element, gchar* name, gchar* v
         return TRUE;
 }
 
-static GstElement * element_create (gchar *job, gchar *pipeline, gchar *param)
+static GstElement * element_create (JobSpec *spec, gchar *pipeline, BinToken *token)
 {
         GstElement *element;
-        gchar *name, *p, **pp, **pp1, **properties, *value;
-        GRegex *regex;
+        gchar *p, **pp, **properties, *value;
+        gint i;
 
         /* create element. */
-        regex = g_regex_new (" .*", 0, 0, NULL);
-        name = g_regex_replace (regex, param, -1, 0, "", 0, NULL);
-        g_regex_unref (regex);
-        element = gst_element_factory_make (name, NULL);
+        element = gst_element_factory_make (token->factory, NULL);
         if (element == NULL) {
-                GST_ERROR ("make element %s error.", name);
-                g_free (name);
+                GST_ERROR ("make element %s error.", token->factory);
                 return NULL;
         }
 
-        p = g_strdup_printf ("%s.elements.%s.property", pipeline, name);
-        properties = jobdesc_element_properties (job, p);
+        p = g_strdup_printf ("%s.elements.%s.property", pipeline, token->factory);
+        properties = jobdesc_element_properties (spec, p);
         g_free (p);
         if (properties != NULL) {
                 /* set propertys in element property. */
                 pp = properties;
                 while (*pp != NULL) {
-                        p = g_strdup_printf ("%s.elements.%s.property.%s", pipeline, name, *pp);
-                        value = jobdesc_element_property_value (job, p);
+                        p = g_strdup_printf ("%s.elements.%s.property.%s", pipeline, token->factory, *pp);
+                        value = jobdesc_element_property_value (spec, p);
                         g_free (p);
                         if (!set_element_property (element, *pp, value)) {
                                 GST_ERROR ("Set property error %s=%s", *pp, value);
+                                g_free (value);
+                                g_strfreev (properties);
+                                gst_object_unref (element);
                                 return NULL;
                         }
                         GST_INFO ("Set property: %s = %s.", *pp, value);
+                        g_free (value);
                         pp++;
                 }
+                g_strfreev (properties);
         }
 
         /* set element propertys in bin. */
-        pp = get_property_names (param);
-        if (pp == NULL) {
-                gst_object_unref (element);
-                g_strfreev (pp);
-                g_free (name);
-                return NULL;
-        }
-        pp1 = pp;
-        while (*pp1 != NULL) {
-                p = get_property_value (param, *pp1);
-                if (p == NULL) {
-                        GST_ERROR ("Create element %s failure, Configure error: %s=%s", name, *pp1, p);
+        for (i = 0; token->names[i] != NULL; i++) {
+                if (!set_element_property (element, token->names[i], token->values[i])) {
+                        GST_ERROR ("Create element %s failure, Set property error: %s=%s", token->factory, token->names[i], token->values[i]);
                         gst_object_unref (element);
-                        g_strfreev (pp);
-                        g_free (name);
                         return NULL;
                 }
-                if (!set_element_property (element, *pp1, p)) {
-                        GST_ERROR ("Create element %s failure, Set property error: %s=%s", name, *pp1, p);
-                        g_free (name);
-                        return NULL;
-                }
-                GST_INFO ("Set property: %s=%s", *pp1, p);
-                g_free (p);
-                pp1++;
+                GST_INFO ("Set property: %s=%s", token->names[i], token->values[i]);
         }
-        g_strfreev (pp);
-        GST_INFO ("Create element %s success.", name);
-        g_free (name);
+        GST_INFO ("Create element %s success.", token->factory);
 
         return element;
 }
@@ -468,24 +550,6 @@ static void free_bin (Bin *bin)
 {
 }
 
-static gboolean is_pad (gchar *element)
-{
-        gchar *p;
-
-        p = element;
-        while (*p != '\0') {
-                if (*p == '.') {
-                        return TRUE;
-                }
-                if (*p == ' ') {
-                        return FALSE;
-                }
-                p++;
-        }
-
-        return FALSE;
-}
-
 static void delay_sometimes_pad_link (Source *source, gchar *name)
 {
         GSList *elements, *bins;
@@ -519,86 +583,88 @@ static void delay_sometimes_pad_link (Source *source, gchar *name)
         }
 }
 
-static gchar * get_bin_name (gchar *bin)
+/*
+ * bin->name, same as name of appsrc or appsink, or name of the demuxer or muxer.
+ */
+static gchar * get_bin_name (GArray *tokens)
 {
-        GRegex *regex;
-        GMatchInfo *match_info;
+        BinToken *token;
         gchar *name;
+        gint i;
 
-        /* bin->name, same as appsrc or appsink. */
-        regex = g_regex_new ("appsrc *name=(?<name>[^ ]*)", G_REGEX_OPTIMIZE, 0, NULL);
-        g_regex_match (regex, bin, 0, &match_info);
-        g_regex_unref (regex);
-        if (g_match_info_matches (match_info)) {
-                name = g_match_info_fetch_named (match_info, "name");
-                g_match_info_free (match_info);
-                return name;
+        /* appsrc name=video ! queue ! x264enc ! queue ! muxer. */
+        for (i = 0; i < tokens->len; i++) {
+                token = &g_array_index (tokens, BinToken, i);
+                name = bin_token_property (token, "name");
+                if ((token->pad == NULL) && (g_strcmp0 (token->factory, "appsrc") == 0) && (name != NULL)) {
+                        return g_strdup (name);
+                }
         }
 
         /* demuxer.video ! queue ! mpeg2dec ! queue ! appsink name = video */
-        regex = g_regex_new ("! *appsink *name *= *(?<name>[^ ]*)[^!]*$", G_REGEX_OPTIMIZE, 0, NULL);
-        g_regex_match (regex, bin, 0, &match_info);
-        g_regex_unref (regex);
-        if (g_match_info_matches (match_info)) {
-                name = g_match_info_fetch_named (match_info, "name");
-                g_match_info_free (match_info);
-                return name;
-        }
-        
+        token = &g_array_index (tokens, BinToken, tokens->len - 1);
+        name = bin_token_property (token, "name");
+        if ((tokens->len > 1) && (g_strcmp0 (token->factory, "appsink") == 0) && (name != NULL)) {
+                return g_strdup (name);
+        }
+
         /* udpsrc ! queue ! mpegtsdemux name=demuxer */
-        regex = g_regex_new ("name *= *(?<name>[^ ]*)$", G_REGEX_OPTIMIZE, 0, NULL);
-        g_regex_match (regex, bin, 0, &match_info);
-        g_regex_unref (regex);
-        if (g_match_info_matches (match_info)) {
-                name = g_match_info_fetch_named (match_info, "name");
-                g_match_info_free (match_info);
-                return name;
-        }
-        
+        i = g_strv_length (token->names);
+        if ((i > 0) && (g_strcmp0 (token->names[i - 1], "name") == 0)) {
+                return g_strdup (token->values[i - 1]);
+        }
+
         /* mpegtsmux name=muxer ! queue ! appsink sync=FALSE */
-        regex = g_regex_new ("[^!]*name *= *(?<name>[^ ]*)", G_REGEX_OPTIMIZE, 0, NULL);
-        g_regex_match (regex, bin, 0, &match_info);
-        g_regex_unref (regex);
-        if (g_match_info_matches (match_info)) {
-                name = g_match_info_fetch_named (match_info, "name");
-                g_match_info_free (match_info);
-                return name;
+        for (i = 0; i < tokens->len; i++) {
+                name = bin_token_property (&g_array_index (tokens, BinToken, i), "name");
+                if (name != NULL) {
+                        return g_strdup (name);
+                }
         }
 
         return NULL;
 }
 
-GSList * bins_parse (gchar *job, gchar *pipeline)
+GSList * bins_parse (JobSpec *spec, gchar *pipeline)
 {
         GstElement *element, *src;
-        gchar *p, *p1, *src_name, *src_pad_name, **pp, **pp1, **bins, **binsp;
+        gchar *p, *src_name, *src_pad_name, *caps_name, **bins, **binsp;
+        GArray *tokens;
+        BinToken *token;
         Bin *bin;
         Link *link;
         GSList *list;
+        gint i;
 
         list = NULL;
-        binsp = bins = jobdesc_bins (job, pipeline);
+        binsp = bins = jobdesc_bins (spec, pipeline);
         while (*binsp != NULL) {
+                tokens = bin_tokenize (*binsp);
+                if (tokens == NULL) {
+                        g_strfreev (bins);
+                        return NULL;
+                }
                 bin = g_slice_new (Bin);
                 bin->links = NULL;
                 bin->elements = NULL;
                 bin->previous = NULL;
                 bin->signal_id = 0;
-                pp = pp1 = g_strsplit (*binsp, "!", 0);
                 src = NULL;
                 src_name = NULL;
                 src_pad_name = NULL;
-                bin->name = get_bin_name (*binsp);
+                caps_name = NULL;
+                element = NULL;
+                bin->name = get_bin_name (tokens);
 
-                while (*pp != NULL) {
-                        p1 = g_strdup (*pp);
-                        p1 = g_strstrip (p1);
-                        if (is_pad (p1)) {
+                for (i = 0; i < tokens->len; i++) {
+                        token = &g_array_index (tokens, BinToken, i);
+                        if (token->pad != NULL) {
                                 /* request pad or sometimes pad */
                                 if (src == NULL) {
                                         /* should be a sometimes pad */
-                                        src_name = g_strndup (p1, g_strrstr (p1, ".") - p1);
-                                        src_pad_name = g_strndup (g_strrstr (p1, ".") + 1, strlen (p1) - strlen (src_name) -1);
+                                        src_name = g_strdup (token->factory);
+                                        src_pad_name = g_strdup (token->pad);
+                                        caps_name = token->factory;
 
                                 } else {
                                         /* should be a request pad */
@@ -607,55 +673,52 @@ GSList * bins_parse (gchar *job, gchar *pipeline)
                                         link->src_name = src_name;
                                         link->src_pad_name = src_pad_name;
                                         link->sink = NULL;
-                                        link->sink_name = g_strndup (p1, g_strrstr (p1, ".") - p1);
+                                        link->sink_name = g_strdup (token->factory);
                                         link->sink_pad_name = g_strdup (link->sink_name);
-                                        p = g_strdup_printf ("%s.elements.%s.caps", pipeline, src_name);
-                                        link->caps = jobdesc_element_caps (job, p);
+                                        p = g_strdup_printf ("%s.elements.%s.caps", pipeline, caps_name);
+                                        link->caps = jobdesc_element_caps (spec, p);
                                         g_free (p);
                                         bin->links = g_slist_append (bin->links, link);
                                 }
-                                pp++;
                                 continue;
                         }
-                        element = element_create (job, pipeline, p1);
-                        if (element != NULL) {
-                                if (src_name != NULL) {
-                                        link = g_slice_new (Link);
-                                        link->src = src;
-                                        link->src_name = src_name;
-                                        link->src_pad_name = src_pad_name;
-                                        link->sink = element;
-                                        link->sink_name = p1;
-                                        link->sink_pad_name = NULL;
-                                        p = g_strdup_printf ("%s.elements.%s.caps", pipeline, src_name);
-                                        link->caps = jobdesc_element_caps (job, p);
-                                        g_free (p);
-                                        if (src_pad_name == NULL) {
-                                                bin->links = g_slist_append (bin->links, link);
-
-                                        } else {
-                                                bin->previous = link;
-                                        }
+                        element = element_create (spec, pipeline, token);
+                        if (element == NULL) {
+                                /* create element failure */
+                                bin_tokens_free (tokens);
+                                g_strfreev (bins);
+                                return NULL;
+                        }
+                        if (src_name != NULL) {
+                                link = g_slice_new (Link);
+                                link->src = src;
+                                link->src_name = src_name;
+                                link->src_pad_name = src_pad_name;
+                                link->sink = element;
+                                link->sink_name = g_strdup (token->text);
+                                link->sink_pad_name = NULL;
+                                p = g_strdup_printf ("%s.elements.%s.caps", pipeline, caps_name);
+                                link->caps = jobdesc_element_caps (spec, p);
+                                g_free (p);
+                                if (src_pad_name == NULL) {
+                                        bin->links = g_slist_append (bin->links, link);
 
                                 } else {
-                                        bin->first = element;
+                                        bin->previous = link;
                                 }
-                                bin->elements = g_slist_append (bin->elements, element);
-                                src = element;
-                                src_name = p1;
-                                src_pad_name = NULL;
 
                         } else {
-                                /* create element failure */
-                                g_free (bins);
-                                g_strfreev (pp1);
-                                return NULL;
+                                bin->first = element;
                         }
-                        pp++;
+                        bin->elements = g_slist_append (bin->elements, element);
+                        src = element;
+                        src_name = g_strdup (token->text);
+                        src_pad_name = NULL;
+                        caps_name = token->factory;
                 }
                 bin->last = element;
                 list = g_slist_append (list, bin);
-                g_strfreev (pp1);
+                bin_tokens_free (tokens);
                 binsp++;
         }
         g_strfreev (bins);
@@ -683,7 +746,84 @@ static void eos_callback (GstAppSink *appsink, gpointer user_data)
 {
         SourceStream *stream = (SourceStream *)user_data;
 
+        g_mutex_lock (&(stream->mutex));
         stream->eos = TRUE;
+        g_cond_broadcast (&(stream->cond));
+        g_mutex_unlock (&(stream->mutex));
+}
+
+/*
+ * is sample at position in ring not yet consumed by encoder at encoder_position.
+ */
+static gboolean ring_unread (SourceStream *stream, gint encoder_position, gint position)
+{
+        gint from, distance, unread;
+
+        if (stream->current_position == -1) {
+                return FALSE;
+        }
+        /* encoder position -1 means nothing consumed */
+        from = (encoder_position + stream->ring_size) % stream->ring_size;
+        distance = (position - from + stream->ring_size) % stream->ring_size;
+        unread = (stream->current_position - from + stream->ring_size) % stream->ring_size;
+
+        return (distance != 0) && (distance <= unread);
+}
+
+/*
+ * release sample at position if it has been consumed by all encoders, called with stream mutex.
+ */
+static void ring_release (SourceStream *stream, gint position)
+{
+        EncoderStream *encoder;
+        gint i;
+
+        if (stream->ring[position] == NULL) {
+                return;
+        }
+        for (i = 0; i < stream->encoders->len; i++) {
+                encoder = g_array_index (stream->encoders, gpointer, i);
+                if (ring_unread (stream, encoder->current_position, position)) {
+                        return;
+                }
+        }
+        stream->state->ring_count--;
+        stream->state->ring_bytes -= gst_buffer_get_size (gst_sample_get_buffer (stream->ring[position]));
+        gst_sample_unref (stream->ring[position]);
+        stream->ring[position] = NULL;
+}
+
+/*
+ * encoder stream too slow to output size bytes sample at position, NULL if no one.
+ */
+static EncoderStream * ring_slow_encoder (SourceStream *stream, gint position, gsize size)
+{
+        EncoderStream *encoder, *slowest;
+        gint i, from, unread, max;
+
+        slowest = NULL;
+        max = 0;
+        for (i = 0; i < stream->encoders->len; i++) {
+                encoder = g_array_index (stream->encoders, gpointer, i);
+                if (stream->current_position == -1) {
+                        break;
+                }
+                from = (encoder->current_position + stream->ring_size) % stream->ring_size;
+                if (from == position) {
+                        /* ring is full for the encoder */
+                        return encoder;
+                }
+                unread = (stream->current_position - from + stream->ring_size) % stream->ring_size;
+                if (unread > max) {
+                        max = unread;
+                        slowest = encoder;
+                }
+        }
+        if ((stream->ring_bytes != 0) && (stream->state->ring_bytes + size > stream->ring_bytes)) {
+                return slowest;
+        }
+
+        return NULL;
 }
 
 static GstFlowReturn new_sample_callback (GstAppSink *elt, gpointer user_data)
@@ -692,43 +832,81 @@ static GstFlowReturn new_sample_callback (GstAppSink *elt, gpointer user_data)
         GstBuffer *buffer;
         SourceStream *stream = (SourceStream *)user_data;
         EncoderStream *encoder;
-        gint i;
+        gint position;
+        gsize size;
 
         sample = gst_app_sink_pull_sample (GST_APP_SINK (elt));
         buffer = gst_sample_get_buffer (sample);
+        size = gst_buffer_get_size (buffer);
         stream->state->last_heartbeat = gst_clock_get_time (stream->system_clock);
-        stream->current_position = (stream->current_position + 1) % SOURCE_RING_SIZE;
 
-        /* output running status */
-        GST_DEBUG ("%s current position %d, buffer duration: %ld", stream->name, stream->current_position, GST_BUFFER_DURATION (buffer));
-        for (i = 0; i < stream->encoders->len; i++) {
-                encoder = g_array_index (stream->encoders, gpointer, i);
-                if (stream->is_live) {
-                        /* a live job, warning encoder too slow */
-                        if (stream->current_position == encoder->current_position) {
-                                GST_WARNING ("encoder stream %s can not catch up source output.", encoder->name);
-                        }
+        g_mutex_lock (&(stream->mutex));
+        position = (stream->current_position + 1) % stream->ring_size;
 
-                } else {
-                        /* not a live job, avoid decoder too fast */
-                        while (stream->current_position == encoder->current_position) {
-                                GST_DEBUG ("waiting %s encoder", stream->name);
-                                g_usleep (50000); /* wiating 50ms */
-                                continue;
-                        }
+        /* output running status */
+        GST_DEBUG ("%s current position %d, buffer duration: %ld", stream->name, position, GST_BUFFER_DURATION (buffer));
+        for (;;) {
+                encoder = ring_slow_encoder (stream, position, size);
+                if (encoder == NULL) {
+                        break;
                 }
+                if (stream->overflow == SOURCE_RING_OVERFLOW_BLOCK) {
+                        /* avoid decoder too fast */
+                        GST_DEBUG ("waiting %s encoder", stream->name);
+                        g_cond_wait (&(stream->cond), &(stream->mutex));
+                        continue;
+                }
+                /* drop the oldest sample of the slow encoder */
+                if (stream->overflow == SOURCE_RING_OVERFLOW_REPORT) {
+                        GST_WARNING ("encoder stream %s can not catch up source output, drop.", encoder->name);
+                }
+                encoder->current_position = (encoder->current_position + 1) % stream->ring_size;
+                ring_release (stream, encoder->current_position);
+                stream->state->dropped++;
         }
 
-        /* out a buffer */
-        if (stream->ring[stream->current_position] != NULL) {
-                gst_sample_unref (stream->ring[stream->current_position]);
+        /* out a buffer, publish position after the sample is in ring. */
+        if (stream->ring[position] != NULL) {
+                stream->state->ring_count--;
+                stream->state->ring_bytes -= gst_buffer_get_size (gst_sample_get_buffer (stream->ring[position]));
+                gst_sample_unref (stream->ring[position]);
         }
-        stream->ring[stream->current_position] = sample;
+        stream->ring[position] = sample;
+        stream->state->ring_count++;
+        stream->state->ring_bytes += size;
+        stream->current_position = position;
+        /* no encoder? */
+        ring_release (stream, position);
+        g_cond_broadcast (&(stream->cond));
+        g_mutex_unlock (&(stream->mutex));
         stream->state->current_timestamp = GST_BUFFER_PTS (buffer);
 
         return GST_FLOW_OK;
 }
 
+/*
+ * source_stream_read:
+ * @stream: (in): the source stream.
+ * @position: (in, out): position of the encoder stream.
+ *
+ * take next sample of the encoder stream from ring, called with stream mutex,
+ * the encoder stream must not catch up with source.
+ *
+ * Returns: (transfer full): the sample.
+ */
+GstSample * source_stream_read (SourceStream *stream, gint *position)
+{
+        GstSample *sample;
+
+        *position = (*position + 1) % stream->ring_size;
+        sample = gst_sample_ref (stream->ring[*position]);
+        ring_release (stream, *position);
+        /* wake up source waiting for slow encoder. */
+        g_cond_broadcast (&(stream->cond));
+
+        return sample;
+}
+
 static GstElement * create_source_pipeline (Source *source)
 {
         GstElement *pipeline, *element;
@@ -781,14 +959,16 @@ static GstElement * create_source_pipeline (Source *source)
                         delay_sometimes_pad_link (source, bin->previous->src_name);
                 }
                         
-                /* new stream, set appsink output callback. */
-                element = bin->last;
-                element_factory = gst_element_get_factory (element);
-                type = gst_element_factory_get_element_type (element_factory);
-                if (g_strcmp0 ("GstAppSink", g_type_name (type)) == 0) {
-                        stream = source_get_stream (source, bin->name);
-                        gst_app_sink_set_callbacks (GST_APP_SINK (element), &appsink_callbacks, stream, NULL);
-                        GST_INFO ("Set callbacks for bin %s", bin->name);
+                /* new stream, set appsink output callback, appsink name is stream name, ladder rungs included. */
+                for (elements = bin->elements; elements != NULL; elements = elements->next) {
+                        element = elements->data;
+                        element_factory = gst_element_get_factory (element);
+                        type = gst_element_factory_get_element_type (element_factory);
+                        if (g_strcmp0 ("GstAppSink", g_type_name (type)) == 0) {
+                                stream = source_get_stream (source, GST_ELEMENT_NAME (element));
+                                gst_app_sink_set_callbacks (GST_APP_SINK (element), &appsink_callbacks, stream, NULL);
+                                GST_INFO ("Set callbacks for bin %s stream %s", bin->name, stream->name);
+                        }
                 }
 
                 bins = g_slist_next (bins);
@@ -801,30 +981,177 @@ static GstElement * create_source_pipeline (Source *source)
         return pipeline;
 }
 
-static gint source_extract_streams (Source *source, gchar *job)
+/*
+ * rungs of scaling ladder of source stream, sorted from the largest to the smallest,
+ * returns array of width and height pairs, NULL if no ladder.
+ */
+static gint * ladder_rungs (JobSpec *spec, gchar *stream, gint *count)
+{
+        gchar **rungs;
+        gint i, j, n, *sizes, width, height;
+
+        *count = 0;
+        rungs = jobdesc_source_ladder (spec, stream);
+        if (rungs == NULL) {
+                return NULL;
+        }
+        n = g_strv_length (rungs);
+        sizes = g_new (gint, 2 * n);
+        for (i = 0; i < n; i++) {
+                if (sscanf (rungs[i], "%dx%d", &width, &height) != 2) {
+                        GST_ERROR ("source stream %s invalid ladder rung %s", stream, rungs[i]);
+                        g_strfreev (rungs);
+                        g_free (sizes);
+                        *count = -1;
+                        return NULL;
+                }
+                /* insertion sort by area, larger first */
+                for (j = i; (j > 0) && (sizes[2 * (j - 1)] * sizes[2 * (j - 1) + 1] < width * height); j--) {
+                        sizes[2 * j] = sizes[2 * (j - 1)];
+                        sizes[2 * j + 1] = sizes[2 * (j - 1) + 1];
+                }
+                sizes[2 * j] = width;
+                sizes[2 * j + 1] = height;
+        }
+        g_strfreev (rungs);
+        *count = n;
+
+        return sizes;
+}
+
+static void ladder_link (Bin *bin, GstElement *src, GstElement *sink, gchar *caps)
+{
+        Link *link;
+
+        link = g_slice_new0 (Link);
+        link->src = src;
+        link->sink = sink;
+        link->src_name = gst_element_get_name (src);
+        link->sink_name = gst_element_get_name (sink);
+        link->caps = caps;
+        bin->links = g_slist_append (bin->links, link);
+}
+
+/*
+ * build scaling ladder of the bin's stream:
+ * stream ! tee ! queue ! appsink name=stream
+ *          tee ! queue ! videoscale ! caps ! tee ! queue ! appsink name=stream_WxH
+ *                                            tee ! queue ! videoscale ! caps ! ...
+ * every rung is scaled from the previous larger one, and is a source stream.
+ */
+static gint ladder_build (JobSpec *spec, Bin *bin)
+{
+        GstElement *appsink, *tee, *queue, *scale, *sink;
+        GSList *links;
+        Link *link;
+        gint i, count, *sizes;
+        gboolean sync;
+        gchar *name;
+
+        if ((bin->last == NULL) || !GST_IS_APP_SINK (bin->last)) {
+                return 0;
+        }
+        sizes = ladder_rungs (spec, bin->name, &count);
+        if (sizes == NULL) {
+                return count == -1 ? 1 : 0;
+        }
+
+        /* insert tee before appsink */
+        appsink = bin->last;
+        tee = gst_element_factory_make ("tee", NULL);
+        queue = gst_element_factory_make ("queue", NULL);
+        if ((bin->previous != NULL) && (bin->previous->sink == appsink)) {
+                bin->previous->sink = tee;
+        }
+        for (links = bin->links; links != NULL; links = links->next) {
+                link = links->data;
+                if (link->sink == appsink) {
+                        link->sink = tee;
+                }
+        }
+        bin->elements = g_slist_append (bin->elements, tee);
+        bin->elements = g_slist_append (bin->elements, queue);
+        ladder_link (bin, tee, queue, NULL);
+        ladder_link (bin, queue, appsink, NULL);
+
+        g_object_get (appsink, "sync", &sync, NULL);
+        for (i = 0; i < count; i++) {
+                name = g_strdup_printf ("%s_%dx%d", bin->name, sizes[2 * i], sizes[2 * i + 1]);
+                GST_INFO ("source stream %s ladder rung %s", bin->name, name);
+                queue = gst_element_factory_make ("queue", NULL);
+                scale = gst_element_factory_make ("videoscale", NULL);
+                bin->elements = g_slist_append (bin->elements, queue);
+                bin->elements = g_slist_append (bin->elements, scale);
+                ladder_link (bin, tee, queue, NULL);
+                ladder_link (bin, queue, scale, NULL);
+                tee = gst_element_factory_make ("tee", NULL);
+                bin->elements = g_slist_append (bin->elements, tee);
+                ladder_link (bin, scale, tee, g_strdup_printf ("video/x-raw,width=%d,height=%d", sizes[2 * i], sizes[2 * i + 1]));
+                queue = gst_element_factory_make ("queue", NULL);
+                sink = gst_element_factory_make ("appsink", name);
+                g_object_set (sink, "sync", sync, NULL);
+                bin->elements = g_slist_append (bin->elements, queue);
+                bin->elements = g_slist_append (bin->elements, sink);
+                ladder_link (bin, tee, queue, NULL);
+                ladder_link (bin, queue, sink, NULL);
+                g_free (name);
+        }
+        g_free (sizes);
+
+        return 0;
+}
+
+static gint source_extract_streams (Source *source, JobSpec *spec)
 {
-        GRegex *regex;
-        GMatchInfo *match_info;
         SourceStream *stream;
-        gchar **bins, **p, *bin;
+        GArray *tokens;
+        BinToken *last;
+        gchar **bins, **p, *bin, *name;
+        gint i, count, *sizes;
 
-        p = bins = jobdesc_bins (job, "source");
+        p = bins = jobdesc_bins (spec, "source");
         while (*p != NULL) {
                 bin = *p;
-                regex = g_regex_new ("! *appsink *name *= *(?<name>[^ ]*)[^!]*$", G_REGEX_OPTIMIZE, 0, NULL);
-                g_regex_match (regex, bin, 0, &match_info);
-                g_regex_unref (regex);
-                if (g_match_info_matches (match_info)) {
-                        stream = (SourceStream *)g_malloc (sizeof (SourceStream));
-                        stream->name = g_match_info_fetch_named (match_info, "name");
+                tokens = bin_tokenize (bin);
+                if (tokens == NULL) {
+                        g_strfreev (bins);
+                        return 1;
+                }
+                /* demuxer.video ! queue ! mpeg2dec ! queue ! appsink name = video */
+                last = &g_array_index (tokens, BinToken, tokens->len - 1);
+                name = NULL;
+                if ((tokens->len > 1) && (g_strcmp0 (last->factory, "appsink") == 0)) {
+                        name = bin_token_property (last, "name");
+                }
+                if (name != NULL) {
+                        stream = (SourceStream *)g_malloc0 (sizeof (SourceStream));
+                        stream->name = g_strdup (name);
                         GST_INFO ("source stream %s found %s", stream->name, bin);
-                        g_match_info_free (match_info);
                         g_array_append_val (source->streams, stream);
 
+                        /* scaling ladder rungs */
+                        name = stream->name;
+                        sizes = ladder_rungs (spec, name, &count);
+                        if (count == -1) {
+                                bin_tokens_free (tokens);
+                                g_strfreev (bins);
+                                return 1;
+                        }
+                        for (i = 0; i < count; i++) {
+                                stream = (SourceStream *)g_malloc0 (sizeof (SourceStream));
+                                stream->name = g_strdup_printf ("%s_%dx%d", name, sizes[2 * i], sizes[2 * i + 1]);
+                                GST_INFO ("source stream %s found, ladder of %s", stream->name, name);
+                                g_array_append_val (source->streams, stream);
+                        }
+                        g_free (sizes);
+
                 } else if (g_strrstr (bin, "appsink") != NULL) {
                         GST_ERROR ("appsink name property must be set");
+                        bin_tokens_free (tokens);
+                        g_strfreev (bins);
                         return 1;
                 }
+                bin_tokens_free (tokens);
                 p++;
         }
         g_strfreev (bins);
@@ -832,14 +1159,16 @@ static gint source_extract_streams (Source *source, gchar *job)
         return 0;
 }
 
-Source * source_initialize (gchar *job, SourceState *source_stat)
+Source * source_initialize (JobSpec *spec, SourceState *source_stat)
 {
-        gint i, j;
+        gint i;
         Source *source;
         SourceStream *stream;
+        gchar *overflow;
+        GSList *list;
 
         source = source_new ("name", "source", NULL);
-        if (source_extract_streams (source, job) != 0) {
+        if (source_extract_streams (source, spec) != 0) {
                 return NULL;
         }
 
@@ -847,7 +1176,9 @@ Source * source_initialize (gchar *job, SourceState *source_stat)
                 stream = g_array_index (source->streams, gpointer, i);
                 stream->eos = FALSE;
                 stream->current_position = -1;
-                if (jobdesc_is_live (job)) {
+                g_mutex_init (&(stream->mutex));
+                g_cond_init (&(stream->cond));
+                if (jobdesc_is_live (spec)) {
                         stream->is_live = TRUE;
                 } else {
 
@@ -855,18 +1186,57 @@ Source * source_initialize (gchar *job, SourceState *source_stat)
                 }
                 stream->system_clock = source->system_clock;
                 stream->encoders = g_array_new (FALSE, FALSE, sizeof (gpointer));
-                for (j = 0; j < SOURCE_RING_SIZE; j++) {
-                        stream->ring[j] = NULL;
+
+                /* ring depth in samples and bytes, overflow policy */
+                stream->ring_size = jobdesc_source_stream_ring_size (spec, stream->name);
+                if (stream->ring_size == 0) {
+                        stream->ring_size = SOURCE_RING_SIZE;
+
+                } else if (stream->ring_size < 2) {
+                        GST_ERROR ("source stream %s ring-size %d too small", stream->name, stream->ring_size);
+                        return NULL;
                 }
+                stream->ring_bytes = jobdesc_source_stream_ring_bytes (spec, stream->name);
+                overflow = jobdesc_source_stream_overflow (spec, stream->name);
+                if (overflow == NULL) {
+                        /* live job can't wait, decoder of non live job can. */
+                        stream->overflow = stream->is_live ? SOURCE_RING_OVERFLOW_REPORT : SOURCE_RING_OVERFLOW_BLOCK;
+
+                } else if (g_strcmp0 (overflow, "block") == 0) {
+                        stream->overflow = SOURCE_RING_OVERFLOW_BLOCK;
+
+                } else if (g_strcmp0 (overflow, "drop") == 0) {
+                        stream->overflow = SOURCE_RING_OVERFLOW_DROP;
+
+                } else if (g_strcmp0 (overflow, "report") == 0) {
+                        stream->overflow = SOURCE_RING_OVERFLOW_REPORT;
+
+                } else {
+                        GST_ERROR ("source stream %s unknown overflow %s", stream->name, overflow);
+                        g_free (overflow);
+                        return NULL;
+                }
+                g_free (overflow);
+                stream->ring = g_new0 (GstSample *, stream->ring_size);
+                GST_INFO ("source stream %s ring size %d bytes %lu", stream->name, stream->ring_size, stream->ring_bytes);
+
                 stream->state = &(source_stat->streams[i]);
                 g_strlcpy (source_stat->streams[i].name, stream->name, STREAM_NAME_LEN);
+                stream->state->ring_count = 0;
+                stream->state->ring_bytes = 0;
+                stream->state->dropped = 0;
         }
 
         /* parse bins and create pipeline. */
-        source->bins = bins_parse (job, "source");
+        source->bins = bins_parse (spec, "source");
         if (source->bins == NULL) {
                 return NULL;
         }
+        for (list = source->bins; list != NULL; list = list->next) {
+                if (ladder_build (spec, list->data) != 0) {
+                        return NULL;
+                }
+        }
         source->pipeline = create_source_pipeline (source);
 
         return source;
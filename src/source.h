@@ -11,6 +11,7 @@
 
 #include "log.h"
 #include "m3u8playlist.h"
+#include "jobdesc.h"
 
 #define SOURCE_RING_SIZE 250
 #define STREAM_NAME_LEN 32
@@ -18,6 +19,17 @@
 typedef struct _Source Source;
 typedef struct _SourceClass SourceClass;
 
+/*
+ * a segment of bin, between "!", e.g. "x264enc bitrate=1000" or "demuxer.video".
+ */
+typedef struct _BinToken {
+        gchar *text; /* segment stripped */
+        gchar *factory; /* element factory name, or element name of pad */
+        gchar *pad; /* pad name, NULL if segment is an element */
+        gchar **names; /* property names in bin */
+        gchar **values; /* property values in bin */
+} BinToken;
+
 typedef struct _Link {
         GstElement *src;
         GstElement *sink;
@@ -43,8 +55,17 @@ typedef struct _SourceStreamState {
         gchar name[STREAM_NAME_LEN];
         GstClockTime current_timestamp;
         GstClockTime last_heartbeat;
+        guint64 ring_count; /* samples in ring not consumed by all encoders */
+        guint64 ring_bytes; /* bytes of samples in ring */
+        guint64 dropped; /* samples dropped for slow encoders */
 } SourceStreamState;
 
+typedef enum {
+        SOURCE_RING_OVERFLOW_BLOCK, /* wait for slow encoder */
+        SOURCE_RING_OVERFLOW_DROP, /* drop oldest sample of slow encoder */
+        SOURCE_RING_OVERFLOW_REPORT /* drop oldest sample of slow encoder and warning */
+} SourceRingOverflow;
+
 typedef struct _SourceState {
         /*
          *  sync error cause sync_error_times inc, 
@@ -60,11 +81,18 @@ typedef struct _SourceStream {
         gchar *name;
         gboolean is_live;
         gboolean eos;
-        GstSample *ring[SOURCE_RING_SIZE];
+        GstSample **ring;
+        gint ring_size; /* slots of ring */
+        gsize ring_bytes; /* bytes limit of samples in ring, 0 means no limit */
+        SourceRingOverflow overflow;
         gint current_position; /* current source output position */
         GstClock *system_clock;
         GArray *encoders;
 
+        /* signalled when source publish or encoder consume a buffer */
+        GMutex mutex;
+        GCond cond;
+
         SourceStreamState *state;
 } SourceStream;
 
@@ -95,7 +123,11 @@ struct _SourceClass {
 GType source_get_type (void);
 
 gboolean bus_callback (GstBus *bus, GstMessage *msg, gpointer user_data);
-GSList * bins_parse (gchar *job, gchar *pipeline);
-Source * source_initialize (gchar *job, SourceState *source_stat);
+GArray * bin_tokenize (gchar *bin);
+void bin_tokens_free (GArray *tokens);
+gchar * bin_token_property (BinToken *token, gchar *name);
+GSList * bins_parse (JobSpec *spec, gchar *pipeline);
+Source * source_initialize (JobSpec *spec, SourceState *source_stat);
+GstSample * source_stream_read (SourceStream *stream, gint *position);
 
 #endif /* __SOURCE_H__ */
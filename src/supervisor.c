@@ -0,0 +1,480 @@
+/*
+ * job supervisor, watch worker exit by pidfd and heartbeat by deadline timer wheel.
+ *
+ * every live job has one entry in the wheel, it's deadline is the earliest heartbeat in share memory
+ * plus the heartbeat timeout, the entry is checked only when it's deadline comes. a healthy job is
+ * checked once per timeout, cost of an idle tick doesn't depend on the number of jobs.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <gst/gst.h>
+
+#include "gstreamill.h"
+#include "jobdesc.h"
+#include "supervisor.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+
+typedef struct _SupervisorEntry {
+        Job *job;
+        GstClockTime timeout; /* heartbeat timeout of source and encoder streams */
+        gint slot;
+        guint64 rounds; /* rounds of wheel to go */
+        GstClockTime grace; /* no heartbeat check before, worker spawned recently */
+} SupervisorEntry;
+
+typedef struct _ChildWatch {
+        GPid pid;
+        gint pidfd;
+        gint status;
+        GChildWatchFunc func;
+        gpointer data;
+} ChildWatch;
+
+typedef struct _Supervisor {
+        gint epoll_fd;
+        gint timer_fd;
+        GThread *thread;
+        GMutex mutex;
+        GSList *wheel[SUPERVISOR_WHEEL_SIZE];
+        gint current; /* current slot */
+        GHashTable *entries; /* job -> entry */
+        GHashTable *watches; /* pid -> child watch, until exit handled in main loop */
+} Supervisor;
+
+static Supervisor *supervisor = NULL;
+
+static GstClockTime now_time (void)
+{
+        /* same as the REALTIME system clock used by heartbeat */
+        return g_get_real_time () * GST_USECOND;
+}
+
+/*
+ * tick while there is job in wheel, stop ticking if wheel is empty, called with mutex.
+ */
+static void timer_arm (gboolean on)
+{
+        struct itimerspec its;
+
+        its.it_value.tv_sec = 0;
+        its.it_value.tv_nsec = on ? SUPERVISOR_TICK : 0;
+        its.it_interval = its.it_value;
+        if (timerfd_settime (supervisor->timer_fd, 0, &its, NULL) == -1) {
+                GST_ERROR ("timerfd_settime error: %s", g_strerror (errno));
+        }
+}
+
+/*
+ * put entry in wheel at deadline, called with mutex.
+ */
+static void wheel_insert (SupervisorEntry *entry, GstClockTime deadline, GstClockTime now)
+{
+        guint64 ticks;
+
+        ticks = deadline > now ? (deadline - now + SUPERVISOR_TICK - 1) / SUPERVISOR_TICK : 1;
+        if (ticks == 0) {
+                ticks = 1;
+        }
+        entry->slot = (supervisor->current + ticks) % SUPERVISOR_WHEEL_SIZE;
+        entry->rounds = (ticks - 1) / SUPERVISOR_WHEEL_SIZE;
+        supervisor->wheel[entry->slot] = g_slist_prepend (supervisor->wheel[entry->slot], entry);
+}
+
+/*
+ * earliest heartbeat deadline of the job, same heartbeats checked as monitor used to.
+ * name of the stream with the earliest deadline is returned in name.
+ */
+static GstClockTime heartbeat_deadline (SupervisorEntry *entry, gchar **name)
+{
+        Job *job = entry->job;
+        GstClockTime deadline, d;
+        gint i, j;
+
+        deadline = GST_CLOCK_TIME_NONE;
+        for (i = 0; i < job->output->source.stream_count; i++) {
+                if (!g_str_has_prefix (job->output->source.streams[i].name, "video") &&
+                    !g_str_has_prefix (job->output->source.streams[i].name, "audio")) {
+                        continue;
+                }
+                d = job->output->source.streams[i].last_heartbeat + entry->timeout;
+                if (d < deadline) {
+                        deadline = d;
+                        *name = job->output->source.streams[i].name;
+                }
+        }
+        for (i = 0; i < job->output->encoder_count; i++) {
+                for (j = 0; j < job->output->encoders[i].stream_count; j++) {
+                        if (!g_str_has_prefix (job->output->encoders[i].streams[j].name, "video") &&
+                            !g_str_has_prefix (job->output->encoders[i].streams[j].name, "audio")) {
+                                continue;
+                        }
+                        d = job->output->encoders[i].streams[j].last_heartbeat + entry->timeout;
+                        if (d < deadline) {
+                                deadline = d;
+                                *name = job->output->encoders[i].streams[j].name;
+                        }
+                }
+                d = *(job->output->encoders[i].heartbeat) + ENCODER_OUTPUT_HEARTBEAT_THRESHHOLD;
+                if (d < deadline) {
+                        deadline = d;
+                        *name = job->output->encoders[i].name;
+                }
+        }
+
+        return deadline;
+}
+
+/*
+ * kill worker by pidfd, pid of worker reaped but exit not handled yet may be reused.
+ * kill by pid if watched by g_child_watch_add, called with mutex.
+ */
+static void worker_kill (GPid pid)
+{
+        ChildWatch *watch;
+
+        watch = g_hash_table_lookup (supervisor->watches, GINT_TO_POINTER (pid));
+        if (watch == NULL) {
+                kill (pid, SIGKILL);
+                return;
+        }
+        if ((syscall (SYS_pidfd_send_signal, watch->pidfd, SIGKILL, NULL, 0) == -1) && (errno != ESRCH)) {
+                GST_ERROR ("pidfd_send_signal %d error: %s", pid, g_strerror (errno));
+        }
+}
+
+/*
+ * deadline of the job comes, kill worker if heartbeat timeout, returns the next deadline.
+ */
+static GstClockTime job_check (SupervisorEntry *entry, GstClockTime now)
+{
+        Job *job = entry->job;
+        GstClockTime deadline;
+        gchar *name;
+
+        if ((job->worker_pid == 0) || (*(job->output->state) != GST_STATE_PLAYING)) {
+                /* stopped, or worker starting up */
+                return now + SUPERVISOR_GRACE;
+        }
+        if (now < entry->grace) {
+                /* heartbeats in share memory may be of the crashed worker */
+                return entry->grace;
+        }
+
+        name = NULL;
+        deadline = heartbeat_deadline (entry, &name);
+        if (deadline == GST_CLOCK_TIME_NONE) {
+                return now + SUPERVISOR_GRACE;
+        }
+        if (deadline > now) {
+                return deadline;
+        }
+
+        GST_ERROR ("%s.%s heartbeat error %lu, restart job, pid %d.",
+                   job->name,
+                   name,
+                   now - deadline + entry->timeout,
+                   job->worker_pid);
+        worker_kill (job->worker_pid);
+
+        return now + SUPERVISOR_GRACE;
+}
+
+static void wheel_tick (void)
+{
+        SupervisorEntry *entry;
+        GSList *list, *expired;
+        GstClockTime now;
+
+        supervisor->current = (supervisor->current + 1) % SUPERVISOR_WHEEL_SIZE;
+        expired = NULL;
+        list = supervisor->wheel[supervisor->current];
+        while (list != NULL) {
+                entry = list->data;
+                list = list->next;
+                if (entry->rounds > 0) {
+                        entry->rounds--;
+                        continue;
+                }
+                supervisor->wheel[supervisor->current] = g_slist_remove (supervisor->wheel[supervisor->current], entry);
+                expired = g_slist_prepend (expired, entry);
+        }
+
+        now = now_time ();
+        for (list = expired; list != NULL; list = list->next) {
+                entry = list->data;
+                wheel_insert (entry, job_check (entry, now), now);
+        }
+        g_slist_free (expired);
+}
+
+static gboolean child_exit_dispatch (gpointer data)
+{
+        ChildWatch *watch = (ChildWatch *)data;
+
+        watch->func (watch->pid, watch->status, watch->data);
+
+        /* worker_pid is reset or new worker spawned, pidfd is not used any more. */
+        g_mutex_lock (&(supervisor->mutex));
+        if (g_hash_table_lookup (supervisor->watches, GINT_TO_POINTER (watch->pid)) == watch) {
+                g_hash_table_remove (supervisor->watches, GINT_TO_POINTER (watch->pid));
+        }
+        g_mutex_unlock (&(supervisor->mutex));
+        close (watch->pidfd);
+        g_free (watch);
+
+        return FALSE;
+}
+
+static void child_exit (ChildWatch *watch)
+{
+        pid_t ret;
+
+        /* pidfd is kept open until exit handled, signal to it never reach a process reusing the pid. */
+        epoll_ctl (supervisor->epoll_fd, EPOLL_CTL_DEL, watch->pidfd, NULL);
+        do {
+                ret = waitpid (watch->pid, &(watch->status), 0);
+        } while ((ret == -1) && (errno == EINTR));
+        if (ret == -1) {
+                GST_ERROR ("waitpid %d error: %s", watch->pid, g_strerror (errno));
+                watch->status = 0;
+        }
+
+        /* restart logic runs in main loop, as child watch source did. */
+        g_main_context_invoke (NULL, child_exit_dispatch, watch);
+}
+
+static gpointer supervisor_thread (gpointer data)
+{
+        struct epoll_event events[32];
+        guint64 expirations;
+        gint i, n;
+
+        for (;;) {
+                n = epoll_wait (supervisor->epoll_fd, events, 32, -1);
+                if (n == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        GST_ERROR ("supervisor epoll_wait error: %s", g_strerror (errno));
+                        break;
+                }
+                for (i = 0; i < n; i++) {
+                        if (events[i].data.ptr != NULL) {
+                                child_exit (events[i].data.ptr);
+                                continue;
+                        }
+                        if (read (supervisor->timer_fd, &expirations, sizeof (expirations)) != sizeof (expirations)) {
+                                continue;
+                        }
+                        g_mutex_lock (&(supervisor->mutex));
+                        while (expirations-- > 0) {
+                                wheel_tick ();
+                        }
+                        g_mutex_unlock (&(supervisor->mutex));
+                }
+        }
+
+        return NULL;
+}
+
+/**
+ * supervisor_start:
+ *
+ * start supervisor thread.
+ *
+ * Returns: 0 on success, 1 on failure.
+ */
+gint supervisor_start (void)
+{
+        struct epoll_event event;
+        Supervisor *s;
+
+        s = g_new0 (Supervisor, 1);
+        s->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+        if (s->epoll_fd == -1) {
+                GST_ERROR ("supervisor epoll_create1 error: %s", g_strerror (errno));
+                g_free (s);
+                return 1;
+        }
+        s->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (s->timer_fd == -1) {
+                GST_ERROR ("supervisor timerfd_create error: %s", g_strerror (errno));
+                close (s->epoll_fd);
+                g_free (s);
+                return 1;
+        }
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        epoll_ctl (s->epoll_fd, EPOLL_CTL_ADD, s->timer_fd, &event);
+        g_mutex_init (&(s->mutex));
+        s->entries = g_hash_table_new (g_direct_hash, g_direct_equal);
+        s->watches = g_hash_table_new (g_direct_hash, g_direct_equal);
+        supervisor = s;
+        s->thread = g_thread_new ("supervisor", supervisor_thread, NULL);
+
+        return 0;
+}
+
+/**
+ * supervisor_is_running:
+ *
+ * Returns: TRUE if heartbeat is checked by supervisor.
+ */
+gboolean supervisor_is_running (void)
+{
+        return supervisor != NULL;
+}
+
+/**
+ * supervisor_watch_child:
+ * @pid: (in): pid of worker.
+ * @func: (in): called in main loop when worker exit.
+ * @data: (in): user data of func.
+ *
+ * watch worker exit by pidfd.
+ *
+ * Returns: FALSE if pidfd is not available, use g_child_watch_add instead.
+ */
+gboolean supervisor_watch_child (GPid pid, GChildWatchFunc func, gpointer data)
+{
+        struct epoll_event event;
+        ChildWatch *watch;
+        gint pidfd;
+
+        if (supervisor == NULL) {
+                return FALSE;
+        }
+        pidfd = syscall (SYS_pidfd_open, pid, 0);
+        if (pidfd == -1) {
+                GST_WARNING ("pidfd_open %d error: %s", pid, g_strerror (errno));
+                return FALSE;
+        }
+        watch = g_new0 (ChildWatch, 1);
+        watch->pid = pid;
+        watch->pidfd = pidfd;
+        watch->func = func;
+        watch->data = data;
+        event.events = EPOLLIN;
+        event.data.ptr = watch;
+        g_mutex_lock (&(supervisor->mutex));
+        if (epoll_ctl (supervisor->epoll_fd, EPOLL_CTL_ADD, pidfd, &event) == -1) {
+                g_mutex_unlock (&(supervisor->mutex));
+                GST_WARNING ("watch pidfd of %d error: %s", pid, g_strerror (errno));
+                close (pidfd);
+                g_free (watch);
+                return FALSE;
+        }
+        g_hash_table_replace (supervisor->watches, GINT_TO_POINTER (pid), watch);
+        g_mutex_unlock (&(supervisor->mutex));
+
+        return TRUE;
+}
+
+/**
+ * supervisor_add_job:
+ * @job: (in): live job to be supervised.
+ *
+ * check heartbeat of the job, worker is killed and restarted if timeout.
+ */
+void supervisor_add_job (Job *job)
+{
+        SupervisorEntry *entry;
+        GstClockTime now;
+        gint64 timeout;
+
+        if (supervisor == NULL) {
+                return;
+        }
+        entry = g_new0 (SupervisorEntry, 1);
+        entry->job = g_object_ref (job);
+        timeout = jobdesc_heartbeat_timeout (job->spec);
+        entry->timeout = timeout > 0 ? timeout * GST_MSECOND : HEARTBEAT_THRESHHOLD;
+        GST_INFO ("supervise job %s, heartbeat timeout %" GST_TIME_FORMAT, job->name, GST_TIME_ARGS (entry->timeout));
+
+        g_mutex_lock (&(supervisor->mutex));
+        if (g_hash_table_size (supervisor->entries) == 0) {
+                timer_arm (TRUE);
+        }
+        g_hash_table_insert (supervisor->entries, job, entry);
+        now = now_time ();
+        entry->grace = now + SUPERVISOR_GRACE;
+        wheel_insert (entry, entry->grace, now);
+        g_mutex_unlock (&(supervisor->mutex));
+}
+
+/**
+ * supervisor_remove_job:
+ * @job: (in): job to be removed.
+ *
+ * stop supervising the job.
+ */
+void supervisor_remove_job (Job *job)
+{
+        SupervisorEntry *entry;
+
+        if (supervisor == NULL) {
+                return;
+        }
+        g_mutex_lock (&(supervisor->mutex));
+        entry = g_hash_table_lookup (supervisor->entries, job);
+        if (entry == NULL) {
+                g_mutex_unlock (&(supervisor->mutex));
+                return;
+        }
+        g_hash_table_remove (supervisor->entries, job);
+        supervisor->wheel[entry->slot] = g_slist_remove (supervisor->wheel[entry->slot], entry);
+        if (g_hash_table_size (supervisor->entries) == 0) {
+                timer_arm (FALSE);
+        }
+        g_mutex_unlock (&(supervisor->mutex));
+        g_object_unref (entry->job);
+        g_free (entry);
+}
+
+/**
+ * supervisor_rearm_job:
+ * @job: (in): job which worker is just spawned.
+ *
+ * give the new worker SUPERVISOR_GRACE to start up, heartbeats left by the
+ * crashed worker are not checked.
+ */
+void supervisor_rearm_job (Job *job)
+{
+        SupervisorEntry *entry;
+        GstClockTime now;
+
+        if (supervisor == NULL) {
+                return;
+        }
+        g_mutex_lock (&(supervisor->mutex));
+        entry = g_hash_table_lookup (supervisor->entries, job);
+        if (entry == NULL) {
+                /* not supervised yet, supervisor_add_job starts with grace */
+                g_mutex_unlock (&(supervisor->mutex));
+                return;
+        }
+        supervisor->wheel[entry->slot] = g_slist_remove (supervisor->wheel[entry->slot], entry);
+        now = now_time ();
+        entry->grace = now + SUPERVISOR_GRACE;
+        wheel_insert (entry, entry->grace, now);
+        g_mutex_unlock (&(supervisor->mutex));
+}
@@ -0,0 +1,26 @@
+/*
+ * job supervisor, watch worker exit by pidfd and heartbeat by deadline timer wheel.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __SUPERVISOR_H__
+#define __SUPERVISOR_H__
+
+#include <gst/gst.h>
+
+#include "job.h"
+
+#define SUPERVISOR_TICK (10 * GST_MSECOND) /* wheel tick, resolution of heartbeat deadline */
+#define SUPERVISOR_WHEEL_SIZE 1024 /* slots of wheel, 10.24s per round */
+#define SUPERVISOR_GRACE (7 * GST_SECOND) /* worker starting up, no heartbeat check */
+
+gint supervisor_start (void);
+gboolean supervisor_is_running (void);
+gboolean supervisor_watch_child (GPid pid, GChildWatchFunc func, gpointer data);
+void supervisor_add_job (Job *job);
+void supervisor_remove_job (Job *job);
+void supervisor_rearm_job (Job *job);
+
+#endif /* __SUPERVISOR_H__ */
@@ -0,0 +1,290 @@
+/*
+ * zygote, a pre-initialized process that forks job workers.
+ *
+ * gstreamer is initialized and plugins are loaded once in zygote, job worker
+ * forked from zygote start the pipeline at once, no exec, gst_init and registry loading.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <gst/gst.h>
+
+#include "zygote.h"
+
+GST_DEBUG_CATEGORY_EXTERN (GSTREAMILL);
+#define GST_CAT_DEFAULT GSTREAMILL
+
+/* plugins used by jobs commonly, missing plugins are skipped. */
+static gchar *preload_plugins[] = {
+        "coreelements",
+        "app",
+        "typefindfunctions",
+        "playback",
+        "udp",
+        "mpegtsdemux",
+        "mpegtsmux",
+        "videoparsersbad",
+        "audioparsers",
+        "libav",
+        "x264",
+        "voaacenc",
+        "faac",
+        "lame",
+        "videoconvert",
+        "videoscale",
+        "deinterlace",
+        "audioconvert",
+        "audioresample",
+        NULL
+};
+
+static gint zygote_sock = -1; /* daemon side of zygote socket */
+static GPid zygote_pid = 0;
+static GMutex zygote_mutex;
+
+static void zygote_preload (void)
+{
+        GstPlugin *plugin;
+        gchar **p;
+
+        for (p = preload_plugins; *p != NULL; p++) {
+                plugin = gst_plugin_load_by_name (*p);
+                if (plugin == NULL) {
+                        continue;
+                }
+                gst_object_unref (plugin);
+        }
+}
+
+/*
+ * fork worker as child of gstreamill rather than zygote, so gstreamill watch and restart it
+ * just like a spawned worker. worker is forked by an intermediate child which exits at once,
+ * the orphaned worker is reparented to gstreamill, the child subreaper. plain fork run atfork
+ * handlers, reset the cached tid and the malloc and stdio locks, worker runs glib and gstreamer.
+ * return pid of worker in zygote, 0 in worker, -1 on failure.
+ */
+static GPid zygote_fork (void)
+{
+        gint fds[2], status;
+        GPid pid, worker;
+
+        if (pipe2 (fds, O_CLOEXEC) == -1) {
+                return -1;
+        }
+        pid = fork ();
+        if (pid == -1) {
+                close (fds[0]);
+                close (fds[1]);
+                return -1;
+        }
+        if (pid == 0) {
+                /* intermediate, tell zygote pid of worker and exit */
+                close (fds[0]);
+                worker = fork ();
+                if (worker == 0) {
+                        close (fds[1]);
+                        return 0;
+                }
+                if (write (fds[1], &worker, sizeof (worker)) != sizeof (worker)) {
+                        _exit (1);
+                }
+                _exit (0);
+        }
+
+        close (fds[1]);
+        if (read (fds[0], &worker, sizeof (worker)) != sizeof (worker)) {
+                worker = -1;
+        }
+        close (fds[0]);
+        /* worker is reparented once intermediate exited, before gstreamill get it's pid. */
+        while ((waitpid (pid, &status, 0) == -1) && (errno == EINTR));
+
+        return worker;
+}
+
+static void zygote_loop (gint sock, zygote_worker_t worker)
+{
+        ZygoteRequest request;
+        gint64 reply;
+        gssize ret;
+        GPid pid;
+
+        /* no zygote without gstreamill */
+        prctl (PR_SET_PDEATHSIG, SIGKILL);
+        if (getppid () == 1) {
+                exit (0);
+        }
+        zygote_preload ();
+
+        for (;;) {
+                ret = recv (sock, &request, sizeof (ZygoteRequest), 0);
+                if (ret == -1) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        exit (1);
+                }
+                if (ret == 0) {
+                        /* gstreamill exit */
+                        exit (0);
+                }
+                if (ret != sizeof (ZygoteRequest)) {
+                        continue;
+                }
+                request.name[ZYGOTE_NAME_LEN - 1] = '\0';
+                request.debug[ZYGOTE_DEBUG_LEN - 1] = '\0';
+
+                pid = zygote_fork ();
+                if (pid == 0) {
+                        /* worker */
+                        prctl (PR_SET_PDEATHSIG, 0);
+                        close (sock);
+                        if (request.debug[0] != '\0') {
+                                gst_debug_set_threshold_from_string (request.debug, TRUE);
+                        }
+                        worker (request.name, request.length, request.debug);
+                        exit (0);
+                }
+                reply = pid;
+                if (send (sock, &reply, sizeof (reply), 0) == -1) {
+                        exit (1);
+                }
+        }
+}
+
+static void zygote_exit_cb (GPid pid, gint status, gpointer user_data)
+{
+        g_spawn_close_pid (pid);
+        GST_ERROR ("zygote %d exit, status %d, workers are spawned from now on", pid, status);
+        g_mutex_lock (&zygote_mutex);
+        if (zygote_sock != -1) {
+                close (zygote_sock);
+                zygote_sock = -1;
+        }
+        zygote_pid = 0;
+        g_mutex_unlock (&zygote_mutex);
+}
+
+/**
+ * zygote_start:
+ * @worker: (in): job worker entry.
+ *
+ * fork zygote process, should be called before any thread created.
+ *
+ * Returns: 0 on success, 1 on failure.
+ */
+gint zygote_start (zygote_worker_t worker)
+{
+        gint sv[2];
+        GPid pid;
+
+        if (socketpair (AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+                GST_ERROR ("create zygote socket error: %s", g_strerror (errno));
+                return 1;
+        }
+        /* workers forked by zygote are orphaned and reparented to gstreamill */
+        if (prctl (PR_SET_CHILD_SUBREAPER, 1) == -1) {
+                GST_ERROR ("set child subreaper error: %s", g_strerror (errno));
+                close (sv[0]);
+                close (sv[1]);
+                return 1;
+        }
+
+        pid = fork ();
+        if (pid == -1) {
+                GST_ERROR ("fork zygote error: %s", g_strerror (errno));
+                close (sv[0]);
+                close (sv[1]);
+                return 1;
+        }
+
+        if (pid == 0) {
+                close (sv[0]);
+                zygote_loop (sv[1], worker);
+                exit (0);
+        }
+
+        close (sv[1]);
+        zygote_sock = sv[0];
+        zygote_pid = pid;
+        g_child_watch_add (pid, zygote_exit_cb, NULL);
+
+        return 0;
+}
+
+/**
+ * zygote_fork_worker:
+ * @name: (in): job name.
+ * @length: (in): job description length.
+ * @debug: (in): gst-debug option of the job, NULL if none.
+ *
+ * request zygote fork a job worker, the worker is child of the caller.
+ *
+ * Returns: pid of the worker, 0 if zygote is not available.
+ */
+GPid zygote_fork_worker (gchar *name, gint length, gchar *debug)
+{
+        ZygoteRequest request;
+        struct pollfd pfd;
+        gint64 reply;
+        gssize ret;
+
+        if ((strlen (name) >= ZYGOTE_NAME_LEN) || ((debug != NULL) && (strlen (debug) >= ZYGOTE_DEBUG_LEN))) {
+                return 0;
+        }
+        memset (&request, 0, sizeof (ZygoteRequest));
+        g_strlcpy (request.name, name, ZYGOTE_NAME_LEN);
+        request.length = length;
+        if (debug != NULL) {
+                g_strlcpy (request.debug, debug, ZYGOTE_DEBUG_LEN);
+        }
+
+        g_mutex_lock (&zygote_mutex);
+        if (zygote_sock == -1) {
+                g_mutex_unlock (&zygote_mutex);
+                return 0;
+        }
+        if (send (zygote_sock, &request, sizeof (ZygoteRequest), MSG_NOSIGNAL) == -1) {
+                goto failure;
+        }
+        pfd.fd = zygote_sock;
+        pfd.events = POLLIN;
+        do {
+                ret = poll (&pfd, 1, 1000);
+        } while ((ret == -1) && (errno == EINTR));
+        if (ret != 1) {
+                goto failure;
+        }
+        ret = recv (zygote_sock, &reply, sizeof (reply), 0);
+        if ((ret != sizeof (reply)) || (reply <= 0)) {
+                goto failure;
+        }
+        g_mutex_unlock (&zygote_mutex);
+        GST_INFO ("zygote fork worker %ld for job %s", reply, name);
+
+        return reply;
+
+failure:
+        /* zygote gone or confused, don't use it any more */
+        GST_ERROR ("zygote %d failure, fall back to spawn", zygote_pid);
+        close (zygote_sock);
+        zygote_sock = -1;
+        if (zygote_pid > 0) {
+                kill (zygote_pid, SIGKILL);
+        }
+        g_mutex_unlock (&zygote_mutex);
+
+        return 0;
+}
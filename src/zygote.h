@@ -0,0 +1,28 @@
+/*
+ * zygote, a pre-initialized process that forks job workers.
+ *
+ * Copyright (C) Zhang Ping <dqzhangp@163.com>
+ *
+ */
+
+#ifndef __ZYGOTE_H__
+#define __ZYGOTE_H__
+
+#include <gst/gst.h>
+
+#define ZYGOTE_NAME_LEN 256
+#define ZYGOTE_DEBUG_LEN 256
+
+typedef struct _ZygoteRequest {
+        gchar name[ZYGOTE_NAME_LEN]; /* job name */
+        gint64 length; /* job description length */
+        gchar debug[ZYGOTE_DEBUG_LEN]; /* gst-debug option of the job, empty if none */
+} ZygoteRequest;
+
+/* run job in worker, should not return */
+typedef void (*zygote_worker_t) (gchar *name, gint length, gchar *debug);
+
+gint zygote_start (zygote_worker_t worker);
+GPid zygote_fork_worker (gchar *name, gint length, gchar *debug);
+
+#endif /* __ZYGOTE_H__ */
@@ -0,0 +1,165 @@
+"""
+webdav stand-in of m3u8 push server, for testing push-server-uri of m3u8streaming.
+
+PUT stores, DELETE removes, GET serves files under the root directory. connections are
+http/1.1 keep-alive, pipelined requests are answered in order. to exercise connection reuse,
+server close and retry of the push client:
+
+    --close-every N     answer the Nth request of a connection with Connection: close
+    --idle-timeout S    close connection idle for S seconds, client finds it closed on reuse
+
+every request is logged with connection id and request number in the connection. a playlist
+referring to a segment not stored yet is reported as an ERROR, segments are pushed before
+playlist. statistics are printed on exit:
+
+    python webdavserver.py --port 8080 --root /tmp/webdav --close-every 3 --idle-timeout 2
+
+job description:
+
+    "m3u8streaming" : {
+        ...
+        "push-server-uri" : "http://127.0.0.1:8080/live"
+    }
+"""
+
+import os
+import sys
+import signal
+import threading
+import itertools
+import optparse
+import BaseHTTPServer
+import SocketServer
+
+options = None
+lock = threading.Lock()
+connection_ids = itertools.count(1)
+stats = {"connections": 0, "requests": 0, "put": 0, "delete": 0, "closed": 0, "timeout": 0, "errors": 0}
+
+def count(name):
+    lock.acquire()
+    stats[name] += 1
+    lock.release()
+
+class WebDAVHandler(BaseHTTPServer.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def setup(self):
+        BaseHTTPServer.BaseHTTPRequestHandler.setup(self)
+        if options.idle_timeout > 0:
+            self.connection.settimeout(options.idle_timeout)
+        self.connection_id = connection_ids.next()
+        self.request_count = 0
+        count("connections")
+
+    def path_of(self):
+        path = os.path.normpath(self.path.split("?")[0]).lstrip("/")
+        if path.startswith(".."):
+            return None
+        return os.path.join(options.root, path)
+
+    def respond(self, code, body=""):
+        self.request_count += 1
+        count("requests")
+        self.send_response(code)
+        self.send_header("Content-Length", str(len(body)))
+        if (options.close_every > 0) and (self.request_count % options.close_every == 0):
+            self.send_header("Connection", "close")
+            self.close_connection = 1
+            count("closed")
+        self.end_headers()
+        if body and (self.command != "HEAD"):
+            self.wfile.write(body)
+
+    def check_playlist(self, path, data):
+        directory = os.path.dirname(path)
+        for line in data.splitlines():
+            line = line.strip()
+            uri = None
+            if line.startswith("#EXT-X-MAP:URI="):
+                uri = line.split("\"")[1]
+            elif line and not line.startswith("#"):
+                uri = line
+            if (uri is None) or uri.endswith(".m3u8"):
+                # variant playlists of master playlist are pushed later
+                continue
+            if not os.path.exists(os.path.join(directory, uri)):
+                print "ERROR : %s refers to %s not stored" % (self.path, uri)
+                count("errors")
+
+    def do_PUT(self):
+        path = self.path_of()
+        length = int(self.headers.getheader("Content-Length", "0"))
+        data = self.rfile.read(length)
+        if path is None:
+            self.respond(403)
+            return
+        if not os.path.isdir(os.path.dirname(path)):
+            os.makedirs(os.path.dirname(path))
+        if path.endswith(".m3u8"):
+            self.check_playlist(path, data)
+        f = open(path, "wb")
+        f.write(data)
+        f.close()
+        count("put")
+        self.respond(201)
+
+    def do_DELETE(self):
+        path = self.path_of()
+        if (path is None) or not os.path.isfile(path):
+            self.respond(404)
+            return
+        os.remove(path)
+        count("delete")
+        self.respond(204)
+
+    def do_GET(self):
+        path = self.path_of()
+        if (path is None) or not os.path.isfile(path):
+            self.respond(404)
+            return
+        f = open(path, "rb")
+        data = f.read()
+        f.close()
+        self.respond(200, data)
+
+    def log_error(self, format, *args):
+        # idle connection timeout is logged as request timed out
+        if format.startswith("Request timed out"):
+            count("timeout")
+        self.log_message(format, *args)
+
+    def log_message(self, format, *args):
+        print "connection %d request %d: %s" % (self.connection_id, self.request_count, format % args)
+
+class ThreadedHTTPServer(SocketServer.ThreadingMixIn, BaseHTTPServer.HTTPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+def interrupt(signum, frame):
+    raise KeyboardInterrupt
+
+def print_stats():
+    print "connections %(connections)d, requests %(requests)d, put %(put)d, delete %(delete)d, " \
+          "closed by server %(closed)d, idle timeout %(timeout)d, errors %(errors)d" % stats
+    if stats["connections"] > 0:
+        print "requests per connection %.2f" % (float(stats["requests"]) / stats["connections"])
+
+if __name__ == "__main__":
+    parser = optparse.OptionParser()
+    parser.add_option("--port", type="int", default=8080)
+    parser.add_option("--root", default="/tmp/webdav")
+    parser.add_option("--close-every", type="int", default=0)
+    parser.add_option("--idle-timeout", type="float", default=0)
+    options, args = parser.parse_args()
+
+    signal.signal(signal.SIGTERM, interrupt)
+    signal.signal(signal.SIGINT, interrupt)
+    server = ThreadedHTTPServer(("", options.port), WebDAVHandler)
+    print "webdav stand-in on port %d, root %s" % (options.port, options.root)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    print_stats()
+    sys.exit(1 if stats["errors"] > 0 else 0)